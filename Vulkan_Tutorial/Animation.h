@@ -0,0 +1,589 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define ANIMATION_USE_SSE2
+#endif
+
+// Note: Quaternions are stored as glm::vec4 (x, y, z, w) so they
+//       can be split into x/y/z/w lanes for SIMD. Poses are kept
+//       as structure of arrays padded to a multiple of 4 joints so
+//       every sampling and blending loop works 4 joints at a time
+
+namespace Animation
+{
+    const uint32_t SIMD_WIDTH = 4;
+
+    inline uint32_t PadToSimd(uint32_t count)
+    {
+        return (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    }
+
+    /// <summary>
+    /// Joint hierarchy. Parents always come before their children
+    /// </summary>
+    struct Skeleton
+    {
+        std::vector<int> parents;
+        std::vector<glm::mat4> inverseBind;
+
+        uint32_t JointCount() const
+        {
+            return static_cast<uint32_t>(parents.size());
+        }
+    };
+
+    #pragma region Compression
+
+    // Note: "Smallest three" quaternion compression. The largest
+    //       component is dropped and rebuilt from the unit length.
+    //       The other three always fit in [-1/sqrt(2), 1/sqrt(2)]
+    //       so 16 bits each is plenty. 8 bytes instead of 16
+
+    const float QUAT_RANGE = 0.70710678f;
+
+    struct QuantizedQuat
+    {
+        uint16_t a, b, c;
+        uint16_t largest; // Index of the dropped component
+    };
+
+    inline QuantizedQuat QuantizeQuat(glm::vec4 q)
+    {
+        uint16_t largest = 0;
+        for (uint16_t i = 1; i < 4; i++)
+        {
+            if (std::fabs(q[i]) > std::fabs(q[largest]))
+            {
+                largest = i;
+            }
+        }
+
+        // q and -q are the same rotation. Keep the dropped one positive
+        if (q[largest] < 0.0f)
+        {
+            q = -q;
+        }
+
+        uint16_t packed[3];
+        for (int i = 0, n = 0; i < 4; i++)
+        {
+            if (i == largest) continue;
+
+            float normalized = std::clamp(q[i] / QUAT_RANGE * 0.5f + 0.5f, 0.0f, 1.0f);
+            packed[n++] = static_cast<uint16_t>(normalized * 65535.0f + 0.5f);
+        }
+
+        return { packed[0], packed[1], packed[2], largest };
+    }
+
+    inline glm::vec4 DequantizeQuat(const QuantizedQuat& q)
+    {
+        float small[3] =
+        {
+            (q.a / 65535.0f * 2.0f - 1.0f) * QUAT_RANGE,
+            (q.b / 65535.0f * 2.0f - 1.0f) * QUAT_RANGE,
+            (q.c / 65535.0f * 2.0f - 1.0f) * QUAT_RANGE
+        };
+        float sum = small[0] * small[0] + small[1] * small[1] + small[2] * small[2];
+
+        glm::vec4 result;
+        for (int i = 0, n = 0; i < 4; i++)
+        {
+            result[i] = i == q.largest ? std::sqrt((std::max)(0.0f, 1.0f - sum)) : small[n++];
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// A vec3 track reduced to the fewest keys that stay within
+    /// a tolerance. Evaluated as a Hermite spline with Catmull-Rom
+    /// style tangents so non-uniform key spacing is fine
+    /// </summary>
+    struct CurveTrack
+    {
+        std::vector<float> times;
+        std::vector<glm::vec3> values;
+
+        glm::vec3 Sample(float time) const
+        {
+            if (values.size() == 1 || time <= times.front()) return values.front();
+            if (time >= times.back()) return values.back();
+
+            // Find the segment [i, i + 1] holding time
+            size_t i = std::upper_bound(times.begin(), times.end(), time) - times.begin() - 1;
+            return Evaluate(i, time);
+        }
+
+        glm::vec3 Evaluate(size_t i, float time) const
+        {
+            float dt = times[i + 1] - times[i];
+            float s = (time - times[i]) / dt;
+
+            glm::vec3 m0 = Tangent(i) * dt;
+            glm::vec3 m1 = Tangent(i + 1) * dt;
+
+            float s2 = s * s;
+            float s3 = s2 * s;
+            return values[i] * (2.0f * s3 - 3.0f * s2 + 1.0f) +
+                m0 * (s3 - 2.0f * s2 + s) +
+                values[i + 1] * (-2.0f * s3 + 3.0f * s2) +
+                m1 * (s3 - s2);
+        }
+
+        glm::vec3 Tangent(size_t i) const
+        {
+            size_t prev = i > 0 ? i - 1 : i;
+            size_t next = i + 1 < values.size() ? i + 1 : i;
+            return (values[next] - values[prev]) / (times[next] - times[prev]);
+        }
+    };
+
+    /// <summary>
+    /// Fits a curve through uniformly spaced samples. Starts with
+    /// the two end points and keeps inserting the worst fitting
+    /// sample as a key until every sample is within tolerance
+    /// </summary>
+    inline CurveTrack FitCurve(const std::vector<glm::vec3>& samples, float sampleRate, float tolerance)
+    {
+        CurveTrack curve;
+        if (samples.size() < 2)
+        {
+            curve.times = { 0.0f };
+            curve.values = { samples.empty() ? glm::vec3(0.0f) : samples[0] };
+            return curve;
+        }
+
+        std::vector<size_t> keys = { 0, samples.size() - 1 };
+        while (true)
+        {
+            curve.times.clear();
+            curve.values.clear();
+            for (size_t key : keys)
+            {
+                curve.times.push_back(key / sampleRate);
+                curve.values.push_back(samples[key]);
+            }
+
+            float worstError = 0.0f;
+            size_t worstSample = 0;
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                float error = glm::length(curve.Sample(i / sampleRate) - samples[i]);
+                if (error > worstError)
+                {
+                    worstError = error;
+                    worstSample = i;
+                }
+            }
+
+            if (worstError <= tolerance)
+            {
+                return curve;
+            }
+
+            keys.insert(std::upper_bound(keys.begin(), keys.end(), worstSample), worstSample);
+        }
+    }
+
+    /// <summary>
+    /// A compressed clip. Rotations are sampled at a fixed rate and
+    /// stored frame by frame so one frame's joints are contiguous.
+    /// Translations are spline fitted per joint
+    /// </summary>
+    struct AnimationClip
+    {
+        float duration = 0.0f;
+        float sampleRate = 30.0f;
+        uint32_t frameCount = 0;
+        uint32_t jointCount = 0;
+        uint32_t paddedJointCount = 0;
+
+        std::vector<QuantizedQuat> rotations; // frameCount * paddedJointCount
+        std::vector<CurveTrack> translations; // jointCount
+    };
+
+    // Fills the local rotation and translation of every joint at time t
+    using ClipSampler = std::function<void(float t, std::vector<glm::vec4>& rotations, std::vector<glm::vec3>& translations)>;
+
+    /// <summary>
+    /// Samples a source animation and compresses it into a clip
+    /// </summary>
+    inline AnimationClip BuildClip(const Skeleton& skeleton, float duration, float sampleRate, const ClipSampler& sampler, float translationTolerance)
+    {
+        AnimationClip clip;
+        clip.duration = duration;
+        clip.sampleRate = sampleRate;
+        clip.frameCount = static_cast<uint32_t>(std::ceil(duration * sampleRate)) + 1;
+        clip.jointCount = skeleton.JointCount();
+        clip.paddedJointCount = PadToSimd(clip.jointCount);
+
+        // Padding joints hold the identity so the SIMD loops can
+        // safely run over them
+        clip.rotations.assign(clip.frameCount * clip.paddedJointCount, QuantizeQuat(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+
+        std::vector<std::vector<glm::vec3>> translationSamples(clip.jointCount);
+        std::vector<glm::vec4> rotations(clip.jointCount);
+        std::vector<glm::vec3> translations(clip.jointCount);
+
+        for (uint32_t frame = 0; frame < clip.frameCount; frame++)
+        {
+            float t = (std::min)(frame / sampleRate, duration);
+            sampler(t, rotations, translations);
+
+            for (uint32_t joint = 0; joint < clip.jointCount; joint++)
+            {
+                clip.rotations[frame * clip.paddedJointCount + joint] = QuantizeQuat(rotations[joint]);
+                translationSamples[joint].push_back(translations[joint]);
+            }
+        }
+
+        for (uint32_t joint = 0; joint < clip.jointCount; joint++)
+        {
+            clip.translations.push_back(FitCurve(translationSamples[joint], sampleRate, translationTolerance));
+        }
+
+        return clip;
+    }
+
+    #pragma endregion
+
+    #pragma region Sampling
+
+    /// <summary>
+    /// Local joint transforms in structure of arrays form
+    /// </summary>
+    struct Pose
+    {
+        std::vector<float> qx, qy, qz, qw;
+        std::vector<glm::vec3> translations;
+
+        void Resize(uint32_t jointCount)
+        {
+            uint32_t padded = PadToSimd(jointCount);
+            qx.resize(padded);
+            qy.resize(padded);
+            qz.resize(padded);
+            qw.resize(padded);
+            translations.resize(jointCount);
+        }
+    };
+
+    /// <summary>
+    /// Normalized lerp of 4 quaternions against 4 others. Takes the
+    /// shortest path by flipping b wherever the dot product is negative
+    /// </summary>
+    inline void Nlerp4(
+        const float* ax, const float* ay, const float* az, const float* aw,
+        const float* bx, const float* by, const float* bz, const float* bw,
+        float alpha,
+        float* ox, float* oy, float* oz, float* ow)
+    {
+    #ifdef ANIMATION_USE_SSE2
+        __m128 x0 = _mm_loadu_ps(ax), y0 = _mm_loadu_ps(ay), z0 = _mm_loadu_ps(az), w0 = _mm_loadu_ps(aw);
+        __m128 x1 = _mm_loadu_ps(bx), y1 = _mm_loadu_ps(by), z1 = _mm_loadu_ps(bz), w1 = _mm_loadu_ps(bw);
+
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, x1), _mm_mul_ps(y0, y1)),
+            _mm_add_ps(_mm_mul_ps(z0, z1), _mm_mul_ps(w0, w1)));
+
+        // Sign bit set where the dot product is negative
+        __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+        x1 = _mm_xor_ps(x1, flip);
+        y1 = _mm_xor_ps(y1, flip);
+        z1 = _mm_xor_ps(z1, flip);
+        w1 = _mm_xor_ps(w1, flip);
+
+        __m128 t = _mm_set1_ps(alpha);
+        __m128 x = _mm_add_ps(x0, _mm_mul_ps(_mm_sub_ps(x1, x0), t));
+        __m128 y = _mm_add_ps(y0, _mm_mul_ps(_mm_sub_ps(y1, y0), t));
+        __m128 z = _mm_add_ps(z0, _mm_mul_ps(_mm_sub_ps(z1, z0), t));
+        __m128 w = _mm_add_ps(w0, _mm_mul_ps(_mm_sub_ps(w1, w0), t));
+
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+            _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+        __m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+
+        _mm_storeu_ps(ox, _mm_mul_ps(x, invLength));
+        _mm_storeu_ps(oy, _mm_mul_ps(y, invLength));
+        _mm_storeu_ps(oz, _mm_mul_ps(z, invLength));
+        _mm_storeu_ps(ow, _mm_mul_ps(w, invLength));
+    #else
+        for (uint32_t i = 0; i < SIMD_WIDTH; i++)
+        {
+            float dot = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i] + aw[i] * bw[i];
+            float sign = dot < 0.0f ? -1.0f : 1.0f;
+
+            float x = ax[i] + (bx[i] * sign - ax[i]) * alpha;
+            float y = ay[i] + (by[i] * sign - ay[i]) * alpha;
+            float z = az[i] + (bz[i] * sign - az[i]) * alpha;
+            float w = aw[i] + (bw[i] * sign - aw[i]) * alpha;
+
+            float invLength = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+            ox[i] = x * invLength;
+            oy[i] = y * invLength;
+            oz[i] = z * invLength;
+            ow[i] = w * invLength;
+        }
+    #endif
+    }
+
+    /// <summary>
+    /// Decompresses 4 quaternions into x/y/z/w lanes. The arithmetic
+    /// is done 4 wide, only the final shuffle by index is scalar
+    /// </summary>
+    inline void Decode4(const QuantizedQuat* q, float* x, float* y, float* z, float* w)
+    {
+        alignas(16) float small[3][SIMD_WIDTH];
+        alignas(16) float large[SIMD_WIDTH];
+
+    #ifdef ANIMATION_USE_SSE2
+        __m128 scale = _mm_set1_ps(2.0f / 65535.0f * QUAT_RANGE);
+        __m128 bias = _mm_set1_ps(-QUAT_RANGE);
+
+        __m128 a = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_set_epi32(q[3].a, q[2].a, q[1].a, q[0].a)), scale), bias);
+        __m128 b = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_set_epi32(q[3].b, q[2].b, q[1].b, q[0].b)), scale), bias);
+        __m128 c = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_set_epi32(q[3].c, q[2].c, q[1].c, q[0].c)), scale), bias);
+
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c));
+        __m128 l = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.0f), sum), _mm_setzero_ps()));
+
+        _mm_store_ps(small[0], a);
+        _mm_store_ps(small[1], b);
+        _mm_store_ps(small[2], c);
+        _mm_store_ps(large, l);
+    #else
+        for (uint32_t i = 0; i < SIMD_WIDTH; i++)
+        {
+            small[0][i] = (q[i].a / 65535.0f * 2.0f - 1.0f) * QUAT_RANGE;
+            small[1][i] = (q[i].b / 65535.0f * 2.0f - 1.0f) * QUAT_RANGE;
+            small[2][i] = (q[i].c / 65535.0f * 2.0f - 1.0f) * QUAT_RANGE;
+            float sum = small[0][i] * small[0][i] + small[1][i] * small[1][i] + small[2][i] * small[2][i];
+            large[i] = std::sqrt((std::max)(0.0f, 1.0f - sum));
+        }
+    #endif
+
+        float* lanes[4] = { x, y, z, w };
+        for (uint32_t i = 0; i < SIMD_WIDTH; i++)
+        {
+            for (uint32_t component = 0, n = 0; component < 4; component++)
+            {
+                lanes[component][i] = component == q[i].largest ? large[i] : small[n++][i];
+            }
+        }
+    }
+
+    /// <summary>
+    /// Samples every joint of a clip at the given time. Looping
+    /// clips should wrap the time before calling this
+    /// </summary>
+    inline void SampleClip(const AnimationClip& clip, float time, Pose& out)
+    {
+        float frame = std::clamp(time, 0.0f, clip.duration) * clip.sampleRate;
+        uint32_t frame0 = (std::min)(static_cast<uint32_t>(frame), clip.frameCount - 1);
+        uint32_t frame1 = (std::min)(frame0 + 1, clip.frameCount - 1);
+        float alpha = frame - frame0;
+
+        const QuantizedQuat* keys0 = &clip.rotations[frame0 * clip.paddedJointCount];
+        const QuantizedQuat* keys1 = &clip.rotations[frame1 * clip.paddedJointCount];
+
+        for (uint32_t joint = 0; joint < clip.paddedJointCount; joint += SIMD_WIDTH)
+        {
+            alignas(16) float a[4][SIMD_WIDTH];
+            alignas(16) float b[4][SIMD_WIDTH];
+            Decode4(keys0 + joint, a[0], a[1], a[2], a[3]);
+            Decode4(keys1 + joint, b[0], b[1], b[2], b[3]);
+
+            Nlerp4(a[0], a[1], a[2], a[3], b[0], b[1], b[2], b[3], alpha,
+                &out.qx[joint], &out.qy[joint], &out.qz[joint], &out.qw[joint]);
+        }
+
+        for (uint32_t joint = 0; joint < clip.jointCount; joint++)
+        {
+            out.translations[joint] = clip.translations[joint].Sample(time);
+        }
+    }
+
+    /// <summary>
+    /// out = lerp(a, b, weight) for every joint. out may alias a
+    /// </summary>
+    inline void BlendPoses(const Pose& a, const Pose& b, float weight, Pose& out)
+    {
+        for (size_t joint = 0; joint < a.qx.size(); joint += SIMD_WIDTH)
+        {
+            Nlerp4(&a.qx[joint], &a.qy[joint], &a.qz[joint], &a.qw[joint],
+                &b.qx[joint], &b.qy[joint], &b.qz[joint], &b.qw[joint], weight,
+                &out.qx[joint], &out.qy[joint], &out.qz[joint], &out.qw[joint]);
+        }
+
+        for (size_t joint = 0; joint < a.translations.size(); joint++)
+        {
+            out.translations[joint] = a.translations[joint] + (b.translations[joint] - a.translations[joint]) * weight;
+        }
+    }
+
+    #pragma endregion
+
+    #pragma region Blend Trees
+
+    /// <summary>
+    /// Node of a blend tree. Clip nodes play a clip, blend nodes
+    /// mix two children by a weight read from the parameter list
+    /// so one tree can be shared by every character
+    /// </summary>
+    struct BlendNode
+    {
+        enum class Type { Clip, Blend };
+
+        Type type = Type::Clip;
+
+        // Clip
+        const AnimationClip* clip = nullptr;
+        float speed = 1.0f;
+
+        // Blend
+        int childA = -1;
+        int childB = -1;
+        uint32_t weightParameter = 0;
+    };
+
+    /// <summary>
+    /// Scratch poses for evaluating a tree. Keep one per thread
+    /// so evaluation never allocates once it has warmed up
+    /// </summary>
+    struct BlendContext
+    {
+        std::vector<Pose> scratch;
+    };
+
+    class BlendTree
+    {
+    public:
+        int AddClip(const AnimationClip* clip, float speed = 1.0f)
+        {
+            BlendNode node;
+            node.type = BlendNode::Type::Clip;
+            node.clip = clip;
+            node.speed = speed;
+            nodes.push_back(node);
+            return root = static_cast<int>(nodes.size()) - 1;
+        }
+
+        int AddBlend(int childA, int childB, uint32_t weightParameter)
+        {
+            BlendNode node;
+            node.type = BlendNode::Type::Blend;
+            node.childA = childA;
+            node.childB = childB;
+            node.weightParameter = weightParameter;
+            nodes.push_back(node);
+            return root = static_cast<int>(nodes.size()) - 1;
+        }
+
+        /// <summary>
+        /// Evaluates the last added node into out. Clip times wrap
+        /// so every clip in the tree loops
+        /// </summary>
+        void Evaluate(float time, const float* parameters, uint32_t jointCount, BlendContext& context, Pose& out) const
+        {
+            // Sized up front so references into it stay valid while recursing
+            if (context.scratch.size() < nodes.size())
+            {
+                context.scratch.resize(nodes.size());
+            }
+
+            out.Resize(jointCount);
+            EvaluateNode(root, time, parameters, jointCount, context, 0, out);
+        }
+
+    private:
+        void EvaluateNode(int index, float time, const float* parameters, uint32_t jointCount, BlendContext& context, size_t depth, Pose& out) const
+        {
+            const BlendNode& node = nodes[index];
+
+            if (node.type == BlendNode::Type::Clip)
+            {
+                float clipTime = std::fmod(time * node.speed, node.clip->duration);
+                if (clipTime < 0.0f) clipTime += node.clip->duration;
+
+                SampleClip(*node.clip, clipTime, out);
+                return;
+            }
+
+            float weight = std::clamp(parameters[node.weightParameter], 0.0f, 1.0f);
+
+            // Skip a whole branch when it has no influence
+            if (weight <= 0.0f)
+            {
+                EvaluateNode(node.childA, time, parameters, jointCount, context, depth, out);
+                return;
+            }
+            if (weight >= 1.0f)
+            {
+                EvaluateNode(node.childB, time, parameters, jointCount, context, depth, out);
+                return;
+            }
+
+            Pose& other = context.scratch[depth];
+            other.Resize(jointCount);
+
+            EvaluateNode(node.childA, time, parameters, jointCount, context, depth + 1, out);
+            EvaluateNode(node.childB, time, parameters, jointCount, context, depth + 1, other);
+            BlendPoses(out, other, weight, out);
+        }
+
+        std::vector<BlendNode> nodes;
+        int root = -1;
+    };
+
+    #pragma endregion
+
+    #pragma region Skinning Palette
+
+    inline glm::mat4 JointMatrix(float x, float y, float z, float w, glm::vec3 t)
+    {
+        glm::mat4 m(1.0f);
+        m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f);
+        m[1] = glm::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f);
+        m[2] = glm::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f);
+        m[3] = glm::vec4(t, 1.0f);
+        return m;
+    }
+
+    /// <summary>
+    /// Turns a local pose into skinning matrices (model space joint
+    /// transform * inverse bind). out can point straight into a
+    /// mapped GPU buffer
+    /// </summary>
+    inline void WritePalette(const Skeleton& skeleton, const Pose& pose, const glm::mat4& root, glm::mat4* out)
+    {
+        // Small skeletons keep their model transforms on the stack
+        const uint32_t STACK_JOINTS = 64;
+        glm::mat4 stackModel[STACK_JOINTS];
+        std::vector<glm::mat4> heapModel;
+        glm::mat4* model = stackModel;
+        if (skeleton.JointCount() > STACK_JOINTS)
+        {
+            heapModel.resize(skeleton.JointCount());
+            model = heapModel.data();
+        }
+
+        for (uint32_t joint = 0; joint < skeleton.JointCount(); joint++)
+        {
+            glm::mat4 local = JointMatrix(pose.qx[joint], pose.qy[joint], pose.qz[joint], pose.qw[joint], pose.translations[joint]);
+
+            int parent = skeleton.parents[joint];
+            model[joint] = (parent < 0 ? root : model[parent]) * local;
+            out[joint] = model[joint] * skeleton.inverseBind[joint];
+        }
+    }
+
+    #pragma endregion
+}
@@ -0,0 +1,570 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "ImageEncode.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define CAPTURE_USE_SSE2
+#endif
+
+// Note: Turns frames read back from the GPU into a video stream. Frames
+//       are converted to YUV 4:2:0 on the job system and written out
+//       as a Y4M stream, either to a file or into the stdin of an
+//       encoder process (e.g. "ffmpeg -i - out.mp4"). Screenshots
+//       take the same path but end up as single PNG or QOI files
+
+namespace Capture
+{
+    /// <summary>
+    /// A planar YUV 4:2:0 frame. Y is full size, U and V are half
+    /// size in both directions (rounded up)
+    /// </summary>
+    struct I420Frame
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> data;
+
+        void Resize(uint32_t newWidth, uint32_t newHeight)
+        {
+            width = newWidth;
+            height = newHeight;
+            data.resize(LumaSize() + 2 * ChromaSize());
+        }
+
+        uint32_t ChromaWidth() const { return (width + 1) / 2; }
+        uint32_t ChromaHeight() const { return (height + 1) / 2; }
+        size_t LumaSize() const { return static_cast<size_t>(width) * height; }
+        size_t ChromaSize() const { return static_cast<size_t>(ChromaWidth()) * ChromaHeight(); }
+
+        uint8_t* Y() { return data.data(); }
+        uint8_t* U() { return data.data() + LumaSize(); }
+        uint8_t* V() { return data.data() + LumaSize() + ChromaSize(); }
+    };
+
+    #pragma region Color Conversion
+
+    // Note: BT.601 limited range with 7 bit coefficients. Every product
+    //       fits a signed 16 bit lane which is what lets SSE2 work on
+    //       8 pixels at once. The scalar path does the exact same math
+    //       so both give identical output
+    //
+    //       Y =  (33R + 65G + 13B) >> 7 + 16
+    //       U = (-19R - 37G + 56B) >> 7 + 128
+    //       V =  (56R - 47G -  9B) >> 7 + 128
+
+    inline uint8_t LumaFromRgb(int r, int g, int b)
+    {
+        return static_cast<uint8_t>(((33 * r + 65 * g + 13 * b + 64) >> 7) + 16);
+    }
+
+    inline uint8_t ChromaUFromRgb(int r, int g, int b)
+    {
+        return static_cast<uint8_t>(((-19 * r - 37 * g + 56 * b + 64) >> 7) + 128);
+    }
+
+    inline uint8_t ChromaVFromRgb(int r, int g, int b)
+    {
+        return static_cast<uint8_t>(((56 * r - 47 * g - 9 * b + 64) >> 7) + 128);
+    }
+
+    /// <summary>
+    /// Converts the 2x2 block whose top left pixel is (x, y). Pixels
+    /// past the right or bottom edge repeat the last row or column
+    /// </summary>
+    inline void ConvertBlockScalar(const uint8_t* src, uint32_t rowPitch, bool bgra,
+        uint32_t x, uint32_t y, I420Frame& out)
+    {
+        int redOffset = bgra ? 2 : 0;
+        int blueOffset = bgra ? 0 : 2;
+        int sumR = 0, sumG = 0, sumB = 0;
+
+        for (uint32_t dy = 0; dy < 2; dy++)
+        {
+            uint32_t py = (std::min)(y + dy, out.height - 1);
+            for (uint32_t dx = 0; dx < 2; dx++)
+            {
+                uint32_t px = (std::min)(x + dx, out.width - 1);
+                const uint8_t* pixel = src + static_cast<size_t>(py) * rowPitch + px * 4;
+                int r = pixel[redOffset];
+                int g = pixel[1];
+                int b = pixel[blueOffset];
+
+                out.Y()[static_cast<size_t>(py) * out.width + px] = LumaFromRgb(r, g, b);
+                sumR += r;
+                sumG += g;
+                sumB += b;
+            }
+        }
+
+        size_t chromaIndex = static_cast<size_t>(y / 2) * out.ChromaWidth() + x / 2;
+        out.U()[chromaIndex] = ChromaUFromRgb((sumR + 2) >> 2, (sumG + 2) >> 2, (sumB + 2) >> 2);
+        out.V()[chromaIndex] = ChromaVFromRgb((sumR + 2) >> 2, (sumG + 2) >> 2, (sumB + 2) >> 2);
+    }
+
+#ifdef CAPTURE_USE_SSE2
+    /// <summary>
+    /// Splits 8 packed 4 byte pixels into 16 bit lanes of a channel
+    /// </summary>
+    inline __m128i Channel8(__m128i first, __m128i second, int shift)
+    {
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        __m128i a = _mm_and_si128(_mm_srli_epi32(first, shift), mask);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(second, shift), mask);
+        return _mm_packs_epi32(a, b);
+    }
+
+    inline __m128i Luma8(__m128i r, __m128i g, __m128i b)
+    {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(33)), _mm_mullo_epi16(g, _mm_set1_epi16(65)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(13)));
+        sum = _mm_add_epi16(sum, _mm_set1_epi16(64));
+        return _mm_add_epi16(_mm_srai_epi16(sum, 7), _mm_set1_epi16(16));
+    }
+
+    /// <summary>
+    /// Averages each horizontal pair of two rows' worth of 16 bit
+    /// sums, leaving 4 values in the low lanes
+    /// </summary>
+    inline __m128i Average2x2(__m128i top, __m128i bottom)
+    {
+        __m128i pairs = _mm_madd_epi16(_mm_add_epi16(top, bottom), _mm_set1_epi16(1));
+        pairs = _mm_srai_epi32(_mm_add_epi32(pairs, _mm_set1_epi32(2)), 2);
+        return _mm_packs_epi32(pairs, pairs);
+    }
+
+    inline __m128i Chroma4(__m128i r, __m128i g, __m128i b, short cr, short cg, short cb)
+    {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)), _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+        sum = _mm_add_epi16(sum, _mm_set1_epi16(64));
+        return _mm_add_epi16(_mm_srai_epi16(sum, 7), _mm_set1_epi16(128));
+    }
+#endif
+
+    /// <summary>
+    /// Converts chroma rows [chromaBegin, chromaEnd) of a BGRA or RGBA
+    /// image, which covers luma rows [2 * chromaBegin, 2 * chromaEnd).
+    /// Separate ranges can run on separate threads
+    /// </summary>
+    inline void ConvertToI420(const uint8_t* src, uint32_t rowPitch, bool bgra,
+        uint32_t chromaBegin, uint32_t chromaEnd, I420Frame& out)
+    {
+        for (uint32_t chromaRow = chromaBegin; chromaRow < chromaEnd; chromaRow++)
+        {
+            uint32_t y = chromaRow * 2;
+            uint32_t x = 0;
+
+#ifdef CAPTURE_USE_SSE2
+            // Full 8 pixel wide blocks where both rows exist
+            if (y + 1 < out.height)
+            {
+                int redShift = bgra ? 16 : 0;
+                int blueShift = bgra ? 0 : 16;
+                const uint8_t* top = src + static_cast<size_t>(y) * rowPitch;
+                const uint8_t* bottom = top + rowPitch;
+                uint8_t* lumaTop = out.Y() + static_cast<size_t>(y) * out.width;
+                uint8_t* lumaBottom = lumaTop + out.width;
+                uint8_t* chromaU = out.U() + static_cast<size_t>(chromaRow) * out.ChromaWidth();
+                uint8_t* chromaV = out.V() + static_cast<size_t>(chromaRow) * out.ChromaWidth();
+
+                for (; x + 8 <= out.width; x += 8)
+                {
+                    __m128i top0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + x * 4));
+                    __m128i top1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + x * 4 + 16));
+                    __m128i bottom0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + x * 4));
+                    __m128i bottom1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + x * 4 + 16));
+
+                    __m128i rTop = Channel8(top0, top1, redShift);
+                    __m128i gTop = Channel8(top0, top1, 8);
+                    __m128i bTop = Channel8(top0, top1, blueShift);
+                    __m128i rBottom = Channel8(bottom0, bottom1, redShift);
+                    __m128i gBottom = Channel8(bottom0, bottom1, 8);
+                    __m128i bBottom = Channel8(bottom0, bottom1, blueShift);
+
+                    __m128i lumaTop8 = Luma8(rTop, gTop, bTop);
+                    __m128i lumaBottom8 = Luma8(rBottom, gBottom, bBottom);
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(lumaTop + x), _mm_packus_epi16(lumaTop8, lumaTop8));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(lumaBottom + x), _mm_packus_epi16(lumaBottom8, lumaBottom8));
+
+                    __m128i r = Average2x2(rTop, rBottom);
+                    __m128i g = Average2x2(gTop, gBottom);
+                    __m128i b = Average2x2(bTop, bBottom);
+
+                    __m128i u = Chroma4(r, g, b, -19, -37, 56);
+                    __m128i v = Chroma4(r, g, b, 56, -47, -9);
+                    int u4 = _mm_cvtsi128_si32(_mm_packus_epi16(u, u));
+                    int v4 = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+                    std::memcpy(chromaU + x / 2, &u4, 4);
+                    std::memcpy(chromaV + x / 2, &v4, 4);
+                }
+            }
+#endif
+
+            // Whatever is left, and every pixel without SSE2
+            for (; x < out.width; x += 2)
+            {
+                ConvertBlockScalar(src, rowPitch, bgra, x, y, out);
+            }
+        }
+    }
+
+    #pragma endregion
+
+    #pragma region Sinks
+
+    /// <summary>
+    /// Somewhere to stream encoded bytes to
+    /// </summary>
+    class FrameSink
+    {
+    public:
+        virtual ~FrameSink() = default;
+        virtual bool Write(const void* data, size_t size) = 0;
+    };
+
+    /// <summary>
+    /// Writes straight into a file
+    /// </summary>
+    class FileSink : public FrameSink
+    {
+    public:
+        explicit FileSink(const std::string& path)
+        {
+            file = std::fopen(path.c_str(), "wb");
+            if (file == nullptr)
+            {
+                throw std::runtime_error("Failed to open " + path + " for recording!");
+            }
+        }
+
+        ~FileSink() override
+        {
+            std::fclose(file);
+        }
+
+        bool Write(const void* data, size_t size) override
+        {
+            return std::fwrite(data, 1, size, file) == size;
+        }
+
+    private:
+        std::FILE* file;
+    };
+
+    /// <summary>
+    /// Starts an encoder process and writes into its stdin
+    /// </summary>
+    class PipeSink : public FrameSink
+    {
+    public:
+        explicit PipeSink(const std::string& command)
+        {
+#ifdef _WIN32
+            pipe = _popen(command.c_str(), "wb");
+#else
+            pipe = popen(command.c_str(), "w");
+#endif
+            if (pipe == nullptr)
+            {
+                throw std::runtime_error("Failed to start encoder: " + command);
+            }
+        }
+
+        ~PipeSink() override
+        {
+            // Closing stdin lets the encoder finish the file
+#ifdef _WIN32
+            _pclose(pipe);
+#else
+            pclose(pipe);
+#endif
+        }
+
+        bool Write(const void* data, size_t size) override
+        {
+            return std::fwrite(data, 1, size, pipe) == size;
+        }
+
+    private:
+        std::FILE* pipe;
+    };
+
+    /// <summary>
+    /// Wraps frames in the YUV4MPEG2 container, which is raw I420
+    /// with a tiny header and one "FRAME" marker per frame
+    /// </summary>
+    class Y4mWriter
+    {
+    public:
+        Y4mWriter(std::unique_ptr<FrameSink> sink, uint32_t width, uint32_t height, uint32_t framesPerSecond)
+            : sink(std::move(sink))
+        {
+            std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) +
+                " F" + std::to_string(framesPerSecond) + ":1 Ip A1:1 C420jpeg\n";
+            ok = this->sink->Write(header.data(), header.size());
+        }
+
+        bool WriteFrame(const I420Frame& frame)
+        {
+            static const char marker[] = "FRAME\n";
+            ok = ok && sink->Write(marker, sizeof(marker) - 1) && sink->Write(frame.data.data(), frame.data.size());
+            return ok;
+        }
+
+        bool Ok() const
+        {
+            return ok;
+        }
+
+    private:
+        std::unique_ptr<FrameSink> sink;
+        bool ok;
+    };
+
+    #pragma endregion
+
+    #pragma region Recorder
+
+    /// <summary>
+    /// Owns a thread that converts submitted frames on the job system
+    /// and streams them out in order. The render thread only ever
+    /// queues a pointer, it never waits on conversion or the sink
+    /// </summary>
+    class Recorder
+    {
+    public:
+        Recorder(JobSystem& jobSystem, std::unique_ptr<FrameSink> sink, uint32_t width, uint32_t height, uint32_t framesPerSecond)
+            : jobSystem(jobSystem), writer(std::move(sink), width, height, framesPerSecond)
+        {
+            frame.Resize(width, height);
+            thread = std::thread([this] { ThreadLoop(); });
+        }
+
+        /// <summary>
+        /// Finishes every queued frame before returning
+        /// </summary>
+        ~Recorder()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            thread.join();
+        }
+
+        Recorder(const Recorder&) = delete;
+        Recorder& operator=(const Recorder&) = delete;
+
+        /// <summary>
+        /// Queues a frame. pixels must stay untouched until done is
+        /// called, which happens as soon as it has been converted
+        /// </summary>
+        void Submit(const uint8_t* pixels, uint32_t rowPitch, bool bgra, std::function<void()> done)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.push_back({ pixels, rowPitch, bgra, std::move(done) });
+            }
+            wake.notify_one();
+        }
+
+        uint64_t FramesWritten() const
+        {
+            return framesWritten;
+        }
+
+        bool Failed() const
+        {
+            return failed;
+        }
+
+    private:
+        struct PendingFrame
+        {
+            const uint8_t* pixels;
+            uint32_t rowPitch;
+            bool bgra;
+            std::function<void()> done;
+        };
+
+        void ThreadLoop()
+        {
+            while (true)
+            {
+                PendingFrame pendingFrame;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !pending.empty(); });
+
+                    if (pending.empty())
+                    {
+                        return;
+                    }
+
+                    pendingFrame = std::move(pending.front());
+                    pending.pop_front();
+                }
+
+                // Bands of chroma rows convert independently
+                jobSystem.ParallelFor(frame.ChromaHeight(), 16, [&](uint32_t begin, uint32_t end)
+                {
+                    ConvertToI420(pendingFrame.pixels, pendingFrame.rowPitch, pendingFrame.bgra, begin, end, frame);
+                });
+
+                // The readback buffer is free again before we touch the sink
+                pendingFrame.done();
+
+                if (!failed && writer.WriteFrame(frame))
+                {
+                    framesWritten++;
+                }
+                else
+                {
+                    failed = true;
+                }
+            }
+        }
+
+        JobSystem& jobSystem;
+        Y4mWriter writer;
+        I420Frame frame;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<PendingFrame> pending;
+        bool stopping = false;
+
+        std::atomic<uint64_t> framesWritten{ 0 };
+        std::atomic<bool> failed{ false };
+    };
+
+    #pragma endregion
+
+    #pragma region Screenshots
+
+    /// <summary>
+    /// Owns a thread that encodes screenshots on the job system and
+    /// writes them to disk, the same way the Recorder handles video
+    /// </summary>
+    class ScreenshotWriter
+    {
+    public:
+        explicit ScreenshotWriter(JobSystem& jobSystem)
+            : jobSystem(jobSystem)
+        {
+            thread = std::thread([this] { ThreadLoop(); });
+        }
+
+        /// <summary>
+        /// Writes every queued screenshot before returning
+        /// </summary>
+        ~ScreenshotWriter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            thread.join();
+        }
+
+        ScreenshotWriter(const ScreenshotWriter&) = delete;
+        ScreenshotWriter& operator=(const ScreenshotWriter&) = delete;
+
+        /// <summary>
+        /// Queues a screenshot. The pixels must stay untouched until
+        /// done is called, which happens as soon as it has been encoded
+        /// </summary>
+        void Submit(const ImageEncode::SourceImage& image, ImageEncode::Format format, const std::string& path, std::function<void()> done)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.push_back({ image, format, path, std::move(done) });
+            }
+            wake.notify_one();
+        }
+
+    private:
+        struct PendingScreenshot
+        {
+            ImageEncode::SourceImage image;
+            ImageEncode::Format format;
+            std::string path;
+            std::function<void()> done;
+        };
+
+        void ThreadLoop()
+        {
+            while (true)
+            {
+                PendingScreenshot screenshot;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !pending.empty(); });
+
+                    if (pending.empty())
+                    {
+                        return;
+                    }
+
+                    screenshot = std::move(pending.front());
+                    pending.pop_front();
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                std::vector<uint8_t> encoded = ImageEncode::Encode(jobSystem, screenshot.image, screenshot.format);
+                auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                screenshot.done();
+
+                // A failed screenshot is reported, it never takes the app down
+                std::FILE* file = std::fopen(screenshot.path.c_str(), "wb");
+                bool written = file != nullptr && std::fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+                if (file != nullptr)
+                {
+                    std::fclose(file);
+                }
+
+                if (written)
+                {
+                    std::cout << "Saved " << screenshot.path << " (encoded in " << elapsed << " ms)" << std::endl;
+                }
+                else
+                {
+                    std::cerr << "Failed to write " << screenshot.path << std::endl;
+                }
+            }
+        }
+
+        JobSystem& jobSystem;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<PendingScreenshot> pending;
+        bool stopping = false;
+    };
+
+    #pragma endregion
+}
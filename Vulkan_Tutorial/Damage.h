@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Note: Damage is tracked on a coarse grid laid over clip space rather
+//       than as a list of rectangles. Marking, merging the damage of
+//       several frames and checking whether anything changed are then
+//       plain bit operations, and every window turns the same grid
+//       into pixel rectangles at its own resolution
+
+namespace Damage
+{
+    /// <summary>
+    /// A rectangle in pixels. Kept free of vulkan types so the grid
+    /// can be used without a device
+    /// </summary>
+    struct Rect
+    {
+        int32_t x;
+        int32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    class Grid
+    {
+    public:
+        static const uint32_t SIZE = 16; // Cells per side
+
+        void Clear() { cells.reset(); }
+        void MarkAll() { cells.set(); }
+        bool Any() const { return cells.any(); }
+        bool All() const { return cells.all(); }
+
+        Grid& operator|=(const Grid& other)
+        {
+            cells |= other.cells;
+            return *this;
+        }
+
+        /// <summary>
+        /// Marks every cell the clip space rectangle touches. Anything
+        /// entirely off screen is ignored
+        /// </summary>
+        void Mark(float minX, float minY, float maxX, float maxY)
+        {
+            if (maxX < -1.0f || maxY < -1.0f || minX > 1.0f || minY > 1.0f || minX > maxX || minY > maxY)
+            {
+                return;
+            }
+
+            uint32_t x0 = Cell(minX);
+            uint32_t x1 = Cell(maxX);
+            uint32_t y0 = Cell(minY);
+            uint32_t y1 = Cell(maxY);
+
+            for (uint32_t y = y0; y <= y1; y++)
+            {
+                for (uint32_t x = x0; x <= x1; x++)
+                {
+                    cells.set(y * SIZE + x);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Pixel rectangles covering every marked cell of a target of
+        /// width x height. Cells are joined into runs along each row and
+        /// runs that line up with the row above grow downwards. If that
+        /// still leaves more than maxRects they collapse into their
+        /// bounding box, a few large rectangles are cheaper to clear and
+        /// draw than many small ones
+        /// </summary>
+        std::vector<Rect> ToRects(uint32_t width, uint32_t height, uint32_t maxRects) const
+        {
+            struct Run
+            {
+                uint32_t x0, x1; // Cells [x0, x1)
+                uint32_t y0, y1; // Rows [y0, y1)
+            };
+
+            std::vector<Run> runs;
+            for (uint32_t y = 0; y < SIZE; y++)
+            {
+                uint32_t x = 0;
+                while (x < SIZE)
+                {
+                    if (!cells.test(y * SIZE + x))
+                    {
+                        x++;
+                        continue;
+                    }
+
+                    uint32_t start = x;
+                    while (x < SIZE && cells.test(y * SIZE + x))
+                    {
+                        x++;
+                    }
+
+                    // Extend the run of the row above if it spans
+                    // exactly the same cells
+                    auto above = std::find_if(runs.begin(), runs.end(), [&](const Run& run)
+                    {
+                        return run.x0 == start && run.x1 == x && run.y1 == y;
+                    });
+
+                    if (above != runs.end())
+                    {
+                        above->y1 = y + 1;
+                    }
+                    else
+                    {
+                        runs.push_back({ start, x, y, y + 1 });
+                    }
+                }
+            }
+
+            if (runs.size() > maxRects)
+            {
+                Run bounds = runs[0];
+                for (const Run& run : runs)
+                {
+                    bounds.x0 = (std::min)(bounds.x0, run.x0);
+                    bounds.x1 = (std::max)(bounds.x1, run.x1);
+                    bounds.y0 = (std::min)(bounds.y0, run.y0);
+                    bounds.y1 = (std::max)(bounds.y1, run.y1);
+                }
+                runs.assign(1, bounds);
+            }
+
+            // Cell edges are rounded outwards so neighbouring cells
+            // never leave a gap of unpainted pixels between them
+            std::vector<Rect> rects;
+            rects.reserve(runs.size());
+            for (const Run& run : runs)
+            {
+                uint32_t left = run.x0 * width / SIZE;
+                uint32_t right = (run.x1 * width + SIZE - 1) / SIZE;
+                uint32_t top = run.y0 * height / SIZE;
+                uint32_t bottom = (run.y1 * height + SIZE - 1) / SIZE;
+
+                if (right > left && bottom > top)
+                {
+                    rects.push_back({ static_cast<int32_t>(left), static_cast<int32_t>(top), right - left, bottom - top });
+                }
+            }
+            return rects;
+        }
+
+    private:
+        static uint32_t Cell(float clip)
+        {
+            float cell = std::floor((clip + 1.0f) * 0.5f * static_cast<float>(SIZE));
+            return static_cast<uint32_t>(std::clamp(cell, 0.0f, static_cast<float>(SIZE - 1)));
+        }
+
+        std::bitset<SIZE * SIZE> cells;
+    };
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Note: Host side of image based lighting. Environments are loaded from
+//       Radiance .hdr files (equirectangular RGBE), and everything the
+//       GPU derives from one is cached on disk under a key hashed from
+//       the input and every setting that changes the result:
+//
+//           header      magic, version, key, payload size
+//           payload     whatever the renderer stored, opaque here
+//
+//       A cache file whose header does not match is treated as missing,
+//       so changing a setting or the file format simply recomputes.
+//       Files are written next to their final name first and renamed
+//       into place, so a crash mid-write never leaves a torn entry
+
+namespace Environment
+{
+    /// <summary>
+    /// An equirectangular environment, linear RGB with an unused fourth
+    /// channel so rows can be uploaded as vec4s. Row 0 looks straight up
+    /// </summary>
+    struct EquirectImage
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<float> pixels;
+    };
+
+    #pragma region Radiance HDR
+
+    inline void DecodeRgbe(const uint8_t* rgbe, float* out)
+    {
+        if (rgbe[3] == 0)
+        {
+            out[0] = out[1] = out[2] = 0.0f;
+        }
+        else
+        {
+            float scale = std::ldexp(1.0f, static_cast<int>(rgbe[3]) - (128 + 8));
+            out[0] = rgbe[0] * scale;
+            out[1] = rgbe[1] * scale;
+            out[2] = rgbe[2] * scale;
+        }
+        out[3] = 1.0f;
+    }
+
+    /// <summary>
+    /// Reads one scanline, either new style run length encoded (every
+    /// channel on its own) or flat RGBE. Old style RLE is not supported
+    /// </summary>
+    inline bool ReadScanline(std::FILE* file, uint32_t width, std::vector<uint8_t>& rgbe)
+    {
+        uint8_t start[4];
+        if (std::fread(start, 1, 4, file) != 4)
+        {
+            return false;
+        }
+
+        bool encoded = width >= 8 && width < 32768 && start[0] == 2 && start[1] == 2 &&
+            ((static_cast<uint32_t>(start[2]) << 8) | start[3]) == width;
+        if (!encoded)
+        {
+            std::memcpy(rgbe.data(), start, 4);
+            return width == 1 || std::fread(rgbe.data() + 4, 4, width - 1, file) == width - 1;
+        }
+
+        for (uint32_t channel = 0; channel < 4; channel++)
+        {
+            uint32_t x = 0;
+            while (x < width)
+            {
+                int count = std::fgetc(file);
+                if (count == EOF || count == 0)
+                {
+                    return false;
+                }
+
+                // Above 128 is a run of one value, otherwise literals
+                bool run = count > 128;
+                uint32_t length = run ? count - 128 : count;
+                if (x + length > width)
+                {
+                    return false;
+                }
+
+                int value = run ? std::fgetc(file) : 0;
+                for (uint32_t i = 0; i < length; i++)
+                {
+                    if (!run)
+                    {
+                        value = std::fgetc(file);
+                    }
+                    if (value == EOF)
+                    {
+                        return false;
+                    }
+                    rgbe[(x++) * 4 + channel] = static_cast<uint8_t>(value);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Loads a Radiance .hdr file. Only the usual -Y height +X width
+    /// orientation is accepted
+    /// </summary>
+    inline bool LoadHdr(const std::string& path, EquirectImage& image)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            return false;
+        }
+
+        // Header lines up to an empty one, then the resolution
+        char line[256];
+        bool rgbe = false;
+        while (std::fgets(line, sizeof(line), file) && line[0] != '\n' && line[0] != '\r')
+        {
+            rgbe |= std::strstr(line, "FORMAT=32-bit_rle_rgbe") != nullptr;
+        }
+
+        unsigned width = 0, height = 0;
+        bool ok = rgbe && std::fgets(line, sizeof(line), file) &&
+            std::sscanf(line, "-Y %u +X %u", &height, &width) == 2 && width > 0 && height > 0;
+
+        if (ok)
+        {
+            image.width = width;
+            image.height = height;
+            image.pixels.resize(static_cast<size_t>(width) * height * 4);
+
+            std::vector<uint8_t> scanline(static_cast<size_t>(width) * 4);
+            for (uint32_t y = 0; y < height && ok; y++)
+            {
+                ok = ReadScanline(file, width, scanline);
+                for (uint32_t x = 0; x < width && ok; x++)
+                {
+                    DecodeRgbe(&scanline[x * 4], &image.pixels[(static_cast<size_t>(y) * width + x) * 4]);
+                }
+            }
+        }
+
+        std::fclose(file);
+        return ok;
+    }
+
+    #pragma endregion
+
+    #pragma region Cache
+
+    const uint32_t CACHE_MAGIC = 0x4C424921;   // "!IBL"
+    const uint64_t HASH_SEED = 14695981039346656037ull;
+
+    struct CacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t payloadSize;
+    };
+
+    /// <summary>
+    /// 64 bit FNV-1a. Chain calls through seed to hash several inputs
+    /// </summary>
+    inline uint64_t Hash(const void* data, size_t size, uint64_t seed = HASH_SEED)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    inline uint64_t HashValue(const T& value, uint64_t seed)
+    {
+        return Hash(&value, sizeof(T), seed);
+    }
+
+    inline std::string CachePath(const std::string& directory, uint64_t key)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.ibl", static_cast<unsigned long long>(key));
+        return directory + "/" + name;
+    }
+
+    /// <summary>
+    /// The payload inside a whole cache file, if the file holds
+    /// exactly payloadSize bytes for this key and version. Null
+    /// otherwise
+    /// </summary>
+    inline const uint8_t* CachedPayload(const uint8_t* file, size_t fileSize, uint64_t key, uint32_t version, size_t payloadSize)
+    {
+        if (file == nullptr || fileSize != sizeof(CacheHeader) + payloadSize)
+        {
+            return nullptr;
+        }
+
+        CacheHeader header;
+        std::memcpy(&header, file, sizeof(header));
+        if (header.magic != CACHE_MAGIC || header.version != version || header.key != key || header.payloadSize != payloadSize)
+        {
+            return nullptr;
+        }
+
+        return file + sizeof(CacheHeader);
+    }
+
+    inline bool WriteCache(const std::string& directory, uint64_t key, uint32_t version, size_t payloadSize, const void* payload)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+
+        std::string path = CachePath(directory, key);
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            CacheHeader header = { CACHE_MAGIC, version, key, payloadSize };
+            if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header)) ||
+                !file.write(static_cast<const char*>(payload), payloadSize))
+            {
+                return false;
+            }
+        }
+
+        // Windows does not rename over an existing file
+        std::remove(path.c_str());
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    #pragma endregion
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Terrain.h"
+
+// Note: Host side of the foliage scattered over the terrain. All the
+//       CPU provides is a density map, two 8 bit channels per texel:
+//
+//           0   grass       chance of a tuft in each grass cell
+//           1   trees       chance of a tree in each tree cell
+//
+//       The map is tiled over the ground, and slope and altitude thin
+//       it further on the GPU. It is either made here from noise or
+//       read from a square RAW file of interleaved grass, tree bytes
+
+namespace Foliage
+{
+    const uint32_t DENSITY_CHANNELS = 2;
+
+    /// <summary>
+    /// A square density map, row by row
+    /// </summary>
+    struct DensityMap
+    {
+        uint32_t size = 0;
+        std::vector<uint8_t> texels;
+    };
+
+    /// <summary>
+    /// Value noise in [0, 1) that repeats every period units, so the
+    /// map tiles without seams
+    /// </summary>
+    inline float TilingNoise(float x, float z, int32_t period)
+    {
+        float fx = std::floor(x);
+        float fz = std::floor(z);
+        int32_t ix = static_cast<int32_t>(fx);
+        int32_t iz = static_cast<int32_t>(fz);
+        float tx = x - fx;
+        float tz = z - fz;
+        tx = tx * tx * (3.0f - 2.0f * tx);
+        tz = tz * tz * (3.0f - 2.0f * tz);
+
+        auto corner = [period](int32_t cx, int32_t cz)
+        {
+            return Terrain::Hash(((cx % period) + period) % period, ((cz % period) + period) % period);
+        };
+
+        float a = corner(ix, iz) + (corner(ix + 1, iz) - corner(ix, iz)) * tx;
+        float b = corner(ix, iz + 1) + (corner(ix + 1, iz + 1) - corner(ix, iz + 1)) * tx;
+        return a + (b - a) * tz;
+    }
+
+    /// <summary>
+    /// Meadows broken up by patches of bare ground, and forests in
+    /// clusters with clearings between them
+    /// </summary>
+    inline DensityMap ProceduralDensity(uint32_t size)
+    {
+        const int32_t BASE_PERIOD = 4;
+        const uint32_t OCTAVES = 4;
+
+        DensityMap map;
+        map.size = size;
+        map.texels.resize(static_cast<size_t>(size) * size * DENSITY_CHANNELS);
+
+        for (uint32_t y = 0; y < size; y++)
+        {
+            for (uint32_t x = 0; x < size; x++)
+            {
+                float noise = 0.0f;
+                float amplitude = 0.5f;
+                int32_t period = BASE_PERIOD;
+                for (uint32_t octave = 0; octave < OCTAVES; octave++)
+                {
+                    float u = static_cast<float>(x) / size * period;
+                    float v = static_cast<float>(y) / size * period;
+                    noise += TilingNoise(u, v, period) * amplitude;
+                    amplitude *= 0.5f;
+                    period *= 2;
+                }
+
+                // Trees only where the noise peaks, grass almost
+                // everywhere but thinner under them
+                float trees = std::clamp((noise - 0.45f) * 4.0f, 0.0f, 1.0f);
+                float grass = std::clamp(1.2f - noise, 0.0f, 1.0f) * (1.0f - 0.5f * trees);
+
+                uint8_t* texel = &map.texels[(static_cast<size_t>(y) * size + x) * DENSITY_CHANNELS];
+                texel[0] = static_cast<uint8_t>(grass * 255.0f + 0.5f);
+                texel[1] = static_cast<uint8_t>(trees * 255.0f + 0.5f);
+            }
+        }
+        return map;
+    }
+
+    /// <summary>
+    /// Reads a square RAW file of interleaved grass and tree bytes.
+    /// The size follows from the file's length
+    /// </summary>
+    inline bool LoadDensity(const std::string& path, DensityMap& map)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            return false;
+        }
+
+        std::streamoff bytes = file.tellg();
+        uint32_t size = static_cast<uint32_t>(std::sqrt(static_cast<double>(bytes / DENSITY_CHANNELS)));
+        if (size == 0 || static_cast<std::streamoff>(size) * size * DENSITY_CHANNELS != bytes)
+        {
+            return false;
+        }
+
+        map.size = size;
+        map.texels.resize(static_cast<size_t>(bytes));
+        file.seekg(0);
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(map.texels.data()), bytes));
+    }
+}
@@ -0,0 +1,468 @@
+#pragma once
+
+#include "FrameExport.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Test consumer for the frame export mode. Imports the exported
+/// images and semaphores into its own device, copies each finished
+/// frame out and prints a checksum of it before handing it back.
+/// The copy only exists so the frames can be checked, a real
+/// encoder would read the imported image directly
+/// </summary>
+class FrameConsumer
+{
+public:
+    /// <summary>
+    /// Connects to the renderer and consumes frames until it goes
+    /// away or frameLimit frames were seen (zero means no limit)
+    /// </summary>
+    void Run(const std::string& socketPath, uint64_t frameLimit)
+    {
+        socket = LocalSocket::Connect(socketPath);
+
+        FrameExport::Message hello{ FrameExport::MESSAGE_HELLO, FrameExport::CurrentProcessId(), 0 };
+        if (!socket.Send(hello) || !FrameExport::ReceiveSetup(socket, setup, memoryHandles, semaphoreHandles))
+        {
+            throw std::runtime_error("Failed to receive the exported frames!");
+        }
+
+        std::cout << "Importing " << setup.imageCount << " frames of " << setup.width << "x" << setup.height << std::endl;
+
+        CreateInstance();
+        PickPhysicalDevice();
+        CreateLogicalDevice();
+        ImportFrames();
+        CreateReadback();
+
+        ConsumeFrames(frameLimit);
+
+        Cleanup();
+    }
+
+private:
+    LocalSocket socket;
+    FrameExport::Setup setup{};
+    std::vector<FrameExport::ExternalHandle> memoryHandles;
+    std::vector<FrameExport::ExternalHandle> semaphoreHandles;
+
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t queueFamily = 0;
+    VkQueue queue;
+
+    std::vector<VkImage> images;
+    std::vector<VkDeviceMemory> imagesMemory;
+    std::vector<VkSemaphore> readySemaphores;
+
+    // Checksums are taken from a host visible copy of the frame
+    VkBuffer readbackBuffer;
+    VkDeviceMemory readbackBufferMemory;
+    void* readbackBufferMapped;
+    VkDeviceSize frameSize;
+
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+
+    void CreateInstance()
+    {
+        VkApplicationInfo appInfo{};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName = "Frame Consumer";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "No Engine";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion = VK_API_VERSION_1_1;
+
+        VkInstanceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+        if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create instance!");
+        }
+    }
+
+    /// <summary>
+    /// The handles only mean something on the exact GPU and driver
+    /// that exported them, so match on their UUIDs
+    /// </summary>
+    void PickPhysicalDevice()
+    {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+        for (const auto& device : devices)
+        {
+            VkPhysicalDeviceIDProperties idProperties{};
+            idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+            VkPhysicalDeviceProperties2 properties{};
+            properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties.pNext = &idProperties;
+            vkGetPhysicalDeviceProperties2(device, &properties);
+
+            if (std::memcmp(idProperties.deviceUUID, setup.deviceUUID, VK_UUID_SIZE) == 0 &&
+                std::memcmp(idProperties.driverUUID, setup.driverUUID, VK_UUID_SIZE) == 0)
+            {
+                physicalDevice = device;
+                break;
+            }
+        }
+
+        if (physicalDevice == VK_NULL_HANDLE)
+        {
+            throw std::runtime_error("Failed to find the GPU the frames were exported from!");
+        }
+    }
+
+    void CreateLogicalDevice()
+    {
+        // Every queue family that can do graphics or compute can
+        // also do transfers, which is all we need
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+        for (uint32_t i = 0; i < queueFamilyCount; i++)
+        {
+            if (queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+            {
+                queueFamily = i;
+                break;
+            }
+        }
+
+        float queuePriority = 1.0f;
+        VkDeviceQueueCreateInfo queueCreateInfo{};
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.queueFamilyIndex = queueFamily;
+        queueCreateInfo.queueCount = 1;
+        queueCreateInfo.pQueuePriorities = &queuePriority;
+
+        const char* extensions[] = { FrameExport::MEMORY_EXTENSION_NAME, FrameExport::SEMAPHORE_EXTENSION_NAME };
+
+        VkDeviceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.queueCreateInfoCount = 1;
+        createInfo.pQueueCreateInfos = &queueCreateInfo;
+        createInfo.enabledExtensionCount = 2;
+        createInfo.ppEnabledExtensionNames = extensions;
+
+        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create logical device!");
+        }
+
+        vkGetDeviceQueue(device, queueFamily, 0, &queue);
+    }
+
+    /// <summary>
+    /// Recreates every exported image on top of the imported memory
+    /// and imports the semaphores that say when a frame is done
+    /// </summary>
+    void ImportFrames()
+    {
+        images.resize(setup.imageCount);
+        imagesMemory.resize(setup.imageCount);
+        readySemaphores.resize(setup.imageCount);
+
+        for (uint32_t i = 0; i < setup.imageCount; i++)
+        {
+            VkExternalMemoryImageCreateInfo externalInfo{};
+            externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+            externalInfo.handleTypes = FrameExport::MEMORY_HANDLE_TYPE;
+
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.pNext = &externalInfo;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent = { setup.width, setup.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = static_cast<VkFormat>(setup.format);
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = FrameExport::IMAGE_USAGE;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(device, &imageInfo, nullptr, &images[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create imported image!");
+            }
+
+            // The exporter used a dedicated allocation so we have to as well
+            VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+            dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+            dedicatedInfo.image = images[i];
+
+#ifdef _WIN32
+            VkImportMemoryWin32HandleInfoKHR importInfo{};
+            importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_WIN32_HANDLE_INFO_KHR;
+            importInfo.handle = memoryHandles[i];
+#else
+            VkImportMemoryFdInfoKHR importInfo{};
+            importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR;
+            importInfo.fd = memoryHandles[i];
+#endif
+            importInfo.handleType = FrameExport::MEMORY_HANDLE_TYPE;
+            importInfo.pNext = &dedicatedInfo;
+
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.pNext = &importInfo;
+            allocInfo.allocationSize = setup.allocationSize;
+            allocInfo.memoryTypeIndex = setup.memoryTypeIndex;
+
+            if (vkAllocateMemory(device, &allocInfo, nullptr, &imagesMemory[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to import frame memory!");
+            }
+
+            vkBindImageMemory(device, images[i], imagesMemory[i], 0);
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &readySemaphores[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create semaphore!");
+            }
+
+            ImportSemaphore(readySemaphores[i], semaphoreHandles[i]);
+        }
+
+        // Note: Successful imports of fds take ownership, win32 handles
+        //       stay ours and still have to be closed
+#ifdef _WIN32
+        for (uint32_t i = 0; i < setup.imageCount; i++)
+        {
+            FrameExport::CloseExternalHandle(memoryHandles[i]);
+            FrameExport::CloseExternalHandle(semaphoreHandles[i]);
+        }
+#endif
+    }
+
+    void ImportSemaphore(VkSemaphore semaphore, FrameExport::ExternalHandle handle)
+    {
+#ifdef _WIN32
+        auto func = (PFN_vkImportSemaphoreWin32HandleKHR)vkGetDeviceProcAddr(device, "vkImportSemaphoreWin32HandleKHR");
+
+        VkImportSemaphoreWin32HandleInfoKHR importInfo{};
+        importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_WIN32_HANDLE_INFO_KHR;
+        importInfo.handle = handle;
+#else
+        auto func = (PFN_vkImportSemaphoreFdKHR)vkGetDeviceProcAddr(device, "vkImportSemaphoreFdKHR");
+
+        VkImportSemaphoreFdInfoKHR importInfo{};
+        importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+        importInfo.fd = handle;
+#endif
+        importInfo.semaphore = semaphore;
+        importInfo.handleType = FrameExport::SEMAPHORE_HANDLE_TYPE;
+
+        if (func == nullptr || func(device, &importInfo) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to import frame semaphore!");
+        }
+    }
+
+    uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+    {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+        {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("Failed to find suitable memory type!");
+    }
+
+    void CreateReadback()
+    {
+        // Exported frames are always 4 bytes per pixel
+        frameSize = static_cast<VkDeviceSize>(setup.width) * setup.height * 4;
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = frameSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &readbackBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create readback buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, readbackBuffer, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &readbackBufferMemory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate readback memory!");
+        }
+
+        vkBindBufferMemory(device, readbackBuffer, readbackBufferMemory, 0);
+        vkMapMemory(device, readbackBufferMemory, 0, frameSize, 0, &readbackBufferMapped);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = queueFamily;
+
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create command pool!");
+        }
+
+        VkCommandBufferAllocateInfo commandInfo{};
+        commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandInfo.commandPool = commandPool;
+        commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(device, &commandInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate command buffer!");
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create fence!");
+        }
+    }
+
+    void ConsumeFrames(uint64_t frameLimit)
+    {
+        uint64_t framesSeen = 0;
+        FrameExport::Message message;
+
+        while ((frameLimit == 0 || framesSeen < frameLimit) && socket.Receive(message))
+        {
+            if (message.type != FrameExport::MESSAGE_FRAME_READY || message.image >= setup.imageCount)
+            {
+                continue;
+            }
+
+            uint64_t checksum = ReadFrame(message.image);
+            std::cout << "Frame " << message.frameNumber << " (image " << message.image << ") checksum "
+                << std::hex << checksum << std::dec << std::endl;
+
+            FrameExport::Message released{ FrameExport::MESSAGE_FRAME_RELEASED, message.image, message.frameNumber };
+            if (!socket.Send(released))
+            {
+                break;
+            }
+
+            framesSeen++;
+        }
+    }
+
+    /// <summary>
+    /// Waits for the renderer to finish the image, copies it out
+    /// and returns an FNV-1a hash of its pixels
+    /// </summary>
+    uint64_t ReadFrame(uint32_t image)
+    {
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        // Take the image over from the renderer's queue
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_EXTERNAL;
+        barrier.dstQueueFamilyIndex = queueFamily;
+        barrier.image = images[image];
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkBufferImageCopy region{};
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageExtent = { setup.width, setup.height, 1 };
+        vkCmdCopyImageToBuffer(commandBuffer, images[image], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+        vkEndCommandBuffer(commandBuffer);
+
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &readySemaphores[image];
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        vkResetFences(device, 1, &fence);
+        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to submit frame readback!");
+        }
+        vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+        const uint8_t* bytes = static_cast<const uint8_t*>(readbackBufferMapped);
+        uint64_t hash = 14695981039346656037ull;
+        for (VkDeviceSize i = 0; i < frameSize; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void Cleanup()
+    {
+        vkDeviceWaitIdle(device);
+
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        vkDestroyBuffer(device, readbackBuffer, nullptr);
+        vkFreeMemory(device, readbackBufferMemory, nullptr);
+
+        for (uint32_t i = 0; i < setup.imageCount; i++)
+        {
+            vkDestroySemaphore(device, readySemaphores[i], nullptr);
+            vkDestroyImage(device, images[i], nullptr);
+            vkFreeMemory(device, imagesMemory[i], nullptr);
+        }
+
+        vkDestroyDevice(device, nullptr);
+        vkDestroyInstance(instance, nullptr);
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "LocalSocket.h"
+
+#if defined(_WIN32) && !defined(VK_USE_PLATFORM_WIN32_KHR)
+    #define VK_USE_PLATFORM_WIN32_KHR
+#endif
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Note: Protocol shared by the exporting renderer and whoever consumes
+//       its frames. Rendered images and the semaphores guarding them
+//       are exported once as OS handles, after that only tiny messages
+//       go over the socket and no pixel is ever copied to the host
+//
+//       consumer -> renderer   Hello           once, after connecting
+//       renderer -> consumer   Setup + handles once
+//       renderer -> consumer   FrameReady      image is rendered, wait on its semaphore
+//       consumer -> renderer   FrameReleased   image can be rendered to again
+//
+//       Handles are opaque fds sent with SCM_RIGHTS, or on Windows NT
+//       handles duplicated straight into the consumer's process
+
+namespace FrameExport
+{
+    const uint32_t MAX_IMAGES = 4;
+
+#ifdef _WIN32
+    typedef HANDLE ExternalHandle;
+    const VkExternalMemoryHandleTypeFlagBits MEMORY_HANDLE_TYPE = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+    const VkExternalSemaphoreHandleTypeFlagBits SEMAPHORE_HANDLE_TYPE = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+    const char* const MEMORY_EXTENSION_NAME = VK_KHR_EXTERNAL_MEMORY_WIN32_EXTENSION_NAME;
+    const char* const SEMAPHORE_EXTENSION_NAME = VK_KHR_EXTERNAL_SEMAPHORE_WIN32_EXTENSION_NAME;
+#else
+    typedef int ExternalHandle;
+    const VkExternalMemoryHandleTypeFlagBits MEMORY_HANDLE_TYPE = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+    const VkExternalSemaphoreHandleTypeFlagBits SEMAPHORE_HANDLE_TYPE = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+    const char* const MEMORY_EXTENSION_NAME = VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME;
+    const char* const SEMAPHORE_EXTENSION_NAME = VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME;
+#endif
+
+    // Exported images are always created with exactly this usage so
+    // both processes describe the same image to their drivers
+    const VkImageUsageFlags IMAGE_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+    enum MessageType : uint32_t
+    {
+        MESSAGE_HELLO = 1,
+        MESSAGE_FRAME_READY,
+        MESSAGE_FRAME_RELEASED,
+    };
+
+    struct Message
+    {
+        uint32_t type;
+        uint32_t image;         // Which exported image, or the process id for Hello
+        uint64_t frameNumber;
+    };
+
+    /// <summary>
+    /// Everything the consumer needs to recreate the images on its
+    /// side. Both processes have to end up on the same GPU and driver
+    /// </summary>
+    struct Setup
+    {
+        uint32_t imageCount;
+        uint32_t width;
+        uint32_t height;
+        int32_t format;
+        uint32_t memoryTypeIndex;
+        uint32_t padding;
+        uint64_t allocationSize;
+        uint8_t deviceUUID[VK_UUID_SIZE];
+        uint8_t driverUUID[VK_UUID_SIZE];
+
+        // Only filled in on Windows, fds travel next to the message
+        uint64_t memoryHandles[MAX_IMAGES];
+        uint64_t semaphoreHandles[MAX_IMAGES];
+    };
+
+    inline uint32_t CurrentProcessId()
+    {
+#ifdef _WIN32
+        return static_cast<uint32_t>(GetCurrentProcessId());
+#else
+        return static_cast<uint32_t>(getpid());
+#endif
+    }
+
+    inline void CloseExternalHandle(ExternalHandle handle)
+    {
+#ifdef _WIN32
+        ::CloseHandle(handle);
+#else
+        close(handle);
+#endif
+    }
+
+    /// <summary>
+    /// Sends the setup and hands the consumer its own copy of every
+    /// handle. Ours are closed afterwards either way
+    /// </summary>
+    inline bool SendSetup(LocalSocket& socket, Setup setup, uint32_t consumerProcessId,
+        const std::vector<ExternalHandle>& memoryHandles, const std::vector<ExternalHandle>& semaphoreHandles)
+    {
+        bool sent = false;
+
+#ifdef _WIN32
+        HANDLE consumerProcess = OpenProcess(PROCESS_DUP_HANDLE, FALSE, consumerProcessId);
+        if (consumerProcess != nullptr)
+        {
+            auto duplicate = [&](HANDLE handle)
+            {
+                HANDLE duplicated = nullptr;
+                DuplicateHandle(GetCurrentProcess(), handle, consumerProcess, &duplicated, 0, FALSE, DUPLICATE_SAME_ACCESS);
+                return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(duplicated));
+            };
+
+            for (uint32_t i = 0; i < setup.imageCount; i++)
+            {
+                setup.memoryHandles[i] = duplicate(memoryHandles[i]);
+                setup.semaphoreHandles[i] = duplicate(semaphoreHandles[i]);
+            }
+
+            ::CloseHandle(consumerProcess);
+            sent = socket.Send(setup);
+        }
+#else
+        (void)consumerProcessId;
+
+        std::vector<int> fds(memoryHandles);
+        fds.insert(fds.end(), semaphoreHandles.begin(), semaphoreHandles.end());
+        sent = socket.SendWithFds(&setup, sizeof(setup), fds);
+#endif
+
+        for (auto handle : memoryHandles)
+        {
+            CloseExternalHandle(handle);
+        }
+        for (auto handle : semaphoreHandles)
+        {
+            CloseExternalHandle(handle);
+        }
+
+        return sent;
+    }
+
+    /// <summary>
+    /// Receives the setup along with the handles that now belong
+    /// to this process
+    /// </summary>
+    inline bool ReceiveSetup(LocalSocket& socket, Setup& setup,
+        std::vector<ExternalHandle>& memoryHandles, std::vector<ExternalHandle>& semaphoreHandles)
+    {
+#ifdef _WIN32
+        if (!socket.Receive(setup) || setup.imageCount > MAX_IMAGES)
+        {
+            return false;
+        }
+
+        memoryHandles.resize(setup.imageCount);
+        semaphoreHandles.resize(setup.imageCount);
+        for (uint32_t i = 0; i < setup.imageCount; i++)
+        {
+            memoryHandles[i] = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(setup.memoryHandles[i]));
+            semaphoreHandles[i] = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(setup.semaphoreHandles[i]));
+        }
+        return true;
+#else
+        std::vector<int> fds;
+        if (!socket.ReceiveWithFds(&setup, sizeof(setup), fds, MAX_IMAGES * 2) ||
+            setup.imageCount > MAX_IMAGES || fds.size() != setup.imageCount * 2)
+        {
+            for (int fd : fds)
+            {
+                close(fd);
+            }
+            return false;
+        }
+
+        memoryHandles.assign(fds.begin(), fds.begin() + setup.imageCount);
+        semaphoreHandles.assign(fds.begin() + setup.imageCount, fds.end());
+        return true;
+#endif
+    }
+}
@@ -0,0 +1,877 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define IMAGE_ENCODE_USE_SSE2
+#endif
+
+// Note: Encodes 8 bit RGBA or BGRA images read back from the GPU as PNG
+//       or QOI. Both are split into strips of rows that encode on the
+//       job system independently and are concatenated afterwards:
+//
+//       PNG   every strip is its own run of deflate blocks ending on a
+//             byte boundary, written as its own IDAT chunk. Only the
+//             adler checksums have to be combined at the end
+//       QOI   every strip starts with an empty colour index, so it only
+//             ever references pixels it encoded itself
+//
+//       Alpha is always written as opaque, swap chains don't have any
+//       meaningful alpha
+
+namespace ImageEncode
+{
+    enum class Format
+    {
+        Png,
+        Qoi,
+    };
+
+    // Rows encoded by one job. Big enough that starting over at every
+    // strip barely costs any compression
+    const uint32_t STRIP_ROWS = 32;
+
+    /// <summary>
+    /// Pixels as they sit in a readback buffer
+    /// </summary>
+    struct SourceImage
+    {
+        const uint8_t* pixels;
+        uint32_t rowPitch;
+        uint32_t width;
+        uint32_t height;
+        bool bgra;
+    };
+
+    #pragma region Pixels
+
+    /// <summary>
+    /// Copies row y into out as RGBA with opaque alpha
+    /// </summary>
+    inline void LoadRow(const SourceImage& image, uint32_t y, uint8_t* out)
+    {
+        const uint8_t* src = image.pixels + static_cast<size_t>(y) * image.rowPitch;
+        uint32_t x = 0;
+
+#ifdef IMAGE_ENCODE_USE_SSE2
+        const __m128i keepMask = _mm_set1_epi32(0x0000FF00);
+        const __m128i lowMask = _mm_set1_epi32(0x000000FF);
+        const __m128i highMask = _mm_set1_epi32(0x00FF0000);
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+        for (; x + 4 <= image.width; x += 4)
+        {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+
+            // Swaps the bytes holding red and blue within every pixel
+            if (image.bgra)
+            {
+                __m128i swapped = _mm_or_si128(
+                    _mm_and_si128(_mm_srli_epi32(pixels, 16), lowMask),
+                    _mm_and_si128(_mm_slli_epi32(pixels, 16), highMask));
+                pixels = _mm_or_si128(_mm_and_si128(pixels, keepMask), swapped);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_or_si128(pixels, alpha));
+        }
+#endif
+
+        for (; x < image.width; x++)
+        {
+            const uint8_t* pixel = src + x * 4;
+            out[x * 4 + 0] = image.bgra ? pixel[2] : pixel[0];
+            out[x * 4 + 1] = pixel[1];
+            out[x * 4 + 2] = image.bgra ? pixel[0] : pixel[2];
+            out[x * 4 + 3] = 0xFF;
+        }
+    }
+
+    inline void WriteBigEndian(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    #pragma endregion
+
+    #pragma region PNG Filters
+
+    // Note: Filters predict every byte from its neighbours and store the
+    //       difference. Left is the same channel one pixel earlier, up
+    //       is the row above. Only raw bytes are ever read so a whole
+    //       row filters in parallel
+
+    enum FilterType : uint8_t
+    {
+        FILTER_NONE,
+        FILTER_SUB,
+        FILTER_UP,
+        FILTER_AVERAGE,
+        FILTER_PAETH,
+        FILTER_COUNT,
+    };
+
+    const uint32_t BYTES_PER_PIXEL = 4;
+
+    inline uint8_t PaethPredictor(int a, int b, int c)
+    {
+        int pa = std::abs(b - c);
+        int pb = std::abs(a - c);
+        int pc = std::abs(a + b - 2 * c);
+
+        if (pa <= pb && pa <= pc)
+        {
+            return static_cast<uint8_t>(a);
+        }
+        return static_cast<uint8_t>(pb <= pc ? b : c);
+    }
+
+    /// <summary>
+    /// Filters bytes [begin, size) of a row one byte at a time
+    /// </summary>
+    inline void FilterBytesScalar(FilterType type, const uint8_t* row, const uint8_t* prior, uint8_t* out, uint32_t begin, uint32_t size)
+    {
+        for (uint32_t i = begin; i < size; i++)
+        {
+            int left = i >= BYTES_PER_PIXEL ? row[i - BYTES_PER_PIXEL] : 0;
+            int up = prior[i];
+            int upLeft = i >= BYTES_PER_PIXEL ? prior[i - BYTES_PER_PIXEL] : 0;
+
+            uint8_t prediction = 0;
+            switch (type)
+            {
+            case FILTER_SUB: prediction = static_cast<uint8_t>(left); break;
+            case FILTER_UP: prediction = static_cast<uint8_t>(up); break;
+            case FILTER_AVERAGE: prediction = static_cast<uint8_t>((left + up) / 2); break;
+            case FILTER_PAETH: prediction = PaethPredictor(left, up, upLeft); break;
+            default: break;
+            }
+
+            out[i] = static_cast<uint8_t>(row[i] - prediction);
+        }
+    }
+
+#ifdef IMAGE_ENCODE_USE_SSE2
+    /// <summary>
+    /// Paeth prediction for 8 bytes widened to 16 bits
+    /// </summary>
+    inline __m128i Paeth8(__m128i a, __m128i b, __m128i c)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        auto absolute = [&](__m128i v) { return _mm_max_epi16(v, _mm_sub_epi16(zero, v)); };
+
+        __m128i pa = absolute(_mm_sub_epi16(b, c));
+        __m128i pb = absolute(_mm_sub_epi16(a, c));
+        __m128i pc = absolute(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+
+        // a wins unless pa is bigger than pb or pc, b wins over c unless pb is bigger than pc
+        __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+        __m128i useC = _mm_cmpgt_epi16(pb, pc);
+
+        __m128i bOrC = _mm_or_si128(_mm_and_si128(useC, c), _mm_andnot_si128(useC, b));
+        return _mm_or_si128(_mm_and_si128(notA, bOrC), _mm_andnot_si128(notA, a));
+    }
+#endif
+
+    /// <summary>
+    /// Filters a whole row of size bytes. prior is the raw row above,
+    /// all zero for the first row
+    /// </summary>
+    inline void FilterRow(FilterType type, const uint8_t* row, const uint8_t* prior, uint8_t* out, uint32_t size)
+    {
+        if (type == FILTER_NONE)
+        {
+            std::memcpy(out, row, size);
+            return;
+        }
+
+        // The first pixel has nothing to its left
+        uint32_t head = (std::min)(BYTES_PER_PIXEL, size);
+        FilterBytesScalar(type, row, prior, out, 0, head);
+        uint32_t i = head;
+
+#ifdef IMAGE_ENCODE_USE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+            __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - BYTES_PER_PIXEL));
+            __m128i up = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+
+            __m128i prediction;
+            switch (type)
+            {
+            case FILTER_SUB:
+                prediction = left;
+                break;
+            case FILTER_UP:
+                prediction = up;
+                break;
+            case FILTER_AVERAGE:
+                // avg_epu8 rounds up, PNG rounds down
+                prediction = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+                break;
+            default:
+            {
+                __m128i upLeft = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i - BYTES_PER_PIXEL));
+                __m128i low = Paeth8(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(up, zero), _mm_unpacklo_epi8(upLeft, zero));
+                __m128i high = Paeth8(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(up, zero), _mm_unpackhi_epi8(upLeft, zero));
+                prediction = _mm_packus_epi16(low, high);
+                break;
+            }
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi8(raw, prediction));
+        }
+#endif
+
+        FilterBytesScalar(type, row, prior, out, i, size);
+    }
+
+    /// <summary>
+    /// Sum of the filtered bytes read as signed values. The filter
+    /// with the smallest sum tends to compress best
+    /// </summary>
+    inline uint64_t FilterCost(const uint8_t* filtered, uint32_t size)
+    {
+        uint64_t cost = 0;
+        uint32_t i = 0;
+
+#ifdef IMAGE_ENCODE_USE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sums = zero;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(filtered + i));
+            __m128i magnitude = _mm_min_epu8(bytes, _mm_sub_epi8(zero, bytes));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(magnitude, zero));
+        }
+
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+        cost = lanes[0] + lanes[1];
+#endif
+
+        for (; i < size; i++)
+        {
+            cost += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+        }
+        return cost;
+    }
+
+    #pragma endregion
+
+    #pragma region Deflate
+
+    /// <summary>
+    /// Writes bits least significant first, as deflate expects
+    /// </summary>
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+        void Write(uint32_t value, uint32_t length)
+        {
+            bits |= static_cast<uint64_t>(value) << count;
+            count += length;
+            while (count >= 8)
+            {
+                out.push_back(static_cast<uint8_t>(bits));
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+
+        void AlignToByte()
+        {
+            if (count > 0)
+            {
+                Write(0, 8 - count);
+            }
+        }
+
+    private:
+        std::vector<uint8_t>& out;
+        uint64_t bits = 0;
+        uint32_t count = 0;
+    };
+
+    /// <summary>
+    /// The fixed Huffman codes from RFC 1951, already bit reversed so
+    /// they can go straight into a BitWriter
+    /// </summary>
+    struct FixedCodes
+    {
+        uint16_t literalCode[288];
+        uint8_t literalLength[288];
+        uint16_t distanceCode[30];
+
+        static uint32_t Reverse(uint32_t code, uint32_t length)
+        {
+            uint32_t reversed = 0;
+            for (uint32_t i = 0; i < length; i++)
+            {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            return reversed;
+        }
+
+        FixedCodes()
+        {
+            for (uint32_t symbol = 0; symbol < 288; symbol++)
+            {
+                uint32_t code, length;
+                if (symbol < 144)      { code = 0x30 + symbol;           length = 8; }
+                else if (symbol < 256) { code = 0x190 + (symbol - 144);  length = 9; }
+                else if (symbol < 280) { code = symbol - 256;            length = 7; }
+                else                   { code = 0xC0 + (symbol - 280);   length = 8; }
+
+                literalCode[symbol] = static_cast<uint16_t>(Reverse(code, length));
+                literalLength[symbol] = static_cast<uint8_t>(length);
+            }
+
+            for (uint32_t symbol = 0; symbol < 30; symbol++)
+            {
+                distanceCode[symbol] = static_cast<uint16_t>(Reverse(symbol, 5));
+            }
+        }
+
+        static const FixedCodes& Get()
+        {
+            static const FixedCodes codes;
+            return codes;
+        }
+    };
+
+    /// <summary>
+    /// Index of the highest set bit, value must not be zero
+    /// </summary>
+    inline uint32_t HighestBit(uint32_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return 31 - static_cast<uint32_t>(__builtin_clz(value));
+#endif
+    }
+
+    /// <summary>
+    /// Compresses data as one fixed Huffman block followed by an empty
+    /// stored block, so the output ends on a byte boundary and the
+    /// next strip can simply be appended. Matches never reach outside
+    /// of data
+    /// </summary>
+    inline void DeflateStrip(const uint8_t* data, uint32_t size, std::vector<uint8_t>& out)
+    {
+        const uint32_t WINDOW_SIZE = 32768;
+        const uint32_t HASH_BITS = 15;
+        const uint32_t MAX_CHAIN = 16;
+        const uint32_t MIN_MATCH = 4;
+        const uint32_t MAX_MATCH = 258;
+
+        const FixedCodes& codes = FixedCodes::Get();
+        BitWriter writer(out);
+
+        // Not final, fixed Huffman
+        writer.Write(0, 1);
+        writer.Write(1, 2);
+
+        auto hash = [&](uint32_t position)
+        {
+            uint32_t value;
+            std::memcpy(&value, data + position, sizeof(value));
+            return (value * 2654435761u) >> (32 - HASH_BITS);
+        };
+
+        // Chains of earlier positions with the same hash
+        std::vector<int32_t> head(1u << HASH_BITS, -1);
+        std::vector<int32_t> previous(WINDOW_SIZE, -1);
+
+        auto insert = [&](uint32_t position)
+        {
+            uint32_t h = hash(position);
+            previous[position & (WINDOW_SIZE - 1)] = head[h];
+            head[h] = static_cast<int32_t>(position);
+        };
+
+        auto writeLiteral = [&](uint32_t symbol)
+        {
+            writer.Write(codes.literalCode[symbol], codes.literalLength[symbol]);
+        };
+
+        uint32_t position = 0;
+        while (position < size)
+        {
+            uint32_t bestLength = 0;
+            uint32_t bestDistance = 0;
+
+            if (position + MIN_MATCH <= size)
+            {
+                uint32_t limit = (std::min)(MAX_MATCH, size - position);
+                int32_t candidate = head[hash(position)];
+
+                for (uint32_t chain = 0; chain < MAX_CHAIN && candidate >= 0; chain++)
+                {
+                    uint32_t distance = position - static_cast<uint32_t>(candidate);
+                    if (distance > WINDOW_SIZE)
+                    {
+                        break;
+                    }
+
+                    const uint8_t* a = data + candidate;
+                    const uint8_t* b = data + position;
+                    if (a[bestLength] == b[bestLength])
+                    {
+                        uint32_t length = 0;
+                        while (length < limit && a[length] == b[length])
+                        {
+                            length++;
+                        }
+
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestDistance = distance;
+                            if (length == limit)
+                            {
+                                break;
+                            }
+                        }
+                    }
+
+                    // Older entries of the ring may already be overwritten
+                    int32_t next = previous[candidate & (WINDOW_SIZE - 1)];
+                    if (next >= candidate)
+                    {
+                        break;
+                    }
+                    candidate = next;
+                }
+
+                insert(position);
+            }
+
+            if (bestLength < MIN_MATCH)
+            {
+                writeLiteral(data[position]);
+                position++;
+                continue;
+            }
+
+            // Length symbols 257-284 cover 3-257 with extra bits, 285 is exactly 258
+            uint32_t lengthValue = bestLength - 3;
+            if (bestLength == MAX_MATCH)
+            {
+                writeLiteral(285);
+            }
+            else if (lengthValue < 8)
+            {
+                writeLiteral(257 + lengthValue);
+            }
+            else
+            {
+                uint32_t bits = HighestBit(lengthValue);
+                uint32_t extraBits = bits - 2;
+                uint32_t code = 4 * (bits - 1) + ((lengthValue >> extraBits) & 3);
+                writeLiteral(257 + code);
+                writer.Write(lengthValue - ((4 + (code & 3)) << extraBits), extraBits);
+            }
+
+            // Distance codes 0-3 are exact, every further pair doubles the range
+            uint32_t distanceValue = bestDistance - 1;
+            if (distanceValue < 4)
+            {
+                writer.Write(codes.distanceCode[distanceValue], 5);
+            }
+            else
+            {
+                uint32_t bits = HighestBit(distanceValue);
+                uint32_t extraBits = bits - 1;
+                uint32_t code = 2 * bits + ((distanceValue >> extraBits) & 1);
+                writer.Write(codes.distanceCode[code], 5);
+                writer.Write(distanceValue - ((2 + (code & 1)) << extraBits), extraBits);
+            }
+
+            // Positions inside the match can still start later matches
+            uint32_t end = position + bestLength;
+            for (position++; position < end; position++)
+            {
+                if (position + MIN_MATCH <= size)
+                {
+                    insert(position);
+                }
+            }
+        }
+
+        // End of block, then an empty stored block to get byte aligned
+        writeLiteral(256);
+        writer.Write(0, 1);
+        writer.Write(0, 2);
+        writer.AlignToByte();
+        out.insert(out.end(), { 0x00, 0x00, 0xFF, 0xFF });
+    }
+
+    const uint32_t ADLER_MODULUS = 65521;
+
+    inline uint32_t Adler32(const uint8_t* data, size_t size)
+    {
+        uint32_t a = 1;
+        uint32_t b = 0;
+
+        // 5552 bytes is the most that can be summed before b overflows
+        while (size > 0)
+        {
+            size_t block = (std::min)(size, static_cast<size_t>(5552));
+            for (size_t i = 0; i < block; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+
+            a %= ADLER_MODULUS;
+            b %= ADLER_MODULUS;
+            data += block;
+            size -= block;
+        }
+
+        return (b << 16) | a;
+    }
+
+    /// <summary>
+    /// Adler-32 of two pieces of data back to back, given both of
+    /// their checksums and the size of the second
+    /// </summary>
+    inline uint32_t Adler32Combine(uint32_t first, uint32_t second, size_t secondSize)
+    {
+        uint32_t remainder = static_cast<uint32_t>(secondSize % ADLER_MODULUS);
+        uint32_t a = first & 0xFFFF;
+        uint32_t b = static_cast<uint32_t>((static_cast<uint64_t>(remainder) * a) % ADLER_MODULUS);
+
+        a += (second & 0xFFFF) + ADLER_MODULUS - 1;
+        b += (first >> 16) + (second >> 16) + ADLER_MODULUS - remainder;
+
+        if (a >= ADLER_MODULUS) a -= ADLER_MODULUS;
+        if (a >= ADLER_MODULUS) a -= ADLER_MODULUS;
+        if (b >= ADLER_MODULUS * 2) b -= ADLER_MODULUS * 2;
+        if (b >= ADLER_MODULUS) b -= ADLER_MODULUS;
+
+        return (b << 16) | a;
+    }
+
+    inline uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+    {
+        static const std::array<uint32_t, 256> table = []()
+        {
+            std::array<uint32_t, 256> result{};
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+                }
+                result[i] = value;
+            }
+            return result;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    #pragma endregion
+
+    #pragma region PNG
+
+    /// <summary>
+    /// Appends a PNG chunk: length, type, data and the CRC of type and data
+    /// </summary>
+    inline void WritePngChunk(std::vector<uint8_t>& out, const char type[4], const uint8_t* data, size_t size)
+    {
+        WriteBigEndian(out, static_cast<uint32_t>(size));
+        size_t typeOffset = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        WriteBigEndian(out, Crc32(out.data() + typeOffset, size + 4));
+    }
+
+    /// <summary>
+    /// Encodes the image as an 8 bit RGBA PNG
+    /// </summary>
+    inline std::vector<uint8_t> EncodePng(JobSystem& jobSystem, const SourceImage& image)
+    {
+        uint32_t rowSize = image.width * BYTES_PER_PIXEL;
+        uint32_t stripCount = (image.height + STRIP_ROWS - 1) / STRIP_ROWS;
+
+        struct Strip
+        {
+            std::vector<uint8_t> chunk; // Whole IDAT chunk
+            uint32_t adler;
+            size_t filteredSize;
+        };
+        std::vector<Strip> strips(stripCount);
+
+        jobSystem.ParallelFor(stripCount, 1, [&](uint32_t begin, uint32_t end)
+        {
+            std::vector<uint8_t> prior(rowSize), row(rowSize);
+            std::vector<uint8_t> candidates[FILTER_COUNT];
+            for (auto& candidate : candidates)
+            {
+                candidate.resize(rowSize);
+            }
+
+            for (uint32_t s = begin; s < end; s++)
+            {
+                uint32_t firstRow = s * STRIP_ROWS;
+                uint32_t lastRow = (std::min)(firstRow + STRIP_ROWS, image.height);
+
+                // Filtering still looks at the row above the strip
+                if (firstRow > 0)
+                {
+                    LoadRow(image, firstRow - 1, prior.data());
+                }
+                else
+                {
+                    std::fill(prior.begin(), prior.end(), 0);
+                }
+
+                // Every row starts with the filter it uses
+                std::vector<uint8_t> filtered;
+                filtered.reserve(static_cast<size_t>(rowSize + 1) * (lastRow - firstRow));
+
+                for (uint32_t y = firstRow; y < lastRow; y++)
+                {
+                    LoadRow(image, y, row.data());
+
+                    uint32_t bestType = FILTER_NONE;
+                    uint64_t bestCost = UINT64_MAX;
+                    for (uint32_t type = 0; type < FILTER_COUNT; type++)
+                    {
+                        FilterRow(static_cast<FilterType>(type), row.data(), prior.data(), candidates[type].data(), rowSize);
+                        uint64_t cost = FilterCost(candidates[type].data(), rowSize);
+                        if (cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestType = type;
+                        }
+                    }
+
+                    filtered.push_back(static_cast<uint8_t>(bestType));
+                    filtered.insert(filtered.end(), candidates[bestType].begin(), candidates[bestType].end());
+                    std::swap(row, prior);
+                }
+
+                std::vector<uint8_t> compressed;
+                DeflateStrip(filtered.data(), static_cast<uint32_t>(filtered.size()), compressed);
+
+                strips[s].adler = Adler32(filtered.data(), filtered.size());
+                strips[s].filteredSize = filtered.size();
+                WritePngChunk(strips[s].chunk, "IDAT", compressed.data(), compressed.size());
+            }
+        });
+
+        std::vector<uint8_t> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+        std::vector<uint8_t> header;
+        WriteBigEndian(header, image.width);
+        WriteBigEndian(header, image.height);
+        header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bit RGBA, deflate, adaptive filters, not interlaced
+        WritePngChunk(out, "IHDR", header.data(), header.size());
+
+        // zlib header: deflate with a 32K window, no preset dictionary
+        const uint8_t zlibHeader[] = { 0x78, 0x01 };
+        WritePngChunk(out, "IDAT", zlibHeader, sizeof(zlibHeader));
+
+        uint32_t adler = 1;
+        for (const auto& strip : strips)
+        {
+            out.insert(out.end(), strip.chunk.begin(), strip.chunk.end());
+            adler = Adler32Combine(adler, strip.adler, strip.filteredSize);
+        }
+
+        // An empty final fixed block, then the checksum of everything
+        std::vector<uint8_t> trailer = { 0x03, 0x00 };
+        WriteBigEndian(trailer, adler);
+        WritePngChunk(out, "IDAT", trailer.data(), trailer.size());
+
+        WritePngChunk(out, "IEND", nullptr, 0);
+        return out;
+    }
+
+    #pragma endregion
+
+    #pragma region QOI
+
+    /// <summary>
+    /// Encodes rows [firstRow, lastRow). previous is the pixel just
+    /// before the strip, which the decoder will also have seen last
+    /// </summary>
+    inline void EncodeQoiStrip(const SourceImage& image, uint32_t firstRow, uint32_t lastRow, uint32_t previous, std::vector<uint8_t>& out)
+    {
+        const uint8_t OP_INDEX = 0x00;
+        const uint8_t OP_DIFF = 0x40;
+        const uint8_t OP_LUMA = 0x80;
+        const uint8_t OP_RUN = 0xC0;
+        const uint8_t OP_RGB = 0xFE;
+
+        // Only entries this strip wrote match the decoder's index
+        uint32_t index[64];
+        uint64_t indexValid = 0;
+        uint32_t run = 0;
+
+        std::vector<uint8_t> row(static_cast<size_t>(image.width) * BYTES_PER_PIXEL);
+
+        for (uint32_t y = firstRow; y < lastRow; y++)
+        {
+            LoadRow(image, y, row.data());
+
+            for (uint32_t x = 0; x < image.width; x++)
+            {
+                uint32_t pixel;
+                std::memcpy(&pixel, row.data() + x * BYTES_PER_PIXEL, sizeof(pixel));
+
+                if (pixel == previous)
+                {
+                    run++;
+                    if (run == 62)
+                    {
+                        out.push_back(static_cast<uint8_t>(OP_RUN | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if (run > 0)
+                {
+                    out.push_back(static_cast<uint8_t>(OP_RUN | (run - 1)));
+                    run = 0;
+                }
+
+                const uint8_t* rgba = row.data() + x * BYTES_PER_PIXEL;
+                uint32_t slot = (rgba[0] * 3 + rgba[1] * 5 + rgba[2] * 7 + rgba[3] * 11) % 64;
+
+                if ((indexValid >> slot & 1) && index[slot] == pixel)
+                {
+                    out.push_back(static_cast<uint8_t>(OP_INDEX | slot));
+                }
+                else
+                {
+                    index[slot] = pixel;
+                    indexValid |= 1ull << slot;
+
+                    uint8_t before[4];
+                    std::memcpy(before, &previous, sizeof(before));
+                    int8_t dr = static_cast<int8_t>(rgba[0] - before[0]);
+                    int8_t dg = static_cast<int8_t>(rgba[1] - before[1]);
+                    int8_t db = static_cast<int8_t>(rgba[2] - before[2]);
+                    int8_t drdg = static_cast<int8_t>(dr - dg);
+                    int8_t dbdg = static_cast<int8_t>(db - dg);
+
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    {
+                        out.push_back(static_cast<uint8_t>(OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    }
+                    else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 && dbdg >= -8 && dbdg <= 7)
+                    {
+                        out.push_back(static_cast<uint8_t>(OP_LUMA | (dg + 32)));
+                        out.push_back(static_cast<uint8_t>((drdg + 8) << 4 | (dbdg + 8)));
+                    }
+                    else
+                    {
+                        out.insert(out.end(), { OP_RGB, rgba[0], rgba[1], rgba[2] });
+                    }
+                }
+
+                previous = pixel;
+            }
+        }
+
+        // Runs never cross into the next strip
+        if (run > 0)
+        {
+            out.push_back(static_cast<uint8_t>(OP_RUN | (run - 1)));
+        }
+    }
+
+    /// <summary>
+    /// Encodes the image as a 4 channel sRGB QOI
+    /// </summary>
+    inline std::vector<uint8_t> EncodeQoi(JobSystem& jobSystem, const SourceImage& image)
+    {
+        uint32_t stripCount = (image.height + STRIP_ROWS - 1) / STRIP_ROWS;
+        std::vector<std::vector<uint8_t>> strips(stripCount);
+
+        jobSystem.ParallelFor(stripCount, 1, [&](uint32_t begin, uint32_t end)
+        {
+            std::vector<uint8_t> row(static_cast<size_t>(image.width) * BYTES_PER_PIXEL);
+
+            for (uint32_t s = begin; s < end; s++)
+            {
+                uint32_t firstRow = s * STRIP_ROWS;
+                uint32_t lastRow = (std::min)(firstRow + STRIP_ROWS, image.height);
+
+                // Decoders start out with opaque black
+                uint32_t previous;
+                const uint8_t start[4] = { 0, 0, 0, 0xFF };
+                std::memcpy(&previous, start, sizeof(previous));
+                if (firstRow > 0)
+                {
+                    LoadRow(image, firstRow - 1, row.data());
+                    std::memcpy(&previous, row.data() + (image.width - 1) * BYTES_PER_PIXEL, sizeof(previous));
+                }
+
+                strips[s].reserve(static_cast<size_t>(image.width) * (lastRow - firstRow) * 2);
+                EncodeQoiStrip(image, firstRow, lastRow, previous, strips[s]);
+            }
+        });
+
+        std::vector<uint8_t> out = { 'q', 'o', 'i', 'f' };
+        WriteBigEndian(out, image.width);
+        WriteBigEndian(out, image.height);
+        out.push_back(4); // RGBA
+        out.push_back(0); // sRGB with linear alpha
+
+        for (const auto& strip : strips)
+        {
+            out.insert(out.end(), strip.begin(), strip.end());
+        }
+
+        out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+        return out;
+    }
+
+    #pragma endregion
+
+    inline std::vector<uint8_t> Encode(JobSystem& jobSystem, const SourceImage& image, Format format)
+    {
+        return format == Format::Png ? EncodePng(jobSystem, image) : EncodeQoi(jobSystem, image);
+    }
+
+    inline const char* FileExtension(Format format)
+    {
+        return format == Format::Png ? ".png" : ".qoi";
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+/// <summary>
+/// A small pool of worker threads. Work is either fired off with
+/// Submit or split across every thread (including the caller)
+/// with ParallelFor
+/// </summary>
+class JobSystem
+{
+public:
+    /// <summary>
+    /// Starts the workers. Zero picks one less than the hardware
+    /// thread count since the calling thread helps out too
+    /// </summary>
+    explicit JobSystem(uint32_t threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            uint32_t hardwareThreads = std::thread::hardware_concurrency();
+            threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    uint32_t ThreadCount() const
+    {
+        return static_cast<uint32_t>(workers.size());
+    }
+
+    /// <summary>
+    /// Queues a job to run on a worker at some point. Nothing
+    /// waits on it so the job must own everything it touches
+    /// </summary>
+    void Submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    /// <summary>
+    /// Calls func(begin, end) over [0, count) in batches of batchSize
+    /// and returns once every batch has run
+    /// </summary>
+    template<typename Func>
+    void ParallelFor(uint32_t count, uint32_t batchSize, Func&& func)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        batchSize = (std::max)(batchSize, 1u);
+        uint32_t batchCount = (count + batchSize - 1) / batchSize;
+
+        // Not worth waking anyone up for a single batch
+        if (batchCount == 1 || workers.empty())
+        {
+            func(0u, count);
+            return;
+        }
+
+        // Note: Shared so that helpers which only start after all of
+        //       the batches are done can still safely look at it
+        struct ForState
+        {
+            std::atomic<uint32_t> nextBatch{ 0 };
+            std::atomic<uint32_t> finishedBatches{ 0 };
+            std::mutex doneMutex;
+            std::condition_variable done;
+        };
+        auto state = std::make_shared<ForState>();
+
+        auto runBatches = [state, count, batchSize, batchCount, &func]()
+        {
+            uint32_t batch;
+            while ((batch = state->nextBatch.fetch_add(1)) < batchCount)
+            {
+                uint32_t begin = batch * batchSize;
+                uint32_t end = (std::min)(begin + batchSize, count);
+                func(begin, end);
+
+                if (state->finishedBatches.fetch_add(1) + 1 == batchCount)
+                {
+                    std::lock_guard<std::mutex> lock(state->doneMutex);
+                    state->done.notify_all();
+                }
+            }
+        };
+
+        // Helpers never outlive this call doing real work since the
+        // caller waits on every batch, so referencing func is safe
+        uint32_t helperCount = (std::min)(ThreadCount(), batchCount - 1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t i = 0; i < helperCount; i++)
+            {
+                jobs.push_back(runBatches);
+            }
+        }
+        wake.notify_all();
+
+        runBatches();
+
+        std::unique_lock<std::mutex> lock(state->doneMutex);
+        state->done.wait(lock, [&] { return state->finishedBatches.load() == batchCount; });
+    }
+
+private:
+    void WorkerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+                if (stopping && jobs.empty())
+                {
+                    return;
+                }
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
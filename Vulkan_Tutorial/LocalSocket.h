@@ -0,0 +1,426 @@
+#pragma once
+
+// Note: Unix domain sockets exist on Windows 10 and up as well, so the
+//       same code talks to other processes on both. Winsock has to be
+//       included before anything else pulls in windows.h
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <afunix.h>
+    #pragma comment(lib, "Ws2_32.lib")
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// A stream socket bound to a path on the local machine. Owns the
+/// underlying socket and closes it when destroyed
+/// </summary>
+class LocalSocket
+{
+public:
+#ifdef _WIN32
+    typedef SOCKET Handle;
+    static constexpr Handle INVALID = INVALID_SOCKET;
+#else
+    typedef int Handle;
+    static constexpr Handle INVALID = -1;
+#endif
+
+    LocalSocket() = default;
+
+    ~LocalSocket()
+    {
+        Close();
+    }
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    LocalSocket(LocalSocket&& other) noexcept : handle(other.handle)
+    {
+        other.handle = INVALID;
+    }
+
+    LocalSocket& operator=(LocalSocket&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            handle = other.handle;
+            other.handle = INVALID;
+        }
+        return *this;
+    }
+
+    bool IsOpen() const
+    {
+        return handle != INVALID;
+    }
+
+    /// <summary>
+    /// Creates a socket that waits for connections on path. Any
+    /// file left behind by a previous run is removed first
+    /// </summary>
+    static LocalSocket Listen(const std::string& path, int backlog = 16)
+    {
+        LocalSocket socket = Create();
+        sockaddr_un address = MakeAddress(path);
+
+#ifdef _WIN32
+        DeleteFileA(path.c_str());
+#else
+        unlink(path.c_str());
+#endif
+
+        if (bind(socket.handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(socket.handle, backlog) != 0)
+        {
+            throw std::runtime_error("Failed to listen on " + path + "!");
+        }
+
+        return socket;
+    }
+
+    /// <summary>
+    /// Connects to a socket that is listening on path
+    /// </summary>
+    static LocalSocket Connect(const std::string& path)
+    {
+        LocalSocket socket = Create();
+        sockaddr_un address = MakeAddress(path);
+
+        if (connect(socket.handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            throw std::runtime_error("Failed to connect to " + path + "!");
+        }
+
+        return socket;
+    }
+
+    /// <summary>
+    /// Takes the next pending connection. Only call once
+    /// WaitReadable says there is one unless blocking is fine
+    /// </summary>
+    LocalSocket Accept()
+    {
+        LocalSocket client;
+        client.handle = accept(handle, nullptr, nullptr);
+        return client;
+    }
+
+    /// <summary>
+    /// Waits up to timeoutMs for data or a connection. Zero just
+    /// polls and a negative timeout waits forever
+    /// </summary>
+    bool WaitReadable(int timeoutMs) const
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(handle, &readSet);
+
+        timeval timeout{};
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+        int result = select(static_cast<int>(handle) + 1, &readSet, nullptr, nullptr, timeoutMs < 0 ? nullptr : &timeout);
+        return result > 0;
+    }
+
+    /// <summary>
+    /// Waits up to timeoutMs until any of the sockets has data or a
+    /// connection, like WaitReadable on all of them at once
+    /// </summary>
+    static bool WaitAnyReadable(const std::vector<const LocalSocket*>& sockets, int timeoutMs)
+    {
+        return WaitAny(sockets, {}, timeoutMs);
+    }
+
+    /// <summary>
+    /// Waits up to timeoutMs until any of the readable sockets has data
+    /// or a connection, or any of the writable ones can take more
+    /// </summary>
+    static bool WaitAny(const std::vector<const LocalSocket*>& readable, const std::vector<const LocalSocket*>& writable, int timeoutMs)
+    {
+        fd_set readSet;
+        fd_set writeSet;
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+
+        // Note: The first argument of select is ignored on Windows 
+        Handle highest = 0;
+        auto add = [&highest](const std::vector<const LocalSocket*>& sockets, fd_set& set)
+        {
+            for (const LocalSocket* socket : sockets)
+            {
+                if (socket->handle != INVALID)
+                {
+                    FD_SET(socket->handle, &set);
+                    highest = socket->handle > highest ? socket->handle : highest;
+                }
+            }
+        };
+        add(readable, readSet);
+        add(writable, writeSet);
+
+        timeval timeout{};
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+        int result = select(static_cast<int>(highest) + 1, &readSet, &writeSet, nullptr, timeoutMs < 0 ? nullptr : &timeout);
+        return result > 0;
+    }
+
+    /// <summary>
+    /// Makes every call on the socket return instead of waiting. Only
+    /// ReceiveSome and SendSome make sense on it afterwards
+    /// </summary>
+    bool SetNonBlocking()
+    {
+#ifdef _WIN32
+        u_long enabled = 1;
+        return ioctlsocket(handle, FIONBIO, &enabled) == 0;
+#else
+        int flags = fcntl(handle, F_GETFL, 0);
+        return flags >= 0 && fcntl(handle, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+    }
+
+    /// <summary>
+    /// Appends whatever has arrived on a non-blocking socket to
+    /// buffer. False if the other side went away
+    /// </summary>
+    bool ReceiveSome(std::vector<uint8_t>& buffer)
+    {
+        char chunk[4096];
+        while (true)
+        {
+            auto received = recv(handle, chunk, static_cast<int>(sizeof(chunk)), 0);
+            if (received > 0)
+            {
+                buffer.insert(buffer.end(), chunk, chunk + received);
+                continue;
+            }
+            return received < 0 && WouldBlock();
+        }
+    }
+
+    /// <summary>
+    /// Sends as much of size bytes as a non-blocking socket takes right
+    /// now and adds it to sent. False if the other side went away
+    /// </summary>
+    bool SendSome(const void* data, size_t size, size_t& sent)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            auto written = send(handle, bytes, static_cast<int>(size), SEND_FLAGS);
+            if (written <= 0)
+            {
+                return written < 0 && WouldBlock();
+            }
+
+            bytes += written;
+            size -= static_cast<size_t>(written);
+            sent += static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Sends all of size bytes. False if the other side went away
+    /// </summary>
+    bool Send(const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            auto sent = send(handle, bytes, static_cast<int>(size), SEND_FLAGS);
+            if (sent <= 0)
+            {
+                return false;
+            }
+
+            bytes += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Receives exactly size bytes. False if the other side went away
+    /// </summary>
+    bool Receive(void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0)
+        {
+            auto received = recv(handle, bytes, static_cast<int>(size), 0);
+            if (received <= 0)
+            {
+                return false;
+            }
+
+            bytes += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool Send(const T& value)
+    {
+        return Send(&value, sizeof(T));
+    }
+
+    template<typename T>
+    bool Receive(T& value)
+    {
+        return Receive(&value, sizeof(T));
+    }
+
+#ifndef _WIN32
+    /// <summary>
+    /// Sends data along with copies of file descriptors. The
+    /// receiver ends up with its own descriptors for the same files
+    /// </summary>
+    bool SendWithFds(const void* data, size_t size, const std::vector<int>& fds)
+    {
+        iovec io{};
+        io.iov_base = const_cast<void*>(data);
+        io.iov_len = size;
+
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+
+        msghdr message{};
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+
+        return sendmsg(handle, &message, SEND_FLAGS) == static_cast<ssize_t>(size);
+    }
+
+    /// <summary>
+    /// Receives data sent with SendWithFds. fds is resized to
+    /// however many descriptors actually arrived
+    /// </summary>
+    bool ReceiveWithFds(void* data, size_t size, std::vector<int>& fds, size_t maxFds)
+    {
+        iovec io{};
+        io.iov_base = data;
+        io.iov_len = size;
+
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * maxFds));
+
+        msghdr message{};
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        if (recvmsg(handle, &message, MSG_WAITALL) != static_cast<ssize_t>(size))
+        {
+            return false;
+        }
+
+        fds.clear();
+        for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+            {
+                size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const int* received = reinterpret_cast<const int*>(CMSG_DATA(header));
+                fds.insert(fds.end(), received, received + count);
+            }
+        }
+        return true;
+    }
+#endif
+
+    void Close()
+    {
+        if (handle != INVALID)
+        {
+#ifdef _WIN32
+            closesocket(handle);
+#else
+            close(handle);
+#endif
+            handle = INVALID;
+        }
+    }
+
+private:
+#ifdef MSG_NOSIGNAL
+    // A closed peer should be an error we handle, not a signal
+    static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    static constexpr int SEND_FLAGS = 0;
+#endif
+
+    static bool WouldBlock()
+    {
+#ifdef _WIN32
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+    }
+
+    static LocalSocket Create()
+    {
+#ifdef _WIN32
+        // Winsock has to be started once per process before use
+        static bool started = []()
+        {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+
+        if (!started)
+        {
+            throw std::runtime_error("Failed to start winsock!");
+        }
+#endif
+
+        LocalSocket socket;
+        socket.handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket.handle == INVALID)
+        {
+            throw std::runtime_error("Failed to create local socket!");
+        }
+        return socket;
+    }
+
+    static sockaddr_un MakeAddress(const std::string& path)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error("Socket path is too long: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    Handle handle = INVALID;
+};
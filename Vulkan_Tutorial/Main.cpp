@@ -3,6 +3,8 @@
 //#include <GLFW/glfw3.h>
 
 #define VK_USE_PLATFORM_WIN32_KHR
+// Note: Pulls in winsock which has to come before windows.h 
+#include "LocalSocket.h"
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #define GLFW_EXPOSE_NATIVE_WIN32
@@ -21,15 +23,250 @@
 
 #include <optional>
 #include <array>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <map>
+#include <thread>
 
 #include <fstream>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <cctype>
+#include <cmath>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Animation.h"
+#include "JobSystem.h"
+#include "FrameExport.h"
+#include "FrameConsumer.h"
+#include "Capture.h"
+#include "RenderService.h"
+#include "RenderClient.h"
+#include "Damage.h"
+#include "Environment.h"
+#include "Terrain.h"
+#include "Foliage.h"
+#include "Primitives.h"
+#include "MappedFile.h"
 
 
 class HelloTriangleApplication {
 public:
-    void Run() {
+    /// <summary>
+    /// Settings picked on the command line 
+    /// </summary>
+    struct Options
+    {
+        // How many windows to open. All of them are drawn by
+        // a single submission and shown by a single present 
+        uint32_t windowCount = 1;
+
+        // How many views to render in one multiview pass. Above one
+        // every view becomes a layer of an image array which is then
+        // laid out side by side in each window 
+        uint32_t viewCount = 1;
+
+        // When set, every frame is also rendered into images that are
+        // shared with a consumer process connecting to this socket 
+        std::string exportPath;
+
+        // Records every frame as Y4M, either into a file or into the
+        // stdin of an encoder command. Only one of them is used 
+        std::string recordPath;
+        std::string recordCommand;
+
+        // When set, F12 saves the next frame into this directory 
+        std::string screenshotDirectory;
+        ImageEncode::Format screenshotFormat = ImageEncode::Format::Png;
+
+        // When set, no window is shown. Instead render jobs from
+        // clients connecting to this socket are served in batches 
+        std::string servePath;
+
+        // Only draw when something changed, but at least every
+        // minimumRefresh seconds. Zero keeps drawing every frame 
+        bool renderOnDemand = false;
+        float minimumRefresh = 1.0f;
+
+        // Only repaint the parts of each window that changed since
+        // the acquired image was last drawn 
+        bool damageTracking = false;
+
+        // Lights moving over the crowd. Zero keeps the scene unlit,
+        // otherwise it is shaded forward or deferred (G switches) 
+        uint32_t lightCount = 0;
+        bool deferredShading = false;
+
+        // Ambient occlusion for deferred shading, computed with one AO
+        // texel per 1, 2 or 4 pixels along each axis. O toggles it 
+        bool ambientOcclusion = false;
+        uint32_t ambientOcclusionScale = 2;
+
+        // Comma separated post effects of the deferred path, "all"
+        // for every one. F1 to F5 toggle them 
+        std::string postEffects;
+
+        // Screen space reflections for deferred shading, "low",
+        // "medium" or "high". Empty leaves them off, R steps through
+        // the qualities and off 
+        std::string reflections;
+
+        // Transparent bubbles drawn over the scene with weighted
+        // blended order-independent transparency. Zero draws none 
+        uint32_t transparentCount = 0;
+
+        // Ambient light from an environment, "sky" or an .hdr file,
+        // instead of a flat color. Whatever is derived from it is
+        // cached in iblCacheDirectory. L turns it 
+        std::string environment;
+        std::string iblCacheDirectory = "ibl_cache";
+
+        // A physically based sky behind the scene. K moves the sun,
+        // sunCycle seconds of animation make a full day. Zero keeps it
+        // where it is 
+        bool sky = false;
+        float sunCycle = 0.0f;
+
+        // Volumetric fog lit by the lights. V turns it 
+        bool fog = false;
+
+        // Clipmap terrain under the sky, "procedural" or a square RAW
+        // file of 16 bit heights 
+        std::string terrain;
+
+        // Grass and trees scattered over the terrain on the GPU, from
+        // a "procedural" density map or a square RAW file of grass and
+        // tree bytes 
+        std::string foliage;
+
+        // Benchmarks the compute primitives for 1K items and every
+        // fourfold up to primitivesMax, then quits without drawing 
+        bool primitivesBenchmark = false;
+        uint32_t primitivesMax = 64u << 20;
+
+        // Where per-frame data goes: "auto" writes it straight into VRAM
+        // with resizable BAR or unified memory, "direct" always does
+        // where the device can, "staged" copies it over every frame 
+        std::string dynamicMemory = "auto";
+
+        // Times per-frame data in every placement, then quits 
+        bool memoryBenchmark = false;
+    };
+
+    void Run(const Options& options) {
+        windowCount = (std::max)(options.windowCount, 1u);
+        viewCount = (std::min)((std::max)(options.viewCount, 1u), static_cast<uint32_t>(MAX_VIEWS));
+        multiviewEnabled = viewCount > 1;
+        exportEnabled = !options.exportPath.empty();
+        exportSocketPath = options.exportPath;
+        recordPath = options.recordPath;
+        recordCommand = options.recordCommand;
+        recordEnabled = !recordPath.empty() || !recordCommand.empty();
+        screenshotDirectory = options.screenshotDirectory;
+        screenshotFormat = options.screenshotFormat;
+        screenshotsEnabled = !screenshotDirectory.empty();
+        readbackEnabled = recordEnabled || screenshotsEnabled;
+        serveEnabled = !options.servePath.empty();
+        serveSocketPath = options.servePath;
+        renderOnDemand = options.renderOnDemand;
+        minimumRefresh = options.minimumRefresh;
+        damageTrackingEnabled = options.damageTracking;
+        lightCount = (std::min)(options.lightCount, MAX_LIGHTS);
+        shadingEnabled = lightCount > 0;
+        shadingPath = options.deferredShading ? SHADING_DEFERRED : SHADING_FORWARD;
+        aoEnabled = options.ambientOcclusion;
+        aoScale = options.ambientOcclusionScale;
+        postEffects = ParsePostEffects(options.postEffects);
+        ssrEnabled = !options.reflections.empty();
+        ssrQuality = options.reflections == "low" ? SSR_LOW : options.reflections == "high" ? SSR_HIGH : SSR_MEDIUM;
+        transparentCount = (std::min)(options.transparentCount, MAX_TRANSPARENT_INSTANCES);
+        transparencyEnabled = transparentCount > 0;
+        iblEnabled = !options.environment.empty();
+        environmentPath = options.environment == "sky" ? "" : options.environment;
+        iblCacheDirectory = options.iblCacheDirectory;
+        skyEnabled = options.sky;
+        sunCycle = options.sunCycle;
+        fogEnabled = options.fog;
+        terrainEnabled = !options.terrain.empty();
+        terrainPath = options.terrain == "procedural" ? "" : options.terrain;
+        foliageEnabled = !options.foliage.empty();
+        foliagePath = options.foliage == "procedural" ? "" : options.foliage;
+        primitivesBenchmark = options.primitivesBenchmark;
+        primitivesBenchmarkMax = (std::max)(options.primitivesMax, 1024u);
+        dynamicPlacement = options.dynamicMemory;
+        memoryBenchmark = options.memoryBenchmark;
+
+        if (exportEnabled && multiviewEnabled)
+        {
+            throw std::runtime_error("Frame export does not support multiview!");
+        }
+
+        if (serveEnabled && multiviewEnabled)
+        {
+            throw std::runtime_error("The render service does not support multiview!");
+        }
+
+        if (damageTrackingEnabled && multiviewEnabled)
+        {
+            throw std::runtime_error("Damage tracking does not support multiview!");
+        }
+
+        if (shadingEnabled && (windowCount > 1 || multiviewEnabled || damageTrackingEnabled))
+        {
+            throw std::runtime_error("Lit shading needs a single window without multiview or damage tracking!");
+        }
+
+        if (transparencyEnabled && (windowCount > 1 || multiviewEnabled || damageTrackingEnabled || serveEnabled))
+        {
+            throw std::runtime_error("Transparency needs a single window without multiview, damage tracking or serving!");
+        }
+
+        if (iblEnabled && !shadingEnabled)
+        {
+            throw std::runtime_error("Image based lighting needs lit shading (--lights)!");
+        }
+
+        if (skyEnabled && !shadingEnabled)
+        {
+            throw std::runtime_error("The sky needs lit shading (--lights)!");
+        }
+
+        if (fogEnabled && !shadingEnabled)
+        {
+            throw std::runtime_error("Volumetric fog needs lit shading (--lights)!");
+        }
+
+        if (ssrEnabled && !shadingEnabled)
+        {
+            throw std::runtime_error("Screen space reflections need lit shading (--lights)!");
+        }
+
+        if (terrainEnabled && !shadingEnabled)
+        {
+            throw std::runtime_error("The terrain needs lit shading (--lights)!");
+        }
+
+        if (foliageEnabled && !terrainEnabled)
+        {
+            throw std::runtime_error("Foliage needs the terrain (--terrain)!");
+        }
+
+        if (ssrEnabled && options.reflections != "low" && options.reflections != "medium" && options.reflections != "high")
+        {
+            throw std::runtime_error("Unknown reflection quality \"" + options.reflections + "\", use low, medium or high!");
+        }
+
+        if (dynamicPlacement != "auto" && dynamicPlacement != "direct" && dynamicPlacement != "staged")
+        {
+            throw std::runtime_error("Unknown dynamic memory placement \"" + dynamicPlacement + "\", use auto, direct or staged!");
+        }
+
         InitWindow();
         InitVulkan();
         MainLoop();
@@ -37,7 +274,6 @@ public:
     }
 
 private:
-    GLFWwindow* window;
     VkInstance instance;
 
     const uint32_t WIDTH = 800;
@@ -65,9 +301,6 @@ private:
     VkDevice device; // Logic device 
     VkQueue graphicsQueue; // Implicitly cleaned 
 
-    // Object and usage is platform agnostic, its creation is not 
-    // mandatory since vulkan can operate offline 
-    VkSurfaceKHR surface; 
     VkQueue presentQueue;
 
 
@@ -88,35 +321,1026 @@ private:
         std::vector<VkSurfaceFormatKHR> formats;
         std::vector<VkPresentModeKHR> presentModes; 
     };
-    
 
-    VkSwapchainKHR swapChain;
-    // Views let us access the images 
-    std::vector<VkImageView> swapChainImageViews;
-    std::vector<VkImage> swapChainImages; 
-    VkFormat swapChainImageFormat;
-    VkExtent2D swapChainExtent;
+    /// <summary>
+    /// Everything that belongs to a single window we present to.
+    /// Each window has its own surface and swap chain
+    /// </summary>
+    struct WindowTarget
+    {
+        GLFWwindow* window = nullptr;
+
+        // Object and usage is platform agnostic, its creation is not 
+        // mandatory since vulkan can operate offline 
+        VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+        VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+        // Views let us access the images 
+        std::vector<VkImageView> swapChainImageViews;
+        std::vector<VkImage> swapChainImages; 
+        VkFormat swapChainImageFormat;
+        VkExtent2D swapChainExtent;
+
+        // Have to choose which framebuffer to use for presentation
+        // and then other requirements 
+        std::vector<VkFramebuffer> swapChainFramebuffers; 
+
+        // One per frame in flight, signaled when the acquired
+        // image is ready to be drawn to 
+        std::vector<VkSemaphore> imageAvailableSemaphores;
+
+        // Image acquired for the current frame. Windows that could
+        // not acquire one (minimized, out of date) sit the frame out 
+        uint32_t imageIndex = 0;
+        bool acquired = false;
+        bool frameBufferResized = false;
+
+        // Damage tracking: the damage frame each image was last drawn
+        // at (0 is never) and what was repainted in the acquired one 
+        std::vector<uint64_t> imageDrawnFrames;
+        std::vector<VkRectLayerKHR> presentRects;
+    };
+
+    // The first window is the primary one. They all share the
+    // render pass so their swap chains must agree on a format 
+    uint32_t windowCount = 1;
+    std::vector<WindowTarget> windows;
 
     VkRenderPass renderPass;
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
 
-    // Have to choose which framebuffer to use for presentation
-    // and then other requirements 
-    std::vector<VkFramebuffer> swapChainFramebuffers; 
-
     VkCommandPool commandPool;
     // A buffer for each frame in flight 
     std::vector<VkCommandBuffer> commandBuffers; // Cleaned up automatically 
-    std::vector<VkSemaphore> imageAvailableSemaphores; 
+
+    // A single submission draws every window so a single
+    // semaphore per frame is enough for all of the presents 
     std::vector<VkSemaphore> renderFinishedSemaphores; 
 
     // How many frames can be processed concurrently 
     const int MAX_FRAMES_IN_FLIGHT = 2;
     uint32_t currentFrame = 0; 
 
+    // How long to wait for a window's next swap chain image. A
+    // window whose images are all held by the compositor skips
+    // the frame rather than stalling every other window 
+    const uint64_t ACQUIRE_TIMEOUT_NS = 2000000;
+
     std::vector<VkFence> inFlightFences;
-    bool frameBufferResized = false; 
+
+    // Host image copy. Texture data is written straight from CPU
+    // memory into optimal tiled images, without a staging buffer or
+    // a copy on the GPU. Images opt in with HostUploadUsage 
+    bool hostImageCopySupported = false;
+    std::vector<VkImageLayout> hostCopyDstLayouts;
+
+    // External host memory. Page aligned host memory, like a mapped
+    // file, is imported as device memory and read by the GPU in place 
+    bool externalHostMemorySupported = false;
+    VkDeviceSize minImportedHostPointerAlignment = 0;
+
+    // Memory placement. Per-frame data is written straight into VRAM
+    // where the CPU can map plenty of it, otherwise into host memory
+    // and copied over by RecordDynamicUploads at the start of a frame 
+    enum MemoryUsage
+    {
+        MEMORY_DEVICE,
+        MEMORY_UPLOAD,
+        MEMORY_DYNAMIC
+    };
+
+    // Without resizable BAR the CPU only sees this much of VRAM 
+    static const VkDeviceSize CLASSIC_BAR_SIZE = 256ull << 20;
+    bool unifiedMemory = false;
+    bool largeBarAvailable = false;
+    VkDeviceSize mappableDeviceLocalSize = 0;
+    bool dynamicDirect = false;
+
+    // auto, direct or staged 
+    std::string dynamicPlacement = "auto";
+
+    // Instead of drawing, time every placement of per-frame data 
+    bool memoryBenchmark = false;
+
+    struct DynamicUpload
+    {
+        VkBuffer buffer;
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingMemory;
+        VkDeviceSize size;
+    };
+
+    // The staged dynamic buffers of every frame in flight 
+    std::vector<std::vector<DynamicUpload>> dynamicUploads;
+
+    // Compute primitives. Scan, compaction and radix sort of uint
+    // buffers for any pass that needs them. Every kernel comes in a
+    // few variants, the fastest one on this device is used 
+    enum PrimitiveKernel : uint32_t
+    {
+        PRIMITIVE_SCAN,
+        PRIMITIVE_COMPACT,
+        PRIMITIVE_HISTOGRAM,
+        PRIMITIVE_SORT_KEYS,
+        PRIMITIVE_SORT_PAIRS,
+        PRIMITIVE_KERNEL_COUNT
+    };
+
+    /// <summary>
+    /// One build of every kernel. Subgroup variants ask for a
+    /// subgroup size, or leave it to the device when it is zero 
+    /// </summary>
+    struct PrimitiveVariant
+    {
+        std::string name;
+        bool subgroups = false;
+        uint32_t subgroupSize = 0;
+        std::array<VkPipeline, PRIMITIVE_KERNEL_COUNT> pipelines{};
+    };
+
+    static const uint32_t MAX_PRIMITIVE_BINDINGS = 16;
+    uint32_t primitivesMaxPartitions = 0;
+    VkDescriptorSetLayout primitivesDescriptorSetLayout;
+    VkDescriptorPool primitivesDescriptorPool;
+    VkPipelineLayout primitivesPipelineLayout;
+    std::vector<PrimitiveVariant> primitiveVariants;
+    std::array<uint32_t, PRIMITIVE_KERNEL_COUNT> primitiveChoices{};
+
+    // What the device's subgroups can do, and which sizes a pipeline
+    // may ask for with VK_EXT_subgroup_size_control 
+    VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+    bool subgroupSizeControlSupported = false;
+    bool computeFullSubgroupsSupported = false;
+    uint32_t minSubgroupSize = 0;
+    uint32_t maxSubgroupSize = 0;
+    uint32_t maxComputeWorkgroupSubgroups = 0;
+
+    // Instead of drawing, time the primitives for up to this many
+    // items and check them against the CPU 
+    bool primitivesBenchmark = false;
+    uint32_t primitivesBenchmarkMax = 64u << 20;
+
+    // Compute skinning. The skinned vertex buffer is written by a
+    // compute pass and then bound as the vertex buffer of every
+    // pass that draws the mesh
+    static const uint32_t MAX_BONES = 64;
+    VkBuffer bindPoseBuffer;
+    VkDeviceMemory bindPoseBufferMemory;
+    VkBuffer skinWeightBuffer;
+    VkDeviceMemory skinWeightBufferMemory;
+    VkBuffer skinnedVertexBuffer;
+    VkDeviceMemory skinnedVertexBufferMemory;
+
+    // One palette per frame in flight so we never write over
+    // a palette the GPU may still be reading. Each character
+    // owns JointCount() consecutive matrices
+    std::vector<VkBuffer> bonePaletteBuffers;
+    std::vector<VkDeviceMemory> bonePaletteBuffersMemory;
+    std::vector<void*> bonePaletteBuffersMapped;
+
+    VkDescriptorSetLayout skinningDescriptorSetLayout;
+    VkDescriptorPool skinningDescriptorPool;
+    std::vector<VkDescriptorSet> skinningDescriptorSets;
+    VkPipelineLayout skinningPipelineLayout;
+    VkPipeline skinningPipeline;
+
+    // Bumped every time the animation writes a new pose. If the
+    // skinned vertex buffer already holds that pose we skip the
+    // dispatch entirely
+    uint64_t poseVersion = 0;
+    uint64_t skinnedPoseVersion = 0;
+    bool animationPaused = false;
+
+    /// <summary>
+    /// Per character animation state. The parameters feed the
+    /// blend nodes of the shared blend tree
+    /// </summary>
+    struct CharacterInstance
+    {
+        glm::mat4 root;
+        float timeOffset;
+        float speed;
+        float parameters[1];
+    };
+
+    // Animation runtime. Every character shares the skeleton, clips
+    // and blend tree and only differs by its parameters
+    static const uint32_t CHARACTER_COUNT = 1024;
+    JobSystem jobSystem;
+    Animation::Skeleton skeleton;
+    std::vector<Animation::AnimationClip> animationClips;
+    Animation::BlendTree blendTree;
+    std::vector<CharacterInstance> characters;
+    float animationTime = 0.0f;
+
+    // Multiview. Every view is a layer of one image array, the
+    // geometry is submitted once and the vertex shader picks the
+    // view's matrix with gl_ViewIndex. One target per frame in
+    // flight since the layers are blitted out after the pass 
+    static const uint32_t MAX_VIEWS = 8;
+    uint32_t viewCount = 1;
+    bool multiviewEnabled = false;
+    VkExtent2D viewExtent;
+    std::vector<VkImage> viewImages;
+    std::vector<VkDeviceMemory> viewImagesMemory;
+    std::vector<VkImageView> viewImageViews;
+    std::vector<VkFramebuffer> viewFramebuffers;
+
+    std::vector<VkBuffer> viewBuffers;
+    std::vector<VkDeviceMemory> viewBuffersMemory;
+    std::vector<void*> viewBuffersMapped;
+
+    VkDescriptorSetLayout viewDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool viewDescriptorPool;
+    std::vector<VkDescriptorSet> viewDescriptorSets;
+
+    // Frame export. The scene is also drawn into images whose memory
+    // and semaphores are shared with a consumer process. An image the
+    // consumer still holds is never rendered to, if they are all busy
+    // that frame simply is not exported 
+    static const uint32_t EXPORT_IMAGE_COUNT = 3;
+    bool exportEnabled = false;
+    std::string exportSocketPath;
+    LocalSocket exportListener;
+    LocalSocket exportConsumer;
+
+    // A consumer is accepted first and only set up once its hello has
+    // arrived, one that stays silent is dropped after a while 
+    bool exportConsumerReady = false;
+    std::chrono::steady_clock::time_point exportHelloDeadline;
+    const int EXPORT_HELLO_SECONDS = 5;
+    VkRenderPass exportRenderPass;
+    VkExtent2D exportExtent;
+    uint32_t exportMemoryTypeIndex;
+    VkDeviceSize exportAllocationSize;
+    std::vector<VkImage> exportImages;
+    std::vector<VkDeviceMemory> exportImagesMemory;
+    std::vector<VkImageView> exportImageViews;
+    std::vector<VkFramebuffer> exportFramebuffers;
+    std::vector<VkSemaphore> exportReadySemaphores;
+    std::vector<bool> exportImageBusy;
+    uint32_t exportNextImage = 0;
+    int32_t exportImageIndex = -1; // Image exported this frame, -1 if none 
+    uint64_t exportFrameNumber = 0;
+
+    // Every submission gets a number. Once the fence of a frame has
+    // been waited on, everything up to its number is known finished 
+    uint64_t submissionCount = 0;
+    uint64_t completedSubmission = 0;
+    std::vector<uint64_t> frameSubmissions;
+
+    // Readback. The primary window's image is copied into a ring of
+    // host visible buffers and only handed on once the GPU is known
+    // to be done with it. That adds a few frames of latency but never
+    // stalls a frame. If the ring is full a recorded frame is dropped
+    // and a screenshot simply waits for the next one 
+    enum ReadbackState : uint32_t
+    {
+        READBACK_FREE,
+        READBACK_COPYING,    // Waiting on the GPU
+        READBACK_READING,    // Owned by the recorder and/or screenshot thread
+    };
+
+    enum ReadbackUse : uint32_t
+    {
+        READBACK_RECORD = 1,
+        READBACK_SCREENSHOT = 2,
+    };
+
+    struct ReadbackSlot
+    {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        void* mapped;
+        uint64_t submission;
+        uint32_t uses;
+        std::atomic<uint32_t> readers{ 0 }; // The last one to finish frees the slot 
+        std::atomic<uint32_t> state{ READBACK_FREE };
+    };
+
+    static const uint32_t READBACK_RING_SIZE = 4;
+    bool readbackEnabled = false;
+    VkExtent2D readbackExtent;
+    bool readbackBgra;
+    bool readbackCoherent;
+    std::array<ReadbackSlot, READBACK_RING_SIZE> readbackSlots;
+    std::deque<uint32_t> readbackCopying; // In submission order 
+    int32_t readbackSlotIndex = -1; // Slot copied into this frame, -1 if none 
+
+    static const uint32_t RECORD_FRAMES_PER_SECOND = 60;
+    bool recordEnabled = false;
+    std::string recordPath;
+    std::string recordCommand;
+    uint64_t recordDroppedFrames = 0;
+    std::unique_ptr<Capture::Recorder> recorder;
+
+    bool screenshotsEnabled = false;
+    std::string screenshotDirectory;
+    ImageEncode::Format screenshotFormat;
+    bool screenshotRequested = false;
+    uint32_t screenshotCount = 0;
+    std::unique_ptr<Capture::ScreenshotWriter> screenshotWriter;
+
+    // Render service. Jobs are packed into an atlas, one per frame in
+    // flight, so one batch renders while the previous one is encoded 
+    struct ServeJob
+    {
+        uint32_t client;
+        RenderService::Job job;
+        VkRect2D tile; // Where in the atlas it was rendered 
+    };
+
+    // Note: Client sockets never block the loop. Requests collect in
+    //       received until one is complete, results wait in outgoing
+    //       until the client reads them. A client that lets too much
+    //       pile up is dropped 
+    struct ServeClient
+    {
+        LocalSocket socket;
+        std::vector<uint8_t> received;
+        std::vector<uint8_t> outgoing;
+        size_t outgoingSent = 0;
+    };
+
+    bool serveEnabled = false;
+    bool serveRunning = false;
+    std::string serveSocketPath;
+    LocalSocket serveListener;
+    std::map<uint32_t, ServeClient> serveClients;
+    uint32_t serveNextClient = 0;
+    const size_t SERVE_MAX_OUTGOING = 64ull << 20;
+    const int SERVE_SHUTDOWN_FLUSH_MS = 1000;
+
+    // How long an idle service sleeps on its sockets between polls of
+    // the window. A request wakes it right away 
+    const int SERVE_IDLE_WAIT_MS = 10;
+    std::deque<ServeJob> servePending;
+    std::vector<std::vector<ServeJob>> serveBatches; // Per frame in flight 
+    std::vector<uint32_t> serveBatchHeights; // Atlas rows used by each batch 
+    bool serveBgra;
+    bool serveCoherent;
+    bool servePosed = false;
+    float servePoseTime = 0.0f;
+    uint64_t serveJobCount = 0;
+    uint64_t serveBatchCount = 0;
+    VkRenderPass serveRenderPass;
+    std::vector<VkImage> serveAtlasImages;
+    std::vector<VkDeviceMemory> serveAtlasImagesMemory;
+    std::vector<VkImageView> serveAtlasImageViews;
+    std::vector<VkFramebuffer> serveAtlasFramebuffers;
+    std::vector<VkBuffer> serveReadbackBuffers;
+    std::vector<VkDeviceMemory> serveReadbackBuffersMemory;
+    std::vector<void*> serveReadbackBuffersMapped;
+
+    // Render on demand. Whatever can change the image marks the frame
+    // dirty and the main loop sleeps in glfwWaitEvents until it is 
+    enum DirtyFlags : uint32_t
+    {
+        DIRTY_INPUT = 1 << 0,
+        DIRTY_ANIMATION = 1 << 1,
+        DIRTY_STREAMING = 1 << 2,   // Export, recording or a screenshot need frames 
+        DIRTY_RESIZE = 1 << 3,
+        DIRTY_REFRESH = 1 << 4,     // Minimum refresh ran out or the OS asked 
+        DIRTY_LIGHTING = 1 << 5,    // The environment, sky, fog, reflections or terrain is still being updated 
+    };
+
+    bool renderOnDemand = false;
+    float minimumRefresh = 1.0f;
+    uint32_t frameDirty = DIRTY_REFRESH; // The first frame always draws 
+    std::chrono::steady_clock::time_point lastFrameTime;
+    uint64_t drawnFrames = 0;
+
+    // Damage tracking. Every frame the parts of the screen that changed
+    // are marked in a grid, an image is repainted with the damage of
+    // every frame since it was last drawn 
+    static const uint32_t DAMAGE_HISTORY = 8;   // Images older than this are drawn in full 
+    static const uint32_t MAX_DAMAGE_RECTS = 16;
+    const float DAMAGE_PADDING = 0.01f;         // Clip space slack around every character 
+    bool damageTrackingEnabled = false;
+    bool incrementalPresentSupported = false;
+    VkRenderPass damageRenderPass;
+    std::array<Damage::Grid, DAMAGE_HISTORY> damageHistory;
+    uint64_t damageFrame = 0;
+    uint64_t damagePoseVersion = 0;
+    bool damageEverything = true;
+    glm::vec2 meshBoundsMin;
+    glm::vec2 meshBoundsMax;
+    std::vector<glm::vec4> characterBounds;         // Clip space (min x, min y, max x, max y) of the latest pose 
+    std::vector<glm::vec4> damagedCharacterBounds;  // What each character covered in the last damaged frame 
+    uint64_t repaintedPixels = 0;
+    uint64_t windowPixels = 0;
+
+    // Lit shading, either forward or deferred through a G-buffer 
+    enum ShadingPath : uint32_t
+    {
+        SHADING_FORWARD,
+        SHADING_DEFERRED,
+        SHADING_PATH_COUNT,
+    };
+
+    /// <summary>
+    /// A light as the shaders see it. Matches Light in lighting.glsl 
+    /// </summary>
+    struct ShadingLight
+    {
+        glm::vec4 positionRadius;
+        glm::vec4 color;
+    };
+
+    /// <summary>
+    /// Matches ShadingPushConstants in shading.glsl 
+    /// </summary>
+    struct ShadingPushConstants
+    {
+        glm::mat4 inverseViewProjection;
+        uint32_t extent[2];
+        uint32_t lightCount;
+        uint32_t verticesPerCharacter;
+        uint32_t aoEnabled;
+        uint32_t aoScale;
+        uint32_t iblEnabled;
+        uint32_t skyEnabled;
+        glm::vec4 sunDirection;
+        uint32_t fogEnabled;
+        uint32_t terrainEnabled;
+    };
+
+    /// <summary>
+    /// Matches IblPushConstants in cubemap.glsl 
+    /// </summary>
+    struct IblPushConstants
+    {
+        uint32_t face;
+        uint32_t size;
+        float roughness;
+        uint32_t sampleCount;
+        float lod;
+        float yaw;
+        float intensity;
+        uint32_t useEquirect;
+        uint32_t equirectSize[2];
+        uint32_t environmentSize;
+    };
+
+    /// <summary>
+    /// Matches AtmospherePushConstants in skyview.comp 
+    /// </summary>
+    struct AtmospherePushConstants
+    {
+        float sunCosZenith;
+        uint32_t firstRow;
+        uint32_t rowCount;
+    };
+
+    /// <summary>
+    /// Matches FogPushConstants in foginject.comp 
+    /// </summary>
+    struct FogPushConstants
+    {
+        glm::mat4 reprojection;
+        glm::vec4 jitter;
+        uint32_t lightCount;
+        uint32_t historyValid;
+        float density;
+        float ambient;
+    };
+
+    /// <summary>
+    /// Matches TerrainPage in terrain.glsl 
+    /// </summary>
+    struct TerrainPageEntry
+    {
+        glm::ivec4 keySlot;
+        glm::vec4 range;
+    };
+
+    static const uint32_t TERRAIN_LEVELS = 9;
+    static const uint32_t TERRAIN_PAGE_TABLE = 4;
+    static const uint32_t TERRAIN_PAGE_SLOTS = TERRAIN_LEVELS * TERRAIN_PAGE_TABLE * TERRAIN_PAGE_TABLE;
+
+    /// <summary>
+    /// Matches TerrainFrame in terrain.glsl 
+    /// </summary>
+    struct TerrainFrameData
+    {
+        glm::mat4 viewProjection;
+        glm::vec4 cameraPosition;
+        glm::vec4 sunDirection;
+        glm::vec4 frustumPlanes[6];
+        glm::ivec4 levels[TERRAIN_LEVELS];
+        TerrainPageEntry pages[TERRAIN_PAGE_SLOTS];
+    };
+
+    /// <summary>
+    /// Matches AmbientOcclusionPushConstants in ssao.comp 
+    /// </summary>
+    struct AmbientOcclusionPushConstants
+    {
+        glm::mat4 inverseViewProjection;
+        uint32_t extent[2];
+        uint32_t aoExtent[2];
+        uint32_t aoScale;
+        uint32_t hiZLevels;
+        float radius;
+        float pixelsPerUnit;
+        float intensity;
+    };
+
+    /// <summary>
+    /// Matches PostPushConstants in post.glsl 
+    /// </summary>
+    struct PostPushConstants
+    {
+        uint32_t sourceSize[2];
+        uint32_t destinationSize[2];
+        uint32_t prefilter;
+        uint32_t bloomLevels;
+        uint32_t outputSrgb;
+        uint32_t frameIndex;
+        float threshold;
+        float knee;
+        float bloomStrength;
+        float exposure;
+        float vignette;
+    };
+
+    /// <summary>
+    /// Matches FilterPushConstants in hiz.comp and aoblur.comp 
+    /// </summary>
+    struct FilterPushConstants
+    {
+        int32_t direction[2];
+        uint32_t sourceSize[2];
+        uint32_t destinationSize[2];
+    };
+
+    /// <summary>
+    /// Matches ReflectionFrame in ssr.glsl 
+    /// </summary>
+    struct ReflectionFrameData
+    {
+        glm::mat4 viewProjection;
+        glm::mat4 inverseViewProjection;
+        glm::mat4 reprojection;
+        uint32_t extent[2];
+        uint32_t traceExtent[2];
+        uint32_t hiZLevels;
+        uint32_t maxSteps;
+        float maxRoughness;
+        float thickness;
+        uint32_t frameIndex;
+        uint32_t historyValid;
+        float historyWeight;
+        uint32_t iblEnabled;
+    };
+
+    /// <summary>
+    /// How a light circles around its spot over the crowd 
+    /// </summary>
+    struct LightOrbit
+    {
+        glm::vec2 center;
+        float distance;
+        float speed;
+        float phase;
+        float radius;
+        glm::vec3 color;
+    };
+
+    /// <summary>
+    /// Everything deferred shading renders into for one frame 
+    /// </summary>
+    struct ShadingTargets
+    {
+        VkImage normalImage, albedoImage, depthImage, litImage;
+        VkDeviceMemory normalMemory, albedoMemory, depthMemory, litMemory;
+        VkImageView normalView, albedoView, depthView, litView;
+        VkFramebuffer framebuffer;
+
+        // Ambient occlusion, see CreateAmbientOcclusionTargets 
+        VkImage hiZImage;
+        VkDeviceMemory hiZMemory;
+        VkImageView hiZView;                        // Every level, for ssao.comp 
+        std::vector<VkImageView> hiZLevelViews;     // One level each, for hiz.comp 
+        std::array<VkImage, 2> aoImages;
+        std::array<VkDeviceMemory, 2> aoMemory;
+        std::array<VkImageView, 2> aoViews;         // [0] holds the result, [1] is the blur's halfway point 
+        std::vector<VkDescriptorSet> hiZSets;
+        VkDescriptorSet aoSet;
+        std::array<VkDescriptorSet, 2> aoBlurSets;
+
+        // Post-processing, see CreatePostProcessingTargets 
+        VkImage bloomImage;
+        VkDeviceMemory bloomMemory;
+        std::vector<VkImageView> bloomLevelViews;
+        std::vector<VkDescriptorSet> bloomDownSets;     // Level i from level i - 1, level 0 from the lit image 
+        std::vector<VkDescriptorSet> bloomUpSets;       // Level i from level i + 1 
+        VkDescriptorSet postSet;
+
+        // Screen space reflections, see CreateReflectionTargets. The
+        // history is read by the other frame in flight as its last 
+        VkImage ssrTraceImage, ssrHistoryImage;
+        VkDeviceMemory ssrTraceMemory, ssrHistoryMemory;
+        VkImageView ssrTraceView, ssrHistoryView;
+
+        // Terrain, see CreateTerrainTargets 
+        VkImage terrainColorImage, terrainDepthImage;
+        VkDeviceMemory terrainColorMemory, terrainDepthMemory;
+        VkImageView terrainColorView, terrainDepthView;
+        VkFramebuffer terrainFramebuffer;
+    };
+
+    // Timestamps written in each frame in flight 
+    enum ShadingQuery : uint32_t
+    {
+        QUERY_SHADING_BEGIN,
+        QUERY_SHADING_END,
+        QUERY_AO_BEGIN,
+        QUERY_AO_END,
+        QUERY_POST_BEGIN,
+        QUERY_POST_END,
+        QUERY_FOG_BEGIN,
+        QUERY_FOG_END,
+        QUERY_TERRAIN_BEGIN,
+        QUERY_TERRAIN_END,
+        QUERY_FOLIAGE_BEGIN,
+        QUERY_FOLIAGE_END,
+        QUERY_SSR_BEGIN,
+        QUERY_SSR_END,
+        SHADING_QUERY_COUNT,
+    };
+
+    /// <summary>
+    /// One transparent bubble, fed to transparent.vert per instance 
+    /// </summary>
+    struct TransparentInstance
+    {
+        glm::vec4 placement;    // x, starting height, depth, radius 
+        glm::vec4 color;        // rgb, alpha 
+        float speed;
+
+        static VkVertexInputBindingDescription GetBindingDescription()
+        {
+            VkVertexInputBindingDescription bindingDescription{};
+            bindingDescription.binding = 0;
+            bindingDescription.stride = sizeof(TransparentInstance);
+            bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+            return bindingDescription;
+        }
+
+        static std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescriptions()
+        {
+            std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+            attributeDescriptions[0] = { 0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(TransparentInstance, placement) };
+            attributeDescriptions[1] = { 1, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(TransparentInstance, color) };
+            attributeDescriptions[2] = { 2, 0, VK_FORMAT_R32_SFLOAT, offsetof(TransparentInstance, speed) };
+
+            return attributeDescriptions;
+        }
+    };
+
+    /// <summary>
+    /// Matches TransparencyPushConstants in transparent.vert 
+    /// </summary>
+    struct TransparencyPushConstants
+    {
+        float time;
+        float aspect;
+    };
+
+    /// <summary>
+    /// GPU time spent shading with one path 
+    /// </summary>
+    struct ShadingStats
+    {
+        double gpuMilliseconds = 0.0;
+        uint64_t frames = 0;
+        uint64_t pixels = 0;
+    };
+
+    static const uint32_t MAX_LIGHTS = 4096;
+    static const uint32_t SHADING_TILE_SIZE = 16; // Keep in sync with deferred.comp 
+    const float LIGHT_HEIGHT = 0.05f;             // How far above the crowd the lights float 
+    const VkFormat GBUFFER_ALBEDO_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+    VkFormat gbufferNormalFormat = VK_FORMAT_R16G16_SNORM;    // See SelectGBufferFormats 
+    VkFormat gbufferDepthFormat = VK_FORMAT_D32_SFLOAT;
+    const VkFormat LIT_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const VkShaderStageFlags SHADING_PUSH_STAGES = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    bool shadingEnabled = false;
+    uint32_t lightCount = 0;
+    ShadingPath shadingPath = SHADING_FORWARD;
+    std::vector<LightOrbit> lightOrbits;
+    std::vector<VkBuffer> lightBuffers;
+    std::vector<VkDeviceMemory> lightBuffersMemory;
+    std::vector<void*> lightBuffersMapped;
+    VkDescriptorSetLayout shadingDescriptorSetLayout;
+    VkDescriptorPool shadingDescriptorPool;
+    std::vector<VkDescriptorSet> shadingDescriptorSets;
+    VkPipelineLayout shadingPipelineLayout;
+    VkPipeline forwardPipeline;
+    VkPipeline gbufferPipeline;
+    VkPipeline lightingPipeline;
+    VkRenderPass gbufferRenderPass;
+    VkSampler shadingSampler;
+    VkExtent2D shadingExtent;
+    std::vector<ShadingTargets> shadingTargets;
+    VkQueryPool shadingQueryPool = VK_NULL_HANDLE; // SHADING_QUERY_COUNT timestamps per frame in flight 
+    float timestampPeriod = 1.0f;
+    std::vector<int> shadingTimedPaths;            // Path timed in each frame, -1 if none 
+    std::vector<uint64_t> shadingTimedPixels;
+    std::array<ShadingStats, SHADING_PATH_COUNT> shadingStats;
+
+    // Screen space ambient occlusion for the deferred path 
+    static const uint32_t MAX_HIZ_LEVELS = 16;
+    static const uint32_t AO_GROUP_SIZE = 8;    // Keep in sync with hiz.comp, ssao.comp and aoblur.comp 
+    const VkFormat HIZ_FORMAT = VK_FORMAT_R32_SFLOAT;
+    const VkFormat AO_FORMAT = VK_FORMAT_R32_UINT; // Occlusion and depth packed as two halves 
+    const float AO_RADIUS = 0.05f;              // World units, reaches a few characters over 
+    const float AO_INTENSITY = 1.0f;
+    bool aoEnabled = false;
+    uint32_t aoScale = 2;                       // Pixels per AO texel along each axis 
+    VkExtent2D hiZExtent;
+    uint32_t hiZLevels = 0;
+    VkExtent2D aoExtent;
+    VkDescriptorSetLayout aoFilterDescriptorSetLayout;
+    VkDescriptorSetLayout aoDescriptorSetLayout;
+    VkDescriptorPool aoDescriptorPool;
+    VkPipelineLayout aoFilterPipelineLayout;
+    VkPipelineLayout aoPipelineLayout;
+    VkPipeline hiZPipeline;
+    VkPipeline aoPipeline;
+    VkPipeline aoBlurPipeline;
+    std::vector<bool> aoTimed;                  // Whether each frame's timestamps include AO 
+    double aoGpuMilliseconds = 0.0;
+    uint64_t aoFrames = 0;
+
+    // Post-processing of the deferred path's lit image. Keep the
+    // effects in sync with the specialization constants of post.comp 
+    enum PostEffect : uint32_t
+    {
+        POST_BLOOM = 1 << 0,
+        POST_TONE_MAPPING = 1 << 1,
+        POST_VIGNETTE = 1 << 2,
+        POST_COLOR_GRADING = 1 << 3,
+        POST_DITHERING = 1 << 4,
+    };
+
+    static const uint32_t POST_EFFECT_COUNT = 5;
+    static const uint32_t BLOOM_LEVELS = 6;
+    static const uint32_t POST_GROUP_SIZE = 8;  // Keep in sync with post.glsl 
+    const VkFormat BLOOM_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const float BLOOM_THRESHOLD = 1.0f;
+    const float BLOOM_KNEE = 0.5f;
+    const float BLOOM_STRENGTH = 0.15f;
+    const float POST_EXPOSURE = 1.0f;
+    const float VIGNETTE_STRENGTH = 0.35f;
+    uint32_t postEffects = 0;
+    uint32_t bloomLevels = 0;
+    VkExtent2D bloomExtent;
+    VkDescriptorSetLayout postDescriptorSetLayout;
+    VkDescriptorPool postDescriptorPool;
+    VkPipelineLayout postPipelineLayout;
+    VkPipeline bloomDownPipeline;
+    VkPipeline bloomUpPipeline;
+    std::array<VkPipeline, 1 << POST_EFFECT_COUNT> postPipelines{}; // One per combination of effects, built on first use 
+    VkSampler postSampler;
+    uint32_t postFrameIndex = 0;
+    std::vector<bool> postTimed;
+    double postGpuMilliseconds = 0.0;
+    uint64_t postFrames = 0;
+
+    // Hi-Z screen space reflections for the deferred path. The quality
+    // picks how many Hi-Z cells a ray may visit and how rough a surface
+    // may be before it keeps the probe's reflection 
+    enum ReflectionQuality : uint32_t
+    {
+        SSR_LOW,
+        SSR_MEDIUM,
+        SSR_HIGH,
+        SSR_QUALITY_COUNT,
+    };
+
+    static constexpr uint32_t SSR_MAX_STEPS[SSR_QUALITY_COUNT] = { 16, 32, 64 };
+    static constexpr float SSR_MAX_ROUGHNESS[SSR_QUALITY_COUNT] = { 0.3f, 0.4f, 0.5f };
+    static const uint32_t SSR_GROUP_SIZE = 8;       // Keep in sync with ssr.glsl 
+    static const uint32_t SSR_SETTLE_FRAMES = 16;   // Frames drawn after a change for the history to converge 
+    const VkFormat SSR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const float SSR_THICKNESS = 0.005f;             // Half the step between the depth layers of lit.vert 
+    const float SSR_HISTORY_WEIGHT = 0.9f;
+    bool ssrEnabled = false;
+    ReflectionQuality ssrQuality = SSR_MEDIUM;
+    bool ssrHistoryValid = false;
+    uint32_t ssrSettleFrames = 0;
+    uint32_t ssrFrameIndex = 0;
+    std::vector<VkBuffer> ssrFrameBuffers;
+    std::vector<VkDeviceMemory> ssrFrameMemory;
+    std::vector<void*> ssrFrameMapped;
+    VkSampler ssrSampler;
+    VkDescriptorSetLayout ssrDescriptorSetLayout;
+    VkDescriptorPool ssrDescriptorPool;
+    std::vector<VkDescriptorSet> ssrDescriptorSets;
+    VkPipelineLayout ssrPipelineLayout;
+    VkPipeline ssrTracePipeline, ssrTemporalPipeline, ssrCompositePipeline;
+    std::vector<bool> ssrTimed;
+    double ssrGpuMilliseconds = 0.0;
+    uint64_t ssrFrames = 0;
+
+    // Image based lighting, precomputed from an environment cube 
+    static const uint32_t IBL_CACHE_VERSION = 1;    // Bump whenever a precompute shader changes 
+    static const uint32_t CUBE_FACES = 6;
+    static const uint32_t ENVIRONMENT_SIZE = 256;
+    static const uint32_t ENVIRONMENT_LEVELS = 9;   // Down to 1x1 
+    static const uint32_t PREFILTER_SIZE = 128;
+    static const uint32_t PREFILTER_LEVELS = 6;     // Roughness 0 to 1 in steps of 0.2 
+    static const uint32_t PREFILTER_SAMPLES = 256;
+    static const uint32_t IRRADIANCE_SAMPLE_SIZE = 64;
+    static const uint32_t SH_COEFFICIENTS = 9;
+    static const uint32_t IRRADIANCE_SLOTS = CUBE_FACES + 1; // One per face and the combined one 
+    static const uint32_t BRDF_LUT_SIZE = 128;
+    static const uint32_t BRDF_LUT_SAMPLES = 1024;
+    static const uint32_t IBL_GROUP_SIZE = 8;       // Keep in sync with cubemap.glsl 
+    static const uint32_t IBL_TEXEL_SIZE = 8;
+    const VkFormat IBL_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const float ENVIRONMENT_INTENSITY = 0.25f;      // Keeps the sky about as bright as the old flat ambient 
+    const float ENVIRONMENT_ROTATION_STEP = 0.7853982f;
+    bool iblEnabled = false;
+    std::string environmentPath;                    // Empty for the procedural sky 
+    std::string iblCacheDirectory;
+    VkExtent2D equirectSize = { 0, 0 };
+    float environmentYaw = 0.0f;
+    bool environmentDirty = false;
+    uint32_t iblNextFace = CUBE_FACES;              // Next face to filter, CUBE_FACES when done 
+    VkImage environmentImage, prefilteredImage, brdfLutImage;
+    VkDeviceMemory environmentMemory, prefilteredMemory, brdfLutMemory;
+    VkImageUsageFlags prefilteredUsage, brdfLutUsage;  // Decide how the cache is uploaded 
+    VkImageView environmentCubeView, environmentFaceView, prefilteredCubeView, brdfLutView;
+    std::array<VkImageView, PREFILTER_LEVELS> prefilteredLevelViews;
+    VkBuffer irradianceBuffer;
+    VkDeviceMemory irradianceMemory;
+    VkBuffer equirectBuffer;
+    VkDeviceMemory equirectMemory;
+    VkSampler iblSampler;
+    VkDescriptorSetLayout iblDescriptorSetLayout;
+    VkDescriptorPool iblDescriptorPool;
+    VkDescriptorSet environmentSet, brdfLutSet, irradianceSet;
+    std::array<VkDescriptorSet, PREFILTER_LEVELS> prefilterSets;
+    VkPipelineLayout iblPipelineLayout;
+    VkPipeline environmentPipeline, prefilterPipeline, irradiancePipeline, brdfLutPipeline;
+
+    // Atmosphere LUTs for the sky behind the scene 
+    static const uint32_t MULTI_SCATTERING_LUT_SIZE = 32;
+    static const uint32_t SKY_VIEW_SLICES = 4;      // Frames a sky-view rebuild is spread over 
+    static const uint32_t ATMOSPHERE_GROUP_SIZE = 8; // Keep in sync with atmosphere.glsl 
+    const VkExtent2D TRANSMITTANCE_LUT_EXTENT = { 256, 64 };
+    const VkExtent2D SKY_VIEW_LUT_EXTENT = { 192, 108 };
+    const VkFormat ATMOSPHERE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const float SUN_MAX_ELEVATION = 1.2f;           // Radians at noon 
+    const float SUN_AZIMUTH = 0.3f;                 // Slightly to the right of the camera at noon 
+    const float SUN_STEP = 0.1f;                    // Along the path for K 
+    bool skyEnabled = false;
+    float sunCycle = 0.0f;
+    float sunAngle = 0.35f;                         // Late morning 
+    glm::vec3 skyBuildSun = glm::vec3(0.0f);
+    glm::vec3 skyShownSun = glm::vec3(0.0f);
+    uint32_t skyBuildSlice = SKY_VIEW_SLICES;       // Next slice to build, SKY_VIEW_SLICES when idle 
+    VkImage transmittanceImage, multiScatteringImage, skyViewImage, skyViewBuildImage;
+    VkDeviceMemory transmittanceMemory, multiScatteringMemory, skyViewMemory, skyViewBuildMemory;
+    VkImageView transmittanceView, multiScatteringView, skyViewView, skyViewBuildView;
+    VkSampler atmosphereSampler;
+    VkDescriptorSetLayout atmosphereDescriptorSetLayout;
+    VkDescriptorPool atmosphereDescriptorPool;
+    VkDescriptorSet transmittanceSet, multiScatteringSet, skyViewSet;
+    VkPipelineLayout atmospherePipelineLayout;
+    VkPipeline transmittancePipeline, multiScatteringPipeline, skyViewPipeline;
+    VkPipeline skyPipeline;                         // Background pass of the forward path, sky and fog 
+
+    // Froxel volumetric fog 
+    static const uint32_t FOG_HISTORY = 2;
+    static const uint32_t FOG_GROUP_SIZE = 4;       // Keep in sync with froxel.glsl 
+    static const uint32_t FOG_INTEGRATE_GROUP_SIZE = 8;
+    static const uint32_t FOG_JITTER_SAMPLES = 16;
+    static const uint32_t FOG_SETTLE_FRAMES = 16;   // Frames drawn after a change for the history to converge 
+    const VkExtent3D FOG_GRID = { 160, 90, 64 };
+    const VkFormat FOG_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const float FOG_DENSITY = 0.8f;                 // Extinction per unit of depth 
+    const float FOG_AMBIENT = 0.02f;
+    bool fogEnabled = false;
+    bool fogHistoryValid = false;
+    uint32_t fogSettleFrames = 0;
+    uint32_t fogFrameIndex = 0;
+    std::array<VkImage, FOG_HISTORY> fogScatteringImages;
+    std::array<VkDeviceMemory, FOG_HISTORY> fogScatteringMemory;
+    std::array<VkImageView, FOG_HISTORY> fogScatteringViews;
+    VkImage fogIntegratedImage;
+    VkDeviceMemory fogIntegratedMemory;
+    VkImageView fogIntegratedView;
+    VkSampler fogSampler;
+    VkDescriptorSetLayout fogDescriptorSetLayout;
+    VkDescriptorPool fogDescriptorPool;
+    std::vector<VkDescriptorSet> fogDescriptorSets;
+    VkPipelineLayout fogPipelineLayout;
+    VkPipeline fogInjectPipeline, fogIntegratePipeline;
+    std::vector<bool> fogTimed;
+    double fogGpuMilliseconds = 0.0;
+    uint64_t fogFrames = 0;
+
+    // GPU-driven clipmap terrain, TERRAIN_LEVELS and the page table
+    // sizes are with TerrainFrameData 
+    static const uint32_t TERRAIN_PATCH_QUADS = 16;     // Keep in sync with terrain.glsl 
+    static const uint32_t TERRAIN_PATCHES = 8;          // Per side of a level 
+    static const uint32_t TERRAIN_CULL_GROUP_SIZE = 64;
+    static const uint32_t TERRAIN_UPLOADS_PER_FRAME = 8;
+    static const size_t TERRAIN_PAGE_BYTES = Terrain::PAGE_TEXELS * Terrain::PAGE_TEXELS * sizeof(float);
+    const VkFormat TERRAIN_HEIGHT_FORMAT = VK_FORMAT_R32_SFLOAT;
+    const VkFormat TERRAIN_COLOR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const VkFormat TERRAIN_DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+    const float TERRAIN_SPACING = 2.0f;                 // Meters between level 0 texels 
+    const float TERRAIN_HEIGHT_SCALE = 600.0f;
+    const float TERRAIN_CAMERA_CLEARANCE = 150.0f;
+    const float TERRAIN_CAMERA_PITCH = 0.15f;           // Keep in sync with SKY_CAMERA_PITCH in sky.glsl 
+    const float TERRAIN_FIELD_OF_VIEW = 1.0472f;        // 60 degrees vertically, like the sky 
+    const float TERRAIN_NEAR = 5.0f;
+    const float TERRAIN_FAR = 100000.0f;
+    const float TERRAIN_FLY_SPEED = 60.0f;              // Meters per second of animation 
+    bool terrainEnabled = false;
+    std::string terrainPath;
+    std::unique_ptr<Terrain::PageStreamer> terrainStreamer;
+    std::unique_ptr<Terrain::PageCache> terrainCache;
+    uint64_t terrainFrameNumber = 0;
+    std::vector<uint32_t> terrainUploads;               // Slots staged this frame, in staging order 
+    uint64_t terrainPagesUploaded = 0;
+    uint32_t terrainPagesMissing = 0;
+    VkImage terrainAtlasImage;
+    VkDeviceMemory terrainAtlasMemory;
+    VkImageView terrainAtlasView;
+    VkBuffer terrainIndexBuffer, terrainVisibleBuffer, terrainDrawBuffer;
+    VkDeviceMemory terrainIndexMemory, terrainVisibleMemory, terrainDrawMemory;
+    uint32_t terrainIndexCount = 0;
+    std::vector<VkBuffer> terrainFrameBuffers, terrainStagingBuffers;
+    std::vector<VkDeviceMemory> terrainFrameMemory, terrainStagingMemory;
+    std::vector<void*> terrainFrameMapped, terrainStagingMapped;
+    VkDescriptorSetLayout terrainDescriptorSetLayout;
+    VkDescriptorPool terrainDescriptorPool;
+    std::vector<VkDescriptorSet> terrainDescriptorSets;
+    VkPipelineLayout terrainPipelineLayout;
+    VkRenderPass terrainRenderPass;
+    VkPipeline terrainPipeline, terrainCullPipeline;
+    std::vector<bool> terrainTimed;
+    double terrainGpuMilliseconds = 0.0;
+    uint64_t terrainFrames = 0;
+
+    // Foliage scattered over the terrain, bin sizes with foliage.glsl 
+    static const uint32_t FOLIAGE_BINS = 4;
+    static constexpr uint32_t FOLIAGE_BIN_CAPACITY[FOLIAGE_BINS] = { 1u << 19, 1u << 21, 1u << 16, 1u << 18 };
+    static constexpr uint32_t FOLIAGE_BIN_VERTICES[FOLIAGE_BINS] = { 27, 3, 48, 12 };
+    static const uint32_t FOLIAGE_DENSITY_SIZE = 256;   // Texels per side of the procedural map 
+    static const size_t FOLIAGE_INSTANCE_BYTES = 16;
+    const VkFormat FOLIAGE_DENSITY_FORMAT = VK_FORMAT_R8G8_UNORM;
+    bool foliageEnabled = false;
+    std::string foliagePath;
+    VkImage foliageDensityImage;
+    VkDeviceMemory foliageDensityMemory;
+    VkImageView foliageDensityView;
+    VkSampler foliageSampler;
+    VkBuffer foliageInstanceBuffer, foliageDrawBuffer;
+    VkDeviceMemory foliageInstanceMemory, foliageDrawMemory;
+    std::vector<VkBuffer> foliageCountBuffers;          // The indirect commands, copied back for the stats 
+    std::vector<VkDeviceMemory> foliageCountMemory;
+    std::vector<void*> foliageCountMapped;
+    std::vector<bool> foliageCounted;
+    VkDescriptorSetLayout foliageDescriptorSetLayout;
+    VkDescriptorPool foliageDescriptorPool;
+    VkDescriptorSet foliageDescriptorSet;
+    VkPipelineLayout foliagePipelineLayout;
+    VkPipeline foliagePipeline, foliageScatterPipeline;
+    std::vector<bool> foliageTimed;
+    double foliageGpuMilliseconds = 0.0;
+    uint64_t foliageTimedFrames = 0;
+    uint64_t foliageInstances[FOLIAGE_BINS] = {};
+    uint64_t foliageOverflows = 0;
+    uint64_t foliageCountedFrames = 0;
+
+    // Weighted blended order-independent transparency 
+    static const uint32_t MAX_TRANSPARENT_INSTANCES = 1 << 20;
+    const VkFormat OIT_ACCUMULATION_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    const VkFormat OIT_REVEALAGE_FORMAT = VK_FORMAT_R8_UNORM;
+    bool transparencyEnabled = false;
+    uint32_t transparentCount = 0;
+    VkBuffer transparentInstanceBuffer;
+    VkDeviceMemory transparentInstanceMemory;
+    VkRenderPass oitRenderPass;
+    VkDescriptorSetLayout oitDescriptorSetLayout;
+    VkDescriptorPool oitDescriptorPool;
+    VkDescriptorSet oitDescriptorSet;
+    VkPipelineLayout oitPipelineLayout;
+    VkPipeline oitAccumulatePipeline;
+    VkPipeline oitResolvePipeline;
+    VkImage oitAccumulationImage, oitRevealageImage;
+    VkDeviceMemory oitAccumulationMemory, oitRevealageMemory;
+    VkImageView oitAccumulationView, oitRevealageView;
+    std::vector<VkFramebuffer> oitFramebuffers;     // One per swap chain image of the first window 
 
 private: // Vukan helpers 
     
@@ -137,7 +1361,8 @@ private: // Vukan helpers
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "No Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        // Note: 1.1 for multiview and the extended feature queries 
+        appInfo.apiVersion = VK_API_VERSION_1_1;
 
         // Tells our Vulkan driver which global extension 
         // and validation layers we want to use 
@@ -368,6 +1593,128 @@ private: // Vukan helpers
         {
             throw std::runtime_error("Failed to find a suitable GPU!");
         }
+
+        QuerySubgroupSupport();
+        QueryHostImageCopySupport();
+        QueryExternalHostMemorySupport();
+        QueryMemoryPlacement();
+    }
+
+    /// <summary>
+    /// Reads the subgroup properties of the picked device and whether
+    /// compute pipelines may choose their subgroup size 
+    /// </summary>
+    void QuerySubgroupSupport()
+    {
+        subgroupProperties = {};
+        subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &subgroupProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        subgroupSizeControlSupported = false;
+        computeFullSubgroupsSupported = false;
+        if (!IsDeviceExtensionAvailable(physicalDevice, VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME))
+        {
+            return;
+        }
+
+        VkPhysicalDeviceSubgroupSizeControlFeaturesEXT sizeControlFeatures{};
+        sizeControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &sizeControlFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        VkPhysicalDeviceSubgroupSizeControlPropertiesEXT sizeControlProperties{};
+        sizeControlProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES_EXT;
+        properties.pNext = &sizeControlProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        // Only compute asks for a size, so that is the stage it has to
+        // be allowed in 
+        subgroupSizeControlSupported = sizeControlFeatures.subgroupSizeControl == VK_TRUE &&
+            (sizeControlProperties.requiredSubgroupSizeStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0;
+        computeFullSubgroupsSupported = subgroupSizeControlSupported && sizeControlFeatures.computeFullSubgroups == VK_TRUE;
+        minSubgroupSize = sizeControlProperties.minSubgroupSize;
+        maxSubgroupSize = sizeControlProperties.maxSubgroupSize;
+        maxComputeWorkgroupSubgroups = sizeControlProperties.maxComputeWorkgroupSubgroups;
+    }
+
+    /// <summary>
+    /// Whether the picked device can copy from host memory into
+    /// images, and into which layouts 
+    /// </summary>
+    void QueryHostImageCopySupport()
+    {
+        hostImageCopySupported = false;
+        hostCopyDstLayouts.clear();
+
+        // Note: VK_EXT_host_image_copy needs both of the others, the
+        //       properties query comes with Vulkan 1.1 
+        const char* required[] = { VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME, VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME,
+            VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME };
+        for (const char* name : required)
+        {
+            if (!IsDeviceExtensionAvailable(physicalDevice, name))
+            {
+                return;
+            }
+        }
+
+        VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures{};
+        hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &hostImageCopyFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+        if (hostImageCopyFeatures.hostImageCopy != VK_TRUE)
+        {
+            return;
+        }
+
+        // Asked twice, once for how many layouts there are 
+        VkPhysicalDeviceHostImageCopyPropertiesEXT hostImageCopyProperties{};
+        hostImageCopyProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &hostImageCopyProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        hostCopyDstLayouts.resize(hostImageCopyProperties.copyDstLayoutCount);
+        hostImageCopyProperties.pCopyDstLayouts = hostCopyDstLayouts.data();
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        hostImageCopySupported = true;
+    }
+
+    /// <summary>
+    /// Whether the picked device can import host memory, and how that
+    /// memory has to be aligned 
+    /// </summary>
+    void QueryExternalHostMemorySupport()
+    {
+        externalHostMemorySupported = IsDeviceExtensionAvailable(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        if (!externalHostMemorySupported)
+        {
+            return;
+        }
+
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties{};
+        hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &hostProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        minImportedHostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
     }
 
     /// <summary>
@@ -388,12 +1735,18 @@ private: // Vukan helpers
         if (extensionsSupported)
         {
             // Check if both formats and present modes
-            // are not empty lists 
-            SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device);
-            swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+            // are not empty lists for every window 
+            swapChainAdequate = true;
+            for (const auto& target : windows)
+            {
+                SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device, target.surface);
+                swapChainAdequate = swapChainAdequate && !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+            }
         }
 
-        return indicies.IsComplete() && extensionsSupported && swapChainAdequate;
+        bool multiviewAdequate = !multiviewEnabled || CheckMultiviewSupport(device);
+
+        return indicies.IsComplete() && extensionsSupported && swapChainAdequate && multiviewAdequate;
 
 
  
@@ -468,10 +1821,15 @@ private: // Vukan helpers
         int i = 0;
         for (const auto& queueFamily : queueFamilies)
         {
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            // Is there a family that supports every window's surface? 
+            VkBool32 presentSupport = true;
+            for (const auto& target : windows)
+            {
+                VkBool32 surfaceSupport = false;
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, target.surface, &surfaceSupport);
+                presentSupport = presentSupport && surfaceSupport;
+            }
 
-            // Is there a family that supports the surface? 
             if (presentSupport)
             {
                 indicies.presentFamily = i;
@@ -505,6 +1863,11 @@ private: // Vukan helpers
     void CreateLogicalDevice()
     {
         QueueFamilyIndicies indices = FindQueueFamilies(physicalDevice);
+
+        // Without incremental present the damage is still only
+        // repainted, the compositor just does not hear about it 
+        incrementalPresentSupported = damageTrackingEnabled &&
+            IsDeviceExtensionAvailable(physicalDevice, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
         
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
@@ -540,6 +1903,19 @@ private: // Vukan helpers
         // device queue 
         VkPhysicalDeviceFeatures deviceFeatures{}; 
 
+        // Weighted blended transparency blends its two targets
+        // differently 
+        if (transparencyEnabled)
+        {
+            VkPhysicalDeviceFeatures supportedFeatures;
+            vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+            if (!supportedFeatures.independentBlend)
+            {
+                throw std::runtime_error("Transparency needs the independentBlend feature!");
+            }
+            deviceFeatures.independentBlend = VK_TRUE;
+        }
+
 
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -551,10 +1927,39 @@ private: // Vukan helpers
         // Attach features 
         createInfo.pEnabledFeatures = &deviceFeatures;
 
-
+        // Features that came after 1.0 are chained on instead 
+        VkPhysicalDeviceMultiviewFeatures multiviewFeatures{};
+        multiviewFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+        if (multiviewEnabled)
+        {
+            multiviewFeatures.multiview = VK_TRUE;
+            createInfo.pNext = &multiviewFeatures;
+        }
+
+        VkPhysicalDeviceSubgroupSizeControlFeaturesEXT sizeControlFeatures{};
+        sizeControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+        if (subgroupSizeControlSupported)
+        {
+            sizeControlFeatures.subgroupSizeControl = VK_TRUE;
+            sizeControlFeatures.computeFullSubgroups = computeFullSubgroupsSupported ? VK_TRUE : VK_FALSE;
+            sizeControlFeatures.pNext = const_cast<void*>(createInfo.pNext);
+            createInfo.pNext = &sizeControlFeatures;
+        }
+
+        VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures{};
+        hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+        if (hostImageCopySupported)
+        {
+            hostImageCopyFeatures.hostImageCopy = VK_TRUE;
+            hostImageCopyFeatures.pNext = const_cast<void*>(createInfo.pNext);
+            createInfo.pNext = &hostImageCopyFeatures;
+        }
+
+
         // Specify any device specific extensions 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        auto extensions = GetDeviceExtensions();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
 
         // Connect validation layers for debugging 
         if (enableValidationLayers)
@@ -583,26 +1988,29 @@ private: // Vukan helpers
 
     #pragma region Window Surface
 
-    void CreateSurface()
+    void CreateSurfaces()
     {
         // Note: Lets us access the platform's window 
 
-        // This seems to be the setup for creating a surface for windows32
-        /*VkWin32SurfaceCreateInfoKHR createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-        createInfo.hwnd = glfwGetWin32Window(window);
-        createInfo.hinstance = GetModuleHandle(nullptr);
-
-        if (vkCreateWin32SurfaceKHR(instance, &createInfo, nullptr, &surface) != VK_SUCCESS)
+        for (auto& target : windows)
         {
-            throw std::runtime_error("Failed to create window surface!");
-        }*/
+            // This seems to be the setup for creating a surface for windows32
+            /*VkWin32SurfaceCreateInfoKHR createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+            createInfo.hwnd = glfwGetWin32Window(target.window);
+            createInfo.hinstance = GetModuleHandle(nullptr);
+
+            if (vkCreateWin32SurfaceKHR(instance, &createInfo, nullptr, &target.surface) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create window surface!");
+            }*/
 
 
-        // Sets up the window surface using GLFW 
-        if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
-        {
-            throw std::runtime_error("Failed to create window surface!");
+            // Sets up the window surface using GLFW 
+            if (glfwCreateWindowSurface(instance, target.window, nullptr, &target.surface) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create window surface!");
+            }
         }
     }
 
@@ -615,6 +2023,67 @@ private: // Vukan helpers
     //       These functions simply help us execute 
     //       our setup process 
 
+    /// <summary>
+    /// Device extensions required by the modes we are running in,
+    /// on top of the ones every mode needs 
+    /// </summary>
+    std::vector<const char*> GetDeviceExtensions()
+    {
+        std::vector<const char*> extensions = deviceExtensions;
+
+        if (exportEnabled)
+        {
+            extensions.push_back(FrameExport::MEMORY_EXTENSION_NAME);
+            extensions.push_back(FrameExport::SEMAPHORE_EXTENSION_NAME);
+        }
+
+        // Optional, only asked for once we know the device has it 
+        if (damageTrackingEnabled && incrementalPresentSupported)
+        {
+            extensions.push_back(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+        }
+
+        if (subgroupSizeControlSupported)
+        {
+            extensions.push_back(VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME);
+        }
+
+        if (hostImageCopySupported)
+        {
+            extensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME);
+        }
+
+        if (externalHostMemorySupported)
+        {
+            extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        }
+
+        return extensions;
+    }
+
+    /// <summary>
+    /// Whether the device offers an extension we can live without 
+    /// </summary>
+    bool IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* name)
+    {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions)
+        {
+            if (std::strcmp(extension.extensionName, name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     /// <summary>
     /// Checks whether the physical device can use the swapchain
     /// to display textures 
@@ -636,7 +2105,8 @@ private: // Vukan helpers
         std::vector<VkExtensionProperties> availableExtensions(extensionCount);
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
     
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        auto extensions = GetDeviceExtensions();
+        std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
     
         // Removes any extension that this device has 
@@ -655,7 +2125,7 @@ private: // Vukan helpers
     /// Populates a struct that holds the information
     /// about the swapchain capabilities of this device 
     /// </summary>
-    SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device)
+    SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface)
     {
         SwapChainSupportDetails details;
 
@@ -745,7 +2215,7 @@ private: // Vukan helpers
     /// <summary>
     /// Set the resolution of the swap chain images 
     /// </summary>
-    VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+    VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwindow* window)
     {
         // The image resolutions almost always match exactly
         // with the resolution of the window in pixels. 
@@ -781,13 +2251,19 @@ private: // Vukan helpers
     /// Create a swap chain from using the current
     /// device's capabilities 
     /// </summary>
-    void CreateSwapChain()
+    void CreateSwapChain(WindowTarget& target)
     {
-        SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(physicalDevice);
+        SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(physicalDevice, target.surface);
 
         VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
         VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presentModes);
-        VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
+        VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities, target.window);
+
+        // Every window is drawn with the same render pass 
+        if (&target != &windows[0] && surfaceFormat.format != windows[0].swapChainImageFormat)
+        {
+            throw std::runtime_error("Windows ended up with different swap chain formats!");
+        }
 
         // We sometimes may have to wait for internal operations to get
         // another image to render to. So, we simply add another in case 
@@ -800,7 +2276,7 @@ private: // Vukan helpers
 
         VkSwapchainCreateInfoKHR createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        createInfo.surface = surface; 
+        createInfo.surface = target.surface; 
 
         // Note: For image use if we want to perform postt processes 
         //       we may want to set it to VK_IMAGE_USAGE_TRANSFER_DST_BIT
@@ -812,6 +2288,29 @@ private: // Vukan helpers
         createInfo.imageArrayLayers = 1; // How many layers each image consists of 
         createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+        // Multiview and deferred shading render elsewhere and blit
+        // the result in 
+        if (multiviewEnabled || shadingEnabled)
+        {
+            if (!(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+            {
+                throw std::runtime_error("Swap chain images can not be blitted to!");
+            }
+
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+
+        // Readback copies the image out after it is drawn 
+        if (readbackEnabled)
+        {
+            if (!(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+            {
+                throw std::runtime_error("Swap chain images can not be copied from!");
+            }
+
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+
 
         // Need to coordinate whether our swapchains will be used
         // across multiple queue families. This can happen if our
@@ -848,23 +2347,28 @@ private: // Vukan helpers
         // Should alpha be used for blending 
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode = presentMode;
-        createInfo.clipped = VK_TRUE;
+        // Damage tracking draws on top of what an image showed last
+        // time, so pixels hidden behind other windows must be kept 
+        createInfo.clipped = damageTrackingEnabled ? VK_FALSE : VK_TRUE;
         // We may sometimes need to recreate the swap chain. Resizing and such 
         // Default is VK_NULL_HANDLE
         createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
+        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &target.swapChain) != VK_SUCCESS)
         {
             throw std::runtime_error("Failed to create swap chain!");
         }
 
         // Connect to the array of vkimages we have 
-        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-        swapChainImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+        vkGetSwapchainImagesKHR(device, target.swapChain, &imageCount, nullptr);
+        target.swapChainImages.resize(imageCount);
+        vkGetSwapchainImagesKHR(device, target.swapChain, &imageCount, target.swapChainImages.data());
+
+        target.swapChainImageFormat = surfaceFormat.format;
+        target.swapChainExtent = extent;
 
-        swapChainImageFormat = surfaceFormat.format;
-        swapChainExtent = extent;
+        // New images hold nothing worth keeping 
+        target.imageDrawnFrames.assign(imageCount, 0);
 
         // We now finally have a set of images we can draw to! 
     }
@@ -872,45 +2376,53 @@ private: // Vukan helpers
     /// <summary>
     /// Cleans up the swap chain and its resources 
     /// </summary>
-    void CleanupSwapChain()
+    void CleanupSwapChain(WindowTarget& target)
     {
-        for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
+        for (size_t i = 0; i < target.swapChainFramebuffers.size(); i++)
         {
-            vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+            vkDestroyFramebuffer(device, target.swapChainFramebuffers[i], nullptr);
         }
 
-        for (size_t i = 0; i < swapChainImageViews.size(); i++)
+        for (size_t i = 0; i < target.swapChainImageViews.size(); i++)
         {
-            vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+            vkDestroyImageView(device, target.swapChainImageViews[i], nullptr);
         }
 
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        vkDestroySwapchainKHR(device, target.swapChain, nullptr);
     }
 
     /// <summary>
     /// If the window surface changes at all make sure to 
-    /// recreate resources connected to it 
+    /// recreate resources connected to it. Returns false if
+    /// the window is minimized and has nothing to draw to 
     /// </summary>
-    void RecreateSwapChain()
+    bool RecreateSwapChain(WindowTarget& target)
     {
+        // Note: A minimized window keeps its old swap chain and is
+        //       skipped until it comes back. Blocking here like a
+        //       single window app would stall every other window 
         int width = 0, height = 0;
-        glfwGetFramebufferSize(window, &width, &height);
-        while (width == 0 || height == 0)
+        glfwGetFramebufferSize(target.window, &width, &height);
+        if (width == 0 || height == 0)
         {
-            // Handle minimizing 
-            glfwGetFramebufferSize(window, &width, &height);
-            glfwWaitEvents();
+            target.frameBufferResized = true;
+            return false;
         }
 
         // Note: This implementation requires us to 
         //       wait for all rendering to stop first 
         vkDeviceWaitIdle(device);
 
-        CleanupSwapChain();
+        CleanupSwapChain(target);
 
-        CreateSwapChain();
-        CreateImageViews();
-        CreateFrameBuffers();
+        CreateSwapChain(target);
+        CreateImageViews(target);
+        CreateFrameBuffers(target);
+        ResizeShadingTargets();
+        ResizeTransparencyTargets();
+
+        target.frameBufferResized = false;
+        return true;
     }
 
 
@@ -918,19 +2430,19 @@ private: // Vukan helpers
 
     #pragma region Image Views 
 
-    void CreateImageViews()
+    void CreateImageViews(WindowTarget& target)
     {
-        swapChainImageViews.resize(swapChainImages.size());
+        target.swapChainImageViews.resize(target.swapChainImages.size());
 
-        for (size_t i = 0; i < swapChainImages.size(); i++)
+        for (size_t i = 0; i < target.swapChainImages.size(); i++)
         {
             VkImageViewCreateInfo createInfo{};
             createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.image = swapChainImages[i];
+            createInfo.image = target.swapChainImages[i];
 
             // How should the data be interpreted? 
             createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = swapChainImageFormat;
+            createInfo.format = target.swapChainImageFormat;
 
             // Allow for color swizzling of each component 
             createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -945,7 +2457,7 @@ private: // Vukan helpers
             createInfo.subresourceRange.baseArrayLayer = 0;
             createInfo.subresourceRange.layerCount = 1;
 
-            if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS)
+            if (vkCreateImageView(device, &createInfo, nullptr, &target.swapChainImageViews[i]) != VK_SUCCESS)
             {
                 throw std::runtime_error("Failed to create image views!"); 
             }
@@ -966,7 +2478,7 @@ private: // Vukan helpers
     {
         // TODO: Automate the process of pipeline creation 
 
-        auto vertShaderCode = ReadFile("Shaders/vert.spv");
+        auto vertShaderCode = ReadFile(multiviewEnabled ? "Shaders/multiview.spv" : "Shaders/vert.spv");
         auto fragShaderCode = ReadFile("Shaders/frag.spv");
 
         VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
@@ -1063,15 +2575,15 @@ private: // Vukan helpers
         VkViewport viewport{};
         viewport.x = 0.0f;
         viewport.y = 0.0f;
-        viewport.width = (float)swapChainExtent.width;
-        viewport.height = (float)swapChainExtent.height;
+        viewport.width = (float)windows[0].swapChainExtent.width;
+        viewport.height = (float)windows[0].swapChainExtent.height;
         viewport.minDepth = 0.0f;
         viewport.maxDepth = 1.0f;
 
         // Draws the entire framebuffer 
         VkRect2D scissor{};
         scissor.offset = { 0, 0 };
-        scissor.extent = swapChainExtent;
+        scissor.extent = windows[0].swapChainExtent;
 
         VkPipelineViewportStateCreateInfo viewportState{};
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -1178,8 +2690,9 @@ private: // Vukan helpers
 
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 0;
-        pipelineLayoutInfo.pSetLayouts = nullptr;
+        // The multiview shader reads its per view matrices from set 0 
+        pipelineLayoutInfo.setLayoutCount = multiviewEnabled ? 1 : 0;
+        pipelineLayoutInfo.pSetLayouts = multiviewEnabled ? &viewDescriptorSetLayout : nullptr;
         pipelineLayoutInfo.pushConstantRangeCount = 0; // Another way to add dynamic values 
         pipelineLayoutInfo.pPushConstantRanges = nullptr; 
 
@@ -1291,9 +2804,10 @@ private: // Vukan helpers
 
 
 
-        // This format should match the format of the swap chain images
+        // This format should match the format of the swap chain images.
+        // CreateSwapChain makes sure every window agrees with the first
         VkAttachmentDescription colorAttachment{};
-        colorAttachment.format = swapChainImageFormat;
+        colorAttachment.format = windows[0].swapChainImageFormat;
         colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 
         // What to do with the data before and after rendering 
@@ -1314,6 +2828,12 @@ private: // Vukan helpers
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
+        // Multiview targets are copied into the swap chain afterwards 
+        if (multiviewEnabled)
+        {
+            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        }
+
         VkAttachmentReference colorAttachmentRef{};
         colorAttachmentRef.attachment = 0; // Index in attachment description array 
         colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
@@ -1338,6 +2858,18 @@ private: // Vukan helpers
         dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+        // The views have to be written before they get blitted out 
+        VkSubpassDependency blitDependency{};
+        blitDependency.srcSubpass = 0;
+        blitDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+
+        blitDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        blitDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        blitDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        blitDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        VkSubpassDependency dependencies[] = { dependency, blitDependency };
 
 
         VkRenderPassCreateInfo renderPassInfo{};
@@ -1347,8 +2879,25 @@ private: // Vukan helpers
         renderPassInfo.subpassCount = 1;
         renderPassInfo.pSubpasses = &subpass;
 
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
+        renderPassInfo.dependencyCount = multiviewEnabled ? 2 : 1;
+        renderPassInfo.pDependencies = dependencies;
+
+        // Multiview: the single subpass is broadcast to every view.
+        // Each set bit of the view mask is a layer of the framebuffer
+        // and the correlation mask hints that the views see mostly
+        // the same thing so the driver can share work between them 
+        uint32_t viewMask = (1u << viewCount) - 1;
+        VkRenderPassMultiviewCreateInfo multiviewInfo{};
+        multiviewInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+        multiviewInfo.subpassCount = 1;
+        multiviewInfo.pViewMasks = &viewMask;
+        multiviewInfo.correlationMaskCount = 1;
+        multiviewInfo.pCorrelationMasks = &viewMask;
+
+        if (multiviewEnabled)
+        {
+            renderPassInfo.pNext = &multiviewInfo;
+        }
 
 
 
@@ -1369,16 +2918,22 @@ private: // Vukan helpers
     /// <summary>
     /// Generates the frame buffers that will be used 
     /// </summary>
-    void CreateFrameBuffers()
+    void CreateFrameBuffers(WindowTarget& target)
     {
-        swapChainFramebuffers.resize(swapChainImageViews.size());
+        // Multiview never renders straight into the swap chain 
+        if (multiviewEnabled)
+        {
+            return;
+        }
+
+        target.swapChainFramebuffers.resize(target.swapChainImageViews.size());
 
         // Iterate through image views and create frame buffers
         // for each of them 
-        for (size_t i = 0; i < swapChainImageViews.size(); i++)
+        for (size_t i = 0; i < target.swapChainImageViews.size(); i++)
         {
             VkImageView attachments[] = {
-                swapChainImageViews[i]
+                target.swapChainImageViews[i]
             };
 
             // Need to define which render passes this swapchain is compatible with 
@@ -1387,11 +2942,11 @@ private: // Vukan helpers
             framebufferInfo.renderPass = renderPass;
             framebufferInfo.attachmentCount = 1;
             framebufferInfo.pAttachments = attachments;
-            framebufferInfo.width = swapChainExtent.width;
-            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.width = target.swapChainExtent.width;
+            framebufferInfo.height = target.swapChainExtent.height;
             framebufferInfo.layers = 1;
 
-            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &target.swapChainFramebuffers[i]) != VK_SUCCESS)
             {
                 throw std::runtime_error("Failed to create framebuffer");
             }
@@ -1455,7 +3010,7 @@ private: // Vukan helpers
     /// <summary>
     /// Writes the commands we want to executte in our command buffer 
     /// </summary>
-    void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+    void RecordCommandBuffer(VkCommandBuffer commandBuffer)
     {
         // Flags determine how we are using this command buffer
         //  VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT         Command buffer will be rerecorded after 
@@ -1476,21 +3031,108 @@ private: // Vukan helpers
             throw std::runtime_error("Failed to begin recording command buffer!");
         }
 
+        // ------------ Dynamic Data ------------
+
+        // Without a large BAR this frame's palettes, views, lights and
+        // the like were written to host memory, they go to VRAM first 
+        RecordDynamicUploads(commandBuffer, currentFrame);
+
+        // ------------ Compute Skinning ------------
+
+        // Must happen outside of the render pass. Every pass after
+        // this point reads the skinned vertices as-is
+        RecordSkinningPass(commandBuffer);
+
+        // ------------ Image Based Lighting ------------
+
+        // Relighting after the environment turned and rebuilding the
+        // sky after the sun moved, a little every frame 
+        RecordImageBasedLighting(commandBuffer);
+        RecordAtmosphere(commandBuffer);
+
+        // ------------ Export Pass ------------
+
+        RecordExportPass(commandBuffer);
+
+        // ------------ Window Passes ------------
+
+        if (multiviewEnabled)
+        {
+            // Every view is drawn once into the image array and then
+            // copied into whichever windows acquired an image 
+            RecordScenePass(commandBuffer, renderPass, viewFramebuffers[currentFrame], viewExtent);
+
+            for (const auto& target : windows)
+            {
+                if (target.acquired)
+                {
+                    RecordViewBlit(commandBuffer, target);
+                }
+            }
+        }
+        else
+        {
+            // Every window that acquired an image gets its own render
+            // pass in this one command buffer 
+            for (auto& target : windows)
+            {
+                if (!target.acquired)
+                {
+                    continue;
+                }
+
+                if (damageTrackingEnabled)
+                {
+                    RecordDamagedScenePass(commandBuffer, target);
+                }
+                else if (shadingEnabled)
+                {
+                    RecordLitScene(commandBuffer, target);
+                }
+                else
+                {
+                    RecordScenePass(commandBuffer, renderPass, target.swapChainFramebuffers[target.imageIndex], target.swapChainExtent);
+                }
+
+                // Whichever way the scene got there, bubbles go on top 
+                if (transparencyEnabled)
+                {
+                    RecordTransparentPass(commandBuffer, target);
+                }
+            }
+        }
+
+        // ------------ Readback ------------
+
+        RecordReadback(commandBuffer);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to record command buffer!");
+        }
+    }
 
+    /// <summary>
+    /// Records the render pass that draws the scene into a
+    /// framebuffer. Either the image a window acquired this 
+    /// frame or, with multiview, every layer of the view array 
+    /// </summary>
+    void RecordScenePass(VkCommandBuffer commandBuffer, VkRenderPass pass, VkFramebuffer framebuffer, VkExtent2D extent)
+    {
         // ------------ Starting Render Pass ------------
 
         // Not really sure if this is where it goes????
 
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.renderPass = pass;
         // Current swap chain frame buffer 
-        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        renderPassInfo.framebuffer = framebuffer;
 
         // Size of render area 
         // Any pixel outside the region will be undefinedd values 
         renderPassInfo.renderArea.offset = { 0, 0 };
-        renderPassInfo.renderArea.extent = swapChainExtent;
+        renderPassInfo.renderArea.extent = extent;
     
         // Setup default values when clearing the screen 
         VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
@@ -1505,43 +3147,68 @@ private: // Vukan helpers
 
         vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     
-        // ------------ Basic Drawing Commands ------------
-        
-        // Binding the command buffer to the graphics pipeline 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-
         // Note: We have already told the pipeline what information we need to send 
         //       so we are simply setting them up here before sending them over 
 
         VkViewport viewport{};
         viewport.x = 0.0f;
         viewport.y = 0.0f;
-        viewport.width = static_cast<float>(swapChainExtent.width);
-        viewport.height = static_cast<float>(swapChainExtent.height);
+        viewport.width = static_cast<float>(extent.width);
+        viewport.height = static_cast<float>(extent.height);
         viewport.minDepth = 0.0f;
         viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
         VkRect2D scissor{};
         scissor.offset = {0, 0};
-        scissor.extent = swapChainExtent;
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        scissor.extent = extent;
+
+        RecordSceneDraw(commandBuffer, viewport, scissor);
+
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    /// <summary>
+    /// Records the draw of the scene into whichever render pass is
+    /// active, mapped through viewport and cut to scissor 
+    /// </summary>
+    void RecordSceneDraw(VkCommandBuffer commandBuffer, const VkViewport& viewport, const VkRect2D& scissor)
+    {
+        // ------------ Basic Drawing Commands ------------
         
+        // Binding the command buffer to the graphics pipeline 
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+        // Per view matrices for the multiview shader 
+        if (multiviewEnabled)
+        {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                0, 1, &viewDescriptorSets[currentFrame], 0, nullptr);
+        }
+
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        RecordCharacterDraw(commandBuffer);
+    }
+
+    /// <summary>
+    /// Draws every character with whatever pipeline is bound 
+    /// </summary>
+    void RecordCharacterDraw(VkCommandBuffer commandBuffer)
+    {
+        // Draw from the post-skinned vertices rather than the bind pose
+        VkBuffer vertexBuffers[] = { skinnedVertexBuffer };
+        VkDeviceSize offsets[] = { 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+        // Every character's skinned copy of the mesh sits back to back
         vkCmdDraw(
-            commandBuffer, 
-            3,  // vertexCount
+            commandBuffer,
+            static_cast<uint32_t>(vertices.size()) * CHARACTER_COUNT,  // vertexCount
             1,  // instanceCount
             0,  // Offset to first vertex 
             0   // offset to first instance 
         );
-
-        vkCmdEndRenderPass(commandBuffer);
-
-        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
-        {
-            throw std::runtime_error("Failed to record command buffer!");
-        }
     }
 
     /// <summary>
@@ -1565,55 +3232,125 @@ private: // Vukan helpers
 
         // We want to wait for all the fences to return true 
         vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+        completedSubmission = (std::max)(completedSubmission, frameSubmissions[currentFrame]);
+
+        CollectReadbacks();
+        CollectShadingTimings();
+        CollectFoliageCounts();
+
+        // Acquire an image from every window's swap chain. A window
+        // that is minimized, out of date or has no image free yet
+        // just sits this frame out instead of holding up the others 
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkPipelineStageFlags> waitStages;
+        std::vector<VkSwapchainKHR> swapChains;
+        std::vector<uint32_t> imageIndices;
+        std::vector<WindowTarget*> presentedWindows;
+        bool anyImagePending = false;
+
+        for (auto& target : windows)
+        {
+            target.acquired = false;
+
+            if (target.frameBufferResized && !RecreateSwapChain(target))
+            {
+                continue;
+            }
 
-        // Acquire an image from the swap chain
-        uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+            VkResult result = vkAcquireNextImageKHR(device, target.swapChain, ACQUIRE_TIMEOUT_NS, target.imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &target.imageIndex);
 
-        // Check if swap chain is valid 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR)
-        {
-            // Swapchain out of date
-            RecreateSwapChain();
-            return;
+            // Check if swap chain is valid 
+            if (result == VK_ERROR_OUT_OF_DATE_KHR)
+            {
+                // Swapchain out of date
+                RecreateSwapChain(target);
+                continue;
+            }
+            else if (result == VK_TIMEOUT || result == VK_NOT_READY)
+            {
+                // Every image is still queued for presentation, the
+                // semaphore is left unsignaled so try again next frame 
+                anyImagePending = true;
+                continue;
+            }
+            else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+            {
+                // Swapchain unobtainable 
+                throw std::runtime_error("Failed to aquire swap chain image!");
+            }
+
+            target.acquired = true;
+            waitSemaphores.push_back(target.imageAvailableSemaphores[currentFrame]);
+            waitStages.push_back(multiviewEnabled ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+            swapChains.push_back(target.swapChain);
+            imageIndices.push_back(target.imageIndex);
+            presentedWindows.push_back(&target);
         }
-        else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+
+        // Nothing to draw into (e.g. every window minimized) so
+        // wait for something to happen rather than spinning. If a
+        // window only timed out the frame is retried straight away,
+        // the acquire timeout already paces the loop 
+        if (presentedWindows.empty())
         {
-            // Swapchain unobtainable 
-            throw std::runtime_error("Failed to aquire swap chain image!");
+            if (anyImagePending)
+            {
+                frameDirty |= DIRTY_REFRESH;
+                return;
+            }
+
+            glfwWaitEvents();
+            return;
         }
 
         // Only reset the fence after we know the swapchain is valid 
         vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
+        UpdateAnimation();
+        UpdateViews();
+        UpdateLights();
+        UpdateTerrain();
+        UpdateDamage();
+        BeginExportFrame();
+        BeginReadbackFrame();
+
 
         // Record command buffer
         //  Second param is a flag for resting the command buffer 
         vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-        RecordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+        RecordCommandBuffer(commandBuffers[currentFrame]);
 
         // Submit the command buffer 
+        //  One submission covers every window and waits on each
+        //  of their image available semaphores 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] }; // Adds semaphore 
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores; 
-        submitInfo.pWaitDstStageMask = waitStages;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data(); 
+        submitInfo.pWaitDstStageMask = waitStages.data();
 
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
         // What to signal after command buffers have finished execution 
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = signalSemaphores; 
+        //  An exported image also tells its consumer when it is done 
+        std::vector<VkSemaphore> signalSemaphores = { renderFinishedSemaphores[currentFrame] };
+        if (exportImageIndex >= 0)
+        {
+            signalSemaphores.push_back(exportReadySemaphores[exportImageIndex]);
+        }
+        submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+        submitInfo.pSignalSemaphores = signalSemaphores.data(); 
 
         if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
         {
             throw std::runtime_error("Failed to submit draw command buffer");
         }
+        frameSubmissions[currentFrame] = ++submissionCount;
+
+        EndExportFrame();
+        EndReadbackFrame();
 
 
         // Presentation 
@@ -1621,31 +3358,56 @@ private: // Vukan helpers
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
         presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = signalSemaphores;
-
-        VkSwapchainKHR swapChains[]{ swapChain };
-        presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = swapChains;
-        presentInfo.pImageIndices = &imageIndex; 
+        presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrame];
+
+        // Every swap chain is presented in a single call 
+        presentInfo.swapchainCount = static_cast<uint32_t>(swapChains.size());
+        presentInfo.pSwapchains = swapChains.data();
+        presentInfo.pImageIndices = imageIndices.data(); 
+
+        // Holds a VkResult per swap chain so that each window can
+        // react to its own result 
+        std::vector<VkResult> presentResults(swapChains.size(), VK_SUCCESS);
+        presentInfo.pResults = presentResults.data();
+
+        // Tells the compositor which parts of each image changed. A
+        // window without rectangles was drawn in full 
+        std::vector<VkPresentRegionKHR> presentRegions;
+        VkPresentRegionsKHR presentRegionsInfo{};
+        if (damageTrackingEnabled && incrementalPresentSupported)
+        {
+            for (const WindowTarget* target : presentedWindows)
+            {
+                presentRegions.push_back({ static_cast<uint32_t>(target->presentRects.size()), target->presentRects.data() });
+            }
 
-        // Can be used to hold an array of VkResult to check if each
-        // swap chain is successful 
-        presentInfo.pResults = nullptr;
+            presentRegionsInfo.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR;
+            presentRegionsInfo.swapchainCount = static_cast<uint32_t>(presentRegions.size());
+            presentRegionsInfo.pRegions = presentRegions.data();
+            presentInfo.pNext = &presentRegionsInfo;
+        }
 
-        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
-        // Check if present queue is valid 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || frameBufferResized)
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)
         {
-            // We want to do this after presenting to make sure
-            // that the semaphores we have connected to vulkan 
-            // are in a consistent state 
-            frameBufferResized = false; 
-            RecreateSwapChain();
+            throw std::runtime_error("Failed to present swap chain image!");
         }
-        else if (result != VK_SUCCESS)
+
+        for (size_t i = 0; i < presentedWindows.size(); i++)
         {
-            throw std::runtime_error("Failed to present swap chain image!");
+            // Check if present queue is valid 
+            if (presentResults[i] == VK_ERROR_OUT_OF_DATE_KHR || presentResults[i] == VK_SUBOPTIMAL_KHR)
+            {
+                // Recreated on the next acquire, after presenting, to 
+                // make sure that the semaphores we have connected to 
+                // vulkan are in a consistent state 
+                presentedWindows[i]->frameBufferResized = true;
+            }
+            else if (presentResults[i] != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to present swap chain image!");
+            }
         }
 
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
@@ -1656,9 +3418,9 @@ private: // Vukan helpers
     /// </summary>
     void CreateSyncObjects()
     {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
         renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
         inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+        frameSubmissions.assign(MAX_FRAMES_IN_FLIGHT, 0);
 
         VkSemaphoreCreateInfo semaphoreInfo{};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1669,8 +3431,7 @@ private: // Vukan helpers
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
-            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
                 vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
             {
                 throw std::runtime_error("Failed to create synchronization objects for a frame!");
@@ -1678,6 +3439,21 @@ private: // Vukan helpers
             
         }
 
+        // Each window acquires its own image so each needs its own
+        // semaphore per frame in flight 
+        for (auto& target : windows)
+        {
+            target.imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            {
+                if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &target.imageAvailableSemaphores[i]) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("Failed to create synchronization objects for a frame!");
+                }
+            }
+        }
+
         //VkSemaphoreCreateInfo semaphoreInfo{};
         //semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
         //
@@ -1697,7 +3473,17 @@ private: // Vukan helpers
     static void FramebufferResizeCallback(GLFWwindow* window, int width, int height)
     {
         auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-        app->frameBufferResized = true; 
+
+        // Only the window that was resized needs a new swap chain 
+        for (auto& target : app->windows)
+        {
+            if (target.window == window)
+            {
+                target.frameBufferResized = true; 
+            }
+        }
+
+        app->frameDirty |= DIRTY_RESIZE;
     }
 
 
@@ -1777,48 +3563,9736 @@ private: // Vukan helpers
         {{-0.5f,  0.5f}, {0.0f, 0.0f, 1.0f}}
     };
 
-    #pragma endregion 
-    
-private: // Main functions 
-    void InitWindow()
+    #pragma endregion
+
+    #pragma region Buffers
+
+    /// <summary>
+    /// Finds a memory type on the GPU that is allowed by the
+    /// filter and has all of the requested properties
+    /// </summary>
+    uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
     {
-        glfwInit();
+        // Note: Memory heaps are distinct resources like VRAM or the
+        //       swap space in RAM. Types live inside those heaps
 
-        // Tell application to not create an OpenGL context 
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
 
+        // Note: A type that is device local and host visible at once is
+        //       the BAR, or all memory on UMA. Buffers that did not ask
+        //       for both stay out of it while another type will do, so
+        //       the small BAR is left to the data that wants it 
+        const VkMemoryPropertyFlags placement = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        const VkMemoryPropertyFlags unwanted = placement & ~properties;
 
-        // Generate window 
-        //      Fourth parameter lets us choose a montitor to open to
-        //      Fifth parameter is only relevant to OpenGL
-        window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-        glfwSetWindowUserPointer(window, this); // Setsup user pointer 
-        glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
+        uint32_t found = UINT32_MAX;
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+        {
+            // The filter is a bitfield of the suitable types
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                if ((memProperties.memoryTypes[i].propertyFlags & unwanted) == 0)
+                {
+                    return i;
+                }
+
+                found = (std::min)(found, i);
+            }
+        }
+
+        if (found != UINT32_MAX)
+        {
+            return found;
+        }
+
+        throw std::runtime_error("Failed to find suitable memory type!");
     }
 
-    void InitVulkan() 
+    /// <summary>
+    /// Whether any memory type allowed by the filter has all of the
+    /// requested properties 
+    /// </summary>
+    bool HasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
     {
-        CreateInstance();
-        SetupDebugMessenger();
-        CreateSurface();
-        PickPhysicalDevice();
-        CreateLogicalDevice();
-        CreateSwapChain();
-        CreateImageViews();
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+        {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// <summary>
+    /// Creates a buffer and allocates and binds memory for it
+    /// </summary>
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+    {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        // Only used by the graphics queue family
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+
+        // Note: Real applications should not call vkAllocateMemory for
+        //       every buffer since the allocation count is limited
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate buffer memory!");
+        }
+
+        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    }
+
+    /// <summary>
+    /// Creates a device local buffer and fills it with the
+    /// given data through a temporary staging buffer
+    /// </summary>
+    void CreateDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+    {
+        // The staging buffer is the only one the CPU can see
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            stagingBuffer, stagingBufferMemory);
+
+        void* mapped;
+        vkMapMemory(device, stagingBufferMemory, 0, size, 0, &mapped);
+        memcpy(mapped, data, (size_t)size);
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        CreateBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+        CopyBuffer(stagingBuffer, buffer, size);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Creates a buffer over host memory the GPU reads in place, such
+    /// as a mapped file, which has to outlive it. The pointer and size
+    /// have to be multiples of minImportedHostPointerAlignment. Returns
+    /// false when the driver cannot import the memory, the caller then
+    /// takes the staging path. On UMA devices the memory may be device
+    /// local, deviceLocal says so, and the buffer is as good as any
+    /// other for vertices 
+    /// </summary>
+    bool ImportHostBuffer(const void* pointer, VkDeviceSize size, VkBufferUsageFlags usage,
+        VkBuffer& buffer, VkDeviceMemory& bufferMemory, bool* deviceLocal = nullptr)
+    {
+        const VkExternalMemoryHandleTypeFlagBits handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+        if (!externalHostMemorySupported || pointer == nullptr || size == 0 ||
+            reinterpret_cast<uintptr_t>(pointer) % minImportedHostPointerAlignment != 0 || size % minImportedHostPointerAlignment != 0)
+        {
+            return false;
+        }
+
+        // Note: Which memory types fit depends on the pointer, some
+        //       drivers only take anonymous memory and refuse files 
+        auto getHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+        VkMemoryHostPointerPropertiesEXT pointerProperties{};
+        pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+        if (getHostPointerProperties == nullptr ||
+            getHostPointerProperties(device, handleType, pointer, &pointerProperties) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        VkExternalMemoryBufferCreateInfo externalInfo{};
+        externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+        externalInfo.handleTypes = handleType;
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.pNext = &externalInfo;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+        // Device local first, it only exists on UMA 
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        uint32_t typeBits = memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits;
+        uint32_t memoryType = UINT32_MAX;
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+        {
+            bool local = (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+            if ((typeBits & (1u << i)) && (memoryType == UINT32_MAX || local))
+            {
+                memoryType = i;
+                if (local)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (memoryType == UINT32_MAX || memRequirements.size > size)
+        {
+            vkDestroyBuffer(device, buffer, nullptr);
+            return false;
+        }
+
+        VkImportMemoryHostPointerInfoEXT importInfo{};
+        importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+        importInfo.handleType = handleType;
+        importInfo.pHostPointer = const_cast<void*>(pointer);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = &importInfo;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+        {
+            vkDestroyBuffer(device, buffer, nullptr);
+            return false;
+        }
+
+        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+
+        if (deviceLocal != nullptr)
+        {
+            *deviceLocal = (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Allocates and begins a command buffer meant to be
+    /// submitted only once
+    /// </summary>
+    VkCommandBuffer BeginSingleTimeCommands()
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        return commandBuffer;
+    }
+
+    /// <summary>
+    /// Submits a single time command buffer and waits for
+    /// it to finish before freeing it
+    /// </summary>
+    void EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+    {
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        vkQueueWaitIdle(graphicsQueue);
+
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    }
+
+    /// <summary>
+    /// Copies the contents of one buffer into another
+    /// </summary>
+    void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+    {
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = 0;
+        copyRegion.dstOffset = 0;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+        EndSingleTimeCommands(commandBuffer);
+    }
+
+    #pragma endregion
+
+    #pragma region Memory Placement
+
+    // Note: Where buffers live is decided by what they are for rather
+    //       than by memory flags at every call site:
+    //
+    //           MEMORY_DEVICE   only the GPU touches it
+    //           MEMORY_UPLOAD   the CPU writes it once, a copy reads it
+    //           MEMORY_DYNAMIC  the CPU rewrites it every frame and
+    //                           shaders read it
+    //
+    //       Dynamic data goes straight into device local memory the CPU
+    //       can map when there is plenty of it: resizable BAR exposes
+    //       all of VRAM that way and on UMA every heap is both. With
+    //       only the classic 256 MB window, or none, it is written to
+    //       host memory and copied into VRAM at the start of the frame,
+    //       so shaders never read across the bus 
+
+    /// <summary>
+    /// Looks at the heaps of the picked device and decides where
+    /// dynamic data goes 
+    /// </summary>
+    void QueryMemoryPlacement()
+    {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        unifiedMemory = true;
+        for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++)
+        {
+            unifiedMemory = unifiedMemory && (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        }
+
+        const VkMemoryPropertyFlags direct = PlacementProperties(MEMORY_DYNAMIC, true);
+        mappableDeviceLocalSize = 0;
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+        {
+            if ((memProperties.memoryTypes[i].propertyFlags & direct) == direct)
+            {
+                VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[i].heapIndex].size;
+                mappableDeviceLocalSize = (std::max)(mappableDeviceLocalSize, heapSize);
+            }
+        }
+
+        largeBarAvailable = mappableDeviceLocalSize > CLASSIC_BAR_SIZE;
+        if (dynamicPlacement == "direct")
+        {
+            dynamicDirect = mappableDeviceLocalSize > 0;
+            if (!dynamicDirect)
+            {
+                std::cout << "No device local memory the CPU can map, staging per-frame data after all" << std::endl;
+            }
+        }
+        else if (dynamicPlacement == "staged")
+        {
+            dynamicDirect = false;
+        }
+        else
+        {
+            dynamicDirect = unifiedMemory || largeBarAvailable;
+        }
+
+        dynamicUploads.assign(MAX_FRAMES_IN_FLIGHT, {});
+
+        std::cout << "Per-frame data " << (dynamicDirect ? "written directly into " : "staged in host memory, ")
+            << (unifiedMemory ? "unified memory" : largeBarAvailable ? "resizable BAR" : mappableDeviceLocalSize > 0 ? "small BAR" : "no mappable VRAM");
+        if (mappableDeviceLocalSize > 0 && !unifiedMemory)
+        {
+            std::cout << " of " << (mappableDeviceLocalSize >> 20) << " MB";
+        }
+        std::cout << std::endl;
+    }
+
+    /// <summary>
+    /// The memory properties a buffer of this usage asks for. Dynamic
+    /// data asks for device local memory only when written directly 
+    /// </summary>
+    VkMemoryPropertyFlags PlacementProperties(MemoryUsage usage, bool direct)
+    {
+        switch (usage)
+        {
+        case MEMORY_UPLOAD:
+            return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        case MEMORY_DYNAMIC:
+            return direct ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT :
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        default:
+            return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        }
+    }
+
+    /// <summary>
+    /// Creates a buffer for data the CPU rewrites every frame, for one
+    /// frame in flight. mapped is where the CPU writes, either the
+    /// buffer itself or its staging buffer, which RecordDynamicUploads
+    /// copies over. Destroy it with DestroyDynamicBuffer 
+    /// </summary>
+    void CreateDynamicBuffer(uint32_t frame, VkDeviceSize size, VkBufferUsageFlags usage,
+        VkBuffer& buffer, VkDeviceMemory& bufferMemory, void*& mapped)
+    {
+        if (dynamicDirect)
+        {
+            CreateBuffer(size, usage, PlacementProperties(MEMORY_DYNAMIC, true), buffer, bufferMemory);
+            vkMapMemory(device, bufferMemory, 0, size, 0, &mapped);
+            return;
+        }
+
+        CreateBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, PlacementProperties(MEMORY_DYNAMIC, false), buffer, bufferMemory);
+
+        DynamicUpload upload{};
+        upload.buffer = buffer;
+        upload.size = size;
+        CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, PlacementProperties(MEMORY_UPLOAD, false),
+            upload.stagingBuffer, upload.stagingMemory);
+        vkMapMemory(device, upload.stagingMemory, 0, size, 0, &mapped);
+
+        dynamicUploads[frame].push_back(upload);
+    }
+
+    void DestroyDynamicBuffer(uint32_t frame, VkBuffer buffer, VkDeviceMemory bufferMemory)
+    {
+        std::vector<DynamicUpload>& uploads = dynamicUploads[frame];
+        for (auto it = uploads.begin(); it != uploads.end(); ++it)
+        {
+            if (it->buffer == buffer)
+            {
+                vkDestroyBuffer(device, it->stagingBuffer, nullptr);
+                vkFreeMemory(device, it->stagingMemory, nullptr);
+                uploads.erase(it);
+                break;
+            }
+        }
+
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, bufferMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Copies this frame's staged dynamic data into place. Recorded
+    /// first, so every pass after it reads this frame's data 
+    /// </summary>
+    void RecordDynamicUploads(VkCommandBuffer commandBuffer, uint32_t frame)
+    {
+        if (dynamicUploads.empty() || dynamicUploads[frame].empty())
+        {
+            return;
+        }
+
+        for (const DynamicUpload& upload : dynamicUploads[frame])
+        {
+            VkBufferCopy copyRegion{ 0, 0, upload.size };
+            vkCmdCopyBuffer(commandBuffer, upload.stagingBuffer, upload.buffer, 1, &copyRegion);
+        }
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    /// <summary>
+    /// Times per-frame data of a few sizes in every placement the
+    /// device offers: the CPU rewrites all of it, then the GPU reads
+    /// it several times over, here as scans 
+    /// </summary>
+    void RunMemoryBenchmark()
+    {
+        const VkDeviceSize sizes[] = { 1ull << 20, 16ull << 20, 64ull << 20 };
+        const uint32_t FRAMES = 32;
+        const uint32_t READS = 4;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        bool timestamps = properties.limits.timestampComputeAndGraphics == VK_TRUE;
+
+        // Note: Reading in place from host memory is what every frame
+        //       did before, device local is only there with a BAR 
+        struct Placement
+        {
+            const char* name;
+            VkMemoryPropertyFlags properties;
+            bool staged;
+        };
+        std::vector<Placement> placements = {
+            { "host memory", PlacementProperties(MEMORY_UPLOAD, false), false },
+            { "staged", PlacementProperties(MEMORY_DYNAMIC, false), true },
+        };
+        if (mappableDeviceLocalSize > 0)
+        {
+            placements.push_back({ "device local", PlacementProperties(MEMORY_DYNAMIC, true), false });
+        }
+
+        std::cout << "Dynamic memory on " << properties.deviceName << ", " << READS << " reads per frame, "
+            << (timestamps ? "GPU timestamps" : "timed on the CPU") << std::endl;
+
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        if (timestamps)
+        {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2;
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create memory benchmark query pool!");
+            }
+        }
+
+        std::mt19937 random(125);
+        for (VkDeviceSize size : sizes)
+        {
+            uint32_t count = static_cast<uint32_t>(size / sizeof(uint32_t));
+            std::string label = std::to_string(size >> 20) + " MB";
+            if (size > properties.limits.maxStorageBufferRange || Primitives::PartitionCount(count) > primitivesMaxPartitions)
+            {
+                std::cout << "Stopping before " << label << ", more than one dispatch can take" << std::endl;
+                break;
+            }
+
+            // Two frames of data so every frame writes something new.
+            // Small values keep the scan's sums in range 
+            std::array<std::vector<uint32_t>, 2> frames;
+            for (std::vector<uint32_t>& data : frames)
+            {
+                data.resize(count);
+                for (uint32_t& value : data)
+                {
+                    value = random() & 3u;
+                }
+            }
+
+            VkBuffer output;
+            VkDeviceMemory outputMemory;
+            CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, PlacementProperties(MEMORY_DEVICE, false), output, outputMemory);
+
+            for (const Placement& placement : placements)
+            {
+                // A small BAR may not hold the larger sizes 
+                VkBuffer buffer = VK_NULL_HANDLE;
+                VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+                VkBuffer stagingBuffer = VK_NULL_HANDLE;
+                VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+                try
+                {
+                    CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        placement.properties, buffer, bufferMemory);
+                    if (placement.staged)
+                    {
+                        CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, PlacementProperties(MEMORY_UPLOAD, false),
+                            stagingBuffer, stagingMemory);
+                    }
+                }
+                catch (const std::runtime_error&)
+                {
+                    std::cout << "  " << std::left << std::setw(14) << placement.name << std::setw(8) << label
+                        << std::right << "does not fit" << std::endl;
+                    vkDestroyBuffer(device, buffer, nullptr);
+                    vkFreeMemory(device, bufferMemory, nullptr);
+                    vkDestroyBuffer(device, stagingBuffer, nullptr);
+                    continue;
+                }
+
+                void* mapped;
+                vkMapMemory(device, placement.staged ? stagingMemory : bufferMemory, 0, size, 0, &mapped);
+                PrimitiveBindings bindings = CreatePrimitiveBindings(count, false, buffer, output);
+
+                // Orders the upload, the scans and their state resets 
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                const VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+                // The first frame only warms up 
+                double writeMilliseconds = 0.0;
+                double gpuMilliseconds = 0.0;
+                double frameMilliseconds = 0.0;
+                for (uint32_t frame = 0; frame <= FRAMES; frame++)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    memcpy(mapped, frames[frame & 1].data(), static_cast<size_t>(size));
+                    auto written = std::chrono::steady_clock::now();
+
+                    VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+                    if (queryPool != VK_NULL_HANDLE)
+                    {
+                        vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+                        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+                    }
+
+                    if (placement.staged)
+                    {
+                        VkBufferCopy copyRegion{ 0, 0, size };
+                        vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+                    }
+
+                    for (uint32_t read = 0; read < READS; read++)
+                    {
+                        vkCmdPipelineBarrier(commandBuffer, stages, stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+                        RecordScan(commandBuffer, bindings, count);
+                    }
+
+                    if (queryPool != VK_NULL_HANDLE)
+                    {
+                        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+                    }
+                    EndSingleTimeCommands(commandBuffer);
+                    auto end = std::chrono::steady_clock::now();
+
+                    if (frame == 0)
+                    {
+                        continue;
+                    }
+
+                    writeMilliseconds += std::chrono::duration<double, std::milli>(written - start).count();
+                    frameMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+                    if (queryPool != VK_NULL_HANDLE)
+                    {
+                        uint64_t ticks[2];
+                        vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                        gpuMilliseconds += static_cast<double>(ticks[1] - ticks[0]) * properties.limits.timestampPeriod / 1e6;
+                    }
+                    else
+                    {
+                        gpuMilliseconds += std::chrono::duration<double, std::milli>(end - written).count();
+                    }
+                }
+
+                writeMilliseconds /= FRAMES;
+                gpuMilliseconds /= FRAMES;
+                frameMilliseconds /= FRAMES;
+                std::cout << "  " << std::left << std::setw(14) << placement.name << std::setw(8) << label << std::right
+                    << std::fixed << std::setprecision(3) << "write " << std::setw(8) << writeMilliseconds << " ms "
+                    << std::setprecision(1) << std::setw(7) << size / writeMilliseconds / 1e6 << " GB/s   GPU "
+                    << std::setprecision(3) << std::setw(8) << gpuMilliseconds << " ms   frame "
+                    << std::setw(8) << frameMilliseconds << " ms" << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                std::cout << std::setprecision(6);
+
+                DestroyPrimitiveBindings(bindings);
+                vkUnmapMemory(device, placement.staged ? stagingMemory : bufferMemory);
+                vkDestroyBuffer(device, buffer, nullptr);
+                vkFreeMemory(device, bufferMemory, nullptr);
+                if (placement.staged)
+                {
+                    vkDestroyBuffer(device, stagingBuffer, nullptr);
+                    vkFreeMemory(device, stagingMemory, nullptr);
+                }
+            }
+
+            vkDestroyBuffer(device, output, nullptr);
+            vkFreeMemory(device, outputMemory, nullptr);
+        }
+
+        if (queryPool != VK_NULL_HANDLE)
+        {
+            vkDestroyQueryPool(device, queryPool, nullptr);
+        }
+
+        std::cout << "Frames here use " << (dynamicDirect ? "device local" : "staged") << " dynamic data" << std::endl;
+    }
+
+    #pragma endregion
+
+    #pragma region Images
+
+    /// <summary>
+    /// The first of the candidates whose optimal tiling has all of the
+    /// features 
+    /// </summary>
+    VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkFormatFeatureFlags features)
+    {
+        for (VkFormat format : candidates)
+        {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+            if ((properties.optimalTilingFeatures & features) == features)
+            {
+                return format;
+            }
+        }
+
+        throw std::runtime_error("Failed to find a supported format!");
+    }
+
+    /// <summary>
+    /// Bytes a texel of a render target or swap chain format takes 
+    /// </summary>
+    static uint32_t FormatBytes(VkFormat format)
+    {
+        switch (format)
+        {
+        case VK_FORMAT_D16_UNORM:
+            return 2;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+        case VK_FORMAT_R16G16_SNORM:
+        case VK_FORMAT_R16G16_SFLOAT:
+        case VK_FORMAT_R32_SFLOAT:
+        case VK_FORMAT_D32_SFLOAT:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+            return 4;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+            return 8;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return 16;
+        default:
+            // Whatever else a surface may offer is almost always 32 bit 
+            return 4;
+        }
+    }
+
+    /// <summary>
+    /// Creates a 2D image, or an array of them when layerCount is
+    /// above one, and binds freshly allocated memory to it
+    /// </summary>
+    void CreateImage(uint32_t width, uint32_t height, uint32_t layerCount, VkFormat format,
+        VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory,
+        const void* imageNext = nullptr, void* allocNext = nullptr, uint32_t mipLevels = 1, VkImageCreateFlags flags = 0)
+    {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.pNext = imageNext;
+        imageInfo.flags = flags;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = width;
+        imageInfo.extent.height = height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = layerCount;
+        imageInfo.format = format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create image!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+        // Lazily allocated memory only exists on tiled GPUs, anywhere
+        // else a transient attachment gets ordinary memory 
+        if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0 && !HasMemoryType(memRequirements.memoryTypeBits, properties))
+        {
+            properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        }
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.pNext = allocNext;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate image memory!");
+        }
+
+        vkBindImageMemory(device, image, imageMemory, 0);
+    }
+
+    /// <summary>
+    /// Creates a 3D image with a single mip level and binds freshly
+    /// allocated memory to it
+    /// </summary>
+    void CreateImage3D(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+        VkImage& image, VkDeviceMemory& imageMemory)
+    {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_3D;
+        imageInfo.extent = extent;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create 3D image!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate image memory!");
+        }
+
+        vkBindImageMemory(device, image, imageMemory, 0);
+    }
+
+    /// <summary>
+    /// Creates a view over every layer of an image
+    /// </summary>
+    VkImageView CreateImageView(VkImage image, VkImageViewType viewType, VkFormat format,
+        VkImageAspectFlags aspectFlags, uint32_t layerCount, uint32_t baseMipLevel = 0, uint32_t levelCount = 1)
+    {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = viewType;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = aspectFlags;
+        viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+        viewInfo.subresourceRange.levelCount = levelCount;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = layerCount;
+
+        VkImageView imageView;
+        if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create image view!");
+        }
+
+        return imageView;
+    }
+
+    /// <summary>
+    /// The usage to create an image with that is filled from the CPU
+    /// by UploadImage. Host image copy is only used where it costs
+    /// the GPU nothing when it later reads the image 
+    /// </summary>
+    VkImageUsageFlags HostUploadUsage(VkFormat format, VkImageUsageFlags usage, VkImageCreateFlags flags = 0)
+    {
+        if (!hostImageCopySupported)
+        {
+            return usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+
+        VkPhysicalDeviceImageFormatInfo2 formatInfo{};
+        formatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+        formatInfo.format = format;
+        formatInfo.type = VK_IMAGE_TYPE_2D;
+        formatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        formatInfo.usage = usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+        formatInfo.flags = flags;
+
+        // Note: Some devices lay images out differently once the host
+        //       may copy into them, which can slow down every read.
+        //       Those keep the staging buffer 
+        VkHostImageCopyDevicePerformanceQueryEXT performance{};
+        performance.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT;
+
+        VkImageFormatProperties2 formatProperties{};
+        formatProperties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+        formatProperties.pNext = &performance;
+
+        if (vkGetPhysicalDeviceImageFormatProperties2(physicalDevice, &formatInfo, &formatProperties) != VK_SUCCESS ||
+            performance.optimalDeviceAccess != VK_TRUE)
+        {
+            return usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+
+        return usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+    }
+
+    /// <summary>
+    /// Fills regions of an image from CPU memory, which may also be a
+    /// mapped file. Offsets in the regions count from data. The image
+    /// goes from oldLayout to newLayout and is ready for dstStage and
+    /// dstAccess afterwards. Images created with HostUploadUsage are
+    /// copied into on the CPU, all others through a staging buffer 
+    /// </summary>
+    void UploadImage(VkImage image, VkImageUsageFlags usage, const void* data, VkDeviceSize size,
+        const std::vector<VkBufferImageCopy>& regions, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+    {
+        const VkImageSubresourceRange everything = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+
+        if (usage & VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT)
+        {
+            auto transitionImageLayout = (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(device, "vkTransitionImageLayoutEXT");
+            auto copyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(device, "vkCopyMemoryToImageEXT");
+            if (transitionImageLayout == nullptr || copyMemoryToImage == nullptr)
+            {
+                throw std::runtime_error("Failed to load the host image copy functions!");
+            }
+
+            // GENERAL is always one of the layouts the host may copy
+            // into, the final one saves a second transition 
+            bool copyToFinal = std::find(hostCopyDstLayouts.begin(), hostCopyDstLayouts.end(), newLayout) != hostCopyDstLayouts.end();
+            VkImageLayout copyLayout = copyToFinal ? newLayout : VK_IMAGE_LAYOUT_GENERAL;
+
+            VkHostImageLayoutTransitionInfoEXT transition{};
+            transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+            transition.image = image;
+            transition.subresourceRange = everything;
+            if (oldLayout != copyLayout)
+            {
+                transition.oldLayout = oldLayout;
+                transition.newLayout = copyLayout;
+                if (transitionImageLayout(device, 1, &transition) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("Failed to transition image on the host!");
+                }
+            }
+
+            std::vector<VkMemoryToImageCopyEXT> copies(regions.size());
+            for (size_t i = 0; i < regions.size(); i++)
+            {
+                copies[i].sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+                copies[i].pHostPointer = static_cast<const uint8_t*>(data) + regions[i].bufferOffset;
+                copies[i].memoryRowLength = regions[i].bufferRowLength;
+                copies[i].memoryImageHeight = regions[i].bufferImageHeight;
+                copies[i].imageSubresource = regions[i].imageSubresource;
+                copies[i].imageOffset = regions[i].imageOffset;
+                copies[i].imageExtent = regions[i].imageExtent;
+            }
+
+            VkCopyMemoryToImageInfoEXT copyInfo{};
+            copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+            copyInfo.dstImage = image;
+            copyInfo.dstImageLayout = copyLayout;
+            copyInfo.regionCount = static_cast<uint32_t>(copies.size());
+            copyInfo.pRegions = copies.data();
+            if (copyMemoryToImage(device, &copyInfo) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to copy memory to image!");
+            }
+
+            if (copyLayout != newLayout)
+            {
+                transition.oldLayout = copyLayout;
+                transition.newLayout = newLayout;
+                if (transitionImageLayout(device, 1, &transition) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("Failed to transition image on the host!");
+                }
+            }
+
+            // Note: Host writes are made visible to the GPU by the next
+            //       queue submission, nothing to record 
+            return;
+        }
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* mapped;
+        vkMapMemory(device, stagingBufferMemory, 0, size, 0, &mapped);
+        memcpy(mapped, data, static_cast<size_t>(size));
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = everything;
+        barrier.srcAccessMask = oldLayout == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            oldLayout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()), regions.data());
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = newLayout;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = dstAccess;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        EndSingleTimeCommands(commandBuffer);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Same as the main render pass except the image is left in the
+    /// given layout for whoever reads it afterwards 
+    /// </summary>
+    VkRenderPass CreateOffscreenRenderPass(VkFormat format, VkImageLayout finalLayout)
+    {
+        VkAttachmentDescription colorAttachment{};
+        colorAttachment.format = format;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = finalLayout;
+
+        VkAttachmentReference colorAttachmentRef{};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &colorAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+
+        VkRenderPass offscreenRenderPass;
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &offscreenRenderPass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create offscreen render pass!");
+        }
+        return offscreenRenderPass;
+    }
+
+    #pragma endregion
+
+    #pragma region Compute Primitives
+
+    // Note: Parallel building blocks for compute passes, see
+    //       Primitives.h for what they do and how they share state.
+    //       A set of buffers to work on is described once by a
+    //       PrimitiveBindings, and any of them is recorded into a
+    //       command buffer like a regular dispatch:
+    //
+    //           RecordScan          destination = exclusive scan of source
+    //           RecordCompact       destination = source where the flag
+    //                               in source extra is set, their count
+    //                               in destination extra
+    //           RecordRadixSort     sorts source, and source extra along
+    //                               with it for pairs, in place. The
+    //                               destinations are scratch
+    //
+    //       Whatever reads the results needs a barrier after them.
+    //
+    //       Every kernel comes in variants: on shared memory alone, and
+    //       on subgroup arithmetic once per subgroup size the device
+    //       lets a pipeline ask for, told to the shader through a
+    //       specialization constant. Which one is fastest differs a lot
+    //       between a GPU and the wide SIMD of a software rasterizer, so
+    //       a short benchmark at startup picks one per kernel 
+
+    /// <summary>
+    /// Push constants handed to every primitive. Matches
+    /// PrimitivePushConstants in primitives.glsl
+    /// </summary>
+    struct PrimitivePushConstants
+    {
+        uint32_t count;
+        uint32_t partitionCount;
+        uint32_t pass;
+    };
+
+    /// <summary>
+    /// The buffers a primitive works on and the state it passes sums
+    /// between partitions through, sized for up to capacity items 
+    /// </summary>
+    struct PrimitiveBindings
+    {
+        uint32_t capacity = 0;
+        bool sorting = false;
+        VkBuffer stateBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory stateMemory = VK_NULL_HANDLE;
+        VkBuffer keptCountBuffer = VK_NULL_HANDLE;
+
+        // The second set swaps sources and destinations, for the odd
+        // passes of a sort 
+        VkDescriptorSet sets[2] = {};
+    };
+
+    /// <summary>
+    /// Creates the pipelines of every variant of every primitive and
+    /// picks the fastest variant of each 
+    /// </summary>
+    void CreateComputePrimitives()
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        primitivesMaxPartitions = properties.limits.maxComputeWorkGroupCount[0];
+
+        //  0   State                   every primitive
+        //  1   Source                  scan input, values to compact, keys
+        //  2   Destination             scan output, kept values, scratch
+        //  3   Source extra            compaction flags, sort values
+        //  4   Destination extra       kept count, scratch
+        std::array<VkDescriptorSetLayoutBinding, 5> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); i++)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &primitivesDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create primitives descriptor set layout!");
+        }
+
+        // Bindings come and go with whoever uses them 
+        uint32_t setCount = MAX_PRIMITIVE_BINDINGS * 2;
+        VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount * static_cast<uint32_t>(bindings.size()) };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &primitivesDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create primitives descriptor pool!");
+        }
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(PrimitivePushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &primitivesDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &primitivesPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create primitives pipeline layout!");
+        }
+
+        // Note: Vulkan 1.1 guarantees basic subgroup operations in
+        //       compute but not arithmetic ones, and a module that uses
+        //       them may not even be created without. So the operations
+        //       decide which build is loaded, while the size only needs
+        //       a specialization constant. A size is only asked for if
+        //       the workgroup fits into the subgroups it may have 
+        primitiveVariants.clear();
+        primitiveVariants.push_back({ "shared", false, 0 });
+
+        const VkSubgroupFeatureFlags subgroupOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+        bool subgroupArithmetic = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0 &&
+            (subgroupProperties.supportedOperations & subgroupOperations) == subgroupOperations;
+        if (subgroupArithmetic && subgroupSizeControlSupported)
+        {
+            for (uint32_t size = minSubgroupSize; size <= maxSubgroupSize; size *= 2)
+            {
+                if (size * maxComputeWorkgroupSubgroups >= Primitives::GROUP_SIZE && Primitives::GROUP_SIZE % size == 0)
+                {
+                    primitiveVariants.push_back({ "subgroup " + std::to_string(size), true, size });
+                }
+            }
+        }
+        else if (subgroupArithmetic)
+        {
+            primitiveVariants.push_back({ "subgroup", true, 0 });
+        }
+
+        // The histogram has nothing to scan and is built only once 
+        const char* kernelNames[PRIMITIVE_KERNEL_COUNT] = { "scan", "compact", "radixhistogram", "onesweep", "onesweeppairs" };
+        for (PrimitiveVariant& variant : primitiveVariants)
+        {
+            for (uint32_t kernel = 0; kernel < PRIMITIVE_KERNEL_COUNT; kernel++)
+            {
+                std::string path = std::string("Shaders/") + kernelNames[kernel];
+                if (variant.subgroups && kernel != PRIMITIVE_HISTOGRAM)
+                {
+                    path += "subgroup";
+                }
+                variant.pipelines[kernel] = CreatePrimitivePipeline(path + ".spv", variant);
+            }
+        }
+
+        primitiveChoices.fill(0);
+        if (primitiveVariants.size() > 1)
+        {
+            SelectPrimitiveVariants();
+        }
+    }
+
+    /// <summary>
+    /// Creates the pipeline of one kernel in one variant, with the
+    /// subgroup size it asks for 
+    /// </summary>
+    VkPipeline CreatePrimitivePipeline(const std::string& compPath, const PrimitiveVariant& variant)
+    {
+        VkShaderModule compShaderModule = CreateShaderModule(ReadFile(compPath));
+
+        // SUBGROUP_SIZE in primitives.glsl 
+        VkSpecializationMapEntry mapEntry{ 0, 0, sizeof(uint32_t) };
+        VkSpecializationInfo specialization{};
+        specialization.mapEntryCount = 1;
+        specialization.pMapEntries = &mapEntry;
+        specialization.dataSize = sizeof(uint32_t);
+        specialization.pData = &variant.subgroupSize;
+
+        VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT requiredSize{};
+        requiredSize.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT;
+        requiredSize.requiredSubgroupSize = variant.subgroupSize;
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = compShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.stage.pSpecializationInfo = variant.subgroups ? &specialization : nullptr;
+        pipelineInfo.layout = primitivesPipelineLayout;
+
+        // Full subgroups keep the size the shader was specialized
+        // for true in every subgroup of the workgroup 
+        if (variant.subgroupSize != 0)
+        {
+            pipelineInfo.stage.pNext = &requiredSize;
+            if (computeFullSubgroupsSupported)
+            {
+                pipelineInfo.stage.flags = VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT_EXT;
+            }
+        }
+
+        VkPipeline pipeline;
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create primitives compute pipeline!");
+        }
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+        return pipeline;
+    }
+
+    /// <summary>
+    /// Describes the buffers of a primitive for up to capacity items.
+    /// Sorting needs a much larger state than scan and compaction.
+    /// The extra buffers are only needed by the primitives that use
+    /// them 
+    /// </summary>
+    PrimitiveBindings CreatePrimitiveBindings(uint32_t capacity, bool sorting, VkBuffer source, VkBuffer destination,
+        VkBuffer sourceExtra = VK_NULL_HANDLE, VkBuffer destinationExtra = VK_NULL_HANDLE)
+    {
+        if (Primitives::PartitionCount(capacity) > primitivesMaxPartitions)
+        {
+            throw std::runtime_error("Too many items for one dispatch of the compute primitives!");
+        }
+
+        PrimitiveBindings bindings;
+        bindings.capacity = capacity;
+        bindings.sorting = sorting;
+        bindings.keptCountBuffer = destinationExtra;
+
+        VkDeviceSize stateSize = Primitives::StateWords(capacity, sorting) * sizeof(uint32_t);
+        CreateBuffer(stateSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bindings.stateBuffer, bindings.stateMemory);
+
+        VkDescriptorSetLayout layouts[2] = { primitivesDescriptorSetLayout, primitivesDescriptorSetLayout };
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = primitivesDescriptorPool;
+        allocInfo.descriptorSetCount = 2;
+        allocInfo.pSetLayouts = layouts;
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, bindings.sets) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate primitives descriptor sets!");
+        }
+
+        for (uint32_t s = 0; s < 2; s++)
+        {
+            const VkBuffer buffers[5] =
+            {
+                bindings.stateBuffer,
+                s == 0 ? source : destination,
+                s == 0 ? destination : source,
+                s == 0 ? sourceExtra : destinationExtra,
+                s == 0 ? destinationExtra : sourceExtra
+            };
+
+            std::array<VkDescriptorBufferInfo, 5> bufferInfos{};
+            std::vector<VkWriteDescriptorSet> descriptorWrites;
+            for (uint32_t b = 0; b < bufferInfos.size(); b++)
+            {
+                if (buffers[b] == VK_NULL_HANDLE)
+                {
+                    continue;
+                }
+
+                bufferInfos[b] = { buffers[b], 0, VK_WHOLE_SIZE };
+
+                VkWriteDescriptorSet descriptorWrite{};
+                descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrite.dstSet = bindings.sets[s];
+                descriptorWrite.dstBinding = b;
+                descriptorWrite.descriptorCount = 1;
+                descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrite.pBufferInfo = &bufferInfos[b];
+                descriptorWrites.push_back(descriptorWrite);
+            }
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        return bindings;
+    }
+
+    void DestroyPrimitiveBindings(PrimitiveBindings& bindings)
+    {
+        vkFreeDescriptorSets(device, primitivesDescriptorPool, 2, bindings.sets);
+        vkDestroyBuffer(device, bindings.stateBuffer, nullptr);
+        vkFreeMemory(device, bindings.stateMemory, nullptr);
+        bindings = PrimitiveBindings{};
+    }
+
+    /// <summary>
+    /// Clears the state a primitive of count items is about to use 
+    /// </summary>
+    void RecordPrimitivesReset(VkCommandBuffer commandBuffer, const PrimitiveBindings& bindings, uint32_t count)
+    {
+        if (count > bindings.capacity)
+        {
+            throw std::runtime_error("More items than the primitive bindings were made for!");
+        }
+
+        VkDeviceSize stateSize = Primitives::StateWords(count, bindings.sorting) * sizeof(uint32_t);
+        vkCmdFillBuffer(commandBuffer, bindings.stateBuffer, 0, stateSize, 0);
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    /// <summary>
+    /// One workgroup per partition of a primitive kernel 
+    /// </summary>
+    void RecordPrimitiveDispatch(VkCommandBuffer commandBuffer, const PrimitiveBindings& bindings, PrimitiveKernel kernel,
+        uint32_t set, uint32_t count, uint32_t pass)
+    {
+        PrimitivePushConstants pushConstants{};
+        pushConstants.count = count;
+        pushConstants.partitionCount = Primitives::PartitionCount(count);
+        pushConstants.pass = pass;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, primitiveVariants[primitiveChoices[kernel]].pipelines[kernel]);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, primitivesPipelineLayout,
+            0, 1, &bindings.sets[set], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, primitivesPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+            0, sizeof(pushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, pushConstants.partitionCount, 1, 1);
+    }
+
+    /// <summary>
+    /// Exclusive prefix sum of count items, in one dispatch 
+    /// </summary>
+    void RecordScan(VkCommandBuffer commandBuffer, const PrimitiveBindings& bindings, uint32_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        RecordPrimitivesReset(commandBuffer, bindings, count);
+        RecordPrimitiveDispatch(commandBuffer, bindings, PRIMITIVE_SCAN, 0, count, 0);
+    }
+
+    /// <summary>
+    /// Keeps the items whose flag is set, in order, in one dispatch 
+    /// </summary>
+    void RecordCompact(VkCommandBuffer commandBuffer, const PrimitiveBindings& bindings, uint32_t count)
+    {
+        if (count == 0)
+        {
+            vkCmdFillBuffer(commandBuffer, bindings.keptCountBuffer, 0, sizeof(uint32_t), 0);
+            return;
+        }
+
+        RecordPrimitivesReset(commandBuffer, bindings, count);
+        RecordPrimitiveDispatch(commandBuffer, bindings, PRIMITIVE_COMPACT, 0, count, 0);
+    }
+
+    /// <summary>
+    /// Sorts count keys, and their values for pairs, in place. One
+    /// dispatch counts the digits of all passes, then one per pass
+    /// scatters the keys back and forth between source and
+    /// destination. After an even number of passes they are back 
+    /// </summary>
+    void RecordRadixSort(VkCommandBuffer commandBuffer, const PrimitiveBindings& bindings, uint32_t count, bool pairs)
+    {
+        if (!bindings.sorting)
+        {
+            throw std::runtime_error("Primitive bindings not made for sorting!");
+        }
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        RecordPrimitivesReset(commandBuffer, bindings, count);
+        RecordPrimitiveDispatch(commandBuffer, bindings, PRIMITIVE_HISTOGRAM, 0, count, 0);
+
+        PrimitiveKernel kernel = pairs ? PRIMITIVE_SORT_PAIRS : PRIMITIVE_SORT_KEYS;
+        for (uint32_t pass = 0; pass < Primitives::RADIX_PASSES; pass++)
+        {
+            RecordComputeBarrier(commandBuffer);
+            RecordPrimitiveDispatch(commandBuffer, bindings, kernel, pass & 1, count, pass);
+        }
+    }
+
+    /// <summary>
+    /// Buffers and random input to time and check the primitives on 
+    /// </summary>
+    struct PrimitiveBench
+    {
+        uint32_t count = 0;
+        VkDeviceSize size = 0;
+        std::vector<uint32_t> keys;
+        std::vector<uint32_t> values;
+
+        // Keys, scratch, values and extra, refilled from the staging
+        // buffer before every iteration 
+        std::array<VkBuffer, 4> work{};
+        std::array<VkDeviceMemory, 4> workMemory{};
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+        uint32_t* staging = nullptr;
+
+        PrimitiveBindings scanBindings;
+        PrimitiveBindings compactBindings;
+        PrimitiveBindings sortBindings;
+
+        // Without timestamps every iteration is timed on the CPU and
+        // also holds restoring the input 
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        double timestampPeriod = 0.0;
+    };
+
+    static const uint32_t PRIMITIVE_BENCH_ITERATIONS = 16;
+
+    PrimitiveBench CreatePrimitiveBench(uint32_t count, std::mt19937& random)
+    {
+        PrimitiveBench bench;
+        bench.count = count;
+        bench.size = VkDeviceSize(count) * sizeof(uint32_t);
+
+        // Half of the values are zero, which makes them flags for
+        // compaction too. The rest are small enough for the sum to
+        // stay in range 
+        uint32_t valueRange = (std::min)(16u, Primitives::SUM_LIMIT / count);
+        bench.keys.resize(count);
+        bench.values.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            bench.keys[i] = random();
+            uint32_t bits = random();
+            bench.values[i] = (bits & 1) != 0 ? (bits >> 1) % valueRange : 0;
+        }
+
+        const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        for (size_t i = 0; i < bench.work.size(); i++)
+        {
+            CreateBuffer(bench.size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bench.work[i], bench.workMemory[i]);
+        }
+
+        CreateBuffer(2 * bench.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bench.stagingBuffer, bench.stagingMemory);
+        vkMapMemory(device, bench.stagingMemory, 0, 2 * bench.size, 0, reinterpret_cast<void**>(&bench.staging));
+
+        bench.scanBindings = CreatePrimitiveBindings(count, false, bench.work[2], bench.work[1]);
+        bench.compactBindings = CreatePrimitiveBindings(count, false, bench.work[0], bench.work[1], bench.work[2], bench.work[3]);
+        bench.sortBindings = CreatePrimitiveBindings(count, true, bench.work[0], bench.work[1], bench.work[2], bench.work[3]);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        if (properties.limits.timestampComputeAndGraphics)
+        {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2 * (PRIMITIVE_BENCH_ITERATIONS + 1);
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &bench.queryPool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create primitives query pool!");
+            }
+            bench.timestampPeriod = properties.limits.timestampPeriod;
+        }
+
+        return bench;
+    }
+
+    void DestroyPrimitiveBench(PrimitiveBench& bench)
+    {
+        DestroyPrimitiveBindings(bench.scanBindings);
+        DestroyPrimitiveBindings(bench.compactBindings);
+        DestroyPrimitiveBindings(bench.sortBindings);
+
+        vkUnmapMemory(device, bench.stagingMemory);
+        vkDestroyBuffer(device, bench.stagingBuffer, nullptr);
+        vkFreeMemory(device, bench.stagingMemory, nullptr);
+        for (size_t i = 0; i < bench.work.size(); i++)
+        {
+            vkDestroyBuffer(device, bench.work[i], nullptr);
+            vkFreeMemory(device, bench.workMemory[i], nullptr);
+        }
+
+        if (bench.queryPool != VK_NULL_HANDLE)
+        {
+            vkDestroyQueryPool(device, bench.queryPool, nullptr);
+        }
+    }
+
+    /// <summary>
+    /// Average milliseconds of a scan, compaction or sort of the bench's
+    /// input with the chosen variants, after one run to warm up. Every
+    /// run starts from the original input 
+    /// </summary>
+    double TimePrimitive(PrimitiveBench& bench, PrimitiveKernel kernel, uint32_t iterations)
+    {
+        iterations = (std::min)(iterations, PRIMITIVE_BENCH_ITERATIONS);
+        bool restoreKeys = kernel != PRIMITIVE_SCAN;
+        bool restoreValues = kernel != PRIMITIVE_SORT_KEYS;
+
+        memcpy(bench.staging, bench.keys.data(), bench.size);
+        memcpy(bench.staging + bench.count, bench.values.data(), bench.size);
+
+        auto start = std::chrono::steady_clock::now();
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+        if (bench.queryPool != VK_NULL_HANDLE)
+        {
+            vkCmdResetQueryPool(commandBuffer, bench.queryPool, 0, 2 * (iterations + 1));
+        }
+
+        // Orders the copies and the primitive both ways 
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        const VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+        for (uint32_t i = 0; i <= iterations; i++)
+        {
+            VkBufferCopy copyRegion{ 0, 0, bench.size };
+            if (restoreKeys)
+            {
+                vkCmdCopyBuffer(commandBuffer, bench.stagingBuffer, bench.work[0], 1, &copyRegion);
+            }
+            if (restoreValues)
+            {
+                copyRegion.srcOffset = bench.size;
+                vkCmdCopyBuffer(commandBuffer, bench.stagingBuffer, bench.work[2], 1, &copyRegion);
+            }
+            vkCmdPipelineBarrier(commandBuffer, stages, stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            if (bench.queryPool != VK_NULL_HANDLE)
+            {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, bench.queryPool, 2 * i);
+            }
+
+            switch (kernel)
+            {
+            case PRIMITIVE_SCAN:
+                RecordScan(commandBuffer, bench.scanBindings, bench.count);
+                break;
+            case PRIMITIVE_COMPACT:
+                RecordCompact(commandBuffer, bench.compactBindings, bench.count);
+                break;
+            default:
+                RecordRadixSort(commandBuffer, bench.sortBindings, bench.count, kernel == PRIMITIVE_SORT_PAIRS);
+                break;
+            }
+
+            if (bench.queryPool != VK_NULL_HANDLE)
+            {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, bench.queryPool, 2 * i + 1);
+            }
+            vkCmdPipelineBarrier(commandBuffer, stages, stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+        EndSingleTimeCommands(commandBuffer);
+
+        if (bench.queryPool == VK_NULL_HANDLE)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / (iterations + 1);
+        }
+
+        std::vector<uint64_t> timestamps(2 * (iterations + 1));
+        vkGetQueryPoolResults(device, bench.queryPool, 0, static_cast<uint32_t>(timestamps.size()),
+            timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        double milliseconds = 0.0;
+        for (uint32_t i = 1; i <= iterations; i++)
+        {
+            milliseconds += static_cast<double>(timestamps[2 * i + 1] - timestamps[2 * i]) * bench.timestampPeriod / 1e6;
+        }
+        return milliseconds / iterations;
+    }
+
+    /// <summary>
+    /// Copies words from the start of a bench buffer 
+    /// </summary>
+    void DownloadPrimitiveBench(PrimitiveBench& bench, VkBuffer buffer, uint64_t words, std::vector<uint32_t>& result)
+    {
+        if (words > 0)
+        {
+            CopyBuffer(buffer, bench.stagingBuffer, words * sizeof(uint32_t));
+        }
+        result.assign(bench.staging, bench.staging + words);
+    }
+
+    /// <summary>
+    /// What the primitives should make of a bench's input, from the
+    /// CPU reference 
+    /// </summary>
+    struct PrimitiveReference
+    {
+        std::vector<uint32_t> scan;
+        std::vector<uint32_t> compact;
+        uint32_t kept = 0;
+        std::vector<uint32_t> keys;
+        std::vector<uint32_t> pairKeys;
+        std::vector<uint32_t> pairValues;
+    };
+
+    static void ComputePrimitiveReference(const PrimitiveBench& bench, PrimitiveReference& reference)
+    {
+        Primitives::ExclusiveScan(bench.values, reference.scan);
+        reference.kept = Primitives::Compact(bench.keys, bench.values, reference.compact);
+        reference.keys = bench.keys;
+        Primitives::Sort(reference.keys, nullptr);
+        reference.pairKeys = bench.keys;
+        reference.pairValues = bench.values;
+        Primitives::Sort(reference.pairKeys, &reference.pairValues);
+    }
+
+    /// <summary>
+    /// Whether the last run of a primitive on the bench, as left by
+    /// TimePrimitive, matches the reference 
+    /// </summary>
+    bool PrimitiveMatches(PrimitiveBench& bench, PrimitiveKernel kernel, const PrimitiveReference& reference)
+    {
+        std::vector<uint32_t> result;
+        switch (kernel)
+        {
+        case PRIMITIVE_SCAN:
+            DownloadPrimitiveBench(bench, bench.work[1], bench.count, result);
+            return result == reference.scan;
+        case PRIMITIVE_COMPACT:
+            DownloadPrimitiveBench(bench, bench.work[3], 1, result);
+            if (result[0] != reference.kept)
+            {
+                return false;
+            }
+            DownloadPrimitiveBench(bench, bench.work[1], reference.kept, result);
+            return result == reference.compact;
+        case PRIMITIVE_SORT_KEYS:
+            DownloadPrimitiveBench(bench, bench.work[0], bench.count, result);
+            return result == reference.keys;
+        default:
+        {
+            std::vector<uint32_t> values;
+            DownloadPrimitiveBench(bench, bench.work[0], bench.count, result);
+            DownloadPrimitiveBench(bench, bench.work[2], bench.count, values);
+            return result == reference.pairKeys && values == reference.pairValues;
+        }
+        }
+    }
+
+    /// <summary>
+    /// Times every variant of every primitive on a small input and
+    /// keeps the fastest of each that gets the right result. The
+    /// sort's histogram is the same in every variant 
+    /// </summary>
+    void SelectPrimitiveVariants()
+    {
+        // Note: Large enough for a few hundred workgroups, so look-back
+        //       and occupancy matter, small enough to take a blink even
+        //       on a software rasterizer 
+        const uint32_t SELECTION_ITEMS = 1u << 18;
+        const uint32_t SELECTION_ITERATIONS = 3;
+        const PrimitiveKernel selected[] = { PRIMITIVE_SCAN, PRIMITIVE_COMPACT, PRIMITIVE_SORT_KEYS, PRIMITIVE_SORT_PAIRS };
+        const char* selectedNames[] = { "scan", "compact", "sort keys", "sort pairs" };
+
+        std::mt19937 random(122);
+        PrimitiveBench bench = CreatePrimitiveBench(SELECTION_ITEMS, random);
+        PrimitiveReference reference;
+        ComputePrimitiveReference(bench, reference);
+
+        // Note: A driver may well accept a subgroup size it then gets
+        //       wrong, so a variant only counts once its result has
+        //       been checked. Should none get it right the shared
+        //       memory one is kept and the problem reported 
+        std::vector<std::string> failures;
+        std::cout << "Compute primitives, " << primitiveVariants.size() << " variants:";
+        for (size_t k = 0; k < std::size(selected); k++)
+        {
+            PrimitiveKernel kernel = selected[k];
+            double fastest = std::numeric_limits<double>::max();
+            uint32_t choice = 0;
+            for (uint32_t v = 0; v < primitiveVariants.size(); v++)
+            {
+                primitiveChoices[kernel] = v;
+                double milliseconds = TimePrimitive(bench, kernel, SELECTION_ITERATIONS);
+                if (!PrimitiveMatches(bench, kernel, reference))
+                {
+                    failures.push_back(std::string(selectedNames[k]) + " on " + primitiveVariants[v].name);
+                    continue;
+                }
+
+                if (milliseconds < fastest)
+                {
+                    fastest = milliseconds;
+                    choice = v;
+                }
+            }
+
+            primitiveChoices[kernel] = choice;
+            std::cout << (k == 0 ? " " : ", ") << selectedNames[k] << " on " << primitiveVariants[choice].name;
+            if (fastest == std::numeric_limits<double>::max())
+            {
+                std::cout << " (no variant was right)";
+            }
+        }
+        std::cout << std::endl;
+
+        for (const std::string& failure : failures)
+        {
+            std::cout << "  Skipped " << failure << ", it differs from the CPU reference" << std::endl;
+        }
+
+        DestroyPrimitiveBench(bench);
+    }
+
+    /// <summary>
+    /// Times every primitive with every variant, for 1K items and
+    /// each fourfold up to primitivesBenchmarkMax, and checks the
+    /// results against the CPU reference 
+    /// </summary>
+    void RunPrimitivesBenchmark()
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        // The work buffers have to fit into device local memory next
+        // to everything else, half of the largest heap is plenty 
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        VkDeviceSize deviceLocalSize = 0;
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+        {
+            if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            {
+                deviceLocalSize = (std::max)(deviceLocalSize, memoryProperties.memoryHeaps[i].size);
+            }
+        }
+
+        std::cout << "Compute primitives on " << properties.deviceName << ", subgroups of " << subgroupProperties.subgroupSize;
+        if (subgroupSizeControlSupported)
+        {
+            std::cout << " (" << minSubgroupSize << " to " << maxSubgroupSize << " on request)";
+        }
+        std::cout << ", " << (properties.limits.timestampComputeAndGraphics ? "GPU timestamps" : "timed on the CPU") << std::endl;
+
+        const std::array<uint32_t, PRIMITIVE_KERNEL_COUNT> chosen = primitiveChoices;
+        std::mt19937 random(121);
+        uint32_t mismatches = 0;
+
+        for (uint64_t count = 1024; count <= primitivesBenchmarkMax; count *= 4)
+        {
+            VkDeviceSize size = count * sizeof(uint32_t);
+            VkDeviceSize sortStateSize = Primitives::StateWords(static_cast<uint32_t>(count), true) * sizeof(uint32_t);
+            std::string label = count >= (1u << 20) ? std::to_string(count >> 20) + "M" : std::to_string(count >> 10) + "K";
+
+            if (size > properties.limits.maxStorageBufferRange || Primitives::PartitionCount(static_cast<uint32_t>(count)) > primitivesMaxPartitions)
+            {
+                std::cout << "Stopping before " << label << " items, more than one dispatch can take" << std::endl;
+                break;
+            }
+
+            if (4 * size + sortStateSize > deviceLocalSize / 2)
+            {
+                std::cout << "Stopping before " << label << " items, not enough device local memory" << std::endl;
+                break;
+            }
+
+            PrimitiveBench bench = CreatePrimitiveBench(static_cast<uint32_t>(count), random);
+
+            // The reference, timed on one CPU thread 
+            PrimitiveReference reference;
+            auto cpuStart = std::chrono::steady_clock::now();
+            Primitives::ExclusiveScan(bench.values, reference.scan);
+            auto cpuScanEnd = std::chrono::steady_clock::now();
+            reference.kept = Primitives::Compact(bench.keys, bench.values, reference.compact);
+            auto cpuCompactEnd = std::chrono::steady_clock::now();
+            reference.keys = bench.keys;
+            Primitives::Sort(reference.keys, nullptr);
+            auto cpuSortEnd = std::chrono::steady_clock::now();
+            reference.pairKeys = bench.keys;
+            reference.pairValues = bench.values;
+            Primitives::Sort(reference.pairKeys, &reference.pairValues);
+            auto cpuPairsEnd = std::chrono::steady_clock::now();
+
+            auto cpuMilliseconds = [](std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+            {
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            };
+
+            auto report = [&](const char* name, const PrimitiveVariant& variant, double milliseconds, double cpuReference, bool matches)
+            {
+                mismatches += matches ? 0 : 1;
+                std::cout << "  " << std::left << std::setw(12) << name << std::setw(6) << label << std::setw(13) << variant.name
+                    << std::right << std::fixed << std::setprecision(3) << std::setw(10) << milliseconds << " ms "
+                    << std::setprecision(0) << std::setw(8) << count / milliseconds / 1e3 << " M/s   CPU "
+                    << std::setprecision(3) << std::setw(10) << cpuReference << " ms   " << (matches ? "ok" : "MISMATCH") << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                std::cout << std::setprecision(6);
+            };
+
+            uint32_t iterations = count <= (1u << 20) ? PRIMITIVE_BENCH_ITERATIONS : 4;
+            for (uint32_t v = 0; v < primitiveVariants.size(); v++)
+            {
+                const PrimitiveVariant& variant = primitiveVariants[v];
+                primitiveChoices.fill(v);
+
+                double milliseconds = TimePrimitive(bench, PRIMITIVE_SCAN, iterations);
+                report("scan", variant, milliseconds, cpuMilliseconds(cpuStart, cpuScanEnd),
+                    PrimitiveMatches(bench, PRIMITIVE_SCAN, reference));
+
+                milliseconds = TimePrimitive(bench, PRIMITIVE_COMPACT, iterations);
+                report("compact", variant, milliseconds, cpuMilliseconds(cpuScanEnd, cpuCompactEnd),
+                    PrimitiveMatches(bench, PRIMITIVE_COMPACT, reference));
+
+                milliseconds = TimePrimitive(bench, PRIMITIVE_SORT_KEYS, iterations);
+                report("sort keys", variant, milliseconds, cpuMilliseconds(cpuCompactEnd, cpuSortEnd),
+                    PrimitiveMatches(bench, PRIMITIVE_SORT_KEYS, reference));
+
+                milliseconds = TimePrimitive(bench, PRIMITIVE_SORT_PAIRS, iterations);
+                report("sort pairs", variant, milliseconds, cpuMilliseconds(cpuSortEnd, cpuPairsEnd),
+                    PrimitiveMatches(bench, PRIMITIVE_SORT_PAIRS, reference));
+            }
+
+            DestroyPrimitiveBench(bench);
+        }
+
+        primitiveChoices = chosen;
+        if (mismatches == 0)
+        {
+            std::cout << "Every result matches the CPU reference" << std::endl;
+        }
+        else
+        {
+            std::cout << mismatches << " results differ from the CPU reference" << std::endl;
+        }
+    }
+
+    void CleanupComputePrimitives()
+    {
+        for (const PrimitiveVariant& variant : primitiveVariants)
+        {
+            for (VkPipeline pipeline : variant.pipelines)
+            {
+                vkDestroyPipeline(device, pipeline, nullptr);
+            }
+        }
+
+        vkDestroyPipelineLayout(device, primitivesPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, primitivesDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, primitivesDescriptorSetLayout, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Compute Skinning
+
+    // Note: Instead of skinning in every vertex shader that draws the
+    //       mesh (main, depth, shadow, ...) we skin once per pose in
+    //       a compute pass. The result is a regular Vertex buffer so
+    //       the graphics pipeline does not know skinning exists
+
+    /// <summary>
+    /// Which bones influence a vertex and by how much. Matches
+    /// the std430 layout of SkinWeights in skinning.comp
+    /// </summary>
+    struct SkinWeights
+    {
+        glm::uvec4 joints;
+        glm::vec4 weights;
+    };
+
+    // One entry per bind pose vertex
+    const std::vector<SkinWeights> skinWeights =
+    {
+        {{0, 0, 0, 0}, {1.0f, 0.0f, 0.0f, 0.0f}},
+        {{1, 0, 0, 0}, {1.0f, 0.0f, 0.0f, 0.0f}},
+        {{0, 1, 0, 0}, {0.5f, 0.5f, 0.0f, 0.0f}}
+    };
+
+    /// <summary>
+    /// Push constants handed to skinning.comp
+    /// </summary>
+    struct SkinningPushConstants
+    {
+        uint32_t vertexCount;
+        uint32_t boneCount;
+    };
+
+    /// <summary>
+    /// Uploads the bind pose and weights and creates the buffers
+    /// the skinning pass writes into
+    /// </summary>
+    void CreateSkinningBuffers()
+    {
+        // The bind pose never changes so it lives in device local memory
+        CreateDeviceLocalBuffer(vertices.data(), sizeof(vertices[0]) * vertices.size(),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bindPoseBuffer, bindPoseBufferMemory);
+
+        CreateDeviceLocalBuffer(skinWeights.data(), sizeof(skinWeights[0]) * skinWeights.size(),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, skinWeightBuffer, skinWeightBufferMemory);
+
+        // Written by compute and read by the vertex input stage. Holds
+        // a skinned copy of the mesh per character
+        CreateBuffer(sizeof(vertices[0]) * vertices.size() * CHARACTER_COUNT,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            skinnedVertexBuffer, skinnedVertexBufferMemory);
+
+        // The palettes are rewritten by the CPU every time the pose
+        // changes so we keep them mapped for the life of the app
+        VkDeviceSize paletteSize = sizeof(glm::mat4) * skeleton.JointCount() * CHARACTER_COUNT;
+
+        bonePaletteBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        bonePaletteBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        bonePaletteBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateDynamicBuffer(static_cast<uint32_t>(i), paletteSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                bonePaletteBuffers[i], bonePaletteBuffersMemory[i], bonePaletteBuffersMapped[i]);
+        }
+    }
+
+    /// <summary>
+    /// Describes the buffers skinning.comp reads and writes
+    /// </summary>
+    void CreateSkinningDescriptorSetLayout()
+    {
+        //  0   Bind pose vertices
+        //  1   Bone indices and weights
+        //  2   Bone palette
+        //  3   Skinned vertices
+        std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); i++)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[i].pImmutableSamplers = nullptr;
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &skinningDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create skinning descriptor set layout!");
+        }
+    }
+
+    /// <summary>
+    /// Creates the compute pipeline that runs skinning.comp
+    /// </summary>
+    void CreateSkinningPipeline()
+    {
+        auto compShaderCode = ReadFile("Shaders/skinning.spv");
+        VkShaderModule compShaderModule = CreateShaderModule(compShaderCode);
+
+        VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+        compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        compShaderStageInfo.module = compShaderModule;
+        compShaderStageInfo.pName = "main";
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(SkinningPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &skinningDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &skinningPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create skinning pipeline layout!");
+        }
+
+        // Compute pipelines only need the one stage and a layout
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage = compShaderStageInfo;
+        pipelineInfo.layout = skinningPipelineLayout;
+
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &skinningPipeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create skinning pipeline!");
+        }
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+    }
+
+    /// <summary>
+    /// Creates the pool the skinning descriptor sets come from
+    /// </summary>
+    void CreateSkinningDescriptorPool()
+    {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * 4);
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &skinningDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create skinning descriptor pool!");
+        }
+    }
+
+    /// <summary>
+    /// Allocates a descriptor set per frame in flight. They only
+    /// differ by which bone palette they point at
+    /// </summary>
+    void CreateSkinningDescriptorSets()
+    {
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, skinningDescriptorSetLayout);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = skinningDescriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        allocInfo.pSetLayouts = layouts.data();
+
+        skinningDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocInfo, skinningDescriptorSets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate skinning descriptor sets!");
+        }
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            std::array<VkDescriptorBufferInfo, 4> bufferInfos{};
+            bufferInfos[0] = { bindPoseBuffer, 0, VK_WHOLE_SIZE };
+            bufferInfos[1] = { skinWeightBuffer, 0, VK_WHOLE_SIZE };
+            bufferInfos[2] = { bonePaletteBuffers[i], 0, VK_WHOLE_SIZE };
+            bufferInfos[3] = { skinnedVertexBuffer, 0, VK_WHOLE_SIZE };
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+            for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+            {
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = skinningDescriptorSets[i];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].dstArrayElement = 0;
+                descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+            }
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+
+    /// <summary>
+    /// Records the skinning dispatch if the pose changed since
+    /// the skinned vertex buffer was last written
+    /// </summary>
+    void RecordSkinningPass(VkCommandBuffer commandBuffer)
+    {
+        // Cached result is still valid, nothing to record
+        if (skinnedPoseVersion == poseVersion)
+        {
+            return;
+        }
+
+        // Previous frames may still be drawing from the skinned
+        // vertices so wait for their vertex input stage first
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = skinnedVertexBuffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skinningPipelineLayout,
+            0, 1, &skinningDescriptorSets[currentFrame], 0, nullptr);
+
+        SkinningPushConstants pushConstants{};
+        pushConstants.vertexCount = static_cast<uint32_t>(vertices.size());
+        pushConstants.boneCount = skeleton.JointCount();
+        vkCmdPushConstants(commandBuffer, skinningPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+            0, sizeof(SkinningPushConstants), &pushConstants);
+
+        // Workgroups are 64 wide in skinning.comp. One row of
+        // workgroups per character
+        uint32_t groupCount = (pushConstants.vertexCount + 63) / 64;
+        vkCmdDispatch(commandBuffer, groupCount, CHARACTER_COUNT, 1);
+
+        // Make the skinned vertices visible to the vertex input stage
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        skinnedPoseVersion = poseVersion;
+    }
+
+    /// <summary>
+    /// Releases everything created for the skinning pass
+    /// </summary>
+    void CleanupSkinning()
+    {
+        vkDestroyPipeline(device, skinningPipeline, nullptr);
+        vkDestroyPipelineLayout(device, skinningPipelineLayout, nullptr);
+
+        vkDestroyDescriptorPool(device, skinningDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, skinningDescriptorSetLayout, nullptr);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            DestroyDynamicBuffer(static_cast<uint32_t>(i), bonePaletteBuffers[i], bonePaletteBuffersMemory[i]);
+        }
+
+        vkDestroyBuffer(device, skinnedVertexBuffer, nullptr);
+        vkFreeMemory(device, skinnedVertexBufferMemory, nullptr);
+        vkDestroyBuffer(device, skinWeightBuffer, nullptr);
+        vkFreeMemory(device, skinWeightBufferMemory, nullptr);
+        vkDestroyBuffer(device, bindPoseBuffer, nullptr);
+        vkFreeMemory(device, bindPoseBufferMemory, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Animation
+
+    /// <summary>
+    /// Builds the skeleton, compresses the clips and sets up the
+    /// blend tree and characters
+    /// </summary>
+    void CreateAnimations()
+    {
+        // Joint 0 is the root at the origin. Joint 1 hangs off the
+        // top of the triangle and swings the bottom right corner
+        glm::vec3 pivot(0.0f, -0.5f, 0.0f);
+
+        skeleton.parents = { -1, 0 };
+        skeleton.inverseBind = { glm::mat4(1.0f), glm::translate(glm::mat4(1.0f), -pivot) };
+
+        if (skeleton.JointCount() > MAX_BONES)
+        {
+            throw std::runtime_error("Skeleton has more joints than the skinning pass supports!");
+        }
+
+        // Note: These stand in for authored clips. They are sampled
+        //       and compressed exactly like imported data would be
+
+        auto makeSwing = [pivot](float degrees, float frequency, float bob)
+        {
+            return [pivot, degrees, frequency, bob](float t, std::vector<glm::vec4>& rotations, std::vector<glm::vec3>& translations)
+            {
+                float angle = glm::radians(degrees) * sin(t * frequency * 6.2831853f);
+
+                // Rotation about z as a quaternion (x, y, z, w)
+                rotations[0] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+                rotations[1] = glm::vec4(0.0f, 0.0f, sin(angle * 0.5f), cos(angle * 0.5f));
+
+                translations[0] = glm::vec3(0.0f, bob * sin(t * frequency * 12.566371f), 0.0f);
+                translations[1] = pivot;
+            };
+        };
+
+        // Reserved so the blend tree can safely point at the clips
+        animationClips.reserve(2);
+        animationClips.push_back(Animation::BuildClip(skeleton, 2.0f, 30.0f, makeSwing(10.0f, 0.5f, 0.0f), 0.001f));
+        animationClips.push_back(Animation::BuildClip(skeleton, 1.0f, 30.0f, makeSwing(35.0f, 1.0f, 0.05f), 0.001f));
+
+        // Idle <-> wave, mixed by parameter 0
+        int idle = blendTree.AddClip(&animationClips[0]);
+        int wave = blendTree.AddClip(&animationClips[1]);
+        blendTree.AddBlend(idle, wave, 0);
+
+        // Lay the characters out in a grid that fills the window
+        uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(CHARACTER_COUNT))));
+        float cellSize = 2.0f / columns;
+
+        characters.resize(CHARACTER_COUNT);
+        for (uint32_t i = 0; i < CHARACTER_COUNT; i++)
+        {
+            uint32_t column = i % columns;
+            uint32_t row = i / columns;
+
+            glm::vec3 center(-1.0f + (column + 0.5f) * cellSize, -1.0f + (row + 0.5f) * cellSize, 0.0f);
+
+            CharacterInstance& character = characters[i];
+            character.root = glm::scale(glm::translate(glm::mat4(1.0f), center), glm::vec3(cellSize * 0.9f));
+            character.timeOffset = (i * 7 % 31) / 31.0f;
+            character.speed = 0.75f + (i % 5) * 0.125f;
+            character.parameters[0] = static_cast<float>(column) / (std::max)(columns - 1, 1u);
+        }
+    }
+
+    /// <summary>
+    /// Advances time and evaluates every character straight into
+    /// this frame's bone palette
+    /// </summary>
+    void UpdateAnimation()
+    {
+        static auto startTime = std::chrono::high_resolution_clock::now();
+
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+        startTime = currentTime;
+
+        // A paused animation keeps its pose so neither the
+        // evaluation nor the skinning pass has to run again
+        if (animationPaused && poseVersion != 0)
+        {
+            return;
+        }
+
+        if (!animationPaused)
+        {
+            animationTime += deltaTime;
+        }
+
+        PoseCharacters(animationTime);
+    }
+
+    /// <summary>
+    /// Poses every character at time into this frame's palette 
+    /// </summary>
+    void PoseCharacters(float time)
+    {
+        // The fence for this frame has been waited on so the
+        // palette is no longer being read
+        glm::mat4* palette = static_cast<glm::mat4*>(bonePaletteBuffersMapped[currentFrame]);
+        uint32_t jointCount = skeleton.JointCount();
+
+        // Note: Each character is independent so they are spread over
+        //       the job system. Batches keep the per job overhead low
+        jobSystem.ParallelFor(CHARACTER_COUNT, 64, [&](uint32_t begin, uint32_t end)
+        {
+            thread_local Animation::BlendContext context;
+            thread_local Animation::Pose pose;
+            thread_local std::vector<glm::mat4> characterPalette;
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const CharacterInstance& character = characters[i];
+                float characterTime = time * character.speed + character.timeOffset;
+
+                blendTree.Evaluate(characterTime, character.parameters, jointCount, context, pose);
+
+                if (!damageTrackingEnabled)
+                {
+                    Animation::WritePalette(skeleton, pose, character.root, palette + i * jointCount);
+                    continue;
+                }
+
+                // The bounds need the palette as well and reading it back
+                // out of the mapped buffer is slow, so it is built here 
+                characterPalette.resize(jointCount);
+                Animation::WritePalette(skeleton, pose, character.root, characterPalette.data());
+                std::copy(characterPalette.begin(), characterPalette.end(), palette + i * jointCount);
+                characterBounds[i] = SkinnedBounds(characterPalette.data(), jointCount);
+            }
+        });
+
+        poseVersion++;
+    }
+
+    static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+    {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->frameDirty |= DIRTY_INPUT;
+
+        // P pauses the animation
+        if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        {
+            app->animationPaused = !app->animationPaused;
+        }
+
+        // F12 saves the next frame 
+        if (key == GLFW_KEY_F12 && action == GLFW_PRESS && app->screenshotsEnabled)
+        {
+            app->screenshotRequested = true;
+        }
+
+        // G switches between forward and deferred shading 
+        if (key == GLFW_KEY_G && action == GLFW_PRESS && app->shadingEnabled)
+        {
+            app->PrintShadingStats();
+            app->shadingPath = app->shadingPath == SHADING_FORWARD ? SHADING_DEFERRED : SHADING_FORWARD;
+            std::cout << "Shading " << (app->shadingPath == SHADING_DEFERRED ? "deferred" : "forward") << std::endl;
+        }
+
+        // O toggles ambient occlusion, which only the deferred path has 
+        if (key == GLFW_KEY_O && action == GLFW_PRESS && app->shadingEnabled)
+        {
+            app->PrintShadingStats();
+            app->aoEnabled = !app->aoEnabled;
+            std::cout << "Ambient occlusion " << (app->aoEnabled ? "on" : "off") << std::endl;
+        }
+
+        // L turns the environment of image based lighting 
+        if (key == GLFW_KEY_L && action == GLFW_PRESS && app->iblEnabled)
+        {
+            app->RotateEnvironment();
+        }
+
+        // K moves the sun of the sky 
+        if (key == GLFW_KEY_K && action == GLFW_PRESS && app->skyEnabled)
+        {
+            app->StepSun();
+        }
+
+        // R steps the reflections of the deferred path through their
+        // qualities and off 
+        if (key == GLFW_KEY_R && action == GLFW_PRESS && app->shadingEnabled)
+        {
+            app->PrintShadingStats();
+            app->StepReflections();
+        }
+
+        // V toggles volumetric fog 
+        if (key == GLFW_KEY_V && action == GLFW_PRESS && app->shadingEnabled)
+        {
+            app->PrintShadingStats();
+            app->ToggleFog();
+        }
+
+        // F1 to F5 toggle bloom, tone mapping, vignette, color grading
+        // and dithering of the deferred path 
+        if (key >= GLFW_KEY_F1 && key <= GLFW_KEY_F5 && action == GLFW_PRESS && app->shadingEnabled)
+        {
+            app->PrintShadingStats();
+            app->postEffects ^= 1u << (key - GLFW_KEY_F1);
+            app->postGpuMilliseconds = 0.0;
+            app->postFrames = 0;
+            std::cout << "Post-processing: " << app->DescribePostEffects(app->postEffects) << std::endl;
+        }
+    }
+
+    #pragma endregion
+
+    #pragma region Multiview
+
+    // Note: Multiview draws the scene once for several views (two eyes
+    //       or the cameras of a video wall). The views live in layers
+    //       of one image array so the vertex work is only submitted
+    //       once. Afterwards each layer is blitted into a slice of
+    //       every window that acquired an image 
+
+    // How far apart neighbouring views are, in clip space 
+    const float VIEW_SEPARATION = 0.05f;
+
+    /// <summary>
+    /// Whether the device can render viewCount views in one pass 
+    /// </summary>
+    bool CheckMultiviewSupport(VkPhysicalDevice device)
+    {
+        VkPhysicalDeviceMultiviewFeatures multiviewFeatures{};
+        multiviewFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &multiviewFeatures;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        VkPhysicalDeviceMultiviewProperties multiviewProperties{};
+        multiviewProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &multiviewProperties;
+        vkGetPhysicalDeviceProperties2(device, &properties);
+
+        return multiviewFeatures.multiview == VK_TRUE && multiviewProperties.maxMultiviewViewCount >= viewCount;
+    }
+
+    /// <summary>
+    /// The graphics pipeline reads the per view matrices from a
+    /// single uniform buffer 
+    /// </summary>
+    void CreateViewDescriptorSetLayout()
+    {
+        if (!multiviewEnabled)
+        {
+            return;
+        }
+
+        VkDescriptorSetLayoutBinding binding{};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        binding.pImmutableSamplers = nullptr;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &binding;
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &viewDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create view descriptor set layout!");
+        }
+    }
+
+    /// <summary>
+    /// Creates the image arrays the views are rendered into along
+    /// with the matrices and descriptor sets, one per frame in flight 
+    /// </summary>
+    void CreateViewTargets()
+    {
+        if (!multiviewEnabled)
+        {
+            return;
+        }
+
+        // Each view gets an equal slice of the primary window 
+        viewExtent.width = (std::max)(windows[0].swapChainExtent.width / viewCount, 1u);
+        viewExtent.height = windows[0].swapChainExtent.height;
+
+        viewImages.resize(MAX_FRAMES_IN_FLIGHT);
+        viewImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        viewImageViews.resize(MAX_FRAMES_IN_FLIGHT);
+        viewFramebuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        viewBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        viewBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        viewBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateImage(viewExtent.width, viewExtent.height, viewCount, windows[0].swapChainImageFormat,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, viewImages[i], viewImagesMemory[i]);
+
+            viewImageViews[i] = CreateImageView(viewImages[i], VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+                windows[0].swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, viewCount);
+
+            // Note: With multiview the framebuffer itself has a single
+            //       layer, the view mask decides which layers get drawn 
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = &viewImageViews[i];
+            framebufferInfo.width = viewExtent.width;
+            framebufferInfo.height = viewExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &viewFramebuffers[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create view framebuffer!");
+            }
+
+            CreateDynamicBuffer(static_cast<uint32_t>(i), sizeof(glm::mat4) * MAX_VIEWS, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                viewBuffers[i], viewBuffersMemory[i], viewBuffersMapped[i]);
+        }
+
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        poolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &viewDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create view descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, viewDescriptorSetLayout);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = viewDescriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        allocInfo.pSetLayouts = layouts.data();
+
+        viewDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocInfo, viewDescriptorSets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate view descriptor sets!");
+        }
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            VkDescriptorBufferInfo bufferInfo{ viewBuffers[i], 0, VK_WHOLE_SIZE };
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = viewDescriptorSets[i];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+
+            vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+
+    /// <summary>
+    /// Writes this frame's per view matrices. The views are spread
+    /// evenly around the centre like the eyes of a stereo camera 
+    /// </summary>
+    void UpdateViews()
+    {
+        if (!multiviewEnabled)
+        {
+            return;
+        }
+
+        glm::mat4* viewMatrices = static_cast<glm::mat4*>(viewBuffersMapped[currentFrame]);
+        for (uint32_t view = 0; view < viewCount; view++)
+        {
+            float offset = (static_cast<float>(view) - 0.5f * static_cast<float>(viewCount - 1)) * VIEW_SEPARATION;
+            viewMatrices[view] = glm::translate(glm::mat4(1.0f), glm::vec3(-offset, 0.0f, 0.0f));
+        }
+    }
+
+    /// <summary>
+    /// Copies every view into its own slice of a window's image
+    /// and leaves the image ready to be presented 
+    /// </summary>
+    void RecordViewBlit(VkCommandBuffer commandBuffer, const WindowTarget& target)
+    {
+        VkImage swapChainImage = target.swapChainImages[target.imageIndex];
+
+        // The old contents are going to be overwritten anyway 
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = swapChainImage;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        std::vector<VkImageBlit> regions(viewCount);
+        for (uint32_t view = 0; view < viewCount; view++)
+        {
+            int32_t sliceBegin = static_cast<int32_t>(target.swapChainExtent.width * view / viewCount);
+            int32_t sliceEnd = static_cast<int32_t>(target.swapChainExtent.width * (view + 1) / viewCount);
+
+            regions[view].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, view, 1 };
+            regions[view].srcOffsets[0] = { 0, 0, 0 };
+            regions[view].srcOffsets[1] = { static_cast<int32_t>(viewExtent.width), static_cast<int32_t>(viewExtent.height), 1 };
+            regions[view].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            regions[view].dstOffsets[0] = { sliceBegin, 0, 0 };
+            regions[view].dstOffsets[1] = { sliceEnd, static_cast<int32_t>(target.swapChainExtent.height), 1 };
+        }
+
+        // Windows can be resized independently of the views so
+        // the blit scales each view to fit its slice 
+        vkCmdBlitImage(commandBuffer,
+            viewImages[currentFrame], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            swapChainImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            static_cast<uint32_t>(regions.size()), regions.data(), VK_FILTER_LINEAR);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    /// <summary>
+    /// Destroys everything owned by the multiview targets 
+    /// </summary>
+    void CleanupViews()
+    {
+        if (!multiviewEnabled)
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkDestroyFramebuffer(device, viewFramebuffers[i], nullptr);
+            vkDestroyImageView(device, viewImageViews[i], nullptr);
+            vkDestroyImage(device, viewImages[i], nullptr);
+            vkFreeMemory(device, viewImagesMemory[i], nullptr);
+
+            DestroyDynamicBuffer(static_cast<uint32_t>(i), viewBuffers[i], viewBuffersMemory[i]);
+        }
+
+        vkDestroyDescriptorPool(device, viewDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, viewDescriptorSetLayout, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Frame Export
+
+    // Note: Export mode shares rendered frames with another process
+    //       without ever copying them. The images and the semaphores
+    //       that say when they are done are created exportable, the
+    //       consumer imports both once and from then on only small
+    //       messages go over the socket. See FrameExport.h 
+
+    /// <summary>
+    /// Hands out an OS handle to exportable memory. Each call makes
+    /// a new handle which the caller owns 
+    /// </summary>
+    FrameExport::ExternalHandle ExportMemoryHandle(VkDeviceMemory memory)
+    {
+        FrameExport::ExternalHandle handle;
+
+#ifdef _WIN32
+        auto func = (PFN_vkGetMemoryWin32HandleKHR)vkGetDeviceProcAddr(device, "vkGetMemoryWin32HandleKHR");
+
+        VkMemoryGetWin32HandleInfoKHR getInfo{};
+        getInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR;
+#else
+        auto func = (PFN_vkGetMemoryFdKHR)vkGetDeviceProcAddr(device, "vkGetMemoryFdKHR");
+
+        VkMemoryGetFdInfoKHR getInfo{};
+        getInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+#endif
+        getInfo.memory = memory;
+        getInfo.handleType = FrameExport::MEMORY_HANDLE_TYPE;
+
+        if (func == nullptr || func(device, &getInfo, &handle) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to export frame memory!");
+        }
+
+        return handle;
+    }
+
+    /// <summary>
+    /// Hands out an OS handle to an exportable semaphore 
+    /// </summary>
+    FrameExport::ExternalHandle ExportSemaphoreHandle(VkSemaphore semaphore)
+    {
+        FrameExport::ExternalHandle handle;
+
+#ifdef _WIN32
+        auto func = (PFN_vkGetSemaphoreWin32HandleKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreWin32HandleKHR");
+
+        VkSemaphoreGetWin32HandleInfoKHR getInfo{};
+        getInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR;
+#else
+        auto func = (PFN_vkGetSemaphoreFdKHR)vkGetDeviceProcAddr(device, "vkGetSemaphoreFdKHR");
+
+        VkSemaphoreGetFdInfoKHR getInfo{};
+        getInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+#endif
+        getInfo.semaphore = semaphore;
+        getInfo.handleType = FrameExport::SEMAPHORE_HANDLE_TYPE;
+
+        if (func == nullptr || func(device, &getInfo, &handle) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to export frame semaphore!");
+        }
+
+        return handle;
+    }
+
+    /// <summary>
+    /// Makes sure the driver can actually share images of this
+    /// format and semaphores with other processes 
+    /// </summary>
+    void CheckExportSupport(VkFormat format)
+    {
+        VkPhysicalDeviceExternalImageFormatInfo externalImageInfo{};
+        externalImageInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO;
+        externalImageInfo.handleType = FrameExport::MEMORY_HANDLE_TYPE;
+
+        VkPhysicalDeviceImageFormatInfo2 imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+        imageInfo.pNext = &externalImageInfo;
+        imageInfo.format = format;
+        imageInfo.type = VK_IMAGE_TYPE_2D;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = FrameExport::IMAGE_USAGE;
+
+        VkExternalImageFormatProperties externalImageProperties{};
+        externalImageProperties.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES;
+
+        VkImageFormatProperties2 imageProperties{};
+        imageProperties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+        imageProperties.pNext = &externalImageProperties;
+
+        if (vkGetPhysicalDeviceImageFormatProperties2(physicalDevice, &imageInfo, &imageProperties) != VK_SUCCESS ||
+            !(externalImageProperties.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT))
+        {
+            throw std::runtime_error("Frame images can not be exported on this device!");
+        }
+
+        VkPhysicalDeviceExternalSemaphoreInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+        semaphoreInfo.handleType = FrameExport::SEMAPHORE_HANDLE_TYPE;
+
+        VkExternalSemaphoreProperties semaphoreProperties{};
+        semaphoreProperties.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+        vkGetPhysicalDeviceExternalSemaphoreProperties(physicalDevice, &semaphoreInfo, &semaphoreProperties);
+
+        if (!(semaphoreProperties.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT))
+        {
+            throw std::runtime_error("Frame semaphores can not be exported on this device!");
+        }
+    }
+
+    /// <summary>
+    /// (Re)creates the exportable semaphores. Done again whenever a
+    /// consumer leaves since it may not have waited on all of them 
+    /// </summary>
+    void CreateExportSemaphores()
+    {
+        exportReadySemaphores.resize(EXPORT_IMAGE_COUNT);
+
+        VkExportSemaphoreCreateInfo exportInfo{};
+        exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+        exportInfo.handleTypes = FrameExport::SEMAPHORE_HANDLE_TYPE;
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &exportInfo;
+
+        for (size_t i = 0; i < EXPORT_IMAGE_COUNT; i++)
+        {
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &exportReadySemaphores[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create export semaphore!");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Creates the exportable images and starts listening for a
+    /// consumer to hand them to 
+    /// </summary>
+    void CreateExportTargets()
+    {
+        if (!exportEnabled)
+        {
+            return;
+        }
+
+        // Matches the swap chain so the graphics pipeline can draw
+        // into both with compatible render passes 
+        VkFormat format = windows[0].swapChainImageFormat;
+        exportExtent = { WIDTH, HEIGHT };
+
+        CheckExportSupport(format);
+        // Left in the general layout since another process picks it up 
+        exportRenderPass = CreateOffscreenRenderPass(format, VK_IMAGE_LAYOUT_GENERAL);
+
+        exportImages.resize(EXPORT_IMAGE_COUNT);
+        exportImagesMemory.resize(EXPORT_IMAGE_COUNT);
+        exportImageViews.resize(EXPORT_IMAGE_COUNT);
+        exportFramebuffers.resize(EXPORT_IMAGE_COUNT);
+        exportImageBusy.assign(EXPORT_IMAGE_COUNT, false);
+
+        for (size_t i = 0; i < EXPORT_IMAGE_COUNT; i++)
+        {
+            VkExternalMemoryImageCreateInfo externalInfo{};
+            externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+            externalInfo.handleTypes = FrameExport::MEMORY_HANDLE_TYPE;
+
+            // Note: Dedicated allocations keep the import on the other
+            //       side simple, it is exactly one image per handle 
+            VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+            dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+
+            VkExportMemoryAllocateInfo exportInfo{};
+            exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+            exportInfo.pNext = &dedicatedInfo;
+            exportInfo.handleTypes = FrameExport::MEMORY_HANDLE_TYPE;
+
+            // The image has to exist before it can be named in the
+            // dedicated allocation, so create it by hand here 
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.pNext = &externalInfo;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent = { exportExtent.width, exportExtent.height, 1 };
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = format;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = FrameExport::IMAGE_USAGE;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(device, &imageInfo, nullptr, &exportImages[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create export image!");
+            }
+
+            VkMemoryRequirements memRequirements;
+            vkGetImageMemoryRequirements(device, exportImages[i], &memRequirements);
+            dedicatedInfo.image = exportImages[i];
+
+            // The consumer has to allocate the exact same size and type 
+            exportAllocationSize = memRequirements.size;
+            exportMemoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.pNext = &exportInfo;
+            allocInfo.allocationSize = exportAllocationSize;
+            allocInfo.memoryTypeIndex = exportMemoryTypeIndex;
+
+            if (vkAllocateMemory(device, &allocInfo, nullptr, &exportImagesMemory[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to allocate export image memory!");
+            }
+
+            vkBindImageMemory(device, exportImages[i], exportImagesMemory[i], 0);
+
+            exportImageViews[i] = CreateImageView(exportImages[i], VK_IMAGE_VIEW_TYPE_2D, format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = exportRenderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = &exportImageViews[i];
+            framebufferInfo.width = exportExtent.width;
+            framebufferInfo.height = exportExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &exportFramebuffers[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create export framebuffer!");
+            }
+        }
+
+        CreateExportSemaphores();
+
+        exportListener = LocalSocket::Listen(exportSocketPath);
+        std::cout << "Exporting frames on " << exportSocketPath << std::endl;
+    }
+
+    /// <summary>
+    /// Exports fresh handles for every image and semaphore and
+    /// sends them to a consumer that just said hello 
+    /// </summary>
+    bool SendExportSetup(uint32_t consumerProcessId)
+    {
+        FrameExport::Setup setup{};
+        setup.imageCount = EXPORT_IMAGE_COUNT;
+        setup.width = exportExtent.width;
+        setup.height = exportExtent.height;
+        setup.format = static_cast<int32_t>(windows[0].swapChainImageFormat);
+        setup.memoryTypeIndex = exportMemoryTypeIndex;
+        setup.allocationSize = exportAllocationSize;
+
+        VkPhysicalDeviceIDProperties idProperties{};
+        idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &idProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        std::memcpy(setup.deviceUUID, idProperties.deviceUUID, VK_UUID_SIZE);
+        std::memcpy(setup.driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+
+        std::vector<FrameExport::ExternalHandle> memoryHandles;
+        std::vector<FrameExport::ExternalHandle> semaphoreHandles;
+        for (size_t i = 0; i < EXPORT_IMAGE_COUNT; i++)
+        {
+            memoryHandles.push_back(ExportMemoryHandle(exportImagesMemory[i]));
+            semaphoreHandles.push_back(ExportSemaphoreHandle(exportReadySemaphores[i]));
+        }
+
+        return FrameExport::SendSetup(exportConsumer, setup, consumerProcessId, memoryHandles, semaphoreHandles);
+    }
+
+    /// <summary>
+    /// Drops the consumer. Semaphores it never waited on would stay
+    /// signaled so they are all replaced for whoever comes next 
+    /// </summary>
+    void DisconnectExportConsumer()
+    {
+        exportConsumer.Close();
+        exportConsumerReady = false;
+
+        vkDeviceWaitIdle(device);
+        for (auto semaphore : exportReadySemaphores)
+        {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        CreateExportSemaphores();
+
+        exportImageBusy.assign(EXPORT_IMAGE_COUNT, false);
+        std::cout << "Frame consumer disconnected" << std::endl;
+    }
+
+    /// <summary>
+    /// Accepts a new consumer and collects released images without
+    /// ever blocking the frame 
+    /// </summary>
+    void PollExportConsumer()
+    {
+        if (!exportConsumer.IsOpen())
+        {
+            if (!exportListener.WaitReadable(0))
+            {
+                return;
+            }
+
+            exportConsumer = exportListener.Accept();
+            exportConsumerReady = false;
+            exportHelloDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(EXPORT_HELLO_SECONDS);
+        }
+
+        // Note: Receive blocks until a whole message is there, so the
+        //       hello is only read once it has started to arrive 
+        if (exportConsumer.IsOpen() && !exportConsumerReady)
+        {
+            if (!exportConsumer.WaitReadable(0))
+            {
+                if (std::chrono::steady_clock::now() > exportHelloDeadline)
+                {
+                    std::cout << "Frame consumer never said hello" << std::endl;
+                    exportConsumer.Close();
+                }
+                return;
+            }
+
+            FrameExport::Message hello;
+            if (!exportConsumer.Receive(hello) || hello.type != FrameExport::MESSAGE_HELLO || !SendExportSetup(hello.image))
+            {
+                exportConsumer.Close();
+                return;
+            }
+
+            exportConsumerReady = true;
+            std::cout << "Frame consumer connected" << std::endl;
+        }
+
+        while (exportConsumer.WaitReadable(0))
+        {
+            FrameExport::Message message;
+            if (!exportConsumer.Receive(message))
+            {
+                DisconnectExportConsumer();
+                return;
+            }
+
+            if (message.type == FrameExport::MESSAGE_FRAME_RELEASED && message.image < EXPORT_IMAGE_COUNT)
+            {
+                exportImageBusy[message.image] = false;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Picks the image this frame gets exported into, if any 
+    /// </summary>
+    void BeginExportFrame()
+    {
+        exportImageIndex = -1;
+
+        if (!exportEnabled)
+        {
+            return;
+        }
+
+        PollExportConsumer();
+        if (!exportConsumer.IsOpen() || !exportConsumerReady)
+        {
+            return;
+        }
+
+        // Hand the images out round robin, skipping held ones 
+        for (uint32_t i = 0; i < EXPORT_IMAGE_COUNT; i++)
+        {
+            uint32_t image = (exportNextImage + i) % EXPORT_IMAGE_COUNT;
+            if (!exportImageBusy[image])
+            {
+                exportImageIndex = static_cast<int32_t>(image);
+                exportNextImage = (image + 1) % EXPORT_IMAGE_COUNT;
+                return;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Draws the scene into this frame's export image and gives it
+    /// up to whichever queue the consumer uses 
+    /// </summary>
+    void RecordExportPass(VkCommandBuffer commandBuffer)
+    {
+        if (exportImageIndex < 0)
+        {
+            return;
+        }
+
+        VkImage image = exportImages[exportImageIndex];
+        uint32_t graphicsFamily = FindQueueFamilies(physicalDevice).graphicsFamily.value();
+
+        // Take the image back from the consumer. Its old contents
+        // are not needed so the layout can start out undefined 
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_EXTERNAL;
+        barrier.dstQueueFamilyIndex = graphicsFamily;
+        barrier.image = image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        RecordScenePass(commandBuffer, exportRenderPass, exportFramebuffers[exportImageIndex], exportExtent);
+
+        // Release it so the consumer's queue can acquire it 
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = graphicsFamily;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_EXTERNAL;
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    /// <summary>
+    /// Once submitted, tells the consumer which image to wait for 
+    /// </summary>
+    void EndExportFrame()
+    {
+        if (exportImageIndex < 0)
+        {
+            return;
+        }
+
+        exportImageBusy[exportImageIndex] = true;
+
+        FrameExport::Message message{ FrameExport::MESSAGE_FRAME_READY, static_cast<uint32_t>(exportImageIndex), exportFrameNumber++ };
+        if (!exportConsumer.Send(message))
+        {
+            DisconnectExportConsumer();
+        }
+    }
+
+    void CleanupExport()
+    {
+        if (!exportEnabled)
+        {
+            return;
+        }
+
+        exportConsumer.Close();
+        exportListener.Close();
+
+        for (size_t i = 0; i < EXPORT_IMAGE_COUNT; i++)
+        {
+            vkDestroySemaphore(device, exportReadySemaphores[i], nullptr);
+            vkDestroyFramebuffer(device, exportFramebuffers[i], nullptr);
+            vkDestroyImageView(device, exportImageViews[i], nullptr);
+            vkDestroyImage(device, exportImages[i], nullptr);
+            vkFreeMemory(device, exportImagesMemory[i], nullptr);
+        }
+
+        vkDestroyRenderPass(device, exportRenderPass, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Readback
+
+    /// <summary>
+    /// Whether pixels of format are read back as BGRA rather than
+    /// RGBA. Nothing else can be encoded 
+    /// </summary>
+    static bool IsReadbackFormatBgra(VkFormat format)
+    {
+        if (format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM)
+        {
+            return true;
+        }
+        if (format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM)
+        {
+            return false;
+        }
+        throw std::runtime_error("Readback needs an 8 bit RGBA or BGRA swap chain!");
+    }
+
+    /// <summary>
+    /// Creates a persistently mapped buffer for the GPU to copy into.
+    /// Returns whether its memory is coherent 
+    /// </summary>
+    bool CreateHostReadBuffer(VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory, void*& mapped)
+    {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create readback buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+        // Note: The CPU reads every byte of these so cached memory
+        //       is much faster. Without coherency we invalidate by
+        //       hand before reading 
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+
+        VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        try
+        {
+            allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, cached);
+        }
+        catch (const std::runtime_error&)
+        {
+            allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        }
+
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        bool coherent = (memProperties.memoryTypes[allocInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate readback memory!");
+        }
+
+        vkBindBufferMemory(device, buffer, memory, 0);
+        vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        return coherent;
+    }
+
+    /// <summary>
+    /// Creates the readback ring and starts the recorder and the
+    /// screenshot thread 
+    /// </summary>
+    void CreateReadback()
+    {
+        if (!readbackEnabled)
+        {
+            return;
+        }
+
+        // The ring keeps the size the primary window started with.
+        // Frames of any other size (while resizing) are skipped 
+        readbackExtent = windows[0].swapChainExtent;
+
+        readbackBgra = IsReadbackFormatBgra(windows[0].swapChainImageFormat);
+
+        VkDeviceSize frameSize = static_cast<VkDeviceSize>(readbackExtent.width) * readbackExtent.height * 4;
+
+        for (auto& slot : readbackSlots)
+        {
+            readbackCoherent = CreateHostReadBuffer(frameSize, slot.buffer, slot.memory, slot.mapped);
+        }
+
+        if (recordEnabled)
+        {
+            std::unique_ptr<Capture::FrameSink> sink;
+            if (!recordCommand.empty())
+            {
+                sink = std::make_unique<Capture::PipeSink>(recordCommand);
+            }
+            else
+            {
+                sink = std::make_unique<Capture::FileSink>(recordPath);
+            }
+
+            recorder = std::make_unique<Capture::Recorder>(jobSystem, std::move(sink),
+                readbackExtent.width, readbackExtent.height, RECORD_FRAMES_PER_SECOND);
+        }
+
+        if (screenshotsEnabled)
+        {
+            screenshotWriter = std::make_unique<Capture::ScreenshotWriter>(jobSystem);
+        }
+    }
+
+    /// <summary>
+    /// Hands every copy the GPU has finished to whoever asked for it,
+    /// oldest first so the video stays in order 
+    /// </summary>
+    void CollectReadbacks()
+    {
+        while (!readbackCopying.empty() && readbackSlots[readbackCopying.front()].submission <= completedSubmission)
+        {
+            ReadbackSlot& slot = readbackSlots[readbackCopying.front()];
+            readbackCopying.pop_front();
+
+            if (!readbackCoherent)
+            {
+                VkMappedMemoryRange range{};
+                range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+                range.memory = slot.memory;
+                range.offset = 0;
+                range.size = VK_WHOLE_SIZE;
+                vkInvalidateMappedMemoryRanges(device, 1, &range);
+            }
+
+            // The readers free the slot from their own threads 
+            slot.state = READBACK_READING;
+            slot.readers = (slot.uses & READBACK_RECORD ? 1 : 0) + (slot.uses & READBACK_SCREENSHOT ? 1 : 0);
+            auto done = [&slot]()
+            {
+                if (--slot.readers == 0)
+                {
+                    slot.state = READBACK_FREE;
+                }
+            };
+
+            const uint8_t* pixels = static_cast<const uint8_t*>(slot.mapped);
+            uint32_t rowPitch = readbackExtent.width * 4;
+
+            if (slot.uses & READBACK_RECORD)
+            {
+                recorder->Submit(pixels, rowPitch, readbackBgra, done);
+            }
+
+            if (slot.uses & READBACK_SCREENSHOT)
+            {
+                ImageEncode::SourceImage image{ pixels, rowPitch, readbackExtent.width, readbackExtent.height, readbackBgra };
+                std::string path = screenshotDirectory + "/screenshot_" + std::to_string(screenshotCount++) +
+                    ImageEncode::FileExtension(screenshotFormat);
+                screenshotWriter->Submit(image, screenshotFormat, path, done);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Picks the readback slot this frame is copied into, if any 
+    /// </summary>
+    void BeginReadbackFrame()
+    {
+        readbackSlotIndex = -1;
+
+        uint32_t uses = (recordEnabled ? READBACK_RECORD : 0) | (screenshotRequested ? READBACK_SCREENSHOT : 0);
+        if (uses == 0)
+        {
+            return;
+        }
+
+        const WindowTarget& target = windows[0];
+        bool copyable = target.acquired && target.swapChainExtent.width == readbackExtent.width &&
+            target.swapChainExtent.height == readbackExtent.height;
+
+        for (uint32_t i = 0; copyable && i < READBACK_RING_SIZE; i++)
+        {
+            if (readbackSlots[i].state == READBACK_FREE)
+            {
+                readbackSlotIndex = static_cast<int32_t>(i);
+                readbackSlots[i].uses = uses;
+                screenshotRequested = false;
+                return;
+            }
+        }
+
+        // Readers can not keep up. Drop rather than wait 
+        if (recordEnabled)
+        {
+            recordDroppedFrames++;
+        }
+    }
+
+    /// <summary>
+    /// Copies the primary window's image into this frame's slot 
+    /// </summary>
+    void RecordReadback(VkCommandBuffer commandBuffer)
+    {
+        if (readbackSlotIndex < 0)
+        {
+            return;
+        }
+
+        const WindowTarget& target = windows[0];
+        VkImage image = target.swapChainImages[target.imageIndex];
+
+        // Drawn by a render pass or, with multiview, by blits 
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0; // Tightly packed 
+        region.bufferImageHeight = 0;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { readbackExtent.width, readbackExtent.height, 1 };
+
+        VkBuffer buffer = readbackSlots[readbackSlotIndex].buffer;
+        vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = 0;
+
+        // Make the copy visible to the host once the fence signals 
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = buffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+            0, 0, nullptr, 1, &bufferBarrier, 1, &barrier);
+    }
+
+    /// <summary>
+    /// Remembers which submission the slot is waiting on 
+    /// </summary>
+    void EndReadbackFrame()
+    {
+        if (readbackSlotIndex < 0)
+        {
+            return;
+        }
+
+        readbackSlots[readbackSlotIndex].submission = submissionCount;
+        readbackSlots[readbackSlotIndex].state = READBACK_COPYING;
+        readbackCopying.push_back(static_cast<uint32_t>(readbackSlotIndex));
+    }
+
+    /// <summary>
+    /// Flushes the last frames into the recording and screenshots and
+    /// frees the ring. The device has to be idle already 
+    /// </summary>
+    void CleanupReadback()
+    {
+        if (!readbackEnabled)
+        {
+            return;
+        }
+
+        completedSubmission = submissionCount;
+        CollectReadbacks();
+
+        // Both wait for their threads to write everything out 
+        screenshotWriter.reset();
+        if (recordEnabled)
+        {
+            bool failed = recorder->Failed();
+            uint64_t framesWritten = recorder->FramesWritten();
+            recorder.reset();
+
+            std::cout << "Recorded " << framesWritten << " frames, dropped " << recordDroppedFrames << std::endl;
+            if (failed)
+            {
+                std::cerr << "Recording sink stopped accepting frames!" << std::endl;
+            }
+        }
+
+        for (auto& slot : readbackSlots)
+        {
+            vkDestroyBuffer(device, slot.buffer, nullptr);
+            vkFreeMemory(device, slot.memory, nullptr);
+        }
+    }
+
+    #pragma endregion
+
+    #pragma region Render Service
+
+    // Note: Serving renders jobs from other processes instead of
+    //       frames for a window. Pending jobs that share a scene time
+    //       are packed into an atlas and drawn by one command buffer,
+    //       each job as its own viewport into the same render pass, so
+    //       one submission covers as many jobs as fit. While the GPU
+    //       works on one batch the previous one is encoded 
+
+    /// <summary>
+    /// Creates the atlases and starts listening for clients 
+    /// </summary>
+    void CreateRenderService()
+    {
+        if (!serveEnabled)
+        {
+            return;
+        }
+
+        // Matches the swap chain so the graphics pipeline can draw
+        // into the atlas with a compatible render pass 
+        VkFormat format = windows[0].swapChainImageFormat;
+        serveBgra = IsReadbackFormatBgra(format);
+        serveRenderPass = CreateOffscreenRenderPass(format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+        const uint32_t size = RenderService::ATLAS_SIZE;
+        serveAtlasImages.resize(MAX_FRAMES_IN_FLIGHT);
+        serveAtlasImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        serveAtlasImageViews.resize(MAX_FRAMES_IN_FLIGHT);
+        serveAtlasFramebuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        serveReadbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        serveReadbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        serveReadbackBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        serveBatches.resize(MAX_FRAMES_IN_FLIGHT);
+        serveBatchHeights.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateImage(size, size, 1, format,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, serveAtlasImages[i], serveAtlasImagesMemory[i]);
+            serveAtlasImageViews[i] = CreateImageView(serveAtlasImages[i], VK_IMAGE_VIEW_TYPE_2D, format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = serveRenderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = &serveAtlasImageViews[i];
+            framebufferInfo.width = size;
+            framebufferInfo.height = size;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &serveAtlasFramebuffers[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create atlas framebuffer!");
+            }
+
+            serveCoherent = CreateHostReadBuffer(static_cast<VkDeviceSize>(size) * size * 4,
+                serveReadbackBuffers[i], serveReadbackBuffersMemory[i], serveReadbackBuffersMapped[i]);
+        }
+
+        serveListener = LocalSocket::Listen(serveSocketPath);
+        std::cout << "Serving render jobs on " << serveSocketPath << std::endl;
+    }
+
+    /// <summary>
+    /// Runs batches until a client asks the server to stop 
+    /// </summary>
+    void ServeLoop()
+    {
+        serveRunning = true;
+
+        while (serveRunning && !glfwWindowShouldClose(windows[0].window))
+        {
+            glfwPollEvents();
+            AcceptServeClients();
+            ReceiveServeRequests();
+            SendServeResults();
+
+            bool batchesInFlight = false;
+            for (const auto& batch : serveBatches)
+            {
+                batchesInFlight = batchesInFlight || !batch.empty();
+            }
+
+            // Nothing to do until a client connects or sends something.
+            // The timeout only bounds how late the window sees events 
+            if (servePending.empty() && !batchesInFlight)
+            {
+                WaitForServeSockets(SERVE_IDLE_WAIT_MS);
+                continue;
+            }
+
+            // The fence guards the batch this slot was last used for.
+            // Its images go out before the atlas is drawn over 
+            vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+            FinishServeBatch(currentFrame);
+
+            if (BuildServeBatch(currentFrame))
+            {
+                SubmitServeBatch(currentFrame);
+            }
+
+            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        }
+
+        std::cout << "Served " << serveJobCount << " jobs in " << serveBatchCount << " batches" << std::endl;
+    }
+
+    void AcceptServeClients()
+    {
+        while (serveListener.WaitReadable(0))
+        {
+            ServeClient client;
+            client.socket = serveListener.Accept();
+            if (!client.socket.IsOpen())
+            {
+                break;
+            }
+            if (client.socket.SetNonBlocking())
+            {
+                serveClients.emplace(serveNextClient++, std::move(client));
+            }
+        }
+    }
+
+    /// <summary>
+    /// Sleeps until a client connects or sends something, or one with
+    /// results waiting can take more of them 
+    /// </summary>
+    void WaitForServeSockets(int timeoutMs)
+    {
+        std::vector<const LocalSocket*> readable = { &serveListener };
+        std::vector<const LocalSocket*> writable;
+        for (const auto& client : serveClients)
+        {
+            readable.push_back(&client.second.socket);
+            if (!client.second.outgoing.empty())
+            {
+                writable.push_back(&client.second.socket);
+            }
+        }
+        LocalSocket::WaitAny(readable, writable, timeoutMs);
+    }
+
+    /// <summary>
+    /// Queues something for a client to read, dropping the client if
+    /// it has stopped reading what it was sent 
+    /// </summary>
+    bool QueueServeOutput(ServeClient& client, const void* data, size_t size)
+    {
+        if (client.outgoing.size() - client.outgoingSent + size > SERVE_MAX_OUTGOING)
+        {
+            return false;
+        }
+
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        client.outgoing.insert(client.outgoing.end(), bytes, bytes + size);
+        return true;
+    }
+
+    /// <summary>
+    /// Sends every client as much of its results as it takes without
+    /// waiting 
+    /// </summary>
+    void SendServeResults()
+    {
+        for (auto it = serveClients.begin(); it != serveClients.end();)
+        {
+            ServeClient& client = it->second;
+            bool connected = true;
+            if (!client.outgoing.empty())
+            {
+                connected = client.socket.SendSome(client.outgoing.data() + client.outgoingSent,
+                    client.outgoing.size() - client.outgoingSent, client.outgoingSent);
+                if (client.outgoingSent == client.outgoing.size())
+                {
+                    client.outgoing.clear();
+                    client.outgoingSent = 0;
+                }
+            }
+
+            it = connected ? std::next(it) : serveClients.erase(it);
+        }
+    }
+
+    /// <summary>
+    /// Queues every request that has fully arrived. Invalid jobs are
+    /// answered right away 
+    /// </summary>
+    void ReceiveServeRequests()
+    {
+        for (auto it = serveClients.begin(); it != serveClients.end();)
+        {
+            ServeClient& client = it->second;
+            bool connected = client.socket.ReceiveSome(client.received);
+
+            // A request cut short by the client is finished next time 
+            size_t offset = 0;
+            while (offset + sizeof(RenderService::Request) <= client.received.size())
+            {
+                RenderService::Request request;
+                memcpy(&request, client.received.data() + offset, sizeof(request));
+                offset += sizeof(request);
+
+                if (request.type == RenderService::REQUEST_SHUTDOWN)
+                {
+                    serveRunning = false;
+                }
+                else if (!RenderService::IsValid(request.job))
+                {
+                    RenderService::Result result{ request.job.id, RenderService::RESULT_INVALID_JOB, 0 };
+                    connected = connected && QueueServeOutput(client, &result, sizeof(result));
+                }
+                else
+                {
+                    servePending.push_back({ it->first, request.job, {} });
+                }
+            }
+            client.received.erase(client.received.begin(), client.received.begin() + offset);
+
+            // Jobs of clients that went away are simply dropped later 
+            it = connected ? std::next(it) : serveClients.erase(it);
+        }
+    }
+
+    /// <summary>
+    /// Moves the oldest pending job and every other pending job with
+    /// the same scene time that still fits into the batch for slot.
+    /// Tiles are placed on shelves, left to right and top to bottom 
+    /// </summary>
+    bool BuildServeBatch(uint32_t slot)
+    {
+        std::vector<ServeJob>& batch = serveBatches[slot];
+        if (servePending.empty())
+        {
+            return false;
+        }
+
+        const uint32_t size = RenderService::ATLAS_SIZE;
+        float sceneTime = servePending.front().job.sceneTime;
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t shelfHeight = 0;
+
+        for (auto it = servePending.begin(); it != servePending.end();)
+        {
+            if (it->job.sceneTime != sceneTime)
+            {
+                ++it;
+                continue;
+            }
+
+            if (x + it->job.width > size)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+
+            // Atlas is full, the rest waits for the next batch 
+            if (y + it->job.height > size)
+            {
+                break;
+            }
+
+            ServeJob job = *it;
+            job.tile.offset = { static_cast<int32_t>(x), static_cast<int32_t>(y) };
+            job.tile.extent = { it->job.width, it->job.height };
+            batch.push_back(job);
+
+            x += it->job.width;
+            shelfHeight = (std::max)(shelfHeight, it->job.height);
+            it = servePending.erase(it);
+        }
+
+        // Nothing to copy back, an empty batch must not be submitted 
+        if (batch.empty())
+        {
+            return false;
+        }
+
+        serveBatchHeights[slot] = y + shelfHeight;
+
+        // Only pose (and skin) again when the scene changes 
+        if (!servePosed || servePoseTime != sceneTime)
+        {
+            PoseCharacters(sceneTime);
+            servePoseTime = sceneTime;
+            servePosed = true;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Records and submits the batch for slot: skinning, one render
+    /// pass over the atlas with a viewport per job, then a copy of
+    /// the used rows into the readback buffer 
+    /// </summary>
+    void SubmitServeBatch(uint32_t slot)
+    {
+        VkCommandBuffer commandBuffer = commandBuffers[slot];
+        vkResetFences(device, 1, &inFlightFences[slot]);
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to begin recording command buffer!");
+        }
+
+        RecordDynamicUploads(commandBuffer, slot);
+        RecordSkinningPass(commandBuffer);
+
+        const uint32_t size = RenderService::ATLAS_SIZE;
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = serveRenderPass;
+        renderPassInfo.framebuffer = serveAtlasFramebuffers[slot];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = { size, size };
+
+        VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // Note: The camera is just the viewport. Zooming scales it
+        //       around the tile and the camera centre ends up in the
+        //       middle of the tile. The scissor keeps neighbours clean 
+        for (const ServeJob& job : serveBatches[slot])
+        {
+            float width = static_cast<float>(job.job.width) * job.job.cameraZoom;
+            float height = static_cast<float>(job.job.height) * job.job.cameraZoom;
+
+            VkViewport viewport{};
+            viewport.x = job.tile.offset.x + job.job.width * 0.5f - (job.job.cameraX + 1.0f) * 0.5f * width;
+            viewport.y = job.tile.offset.y + job.job.height * 0.5f - (job.job.cameraY + 1.0f) * 0.5f * height;
+            viewport.width = width;
+            viewport.height = height;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+
+            RecordSceneDraw(commandBuffer, viewport, job.tile);
+        }
+
+        vkCmdEndRenderPass(commandBuffer);
+
+        // The render pass leaves the atlas ready to copy but nothing
+        // made the writes available to the transfer yet 
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = serveAtlasImages[slot];
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        // Rows below the last shelf are empty, no need to copy them 
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { size, serveBatchHeights[slot], 1 };
+
+        vkCmdCopyImageToBuffer(commandBuffer, serveAtlasImages[slot], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            serveReadbackBuffers[slot], 1, &region);
+
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = serveReadbackBuffers[slot];
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to record command buffer!");
+        }
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[slot]) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to submit render batch!");
+        }
+
+        serveJobCount += serveBatches[slot].size();
+        serveBatchCount++;
+    }
+
+    /// <summary>
+    /// Encodes every job of a finished batch in parallel and sends
+    /// the images back. The fence of slot must have been waited on 
+    /// </summary>
+    void FinishServeBatch(uint32_t slot)
+    {
+        std::vector<ServeJob>& batch = serveBatches[slot];
+        if (batch.empty())
+        {
+            return;
+        }
+
+        if (!serveCoherent)
+        {
+            VkMappedMemoryRange range{};
+            range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            range.memory = serveReadbackBuffersMemory[slot];
+            range.offset = 0;
+            range.size = VK_WHOLE_SIZE;
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+
+        const uint8_t* atlas = static_cast<const uint8_t*>(serveReadbackBuffersMapped[slot]);
+        const uint32_t rowPitch = RenderService::ATLAS_SIZE * 4;
+
+        std::vector<std::vector<uint8_t>> encoded(batch.size());
+        jobSystem.ParallelFor(static_cast<uint32_t>(batch.size()), 1, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const ServeJob& job = batch[i];
+
+                ImageEncode::SourceImage image{};
+                image.pixels = atlas + static_cast<size_t>(job.tile.offset.y) * rowPitch + job.tile.offset.x * 4;
+                image.rowPitch = rowPitch;
+                image.width = job.tile.extent.width;
+                image.height = job.tile.extent.height;
+                image.bgra = serveBgra;
+
+                auto format = job.job.format == RenderService::IMAGE_FORMAT_PNG ? ImageEncode::Format::Png : ImageEncode::Format::Qoi;
+                encoded[i] = ImageEncode::Encode(jobSystem, image, format);
+            }
+        });
+
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            auto client = serveClients.find(batch[i].client);
+            if (client == serveClients.end())
+            {
+                continue;
+            }
+
+            RenderService::Result result{ batch[i].job.id, RenderService::RESULT_OK, encoded[i].size() };
+            if (!QueueServeOutput(client->second, &result, sizeof(result)) ||
+                !QueueServeOutput(client->second, encoded[i].data(), encoded[i].size()))
+            {
+                std::cout << "Dropped a render client that stopped reading its results" << std::endl;
+                serveClients.erase(client);
+            }
+        }
+
+        batch.clear();
+        SendServeResults();
+    }
+
+    /// <summary>
+    /// Sends out whatever is still in flight and frees the atlases.
+    /// The device has to be idle already 
+    /// </summary>
+    void CleanupRenderService()
+    {
+        if (!serveEnabled)
+        {
+            return;
+        }
+
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            FinishServeBatch(i);
+
+            vkDestroyFramebuffer(device, serveAtlasFramebuffers[i], nullptr);
+            vkDestroyImageView(device, serveAtlasImageViews[i], nullptr);
+            vkDestroyImage(device, serveAtlasImages[i], nullptr);
+            vkFreeMemory(device, serveAtlasImagesMemory[i], nullptr);
+
+            vkDestroyBuffer(device, serveReadbackBuffers[i], nullptr);
+            vkFreeMemory(device, serveReadbackBuffersMemory[i], nullptr);
+        }
+
+        vkDestroyRenderPass(device, serveRenderPass, nullptr);
+
+        // The last results still get a moment to go out 
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERVE_SHUTDOWN_FLUSH_MS);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            SendServeResults();
+
+            bool sending = false;
+            for (const auto& client : serveClients)
+            {
+                sending = sending || !client.second.outgoing.empty();
+            }
+            if (!sending)
+            {
+                break;
+            }
+            WaitForServeSockets(SERVE_IDLE_WAIT_MS);
+        }
+
+        serveClients.clear();
+        serveListener.Close();
+    }
+
+    #pragma endregion
+
+    #pragma region Render On Demand
+
+    // Note: Kiosks mostly show a still image, so drawing it again and
+    //       again only burns power. In this mode the main loop sleeps
+    //       in glfwWaitEventsTimeout and draws only once something
+    //       marked the frame dirty. Input and resizes mark it from
+    //       their callbacks, anything that changes every frame
+    //       (animation, frames streamed out) is checked before sleeping 
+
+    /// <summary>
+    /// Marks the frame dirty for everything that needs a new image
+    /// every frame while it is active 
+    /// </summary>
+    void UpdateContinuousDirty()
+    {
+        if (!animationPaused)
+        {
+            frameDirty |= DIRTY_ANIMATION;
+        }
+
+        // Copies are only collected by the next DrawFrame, so frames
+        // keep coming until the last screenshot has been handed over 
+        if (exportEnabled || recordEnabled || screenshotRequested || !readbackCopying.empty())
+        {
+            frameDirty |= DIRTY_STREAMING;
+        }
+
+        if (environmentDirty || iblNextFace < CUBE_FACES || skyBuildSlice < SKY_VIEW_SLICES || fogSettleFrames > 0 ||
+            ssrSettleFrames > 0 || terrainPagesMissing > 0)
+        {
+            frameDirty |= DIRTY_LIGHTING;
+        }
+    }
+
+    /// <summary>
+    /// Blocks until the next frame should be drawn. Returns false if
+    /// a window was closed while waiting 
+    /// </summary>
+    bool WaitForDirtyFrame(const std::function<bool()>& anyWindowClosed)
+    {
+        glfwPollEvents();
+        UpdateContinuousDirty();
+
+        while (frameDirty == 0)
+        {
+            if (anyWindowClosed())
+            {
+                return false;
+            }
+
+            float idle = std::chrono::duration<float>(std::chrono::steady_clock::now() - lastFrameTime).count();
+            float remaining = minimumRefresh - idle;
+            if (minimumRefresh > 0.0f && remaining <= 0.0f)
+            {
+                frameDirty |= DIRTY_REFRESH;
+                break;
+            }
+
+            // Note: Returns as soon as any event arrives, the callbacks
+            //       decide whether it actually changed anything 
+            if (minimumRefresh > 0.0f)
+            {
+                glfwWaitEventsTimeout(remaining);
+            }
+            else
+            {
+                glfwWaitEvents();
+            }
+
+            UpdateContinuousDirty();
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// The window was uncovered or the OS otherwise lost its contents 
+    /// </summary>
+    static void WindowRefreshCallback(GLFWwindow* window)
+    {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->frameDirty |= DIRTY_REFRESH;
+        app->damageEverything = true;
+    }
+
+    static void CursorPosCallback(GLFWwindow* window, double x, double y)
+    {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->frameDirty |= DIRTY_INPUT;
+    }
+
+    static void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+    {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->frameDirty |= DIRTY_INPUT;
+    }
+
+    static void ScrollCallback(GLFWwindow* window, double x, double y)
+    {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->frameDirty |= DIRTY_INPUT;
+    }
+
+    #pragma endregion
+
+    #pragma region Damage Tracking
+
+    // Note: Most of a frame usually looks exactly like the one before.
+    //       Swap chain images keep their contents, so instead of
+    //       clearing and drawing everything we load what the image
+    //       showed when it was last drawn and only repaint the cells
+    //       that changed since. The scene is drawn once per damaged
+    //       rectangle with the scissor cut down to it, which throws
+    //       away the fragment work everywhere else. With
+    //       VK_KHR_incremental_present the same rectangles are passed
+    //       on so the compositor only has to copy those as well
+    //
+    //       The damage of a frame comes from every character whose
+    //       pose moved it, marked where it was and where it is now 
+
+    void CreateDamageTracking()
+    {
+        if (!damageTrackingEnabled)
+        {
+            return;
+        }
+
+        damageRenderPass = CreateDamageRenderPass();
+
+        // Skinning only ever mixes joint transforms of the bind pose,
+        // so the bind pose bounds moved by every joint contain the
+        // skinned mesh 
+        meshBoundsMin = vertices[0].pos;
+        meshBoundsMax = vertices[0].pos;
+        for (const Vertex& vertex : vertices)
+        {
+            meshBoundsMin = glm::min(meshBoundsMin, vertex.pos);
+            meshBoundsMax = glm::max(meshBoundsMax, vertex.pos);
+        }
+
+        // An empty rectangle, the first pose damages nothing it did
+        // not already cover 
+        characterBounds.assign(CHARACTER_COUNT, glm::vec4(1.0f, 1.0f, -1.0f, -1.0f));
+        damagedCharacterBounds = characterBounds;
+    }
+
+    /// <summary>
+    /// Same attachment as renderPass, so the framebuffers and pipeline
+    /// work with either, but it keeps what the image showed before 
+    /// </summary>
+    VkRenderPass CreateDamageRenderPass()
+    {
+        VkAttachmentDescription colorAttachment{};
+        colorAttachment.format = windows[0].swapChainImageFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorAttachmentRef{};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+
+        // Loading reads the image so the read has to wait for the
+        // acquire as well, not just the writes 
+        VkSubpassDependency dependency{};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &colorAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies = &dependency;
+
+        VkRenderPass pass;
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create damage render pass!");
+        }
+        return pass;
+    }
+
+    /// <summary>
+    /// Clip space bounds of a character posed by palette, padded a
+    /// little so rounding never leaves a stale pixel behind 
+    /// </summary>
+    glm::vec4 SkinnedBounds(const glm::mat4* palette, uint32_t jointCount) const
+    {
+        const glm::vec2 corners[] =
+        {
+            meshBoundsMin,
+            { meshBoundsMax.x, meshBoundsMin.y },
+            { meshBoundsMin.x, meshBoundsMax.y },
+            meshBoundsMax
+        };
+
+        glm::vec2 boundsMin(std::numeric_limits<float>::max());
+        glm::vec2 boundsMax(std::numeric_limits<float>::lowest());
+        for (uint32_t joint = 0; joint < jointCount; joint++)
+        {
+            for (const glm::vec2& corner : corners)
+            {
+                glm::vec2 position = glm::vec2(palette[joint] * glm::vec4(corner, 0.0f, 1.0f));
+                boundsMin = glm::min(boundsMin, position);
+                boundsMax = glm::max(boundsMax, position);
+            }
+        }
+
+        return glm::vec4(boundsMin - DAMAGE_PADDING, boundsMax + DAMAGE_PADDING);
+    }
+
+    /// <summary>
+    /// Starts a new damage frame and marks everything that changed
+    /// since the previous one 
+    /// </summary>
+    void UpdateDamage()
+    {
+        if (!damageTrackingEnabled)
+        {
+            return;
+        }
+
+        Damage::Grid& damage = damageHistory[++damageFrame % DAMAGE_HISTORY];
+        damage.Clear();
+
+        if (damageEverything)
+        {
+            damage.MarkAll();
+            damageEverything = false;
+        }
+
+        if (poseVersion == damagePoseVersion)
+        {
+            return;
+        }
+
+        for (uint32_t i = 0; i < CHARACTER_COUNT; i++)
+        {
+            const glm::vec4& before = damagedCharacterBounds[i];
+            const glm::vec4& after = characterBounds[i];
+            if (before == after)
+            {
+                continue;
+            }
+
+            damage.Mark(before.x, before.y, before.z, before.w);
+            damage.Mark(after.x, after.y, after.z, after.w);
+            damagedCharacterBounds[i] = after;
+        }
+
+        damagePoseVersion = poseVersion;
+    }
+
+    /// <summary>
+    /// Brings the image a window acquired up to date by repainting
+    /// only what changed since it was last drawn. Leaves the
+    /// repainted rectangles for the present 
+    /// </summary>
+    void RecordDamagedScenePass(VkCommandBuffer commandBuffer, WindowTarget& target)
+    {
+        VkFramebuffer framebuffer = target.swapChainFramebuffers[target.imageIndex];
+        VkExtent2D extent = target.swapChainExtent;
+
+        uint64_t drawnFrame = target.imageDrawnFrames[target.imageIndex];
+        target.imageDrawnFrames[target.imageIndex] = damageFrame;
+        target.presentRects.clear();
+        windowPixels += static_cast<uint64_t>(extent.width) * extent.height;
+
+        // The history only reaches back DAMAGE_HISTORY frames. An image
+        // drawn before that, or never, has to be drawn in full 
+        Damage::Grid repaint;
+        if (drawnFrame == 0 || damageFrame - drawnFrame > DAMAGE_HISTORY)
+        {
+            repaint.MarkAll();
+        }
+        else
+        {
+            for (uint64_t frame = drawnFrame + 1; frame <= damageFrame; frame++)
+            {
+                repaint |= damageHistory[frame % DAMAGE_HISTORY];
+            }
+        }
+
+        if (repaint.All())
+        {
+            RecordScenePass(commandBuffer, renderPass, framebuffer, extent);
+            repaintedPixels += static_cast<uint64_t>(extent.width) * extent.height;
+            return;
+        }
+
+        // The image already shows this frame. It still has to be
+        // presented, so a single pixel is reported as changed 
+        if (!repaint.Any())
+        {
+            target.presentRects.push_back({ { 0, 0 }, { 1, 1 }, 0 });
+            return;
+        }
+
+        std::vector<Damage::Rect> rects = repaint.ToRects(extent.width, extent.height, MAX_DAMAGE_RECTS);
+
+        std::vector<VkClearRect> clearRects;
+        VkRect2D renderArea = { { rects[0].x, rects[0].y }, { rects[0].width, rects[0].height } };
+        for (const Damage::Rect& rect : rects)
+        {
+            VkRect2D area = { { rect.x, rect.y }, { rect.width, rect.height } };
+            clearRects.push_back({ area, 0, 1 });
+            target.presentRects.push_back({ area.offset, area.extent, 0 });
+            repaintedPixels += static_cast<uint64_t>(rect.width) * rect.height;
+
+            int32_t right = (std::max)(renderArea.offset.x + static_cast<int32_t>(renderArea.extent.width), rect.x + static_cast<int32_t>(rect.width));
+            int32_t bottom = (std::max)(renderArea.offset.y + static_cast<int32_t>(renderArea.extent.height), rect.y + static_cast<int32_t>(rect.height));
+            renderArea.offset.x = (std::min)(renderArea.offset.x, rect.x);
+            renderArea.offset.y = (std::min)(renderArea.offset.y, rect.y);
+            renderArea.extent.width = static_cast<uint32_t>(right - renderArea.offset.x);
+            renderArea.extent.height = static_cast<uint32_t>(bottom - renderArea.offset.y);
+        }
+
+        // The render area only promises the driver nothing outside of
+        // it is touched, the scissor does the actual cutting 
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = damageRenderPass;
+        renderPassInfo.framebuffer = framebuffer;
+        renderPassInfo.renderArea = renderArea;
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // Same clear color as RecordScenePass 
+        VkClearAttachment clearAttachment{};
+        clearAttachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        clearAttachment.colorAttachment = 0;
+        clearAttachment.clearValue = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
+        vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, static_cast<uint32_t>(clearRects.size()), clearRects.data());
+
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = static_cast<float>(extent.width);
+        viewport.height = static_cast<float>(extent.height);
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        for (const VkClearRect& clearRect : clearRects)
+        {
+            RecordSceneDraw(commandBuffer, viewport, clearRect.rect);
+        }
+
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    void CleanupDamageTracking()
+    {
+        if (!damageTrackingEnabled)
+        {
+            return;
+        }
+
+        vkDestroyRenderPass(device, damageRenderPass, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Shading
+
+    // Note: With lights in the scene there are two ways to shade it.
+    //       Forward runs every light in the fragment shader of the main
+    //       pass, so its cost is covered pixels (and overdraw) times
+    //       lights. Deferred first writes what the surface looks like
+    //       into a G-buffer, then a compute pass splits the screen into
+    //       tiles, culls the lights per tile and shades every pixel
+    //       once with only the lights that reach it
+    //
+    //       Every byte of the G-buffer is written and read back once a
+    //       pixel, so it is kept as small as the surface allows:
+    //
+    //           normal  R16G16_SNORM    octahedral encoded 
+    //           albedo  R8G8B8A8_SRGB   roughness in alpha 
+    //           depth   D32_SFLOAT      position is rebuilt from it 
+    //
+    //       12 bytes a pixel, a RGBA32F position and RGBA16F normal
+    //       would take 32. Devices that cannot render to the normal or
+    //       depth format get the closest one they can, see
+    //       SelectGBufferFormats. The lighting result is blitted into the swap
+    //       chain. G switches paths while running and the GPU time of
+    //       both is printed when switching and on exit. The deferred
+    //       path can add ambient occlusion and post-processing, see
+    //       their regions 
+
+    void CreateShading()
+    {
+        if (!shadingEnabled)
+        {
+            return;
+        }
+
+        CreateLights();
+        CreateShadingDescriptorSetLayout();
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = SHADING_PUSH_STAGES;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(ShadingPushConstants);
+
+        // Every shading pipeline shares one layout so the same
+        // descriptor set and push constants serve both paths 
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &shadingDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &shadingPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create shading pipeline layout!");
+        }
+
+        SelectGBufferFormats();
+        gbufferRenderPass = CreateGBufferRenderPass();
+        forwardPipeline = CreateLitPipeline("Shaders/forward.spv", renderPass, 1, false);
+        gbufferPipeline = CreateLitPipeline("Shaders/gbuffer.spv", gbufferRenderPass, 2, true);
+        lightingPipeline = CreateShadingComputePipeline("Shaders/deferred.spv", shadingPipelineLayout);
+        skyPipeline = CreateLitPipeline("Shaders/sky.spv", renderPass, 1, false, true);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &shadingSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create G-buffer sampler!");
+        }
+
+        CreateAmbientOcclusion();
+        CreatePostProcessing();
+        CreateReflections();
+        CreateImageBasedLighting();
+        CreateAtmosphere();
+        CreateFog();
+        CreateTerrain();
+        CreateFoliage();
+
+        //  2 storage buffers       Lights, irradiance
+        // 10 combined samplers     Normal, albedo, depth, AO, prefiltered environment, BRDF LUT,
+        //                          sky-view LUT, transmittance LUT, fog volume, terrain
+        //  1 storage image         Lighting result
+        uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount * 2 };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount * 10 };
+        poolSizes[2] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &shadingDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create shading descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, shadingDescriptorSetLayout);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = shadingDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        shadingDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocInfo, shadingDescriptorSets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate shading descriptor sets!");
+        }
+
+        CreateShadingTargets(windows[0].swapChainExtent);
+
+        // Note: Timestamps are optional, without them both paths still
+        //       work but there is nothing to compare 
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+        shadingTimedPaths.assign(MAX_FRAMES_IN_FLIGHT, -1);
+        shadingTimedPixels.assign(MAX_FRAMES_IN_FLIGHT, 0);
+        aoTimed.assign(MAX_FRAMES_IN_FLIGHT, false);
+        postTimed.assign(MAX_FRAMES_IN_FLIGHT, false);
+        ssrTimed.assign(MAX_FRAMES_IN_FLIGHT, false);
+        fogTimed.assign(MAX_FRAMES_IN_FLIGHT, false);
+        terrainTimed.assign(MAX_FRAMES_IN_FLIGHT, false);
+        foliageTimed.assign(MAX_FRAMES_IN_FLIGHT, false);
+
+        if (properties.limits.timestampComputeAndGraphics)
+        {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = setCount * SHADING_QUERY_COUNT;
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &shadingQueryPool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create shading query pool!");
+            }
+        }
+    }
+
+    /// <summary>
+    /// Scatters the lights over the crowd and creates a buffer per
+    /// frame in flight for their animated positions 
+    /// </summary>
+    void CreateLights()
+    {
+        // Note: Steps of the golden ratio spread the lights evenly
+        //       and give every one its own look without any randomness 
+        auto sequence = [](uint32_t i, float step)
+        {
+            return std::fmod(static_cast<float>(i) * step, 1.0f);
+        };
+
+        lightOrbits.resize(lightCount);
+        for (uint32_t i = 0; i < lightCount; i++)
+        {
+            LightOrbit& orbit = lightOrbits[i];
+            orbit.center = glm::vec2(sequence(i, 0.618034f), (static_cast<float>(i) + 0.5f) / lightCount) * 2.0f - 1.0f;
+            orbit.distance = 0.05f + 0.1f * sequence(i, 0.754878f);
+            orbit.speed = 0.5f + sequence(i, 0.569840f);
+            orbit.phase = 6.2831853f * sequence(i, 0.381966f);
+            orbit.radius = 0.1f + 0.1f * sequence(i, 0.414214f);
+
+            // Fully saturated hue 
+            float hue = sequence(i, 0.618034f) * 6.0f;
+            orbit.color = glm::clamp(glm::vec3(
+                std::abs(hue - 3.0f) - 1.0f,
+                2.0f - std::abs(hue - 2.0f),
+                2.0f - std::abs(hue - 4.0f)), 0.0f, 1.0f) * 0.6f;
+        }
+
+        VkDeviceSize size = sizeof(ShadingLight) * lightCount;
+        lightBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        lightBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        lightBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateDynamicBuffer(static_cast<uint32_t>(i), size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                lightBuffers[i], lightBuffersMemory[i], lightBuffersMapped[i]);
+        }
+    }
+
+    void CreateShadingDescriptorSetLayout()
+    {
+        //  0   Lights                  forward.frag, deferred.comp
+        //  1   G-buffer normal         deferred.comp
+        //  2   G-buffer albedo         deferred.comp
+        //  3   G-buffer depth          deferred.comp
+        //  4   Lighting result         deferred.comp
+        //  5   Ambient occlusion       deferred.comp
+        //  6   Prefiltered environment forward.frag, deferred.comp
+        //  7   BRDF lookup table       forward.frag, deferred.comp
+        //  8   Irradiance              forward.frag, deferred.comp
+        //  9   Sky-view LUT            sky.frag, deferred.comp
+        // 10   Transmittance LUT       sky.frag, deferred.comp
+        // 11   Fog volume              forward.frag, sky.frag, deferred.comp
+        // 12   Terrain color           sky.frag, deferred.comp
+        std::array<VkDescriptorSetLayoutBinding, 13> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); i++)
+        {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        for (uint32_t i = 6; i < bindings.size(); i++)
+        {
+            bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &shadingDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create shading descriptor set layout!");
+        }
+    }
+
+    /// <summary>
+    /// Picks G-buffer formats the device can both render to and sample.
+    /// R16G16_SFLOAT holds the octahedral normal just as well, only
+    /// unclamped. Of the depth formats D16 always works, if coarsely 
+    /// </summary>
+    void SelectGBufferFormats()
+    {
+        const VkFormatFeatureFlags colorFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        const VkFormatFeatureFlags depthFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
+        gbufferNormalFormat = FindSupportedFormat({ VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT }, colorFeatures);
+        gbufferDepthFormat = FindSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM }, depthFeatures);
+    }
+
+    /// <summary>
+    /// Two color attachments and depth, all left ready to be read
+    /// by the lighting pass 
+    /// </summary>
+    VkRenderPass CreateGBufferRenderPass()
+    {
+        std::array<VkAttachmentDescription, 3> attachments{};
+        const VkFormat formats[] = { gbufferNormalFormat, GBUFFER_ALBEDO_FORMAT, gbufferDepthFormat };
+        for (uint32_t i = 0; i < attachments.size(); i++)
+        {
+            attachments[i].format = formats[i];
+            attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+            attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+        attachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentRefs[] =
+        {
+            { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+            { 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }
+        };
+        VkAttachmentReference depthAttachmentRef = { 2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 2;
+        subpass.pColorAttachments = colorAttachmentRefs;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        // The lighting pass of an earlier frame may still read the
+        // G-buffer, and this frame's lighting pass has to wait for it 
+        std::array<VkSubpassDependency, 2> dependencies{};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+
+        VkRenderPass pass;
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create G-buffer render pass!");
+        }
+        return pass;
+    }
+
+    /// <summary>
+    /// The characters drawn through lit.vert and the given fragment
+    /// shader. Fixed function state is the same as the unlit
+    /// pipeline of CreateGraphicsPipeline 
+    /// </summary>
+    VkPipeline CreateLitPipeline(const std::string& fragPath, VkRenderPass pass, uint32_t colorAttachmentCount, bool depthTest,
+        bool fullscreen = false)
+    {
+        VkShaderModule vertShaderModule = CreateShaderModule(ReadFile(fullscreen ? "Shaders/fullscreen.spv" : "Shaders/lit.spv"));
+        VkShaderModule fragShaderModule = CreateShaderModule(ReadFile(fragPath));
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStages[0].module = vertShaderModule;
+        shaderStages[0].pName = "main";
+        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[1].module = fragShaderModule;
+        shaderStages[1].pName = "main";
+
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        // A full screen triangle makes its own vertices 
+        auto bindingDescription = Vertex::GetBindingDescription();
+        auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        if (!fullscreen)
+        {
+            vertexInputInfo.vertexBindingDescriptionCount = 1;
+            vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+            vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+            vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+        }
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = fullscreen ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.minSampleShading = 1.0f;
+
+        // Characters lie on a few depth layers (see lit.vert) but the
+        // forward path has no depth buffer. ALWAYS keeps the last one
+        // drawn on top just like there, while depth still records
+        // what ended up visible 
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+        std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(colorAttachmentCount);
+        for (auto& colorBlendAttachment : colorBlendAttachments)
+        {
+            colorBlendAttachment.colorWriteMask =
+                VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+            colorBlendAttachment.blendEnable = VK_FALSE;
+        }
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.attachmentCount = colorAttachmentCount;
+        colorBlending.pAttachments = colorBlendAttachments.data();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        pipelineInfo.pStages = shaderStages.data();
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = depthTest ? &depthStencil : nullptr;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = shadingPipelineLayout;
+        pipelineInfo.renderPass = pass;
+        pipelineInfo.subpass = 0;
+
+        VkPipeline pipeline;
+        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create lit pipeline!");
+        }
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        return pipeline;
+    }
+
+    VkPipeline CreateShadingComputePipeline(const std::string& compPath, VkPipelineLayout layout,
+        const VkSpecializationInfo* specialization = nullptr)
+    {
+        VkShaderModule compShaderModule = CreateShaderModule(ReadFile(compPath));
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = compShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.stage.pSpecializationInfo = specialization;
+        pipelineInfo.layout = layout;
+
+        VkPipeline pipeline;
+        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create shading compute pipeline!");
+        }
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+        return pipeline;
+    }
+
+    /// <summary>
+    /// Creates the G-buffer and lighting result of every frame in
+    /// flight at the window's size and points the descriptor sets
+    /// at them 
+    /// </summary>
+    void CreateShadingTargets(VkExtent2D extent)
+    {
+        shadingExtent = extent;
+        shadingTargets.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            ShadingTargets& targets = shadingTargets[i];
+
+            CreateImage(extent.width, extent.height, 1, gbufferNormalFormat,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.normalImage, targets.normalMemory);
+            targets.normalView = CreateImageView(targets.normalImage, VK_IMAGE_VIEW_TYPE_2D, gbufferNormalFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+            CreateImage(extent.width, extent.height, 1, GBUFFER_ALBEDO_FORMAT,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.albedoImage, targets.albedoMemory);
+            targets.albedoView = CreateImageView(targets.albedoImage, VK_IMAGE_VIEW_TYPE_2D, GBUFFER_ALBEDO_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+            CreateImage(extent.width, extent.height, 1, gbufferDepthFormat,
+                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.depthImage, targets.depthMemory);
+            targets.depthView = CreateImageView(targets.depthImage, VK_IMAGE_VIEW_TYPE_2D, gbufferDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+            CreateImage(extent.width, extent.height, 1, LIT_FORMAT,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.litImage, targets.litMemory);
+            targets.litView = CreateImageView(targets.litImage, VK_IMAGE_VIEW_TYPE_2D, LIT_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+            std::array<VkImageView, 3> attachments = { targets.normalView, targets.albedoView, targets.depthView };
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = gbufferRenderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            framebufferInfo.pAttachments = attachments.data();
+            framebufferInfo.width = extent.width;
+            framebufferInfo.height = extent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &targets.framebuffer) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create G-buffer framebuffer!");
+            }
+
+            CreateAmbientOcclusionTargets(targets, extent);
+            CreatePostProcessingTargets(targets, extent);
+            CreateReflectionTargets(targets);
+            CreateTerrainTargets(targets, extent);
+
+            VkDescriptorBufferInfo lightInfo = { lightBuffers[i], 0, VK_WHOLE_SIZE };
+            VkDescriptorBufferInfo irradianceInfo = { irradianceBuffer, 0, VK_WHOLE_SIZE };
+            // Indexed by binding, 0 and 8 are buffers 
+            std::array<VkDescriptorImageInfo, 13> imageInfos{};
+            imageInfos[1] = { shadingSampler, targets.normalView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+            imageInfos[2] = { shadingSampler, targets.albedoView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+            imageInfos[3] = { shadingSampler, targets.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+            imageInfos[4] = { VK_NULL_HANDLE, targets.litView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[5] = { shadingSampler, targets.aoViews[0], VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[6] = { iblSampler, prefilteredCubeView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[7] = { iblSampler, brdfLutView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[9] = { atmosphereSampler, skyViewView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[10] = { atmosphereSampler, transmittanceView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[11] = { fogSampler, fogIntegratedView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[12] = { shadingSampler, targets.terrainColorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+            std::array<VkWriteDescriptorSet, 13> descriptorWrites{};
+            for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+            {
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = shadingDescriptorSets[i];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                descriptorWrites[b].pImageInfo = &imageInfos[b];
+            }
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[0].pBufferInfo = &lightInfo;
+            descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[8].pBufferInfo = &irradianceInfo;
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        // Each frame's reflections read the other frame's history, so
+        // their sets wait until every target exists 
+        WriteReflectionDescriptorSets();
+    }
+
+    void DestroyShadingTargets()
+    {
+        for (ShadingTargets& targets : shadingTargets)
+        {
+            vkDestroyFramebuffer(device, targets.framebuffer, nullptr);
+
+            const VkImageView views[] = { targets.normalView, targets.albedoView, targets.depthView, targets.litView };
+            const VkImage images[] = { targets.normalImage, targets.albedoImage, targets.depthImage, targets.litImage };
+            const VkDeviceMemory memories[] = { targets.normalMemory, targets.albedoMemory, targets.depthMemory, targets.litMemory };
+            for (size_t i = 0; i < 4; i++)
+            {
+                vkDestroyImageView(device, views[i], nullptr);
+                vkDestroyImage(device, images[i], nullptr);
+                vkFreeMemory(device, memories[i], nullptr);
+            }
+
+            DestroyAmbientOcclusionTargets(targets);
+            DestroyPostProcessingTargets(targets);
+            DestroyReflectionTargets(targets);
+            DestroyTerrainTargets(targets);
+        }
+        shadingTargets.clear();
+
+        // Every AO and post-processing set belonged to the targets
+        // just destroyed 
+        vkResetDescriptorPool(device, aoDescriptorPool, 0);
+        vkResetDescriptorPool(device, postDescriptorPool, 0);
+    }
+
+    /// <summary>
+    /// Follows the window to its new size. The device is idle while
+    /// swap chains are recreated so nothing is still using them 
+    /// </summary>
+    void ResizeShadingTargets()
+    {
+        if (!shadingEnabled)
+        {
+            return;
+        }
+
+        DestroyShadingTargets();
+        CreateShadingTargets(windows[0].swapChainExtent);
+    }
+
+    /// <summary>
+    /// Moves every light along its orbit into this frame's buffer 
+    /// </summary>
+    void UpdateLights()
+    {
+        if (!shadingEnabled)
+        {
+            return;
+        }
+
+        ShadingLight* lights = static_cast<ShadingLight*>(lightBuffersMapped[currentFrame]);
+        for (uint32_t i = 0; i < lightCount; i++)
+        {
+            const LightOrbit& orbit = lightOrbits[i];
+            float angle = animationTime * orbit.speed + orbit.phase;
+            glm::vec2 position = orbit.center + orbit.distance * glm::vec2(std::cos(angle), std::sin(angle));
+
+            lights[i].positionRadius = glm::vec4(position, -LIGHT_HEIGHT, orbit.radius);
+            lights[i].color = glm::vec4(orbit.color, 0.0f);
+        }
+    }
+
+    /// <summary>
+    /// Draws the lit scene into the image a window acquired with
+    /// whichever path is selected, timing it if possible 
+    /// </summary>
+    void RecordLitScene(VkCommandBuffer commandBuffer, const WindowTarget& target)
+    {
+        // The scene is drawn straight in clip space so there is no
+        // camera to undo when rebuilding positions 
+        ShadingPushConstants pushConstants{};
+        pushConstants.inverseViewProjection = glm::mat4(1.0f);
+        pushConstants.extent[0] = target.swapChainExtent.width;
+        pushConstants.extent[1] = target.swapChainExtent.height;
+        pushConstants.lightCount = lightCount;
+        pushConstants.verticesPerCharacter = static_cast<uint32_t>(vertices.size());
+        pushConstants.aoEnabled = aoEnabled ? 1 : 0;
+        pushConstants.aoScale = aoScale;
+        pushConstants.iblEnabled = iblEnabled ? 1 : 0;
+        pushConstants.skyEnabled = skyEnabled ? 1 : 0;
+        pushConstants.sunDirection = glm::vec4(skyShownSun, 0.0f);
+        pushConstants.fogEnabled = fogEnabled ? 1 : 0;
+        pushConstants.terrainEnabled = terrainEnabled ? 1 : 0;
+
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdResetQueryPool(commandBuffer, shadingQueryPool, firstQuery, SHADING_QUERY_COUNT);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_SHADING_BEGIN);
+        }
+
+        if (fogEnabled)
+        {
+            RecordFog(commandBuffer);
+        }
+
+        if (terrainEnabled)
+        {
+            RecordTerrain(commandBuffer, shadingTargets[currentFrame]);
+        }
+
+        if (shadingPath == SHADING_DEFERRED)
+        {
+            RecordDeferredShading(commandBuffer, target, pushConstants);
+        }
+        else
+        {
+            RecordForwardShading(commandBuffer, target, pushConstants);
+        }
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_SHADING_END);
+            shadingTimedPaths[currentFrame] = shadingPath;
+            shadingTimedPixels[currentFrame] = static_cast<uint64_t>(target.swapChainExtent.width) * target.swapChainExtent.height;
+        }
+    }
+
+    void RecordForwardShading(VkCommandBuffer commandBuffer, const WindowTarget& target, const ShadingPushConstants& pushConstants)
+    {
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = target.swapChainFramebuffers[target.imageIndex];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = target.swapChainExtent;
+
+        VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // The background first, sky, terrain and fog, every character
+        // is drawn over it 
+        if (skyEnabled || fogEnabled || terrainEnabled)
+        {
+            BindLitPipeline(commandBuffer, skyPipeline, target.swapChainExtent, pushConstants);
+            vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+        }
+
+        BindLitPipeline(commandBuffer, forwardPipeline, target.swapChainExtent, pushConstants);
+        RecordCharacterDraw(commandBuffer);
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    void RecordDeferredShading(VkCommandBuffer commandBuffer, const WindowTarget& target, const ShadingPushConstants& pushConstants)
+    {
+        const ShadingTargets& targets = shadingTargets[currentFrame];
+
+        // ------------ Geometry Pass ------------
+
+        std::array<VkClearValue, 3> clearValues{};
+        clearValues[0].color = { {0.0f, 0.0f, 0.0f, 0.0f} };
+        clearValues[1].color = { {0.0f, 0.0f, 0.0f, 0.0f} };
+        clearValues[2].depthStencil = { 1.0f, 0 };
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = gbufferRenderPass;
+        renderPassInfo.framebuffer = targets.framebuffer;
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = shadingExtent;
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        BindLitPipeline(commandBuffer, gbufferPipeline, shadingExtent, pushConstants);
+        RecordCharacterDraw(commandBuffer);
+        vkCmdEndRenderPass(commandBuffer);
+
+        // ------------ Ambient Occlusion ------------
+
+        if (aoEnabled)
+        {
+            RecordAmbientOcclusion(commandBuffer, targets, pushConstants.inverseViewProjection);
+        }
+
+        // ------------ Lighting Pass ------------
+
+        // Whatever the lighting result held before is overwritten 
+        VkImageMemoryBarrier litBarrier{};
+        litBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        litBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        litBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        litBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        litBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        litBarrier.image = targets.litImage;
+        litBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        litBarrier.srcAccessMask = 0;
+        litBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &litBarrier);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightingPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadingPipelineLayout,
+            0, 1, &shadingDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, shadingPipelineLayout, SHADING_PUSH_STAGES,
+            0, sizeof(ShadingPushConstants), &pushConstants);
+
+        vkCmdDispatch(commandBuffer,
+            (shadingExtent.width + SHADING_TILE_SIZE - 1) / SHADING_TILE_SIZE,
+            (shadingExtent.height + SHADING_TILE_SIZE - 1) / SHADING_TILE_SIZE, 1);
+
+        // ------------ Reflections ------------
+
+        if (ssrEnabled)
+        {
+            RecordComputeBarrier(commandBuffer);
+            RecordReflections(commandBuffer, targets, pushConstants.inverseViewProjection);
+        }
+
+        // ------------ Post-Processing ------------
+
+        if (postEffects != 0)
+        {
+            RecordComputeBarrier(commandBuffer);
+            RecordPostProcessing(commandBuffer, targets, target.swapChainImageFormat);
+        }
+
+        // ------------ Copy To Swap Chain ------------
+
+        litBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        litBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        litBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        // Note: The acquire semaphore is waited on at the color
+        //       attachment output stage, starting the barrier there
+        //       makes the blit wait for it as well 
+        VkImageMemoryBarrier swapChainBarrier{};
+        swapChainBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        swapChainBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        swapChainBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        swapChainBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        swapChainBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        swapChainBarrier.image = target.swapChainImages[target.imageIndex];
+        swapChainBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        swapChainBarrier.srcAccessMask = 0;
+        swapChainBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &litBarrier);
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &swapChainBarrier);
+
+        // A blit rather than a copy since the formats differ 
+        VkImageBlit region{};
+        region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.srcOffsets[1] = { static_cast<int32_t>(shadingExtent.width), static_cast<int32_t>(shadingExtent.height), 1 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.dstOffsets[1] = { static_cast<int32_t>(target.swapChainExtent.width), static_cast<int32_t>(target.swapChainExtent.height), 1 };
+
+        vkCmdBlitImage(commandBuffer,
+            targets.litImage, VK_IMAGE_LAYOUT_GENERAL,
+            swapChainBarrier.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &region, VK_FILTER_NEAREST);
+
+        swapChainBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        swapChainBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        swapChainBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        swapChainBarrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &swapChainBarrier);
+    }
+
+    /// <summary>
+    /// Binds a lit graphics pipeline with its lights and sets it up
+    /// to cover the whole extent 
+    /// </summary>
+    void BindLitPipeline(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkExtent2D extent, const ShadingPushConstants& pushConstants)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadingPipelineLayout,
+            0, 1, &shadingDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, shadingPipelineLayout, SHADING_PUSH_STAGES,
+            0, sizeof(ShadingPushConstants), &pushConstants);
+
+        VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+        VkRect2D scissor = { { 0, 0 }, extent };
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+
+    /// <summary>
+    /// Adds the GPU time of the frame whose fence was just waited on
+    /// to the path it was shaded with 
+    /// </summary>
+    void CollectShadingTimings()
+    {
+        if (shadingQueryPool == VK_NULL_HANDLE || shadingTimedPaths[currentFrame] < 0)
+        {
+            return;
+        }
+
+        // The AO and post-processing timestamps were only written if
+        // those passes ran 
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        double milliseconds;
+        if (ReadShadingSpan(firstQuery + QUERY_SHADING_BEGIN, milliseconds))
+        {
+            ShadingStats& stats = shadingStats[shadingTimedPaths[currentFrame]];
+            stats.gpuMilliseconds += milliseconds;
+            stats.frames++;
+            stats.pixels += shadingTimedPixels[currentFrame];
+        }
+
+        if (aoTimed[currentFrame] && ReadShadingSpan(firstQuery + QUERY_AO_BEGIN, milliseconds))
+        {
+            aoGpuMilliseconds += milliseconds;
+            aoFrames++;
+        }
+
+        if (postTimed[currentFrame] && ReadShadingSpan(firstQuery + QUERY_POST_BEGIN, milliseconds))
+        {
+            postGpuMilliseconds += milliseconds;
+            postFrames++;
+        }
+
+        if (ssrTimed[currentFrame] && ReadShadingSpan(firstQuery + QUERY_SSR_BEGIN, milliseconds))
+        {
+            ssrGpuMilliseconds += milliseconds;
+            ssrFrames++;
+        }
+
+        if (fogTimed[currentFrame] && ReadShadingSpan(firstQuery + QUERY_FOG_BEGIN, milliseconds))
+        {
+            fogGpuMilliseconds += milliseconds;
+            fogFrames++;
+        }
+
+        if (terrainTimed[currentFrame] && ReadShadingSpan(firstQuery + QUERY_TERRAIN_BEGIN, milliseconds))
+        {
+            terrainGpuMilliseconds += milliseconds;
+            terrainFrames++;
+        }
+
+        if (foliageTimed[currentFrame] && ReadShadingSpan(firstQuery + QUERY_FOLIAGE_BEGIN, milliseconds))
+        {
+            foliageGpuMilliseconds += milliseconds;
+            foliageTimedFrames++;
+        }
+
+        shadingTimedPaths[currentFrame] = -1;
+        aoTimed[currentFrame] = false;
+        postTimed[currentFrame] = false;
+        ssrTimed[currentFrame] = false;
+        fogTimed[currentFrame] = false;
+        terrainTimed[currentFrame] = false;
+        foliageTimed[currentFrame] = false;
+    }
+
+    /// <summary>
+    /// GPU time between a timestamp and the one after it 
+    /// </summary>
+    bool ReadShadingSpan(uint32_t firstQuery, double& milliseconds)
+    {
+        uint64_t timestamps[2];
+        VkResult result = vkGetQueryPoolResults(device, shadingQueryPool, firstQuery, 2,
+            sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        milliseconds = static_cast<double>(timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+        return true;
+    }
+
+    /// <summary>
+    /// Prints the average GPU time of both paths next to how much
+    /// attachment memory each one moves per frame 
+    /// </summary>
+    void PrintShadingStats()
+    {
+        if (shadingQueryPool == VK_NULL_HANDLE)
+        {
+            std::cout << "No GPU timestamps on this device to compare the shading paths with" << std::endl;
+            return;
+        }
+
+        // Note: Estimated bytes written plus read per pixel, with every
+        //       attachment touched once. Light reads are left out, they
+        //       mostly hit the cache either way
+        //
+        //       forward     swap chain
+        //       deferred    G-buffer and lighting result written and
+        //                   read, swap chain 
+        const char* names[SHADING_PATH_COUNT] = { "forward", "deferred" };
+        const double swapChainBytes = FormatBytes(windows[0].swapChainImageFormat);
+        const double gbufferBytes = FormatBytes(gbufferNormalFormat) + FormatBytes(GBUFFER_ALBEDO_FORMAT) + FormatBytes(gbufferDepthFormat);
+        const double bytesPerPixel[SHADING_PATH_COUNT] = {
+            swapChainBytes,
+            2.0 * (gbufferBytes + FormatBytes(LIT_FORMAT)) + swapChainBytes
+        };
+
+        for (uint32_t path = 0; path < SHADING_PATH_COUNT; path++)
+        {
+            const ShadingStats& stats = shadingStats[path];
+            if (stats.frames == 0)
+            {
+                continue;
+            }
+
+            double pixels = static_cast<double>(stats.pixels) / stats.frames;
+            std::cout << names[path] << " shading, " << lightCount << " lights: "
+                << stats.gpuMilliseconds / stats.frames << " ms GPU, ~"
+                << pixels * bytesPerPixel[path] / (1024.0 * 1024.0) << " MB attachment traffic per frame ("
+                << stats.frames << " frames)" << std::endl;
+        }
+
+        PrintAmbientOcclusionStats();
+        PrintPostProcessingStats();
+        PrintReflectionStats();
+        PrintFogStats();
+        PrintTerrainStats();
+        PrintFoliageStats();
+    }
+
+    void CleanupShading()
+    {
+        if (!shadingEnabled)
+        {
+            return;
+        }
+
+        DestroyShadingTargets();
+        CleanupAmbientOcclusion();
+        CleanupPostProcessing();
+        CleanupReflections();
+        CleanupImageBasedLighting();
+        CleanupAtmosphere();
+        CleanupFog();
+        CleanupFoliage();
+        CleanupTerrain();
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkDestroyQueryPool(device, shadingQueryPool, nullptr);
+        }
+
+        vkDestroySampler(device, shadingSampler, nullptr);
+        vkDestroyPipeline(device, forwardPipeline, nullptr);
+        vkDestroyPipeline(device, gbufferPipeline, nullptr);
+        vkDestroyPipeline(device, lightingPipeline, nullptr);
+        vkDestroyPipeline(device, skyPipeline, nullptr);
+        vkDestroyPipelineLayout(device, shadingPipelineLayout, nullptr);
+        vkDestroyRenderPass(device, gbufferRenderPass, nullptr);
+        vkDestroyDescriptorPool(device, shadingDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, shadingDescriptorSetLayout, nullptr);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            DestroyDynamicBuffer(static_cast<uint32_t>(i), lightBuffers[i], lightBuffersMemory[i]);
+        }
+    }
+
+    #pragma endregion
+
+    #pragma region Ambient Occlusion
+
+    // Note: Screen space ambient occlusion for the deferred path. It
+    //       is computed on a coarser grid than the screen and brought
+    //       back to full resolution while lighting:
+    //
+    //           hiz.comp        closest depth mip chain of the
+    //                           G-buffer, level 0 at half resolution
+    //           ssao.comp       a spiral of samples per AO texel, the
+    //                           far ones read from coarse Hi-Z levels
+    //           aoblur.comp     depth-aware blur, horizontal then
+    //                           vertical
+    //           deferred.comp   joint bilateral upsample, darkens
+    //                           the ambient light
+    //
+    //       At half resolution the AO passes run for a quarter of the
+    //       pixels, at quarter resolution for a sixteenth. AO texels
+    //       hold occlusion and depth as two halves in R32_UINT so the
+    //       blur and the upsample can keep surfaces apart without
+    //       reading the depth buffer again. --ssao full measures what
+    //       the reduced resolutions save
+
+    void CreateAmbientOcclusion()
+    {
+        // hiz.comp and aoblur.comp both read one image and write another
+        std::array<VkDescriptorSetLayoutBinding, 2> filterBindings{};
+        filterBindings[0] = { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+        filterBindings[1] = { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(filterBindings.size());
+        layoutInfo.pBindings = filterBindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &aoFilterDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create AO filter descriptor set layout!");
+        }
+
+        //  0   G-buffer depth
+        //  1   G-buffer normal
+        //  2   Hi-Z, every level
+        //  3   AO result
+        std::array<VkDescriptorSetLayoutBinding, 4> aoBindings{};
+        for (uint32_t i = 0; i < aoBindings.size(); i++)
+        {
+            aoBindings[i] = { i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+        }
+        aoBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+        layoutInfo.bindingCount = static_cast<uint32_t>(aoBindings.size());
+        layoutInfo.pBindings = aoBindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &aoDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create AO descriptor set layout!");
+        }
+
+        aoFilterPipelineLayout = CreateAmbientOcclusionPipelineLayout(aoFilterDescriptorSetLayout, sizeof(FilterPushConstants));
+        aoPipelineLayout = CreateAmbientOcclusionPipelineLayout(aoDescriptorSetLayout, sizeof(AmbientOcclusionPushConstants));
+        hiZPipeline = CreateShadingComputePipeline("Shaders/hiz.spv", aoFilterPipelineLayout);
+        aoPipeline = CreateShadingComputePipeline("Shaders/ssao.spv", aoPipelineLayout);
+        aoBlurPipeline = CreateShadingComputePipeline("Shaders/aoblur.spv", aoFilterPipelineLayout);
+
+        // Per frame in flight one filter set per Hi-Z level and blur
+        // direction, plus the ssao.comp set. The pool is reset and
+        // filled again whenever the targets are resized
+        uint32_t filterSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * (MAX_HIZ_LEVELS + 2);
+        uint32_t aoSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, filterSetCount + aoSetCount * 3 };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, filterSetCount + aoSetCount };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = filterSetCount + aoSetCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &aoDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create AO descriptor pool!");
+        }
+    }
+
+    VkPipelineLayout CreateAmbientOcclusionPipelineLayout(VkDescriptorSetLayout setLayout, uint32_t pushConstantSize)
+    {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = pushConstantSize;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &setLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkPipelineLayout layout;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create AO pipeline layout!");
+        }
+        return layout;
+    }
+
+    /// <summary>
+    /// Creates the Hi-Z chain and AO images of one frame in flight
+    /// and their descriptor sets. Both stay in the general layout
+    /// for their whole life, so the lighting pass may bind them even
+    /// on frames that skip AO
+    /// </summary>
+    void CreateAmbientOcclusionTargets(ShadingTargets& targets, VkExtent2D extent)
+    {
+        hiZExtent = { (std::max)(extent.width / 2, 1u), (std::max)(extent.height / 2, 1u) };
+        hiZLevels = 1;
+        while (hiZLevels < MAX_HIZ_LEVELS && ((hiZExtent.width >> hiZLevels) > 0 || (hiZExtent.height >> hiZLevels) > 0))
+        {
+            hiZLevels++;
+        }
+        aoExtent = { (extent.width + aoScale - 1) / aoScale, (extent.height + aoScale - 1) / aoScale };
+
+        CreateImage(hiZExtent.width, hiZExtent.height, 1, HIZ_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.hiZImage, targets.hiZMemory, nullptr, nullptr, hiZLevels);
+        targets.hiZView = CreateImageView(targets.hiZImage, VK_IMAGE_VIEW_TYPE_2D, HIZ_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, 0, hiZLevels);
+        targets.hiZLevelViews.resize(hiZLevels);
+        for (uint32_t level = 0; level < hiZLevels; level++)
+        {
+            targets.hiZLevelViews[level] = CreateImageView(targets.hiZImage, VK_IMAGE_VIEW_TYPE_2D, HIZ_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, level, 1);
+        }
+
+        for (size_t i = 0; i < targets.aoImages.size(); i++)
+        {
+            CreateImage(aoExtent.width, aoExtent.height, 1, AO_FORMAT,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.aoImages[i], targets.aoMemory[i]);
+            targets.aoViews[i] = CreateImageView(targets.aoImages[i], VK_IMAGE_VIEW_TYPE_2D, AO_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        }
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        std::array<VkImageMemoryBarrier, 3> barriers{};
+        const VkImage images[] = { targets.hiZImage, targets.aoImages[0], targets.aoImages[1] };
+        for (size_t i = 0; i < barriers.size(); i++)
+        {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = images[i];
+            barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        EndSingleTimeCommands(commandBuffer);
+
+        // ------------ Descriptor Sets ------------
+
+        std::vector<VkDescriptorSetLayout> layouts(hiZLevels + 2, aoFilterDescriptorSetLayout);
+        layouts.push_back(aoDescriptorSetLayout);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = aoDescriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+        allocInfo.pSetLayouts = layouts.data();
+
+        std::vector<VkDescriptorSet> sets(layouts.size());
+        if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate AO descriptor sets!");
+        }
+
+        targets.hiZSets.assign(sets.begin(), sets.begin() + hiZLevels);
+        targets.aoBlurSets = { sets[hiZLevels], sets[hiZLevels + 1] };
+        targets.aoSet = sets.back();
+
+        // Hi-Z level 0 reads the G-buffer depth, every other level the
+        // one above it. The blur goes from [0] to [1] and back
+        std::vector<VkDescriptorImageInfo> imageInfos;
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        imageInfos.reserve((hiZLevels + 2) * 2 + 4);
+
+        auto write = [&](VkDescriptorSet set, uint32_t binding, VkDescriptorType type, VkImageView view, VkImageLayout layout)
+        {
+            imageInfos.push_back({ type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ? VK_NULL_HANDLE : shadingSampler, view, layout });
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = set;
+            descriptorWrite.dstBinding = binding;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.descriptorType = type;
+            descriptorWrite.pImageInfo = &imageInfos.back();
+            descriptorWrites.push_back(descriptorWrite);
+        };
+
+        for (uint32_t level = 0; level < hiZLevels; level++)
+        {
+            if (level == 0)
+            {
+                write(targets.hiZSets[level], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, targets.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+            }
+            else
+            {
+                write(targets.hiZSets[level], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, targets.hiZLevelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL);
+            }
+            write(targets.hiZSets[level], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, targets.hiZLevelViews[level], VK_IMAGE_LAYOUT_GENERAL);
+        }
+
+        for (uint32_t pass = 0; pass < 2; pass++)
+        {
+            write(targets.aoBlurSets[pass], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, targets.aoViews[pass], VK_IMAGE_LAYOUT_GENERAL);
+            write(targets.aoBlurSets[pass], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, targets.aoViews[1 - pass], VK_IMAGE_LAYOUT_GENERAL);
+        }
+
+        write(targets.aoSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, targets.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+        write(targets.aoSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, targets.normalView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        write(targets.aoSet, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, targets.hiZView, VK_IMAGE_LAYOUT_GENERAL);
+        write(targets.aoSet, 3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, targets.aoViews[0], VK_IMAGE_LAYOUT_GENERAL);
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    /// <summary>
+    /// The descriptor sets go back with the pool reset in
+    /// DestroyShadingTargets
+    /// </summary>
+    void DestroyAmbientOcclusionTargets(ShadingTargets& targets)
+    {
+        for (VkImageView view : targets.hiZLevelViews)
+        {
+            vkDestroyImageView(device, view, nullptr);
+        }
+        vkDestroyImageView(device, targets.hiZView, nullptr);
+        vkDestroyImage(device, targets.hiZImage, nullptr);
+        vkFreeMemory(device, targets.hiZMemory, nullptr);
+
+        for (size_t i = 0; i < targets.aoImages.size(); i++)
+        {
+            vkDestroyImageView(device, targets.aoViews[i], nullptr);
+            vkDestroyImage(device, targets.aoImages[i], nullptr);
+            vkFreeMemory(device, targets.aoMemory[i], nullptr);
+        }
+    }
+
+    /// <summary>
+    /// Builds the Hi-Z chain and the blurred AO from this frame's
+    /// G-buffer, between the geometry and the lighting pass
+    /// </summary>
+    void RecordAmbientOcclusion(VkCommandBuffer commandBuffer, const ShadingTargets& targets, const glm::mat4& inverseViewProjection)
+    {
+        // Note: Both timestamps wait for everything before them, so
+        //       the span holds the AO passes and nothing else
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_AO_BEGIN);
+        }
+
+        auto groups = [](uint32_t size)
+        {
+            return (size + AO_GROUP_SIZE - 1) / AO_GROUP_SIZE;
+        };
+
+        RecordHiZ(commandBuffer, targets);
+
+        // ------------ SSAO ------------
+
+        AmbientOcclusionPushConstants aoPushConstants{};
+        aoPushConstants.inverseViewProjection = inverseViewProjection;
+        aoPushConstants.extent[0] = shadingExtent.width;
+        aoPushConstants.extent[1] = shadingExtent.height;
+        aoPushConstants.aoExtent[0] = aoExtent.width;
+        aoPushConstants.aoExtent[1] = aoExtent.height;
+        aoPushConstants.aoScale = aoScale;
+        aoPushConstants.hiZLevels = hiZLevels;
+        aoPushConstants.radius = AO_RADIUS;
+        aoPushConstants.intensity = AO_INTENSITY;
+
+        // Clip space spans two units from top to bottom. A perspective
+        // camera would also divide by the distance in the shader
+        aoPushConstants.pixelsPerUnit = shadingExtent.height / 2.0f;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, aoPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, aoPipelineLayout,
+            0, 1, &targets.aoSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, aoPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+            0, sizeof(AmbientOcclusionPushConstants), &aoPushConstants);
+        vkCmdDispatch(commandBuffer, groups(aoExtent.width), groups(aoExtent.height), 1);
+        RecordComputeBarrier(commandBuffer);
+
+        // ------------ Blur ------------
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, aoBlurPipeline);
+
+        for (uint32_t pass = 0; pass < 2; pass++)
+        {
+            FilterPushConstants pushConstants{};
+            pushConstants.direction[0] = pass == 0 ? 1 : 0;
+            pushConstants.direction[1] = pass == 0 ? 0 : 1;
+            pushConstants.sourceSize[0] = pushConstants.destinationSize[0] = aoExtent.width;
+            pushConstants.sourceSize[1] = pushConstants.destinationSize[1] = aoExtent.height;
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, aoFilterPipelineLayout,
+                0, 1, &targets.aoBlurSets[pass], 0, nullptr);
+            vkCmdPushConstants(commandBuffer, aoFilterPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                0, sizeof(FilterPushConstants), &pushConstants);
+            vkCmdDispatch(commandBuffer, groups(aoExtent.width), groups(aoExtent.height), 1);
+            RecordComputeBarrier(commandBuffer);
+        }
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_AO_END);
+            aoTimed[currentFrame] = true;
+        }
+    }
+
+    /// <summary>
+    /// Builds the Hi-Z chain from this frame's G-buffer depth, for
+    /// SSAO and the reflections, whichever runs first
+    /// </summary>
+    void RecordHiZ(VkCommandBuffer commandBuffer, const ShadingTargets& targets)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipeline);
+
+        VkExtent2D sourceSize = shadingExtent;
+        for (uint32_t level = 0; level < hiZLevels; level++)
+        {
+            VkExtent2D levelSize = { (std::max)(sourceSize.width / 2, 1u), (std::max)(sourceSize.height / 2, 1u) };
+
+            FilterPushConstants pushConstants{};
+            pushConstants.sourceSize[0] = sourceSize.width;
+            pushConstants.sourceSize[1] = sourceSize.height;
+            pushConstants.destinationSize[0] = levelSize.width;
+            pushConstants.destinationSize[1] = levelSize.height;
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, aoFilterPipelineLayout,
+                0, 1, &targets.hiZSets[level], 0, nullptr);
+            vkCmdPushConstants(commandBuffer, aoFilterPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                0, sizeof(FilterPushConstants), &pushConstants);
+            vkCmdDispatch(commandBuffer,
+                (levelSize.width + AO_GROUP_SIZE - 1) / AO_GROUP_SIZE,
+                (levelSize.height + AO_GROUP_SIZE - 1) / AO_GROUP_SIZE, 1);
+            RecordComputeBarrier(commandBuffer);
+
+            sourceSize = levelSize;
+        }
+    }
+
+    /// <summary>
+    /// Makes what one dispatch wrote visible to the next
+    /// </summary>
+    void RecordComputeBarrier(VkCommandBuffer commandBuffer)
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    /// <summary>
+    /// Prints the average GPU time of the AO passes next to the share
+    /// of the screen's pixels they ran for
+    /// </summary>
+    void PrintAmbientOcclusionStats()
+    {
+        if (aoFrames == 0)
+        {
+            return;
+        }
+
+        double milliseconds = aoGpuMilliseconds / aoFrames;
+        std::cout << "SSAO at 1/" << aoScale << " resolution (" << aoExtent.width << "x" << aoExtent.height
+            << ", 1/" << aoScale * aoScale << " of the pixels): " << milliseconds << " ms GPU";
+
+        const ShadingStats& deferred = shadingStats[SHADING_DEFERRED];
+        if (deferred.frames > 0)
+        {
+            std::cout << ", " << 100.0 * milliseconds / (deferred.gpuMilliseconds / deferred.frames) << "% of a deferred frame";
+        }
+        std::cout << " (" << aoFrames << " frames)" << std::endl;
+    }
+
+    void CleanupAmbientOcclusion()
+    {
+        vkDestroyPipeline(device, hiZPipeline, nullptr);
+        vkDestroyPipeline(device, aoPipeline, nullptr);
+        vkDestroyPipeline(device, aoBlurPipeline, nullptr);
+        vkDestroyPipelineLayout(device, aoFilterPipelineLayout, nullptr);
+        vkDestroyPipelineLayout(device, aoPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, aoDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, aoFilterDescriptorSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, aoDescriptorSetLayout, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Post Processing
+
+    // Note: Post-processing of the deferred path's HDR lit image,
+    //       before it is blitted into the swap chain. Every full screen
+    //       effect runs in one post.comp dispatch which reads each
+    //       pixel once and writes it back in place:
+    //
+    //           bloom           add the blurred bright parts
+    //           tone mapping    ACES filmic curve
+    //           vignette        darken towards the corners
+    //           color grading   a fixed warm look
+    //           dithering       triangular noise before 8 bit output
+    //
+    //       Run as separate passes, each effect would read and write
+    //       the whole screen again. Only bloom needs passes of its own,
+    //       it blurs through a half resolution mip chain: 13 tap
+    //       downsamples (the first one cuts everything below the
+    //       threshold) and then tent upsamples adding each level onto
+    //       the one above. All levels together hold about a third as
+    //       many texels as the screen. post.comp reads level 0 through
+    //       a tent filter.
+    //
+    //       Effects are specialization constants, every combination is
+    //       its own pipeline built the first time it is used, so an
+    //       effect that is off costs nothing
+
+    static const char* PostEffectName(uint32_t effect)
+    {
+        const char* names[POST_EFFECT_COUNT] = { "bloom", "tonemap", "vignette", "grade", "dither" };
+        return names[effect];
+    }
+
+    /// <summary>
+    /// Turns a comma separated list of effect names (or "all") into
+    /// PostEffect bits
+    /// </summary>
+    uint32_t ParsePostEffects(const std::string& list)
+    {
+        if (list == "all")
+        {
+            return (1u << POST_EFFECT_COUNT) - 1;
+        }
+
+        uint32_t effects = 0;
+        size_t start = 0;
+        while (start < list.size())
+        {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos)
+            {
+                end = list.size();
+            }
+
+            std::string name = list.substr(start, end - start);
+            uint32_t effect = 0;
+            while (effect < POST_EFFECT_COUNT && name != PostEffectName(effect))
+            {
+                effect++;
+            }
+
+            if (effect == POST_EFFECT_COUNT)
+            {
+                throw std::runtime_error("Unknown post effect " + name + "!");
+            }
+
+            effects |= 1u << effect;
+            start = end + 1;
+        }
+        return effects;
+    }
+
+    std::string DescribePostEffects(uint32_t effects)
+    {
+        std::string description;
+        for (uint32_t effect = 0; effect < POST_EFFECT_COUNT; effect++)
+        {
+            if (effects & (1u << effect))
+            {
+                description += (description.empty() ? "" : ", ") + std::string(PostEffectName(effect));
+            }
+        }
+        return description.empty() ? "none" : description;
+    }
+
+    void CreatePostProcessing()
+    {
+        // Every post pass reads one image and writes another
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[0] = { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+        bindings[1] = { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &postDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create post-processing descriptor set layout!");
+        }
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(PostPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &postDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &postPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create post-processing pipeline layout!");
+        }
+
+        bloomDownPipeline = CreateShadingComputePipeline("Shaders/bloomdown.spv", postPipelineLayout);
+        bloomUpPipeline = CreateShadingComputePipeline("Shaders/bloomup.spv", postPipelineLayout);
+
+        // Bloom filters between texels, and reads past the edge repeat it
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &postSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create post-processing sampler!");
+        }
+
+        // Per frame in flight a down and an up set per bloom level plus
+        // the post.comp set. Reset and filled again on resize
+        uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * (BLOOM_LEVELS * 2 + 1);
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &postDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create post-processing descriptor pool!");
+        }
+    }
+
+    /// <summary>
+    /// The post.comp variant with exactly these effects compiled in
+    /// </summary>
+    VkPipeline GetPostPipeline(uint32_t effects)
+    {
+        if (postPipelines[effects] != VK_NULL_HANDLE)
+        {
+            return postPipelines[effects];
+        }
+
+        std::array<VkBool32, POST_EFFECT_COUNT> enabled{};
+        std::array<VkSpecializationMapEntry, POST_EFFECT_COUNT> entries{};
+        for (uint32_t effect = 0; effect < POST_EFFECT_COUNT; effect++)
+        {
+            enabled[effect] = (effects & (1u << effect)) ? VK_TRUE : VK_FALSE;
+            entries[effect] = { effect, static_cast<uint32_t>(effect * sizeof(VkBool32)), sizeof(VkBool32) };
+        }
+
+        VkSpecializationInfo specialization{};
+        specialization.mapEntryCount = static_cast<uint32_t>(entries.size());
+        specialization.pMapEntries = entries.data();
+        specialization.dataSize = sizeof(enabled);
+        specialization.pData = enabled.data();
+
+        postPipelines[effects] = CreateShadingComputePipeline("Shaders/post.spv", postPipelineLayout, &specialization);
+        return postPipelines[effects];
+    }
+
+    /// <summary>
+    /// Creates the bloom chain of one frame in flight and the sets of
+    /// every post pass. Like the AO images it stays in the general
+    /// layout
+    /// </summary>
+    void CreatePostProcessingTargets(ShadingTargets& targets, VkExtent2D extent)
+    {
+        bloomExtent = { (std::max)(extent.width / 2, 1u), (std::max)(extent.height / 2, 1u) };
+        bloomLevels = 1;
+        while (bloomLevels < BLOOM_LEVELS && ((bloomExtent.width >> bloomLevels) > 0 || (bloomExtent.height >> bloomLevels) > 0))
+        {
+            bloomLevels++;
+        }
+
+        CreateImage(bloomExtent.width, bloomExtent.height, 1, BLOOM_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.bloomImage, targets.bloomMemory, nullptr, nullptr, bloomLevels);
+        targets.bloomLevelViews.resize(bloomLevels);
+        for (uint32_t level = 0; level < bloomLevels; level++)
+        {
+            targets.bloomLevelViews[level] = CreateImageView(targets.bloomImage, VK_IMAGE_VIEW_TYPE_2D, BLOOM_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, level, 1);
+        }
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = targets.bloomImage;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        EndSingleTimeCommands(commandBuffer);
+
+        // ------------ Descriptor Sets ------------
+
+        std::vector<VkDescriptorSetLayout> layouts(bloomLevels * 2, postDescriptorSetLayout);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = postDescriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+        allocInfo.pSetLayouts = layouts.data();
+
+        std::vector<VkDescriptorSet> sets(layouts.size());
+        if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate post-processing descriptor sets!");
+        }
+
+        // The last level has nothing below it to add, its set goes to post.comp
+        targets.bloomDownSets.assign(sets.begin(), sets.begin() + bloomLevels);
+        targets.bloomUpSets.assign(sets.begin() + bloomLevels, sets.end() - 1);
+        targets.postSet = sets.back();
+
+        std::vector<VkDescriptorImageInfo> imageInfos;
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        imageInfos.reserve(sets.size() * 2);
+
+        auto write = [&](VkDescriptorSet set, VkImageView source, VkImageView destination)
+        {
+            imageInfos.push_back({ postSampler, source, VK_IMAGE_LAYOUT_GENERAL });
+            imageInfos.push_back({ VK_NULL_HANDLE, destination, VK_IMAGE_LAYOUT_GENERAL });
+
+            for (uint32_t binding = 0; binding < 2; binding++)
+            {
+                VkWriteDescriptorSet descriptorWrite{};
+                descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrite.dstSet = set;
+                descriptorWrite.dstBinding = binding;
+                descriptorWrite.descriptorCount = 1;
+                descriptorWrite.descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                descriptorWrite.pImageInfo = &imageInfos[imageInfos.size() - 2 + binding];
+                descriptorWrites.push_back(descriptorWrite);
+            }
+        };
+
+        for (uint32_t level = 0; level < bloomLevels; level++)
+        {
+            write(targets.bloomDownSets[level], level == 0 ? targets.litView : targets.bloomLevelViews[level - 1], targets.bloomLevelViews[level]);
+        }
+        for (uint32_t level = 0; level + 1 < bloomLevels; level++)
+        {
+            write(targets.bloomUpSets[level], targets.bloomLevelViews[level + 1], targets.bloomLevelViews[level]);
+        }
+        write(targets.postSet, targets.bloomLevelViews[0], targets.litView);
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    void DestroyPostProcessingTargets(ShadingTargets& targets)
+    {
+        for (VkImageView view : targets.bloomLevelViews)
+        {
+            vkDestroyImageView(device, view, nullptr);
+        }
+        vkDestroyImage(device, targets.bloomImage, nullptr);
+        vkFreeMemory(device, targets.bloomMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Blurs the bloom chain if bloom is on, then runs every active
+    /// effect over the lit image in one dispatch
+    /// </summary>
+    void RecordPostProcessing(VkCommandBuffer commandBuffer, const ShadingTargets& targets, VkFormat outputFormat)
+    {
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_POST_BEGIN);
+        }
+
+        auto groups = [](uint32_t size)
+        {
+            return (size + POST_GROUP_SIZE - 1) / POST_GROUP_SIZE;
+        };
+
+        auto levelSize = [&](uint32_t level)
+        {
+            return VkExtent2D{ (std::max)(bloomExtent.width >> level, 1u), (std::max)(bloomExtent.height >> level, 1u) };
+        };
+
+        PostPushConstants pushConstants{};
+        pushConstants.bloomLevels = bloomLevels;
+        pushConstants.outputSrgb = IsSrgbFormat(outputFormat) ? 1 : 0;
+        pushConstants.frameIndex = postFrameIndex++;
+        pushConstants.threshold = BLOOM_THRESHOLD;
+        pushConstants.knee = BLOOM_KNEE;
+        pushConstants.bloomStrength = BLOOM_STRENGTH;
+        pushConstants.exposure = POST_EXPOSURE;
+        pushConstants.vignette = VIGNETTE_STRENGTH;
+
+        auto dispatch = [&](VkDescriptorSet set, VkExtent2D source, VkExtent2D destination)
+        {
+            pushConstants.sourceSize[0] = source.width;
+            pushConstants.sourceSize[1] = source.height;
+            pushConstants.destinationSize[0] = destination.width;
+            pushConstants.destinationSize[1] = destination.height;
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, postPipelineLayout,
+                0, 1, &set, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, postPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                0, sizeof(PostPushConstants), &pushConstants);
+            vkCmdDispatch(commandBuffer, groups(destination.width), groups(destination.height), 1);
+            RecordComputeBarrier(commandBuffer);
+        };
+
+        if (postEffects & POST_BLOOM)
+        {
+            // ------------ Bloom Down ------------
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bloomDownPipeline);
+            for (uint32_t level = 0; level < bloomLevels; level++)
+            {
+                pushConstants.prefilter = level == 0 ? 1 : 0;
+                dispatch(targets.bloomDownSets[level], level == 0 ? shadingExtent : levelSize(level - 1), levelSize(level));
+            }
+
+            // ------------ Bloom Up ------------
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bloomUpPipeline);
+            for (uint32_t level = bloomLevels - 1; level-- > 0;)
+            {
+                dispatch(targets.bloomUpSets[level], levelSize(level + 1), levelSize(level));
+            }
+        }
+
+        // ------------ Fused Effects ------------
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, GetPostPipeline(postEffects));
+        dispatch(targets.postSet, bloomExtent, shadingExtent);
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_POST_END);
+            postTimed[currentFrame] = true;
+        }
+    }
+
+    static bool IsSrgbFormat(VkFormat format)
+    {
+        return format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_A8B8G8R8_SRGB_PACK32;
+    }
+
+    /// <summary>
+    /// Prints the GPU time of the post passes with the effects that
+    /// are on, next to the full screen traffic they replace
+    /// </summary>
+    void PrintPostProcessingStats()
+    {
+        if (postFrames == 0)
+        {
+            return;
+        }
+
+        // Note: Fused, the lit image is read and written once (16 bytes
+        //       a pixel). One pass per effect would move that for every
+        //       effect, bloom's chain comes on top either way
+        uint32_t effectCount = 0;
+        for (uint32_t effect = 0; effect < POST_EFFECT_COUNT; effect++)
+        {
+            effectCount += (postEffects >> effect) & 1;
+        }
+
+        double megabytes = static_cast<double>(shadingExtent.width) * shadingExtent.height * 16.0 / (1024.0 * 1024.0);
+        std::cout << "Post-processing (" << DescribePostEffects(postEffects) << "): "
+            << postGpuMilliseconds / postFrames << " ms GPU, ~" << megabytes << " MB full screen traffic fused vs ~"
+            << megabytes * effectCount << " MB as separate passes (" << postFrames << " frames)" << std::endl;
+    }
+
+    void CleanupPostProcessing()
+    {
+        for (VkPipeline pipeline : postPipelines)
+        {
+            if (pipeline != VK_NULL_HANDLE)
+            {
+                vkDestroyPipeline(device, pipeline, nullptr);
+            }
+        }
+
+        vkDestroyPipeline(device, bloomDownPipeline, nullptr);
+        vkDestroyPipeline(device, bloomUpPipeline, nullptr);
+        vkDestroySampler(device, postSampler, nullptr);
+        vkDestroyPipelineLayout(device, postPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, postDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, postDescriptorSetLayout, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Screen Space Reflections
+
+    // Note: Reflections of what is on the screen for the deferred path,
+    //       traced against the Hi-Z chain SSAO builds (built here when
+    //       AO is off) after the lighting pass and before post-processing,
+    //       so rays find this frame's lit image while it is still HDR:
+    //
+    //           ssr.comp            one ray per texel of Hi-Z level 0,
+    //                               drawn from the GGX lobe 
+    //           ssrtemporal.comp    blends with last frame's history,
+    //                               reprojected and clamped 
+    //           ssrcomposite.comp   depth-aware upsample, takes the
+    //                               probe's reflection out where a ray
+    //                               hit and adds the traced one 
+    //
+    //       Tracing runs for a quarter of the pixels and a ray skips
+    //       empty space a whole Hi-Z cell at a time, so the cost is
+    //       bounded by the quality's step count whatever the scene
+    //       looks like. Surfaces rougher than the quality allows are
+    //       not traced at all and keep the probe 
+
+    /// <summary>
+    /// Creates the reflection passes. They exist whenever shading
+    /// does so R can turn them on at any time 
+    /// </summary>
+    void CreateReflections()
+    {
+        ssrFrameBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        ssrFrameMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        ssrFrameMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateDynamicBuffer(static_cast<uint32_t>(i), sizeof(ReflectionFrameData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                ssrFrameBuffers[i], ssrFrameMemory[i], ssrFrameMapped[i]);
+        }
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &ssrSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create reflection sampler!");
+        }
+
+        //  0   Frame                   all
+        //  1   G-buffer depth          all
+        //  2   G-buffer normal         all
+        //  3   G-buffer albedo         all, for the roughness
+        //  4   Hi-Z, every level       all
+        //  5   Lit image               ssr.comp
+        //  6   Trace result            ssr.comp
+        //  7   Trace result            ssrtemporal.comp
+        //  8   Last frame's history    ssrtemporal.comp
+        //  9   This frame's history    ssrtemporal.comp
+        // 10   This frame's history    ssrcomposite.comp
+        // 11   Lit image               ssrcomposite.comp
+        // 12   Prefiltered environment ssrcomposite.comp
+        // 13   BRDF lookup table       ssrcomposite.comp
+        std::array<VkDescriptorSetLayoutBinding, 14> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &ssrDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create reflection descriptor set layout!");
+        }
+
+        // One set per frame in flight, written again whenever the
+        // targets are resized 
+        uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setCount };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount * 10 };
+        poolSizes[2] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount * 3 };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &ssrDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create reflection descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, ssrDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = ssrDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        ssrDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocInfo, ssrDescriptorSets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate reflection descriptor sets!");
+        }
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &ssrDescriptorSetLayout;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &ssrPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create reflection pipeline layout!");
+        }
+
+        ssrTracePipeline = CreateShadingComputePipeline("Shaders/ssr.spv", ssrPipelineLayout);
+        ssrTemporalPipeline = CreateShadingComputePipeline("Shaders/ssrtemporal.spv", ssrPipelineLayout);
+        ssrCompositePipeline = CreateShadingComputePipeline("Shaders/ssrcomposite.spv", ssrPipelineLayout);
+    }
+
+    /// <summary>
+    /// Creates the trace result and history of one frame in flight at
+    /// the size of Hi-Z level 0, which CreateAmbientOcclusionTargets
+    /// has just worked out. Both stay in the general layout 
+    /// </summary>
+    void CreateReflectionTargets(ShadingTargets& targets)
+    {
+        const VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        CreateImage(hiZExtent.width, hiZExtent.height, 1, SSR_FORMAT, usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.ssrTraceImage, targets.ssrTraceMemory);
+        targets.ssrTraceView = CreateImageView(targets.ssrTraceImage, VK_IMAGE_VIEW_TYPE_2D, SSR_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        CreateImage(hiZExtent.width, hiZExtent.height, 1, SSR_FORMAT, usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.ssrHistoryImage, targets.ssrHistoryMemory);
+        targets.ssrHistoryView = CreateImageView(targets.ssrHistoryImage, VK_IMAGE_VIEW_TYPE_2D, SSR_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        std::array<VkImageMemoryBarrier, 2> barriers{};
+        const VkImage images[] = { targets.ssrTraceImage, targets.ssrHistoryImage };
+        for (size_t i = 0; i < barriers.size(); i++)
+        {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = images[i];
+            barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        EndSingleTimeCommands(commandBuffer);
+
+        // Whatever the history held belonged to the old size 
+        ssrHistoryValid = false;
+        ssrSettleFrames = ssrEnabled ? SSR_SETTLE_FRAMES : 0;
+    }
+
+    /// <summary>
+    /// Points every frame's set at its targets, with the other frame's
+    /// history as the one to blend with 
+    /// </summary>
+    void WriteReflectionDescriptorSets()
+    {
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            const ShadingTargets& targets = shadingTargets[i];
+            const ShadingTargets& previous = shadingTargets[(i + 1) % MAX_FRAMES_IN_FLIGHT];
+
+            VkDescriptorBufferInfo frameInfo = { ssrFrameBuffers[i], 0, VK_WHOLE_SIZE };
+            // Indexed by binding, 0 is the buffer 
+            std::array<VkDescriptorImageInfo, 14> imageInfos{};
+            imageInfos[1] = { shadingSampler, targets.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+            imageInfos[2] = { shadingSampler, targets.normalView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+            imageInfos[3] = { shadingSampler, targets.albedoView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+            imageInfos[4] = { shadingSampler, targets.hiZView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[5] = { ssrSampler, targets.litView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[6] = { VK_NULL_HANDLE, targets.ssrTraceView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[7] = { ssrSampler, targets.ssrTraceView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[8] = { ssrSampler, previous.ssrHistoryView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[9] = { VK_NULL_HANDLE, targets.ssrHistoryView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[10] = { ssrSampler, targets.ssrHistoryView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[11] = { VK_NULL_HANDLE, targets.litView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[12] = { iblSampler, prefilteredCubeView, VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[13] = { iblSampler, brdfLutView, VK_IMAGE_LAYOUT_GENERAL };
+
+            std::array<VkWriteDescriptorSet, 14> descriptorWrites{};
+            for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+            {
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = ssrDescriptorSets[i];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                descriptorWrites[b].pImageInfo = &imageInfos[b];
+            }
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrites[0].pImageInfo = nullptr;
+            descriptorWrites[0].pBufferInfo = &frameInfo;
+            descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+
+    void DestroyReflectionTargets(ShadingTargets& targets)
+    {
+        vkDestroyImageView(device, targets.ssrTraceView, nullptr);
+        vkDestroyImage(device, targets.ssrTraceImage, nullptr);
+        vkFreeMemory(device, targets.ssrTraceMemory, nullptr);
+        vkDestroyImageView(device, targets.ssrHistoryView, nullptr);
+        vkDestroyImage(device, targets.ssrHistoryImage, nullptr);
+        vkFreeMemory(device, targets.ssrHistoryMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Traces, accumulates and composites this frame's reflections into
+    /// the lit image, after the lighting pass wrote it 
+    /// </summary>
+    void RecordReflections(VkCommandBuffer commandBuffer, const ShadingTargets& targets, const glm::mat4& inverseViewProjection)
+    {
+        // Note: Both timestamps wait for everything before them, so
+        //       the span holds the reflection passes and nothing else 
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_SSR_BEGIN);
+        }
+
+        if (!aoEnabled)
+        {
+            RecordHiZ(commandBuffer, targets);
+        }
+
+        // Note: The scene has no camera, so nothing moves between
+        //       frames and the reprojection is the identity. With one
+        //       it would be last frame's view projection times the
+        //       inverse of this frame's 
+        ReflectionFrameData& frame = *static_cast<ReflectionFrameData*>(ssrFrameMapped[currentFrame]);
+        frame.viewProjection = glm::inverse(inverseViewProjection);
+        frame.inverseViewProjection = inverseViewProjection;
+        frame.reprojection = glm::mat4(1.0f);
+        frame.extent[0] = shadingExtent.width;
+        frame.extent[1] = shadingExtent.height;
+        frame.traceExtent[0] = hiZExtent.width;
+        frame.traceExtent[1] = hiZExtent.height;
+        frame.hiZLevels = hiZLevels;
+        frame.maxSteps = SSR_MAX_STEPS[ssrQuality];
+        frame.maxRoughness = SSR_MAX_ROUGHNESS[ssrQuality];
+        frame.thickness = SSR_THICKNESS;
+        frame.frameIndex = ssrFrameIndex++;
+        frame.historyValid = ssrHistoryValid ? 1 : 0;
+        frame.historyWeight = SSR_HISTORY_WEIGHT;
+        frame.iblEnabled = iblEnabled ? 1 : 0;
+
+        auto groups = [](uint32_t size)
+        {
+            return (size + SSR_GROUP_SIZE - 1) / SSR_GROUP_SIZE;
+        };
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrPipelineLayout,
+            0, 1, &ssrDescriptorSets[currentFrame], 0, nullptr);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrTracePipeline);
+        vkCmdDispatch(commandBuffer, groups(hiZExtent.width), groups(hiZExtent.height), 1);
+        RecordComputeBarrier(commandBuffer);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrTemporalPipeline);
+        vkCmdDispatch(commandBuffer, groups(hiZExtent.width), groups(hiZExtent.height), 1);
+        RecordComputeBarrier(commandBuffer);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ssrCompositePipeline);
+        vkCmdDispatch(commandBuffer, groups(shadingExtent.width), groups(shadingExtent.height), 1);
+
+        ssrHistoryValid = true;
+        if (ssrSettleFrames > 0)
+        {
+            ssrSettleFrames--;
+        }
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_SSR_END);
+            ssrTimed[currentFrame] = true;
+        }
+    }
+
+    /// <summary>
+    /// R goes from off through low, medium and high back to off. A
+    /// fresh start has no history, so a few frames are drawn for it
+    /// to settle 
+    /// </summary>
+    void StepReflections()
+    {
+        if (!ssrEnabled)
+        {
+            ssrEnabled = true;
+            ssrQuality = SSR_LOW;
+        }
+        else if (ssrQuality + 1 < SSR_QUALITY_COUNT)
+        {
+            ssrQuality = static_cast<ReflectionQuality>(ssrQuality + 1);
+        }
+        else
+        {
+            ssrEnabled = false;
+        }
+
+        ssrHistoryValid = false;
+        ssrSettleFrames = ssrEnabled ? SSR_SETTLE_FRAMES : 0;
+        ssrGpuMilliseconds = 0.0;
+        ssrFrames = 0;
+        std::cout << "Screen space reflections " << (ssrEnabled ? DescribeReflectionQuality(ssrQuality) : "off") << std::endl;
+    }
+
+    static const char* DescribeReflectionQuality(ReflectionQuality quality)
+    {
+        const char* names[SSR_QUALITY_COUNT] = { "low", "medium", "high" };
+        return names[quality];
+    }
+
+    /// <summary>
+    /// Prints the GPU time of the reflection passes at the current
+    /// quality, next to their share of a deferred frame 
+    /// </summary>
+    void PrintReflectionStats()
+    {
+        if (ssrFrames == 0)
+        {
+            return;
+        }
+
+        double milliseconds = ssrGpuMilliseconds / ssrFrames;
+        std::cout << "SSR " << DescribeReflectionQuality(ssrQuality) << " (" << SSR_MAX_STEPS[ssrQuality]
+            << " steps, roughness up to " << SSR_MAX_ROUGHNESS[ssrQuality] << ") traced at " << hiZExtent.width << "x"
+            << hiZExtent.height << ": " << milliseconds << " ms GPU";
+
+        const ShadingStats& deferred = shadingStats[SHADING_DEFERRED];
+        if (deferred.frames > 0)
+        {
+            std::cout << ", " << 100.0 * milliseconds / (deferred.gpuMilliseconds / deferred.frames) << "% of a deferred frame";
+        }
+        std::cout << " (" << ssrFrames << " frames)" << std::endl;
+    }
+
+    void CleanupReflections()
+    {
+        vkDestroyPipeline(device, ssrTracePipeline, nullptr);
+        vkDestroyPipeline(device, ssrTemporalPipeline, nullptr);
+        vkDestroyPipeline(device, ssrCompositePipeline, nullptr);
+        vkDestroyPipelineLayout(device, ssrPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, ssrDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, ssrDescriptorSetLayout, nullptr);
+        vkDestroySampler(device, ssrSampler, nullptr);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            DestroyDynamicBuffer(static_cast<uint32_t>(i), ssrFrameBuffers[i], ssrFrameMemory[i]);
+        }
+    }
+
+    #pragma endregion
+
+    #pragma region Transparency
+
+    // Note: Weighted blended order-independent transparency. Blending
+    //       over what is already drawn only looks right back to front,
+    //       so transparent draws usually have to be sorted every frame
+    //       and cannot be batched across materials. Here they are drawn
+    //       in whatever order into two targets instead:
+    //
+    //           accumulation    RGBA16F   sum of premultiplied color
+    //                                     times a depth weight, ONE ONE 
+    //           revealage       R8        product of (1 - alpha),
+    //                                     ZERO ONE_MINUS_SRC_COLOR 
+    //
+    //       A second subpass reads both as input attachments and blends
+    //       the weighted average color over the scene with the coverage
+    //       they imply. Sums and products do not depend on order, so all
+    //       bubbles are one instanced draw out of a static buffer. The
+    //       targets only live for the render pass (cleared on load, not
+    //       stored) so on tiled GPUs they never need to reach memory.
+    //
+    //       The two targets blend differently, which needs the
+    //       independentBlend feature. The scene has no depth buffer, so
+    //       the bubbles are never hidden behind the crowd 
+
+    /// <summary>
+    /// Scatters the bubbles and builds everything to draw and resolve
+    /// them over the first window 
+    /// </summary>
+    void CreateTransparency()
+    {
+        if (!transparencyEnabled)
+        {
+            return;
+        }
+
+        // Same golden ratio steps as the lights 
+        auto sequence = [](uint32_t i, float step)
+        {
+            return std::fmod(static_cast<float>(i) * step, 1.0f);
+        };
+
+        std::vector<TransparentInstance> instances(transparentCount);
+        for (uint32_t i = 0; i < transparentCount; i++)
+        {
+            float radius = 0.02f + 0.06f * sequence(i, 0.414214f);
+            float depth = 0.05f + 0.9f * sequence(i, 0.754878f);
+            instances[i].placement = glm::vec4(sequence(i, 0.618034f) * 2.0f - 1.0f, 4.0f * sequence(i, 0.381966f), depth, radius);
+
+            // Soft pastel hues, smaller bubbles are more see-through 
+            float hue = sequence(i, 0.569840f) * 6.0f;
+            glm::vec3 color = glm::clamp(glm::vec3(
+                std::abs(hue - 3.0f) - 1.0f,
+                2.0f - std::abs(hue - 2.0f),
+                2.0f - std::abs(hue - 4.0f)), 0.0f, 1.0f);
+            instances[i].color = glm::vec4(glm::mix(color, glm::vec3(1.0f), 0.4f), 0.25f + 0.35f * radius / 0.08f);
+            instances[i].speed = 0.1f + 0.2f * sequence(i, 0.236068f);
+        }
+
+        CreateDeviceLocalBuffer(instances.data(), sizeof(TransparentInstance) * instances.size(),
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, transparentInstanceBuffer, transparentInstanceMemory);
+
+        CreateTransparencyRenderPass();
+
+        //  0   Accumulation    oitresolve.frag
+        //  1   Revealage       oitresolve.frag
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &oitDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create transparency descriptor set layout!");
+        }
+
+        VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 2 };
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = 1;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &oitDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create transparency descriptor pool!");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = oitDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &oitDescriptorSetLayout;
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, &oitDescriptorSet) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate transparency descriptor set!");
+        }
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(TransparencyPushConstants);
+
+        // Both subpasses share one layout, only the resolve uses the set 
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &oitDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &oitPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create transparency pipeline layout!");
+        }
+
+        // Accumulation adds, revealage multiplies by 1 - alpha 
+        std::vector<VkPipelineColorBlendAttachmentState> accumulateBlend(2);
+        accumulateBlend[0].blendEnable = VK_TRUE;
+        accumulateBlend[0].srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        accumulateBlend[0].dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        accumulateBlend[0].colorBlendOp = VK_BLEND_OP_ADD;
+        accumulateBlend[0].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        accumulateBlend[0].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        accumulateBlend[0].alphaBlendOp = VK_BLEND_OP_ADD;
+        accumulateBlend[0].colorWriteMask =
+            VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        accumulateBlend[1].blendEnable = VK_TRUE;
+        accumulateBlend[1].srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+        accumulateBlend[1].dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_COLOR;
+        accumulateBlend[1].colorBlendOp = VK_BLEND_OP_ADD;
+        accumulateBlend[1].srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        accumulateBlend[1].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        accumulateBlend[1].alphaBlendOp = VK_BLEND_OP_ADD;
+        accumulateBlend[1].colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+
+        // The average color goes over the scene, whose alpha is kept 
+        std::vector<VkPipelineColorBlendAttachmentState> resolveBlend(1);
+        resolveBlend[0].blendEnable = VK_TRUE;
+        resolveBlend[0].srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        resolveBlend[0].dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        resolveBlend[0].colorBlendOp = VK_BLEND_OP_ADD;
+        resolveBlend[0].srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        resolveBlend[0].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        resolveBlend[0].alphaBlendOp = VK_BLEND_OP_ADD;
+        resolveBlend[0].colorWriteMask =
+            VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        oitAccumulatePipeline = CreateTransparencyPipeline("Shaders/transparent.spv", "Shaders/oit.spv", 0, true, accumulateBlend);
+        oitResolvePipeline = CreateTransparencyPipeline("Shaders/fullscreen.spv", "Shaders/oitresolve.spv", 1, false, resolveBlend);
+
+        CreateTransparencyTargets();
+    }
+
+    void CreateTransparencyRenderPass()
+    {
+        // Note: The scene is already in the swap chain image, so it is
+        //       loaded and left ready to present. The weighted targets
+        //       start out empty (nothing accumulated, everything
+        //       revealed) and are thrown away at the end 
+        std::array<VkAttachmentDescription, 3> attachments{};
+        attachments[0].format = windows[0].swapChainImageFormat;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        const VkFormat formats[] = { OIT_ACCUMULATION_FORMAT, OIT_REVEALAGE_FORMAT };
+        for (uint32_t i = 1; i < attachments.size(); i++)
+        {
+            attachments[i].format = formats[i - 1];
+            attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+            attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+
+        std::array<VkAttachmentReference, 2> accumulateRefs = { {
+            { 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+            { 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL } } };
+        std::array<VkAttachmentReference, 2> inputRefs = { {
+            { 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+            { 2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL } } };
+        VkAttachmentReference sceneRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        uint32_t preserved = 0;
+
+        std::array<VkSubpassDescription, 2> subpasses{};
+        subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[0].colorAttachmentCount = static_cast<uint32_t>(accumulateRefs.size());
+        subpasses[0].pColorAttachments = accumulateRefs.data();
+        subpasses[0].preserveAttachmentCount = 1;
+        subpasses[0].pPreserveAttachments = &preserved;
+
+        subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[1].inputAttachmentCount = static_cast<uint32_t>(inputRefs.size());
+        subpasses[1].pInputAttachments = inputRefs.data();
+        subpasses[1].colorAttachmentCount = 1;
+        subpasses[1].pColorAttachments = &sceneRef;
+
+        // Note: The scene was drawn by a render pass or, deferred,
+        //       blitted in. The weighted targets are shared by every
+        //       frame in flight, so the previous frame's resolve also
+        //       has to be done reading them before they are cleared 
+        std::array<VkSubpassDependency, 2> dependencies{};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask =
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        // The resolve only reads the pixel it writes 
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = 1;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstAccessMask =
+            VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+        renderPassInfo.pSubpasses = subpasses.data();
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &oitRenderPass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create transparency render pass!");
+        }
+    }
+
+    /// <summary>
+    /// One of the two transparency subpasses. The accumulation draws
+    /// instanced bubbles, the resolve a full screen triangle 
+    /// </summary>
+    VkPipeline CreateTransparencyPipeline(const std::string& vertPath, const std::string& fragPath, uint32_t subpass,
+        bool instanced, const std::vector<VkPipelineColorBlendAttachmentState>& blendAttachments)
+    {
+        VkShaderModule vertShaderModule = CreateShaderModule(ReadFile(vertPath));
+        VkShaderModule fragShaderModule = CreateShaderModule(ReadFile(fragPath));
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStages[0].module = vertShaderModule;
+        shaderStages[0].pName = "main";
+        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[1].module = fragShaderModule;
+        shaderStages[1].pName = "main";
+
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        auto bindingDescription = TransparentInstance::GetBindingDescription();
+        auto attributeDescriptions = TransparentInstance::GetAttributeDescriptions();
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        if (instanced)
+        {
+            vertexInputInfo.vertexBindingDescriptionCount = 1;
+            vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+            vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+            vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+        }
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        // Bubbles are seen from both sides, so nothing is culled 
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.minSampleShading = 1.0f;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.attachmentCount = static_cast<uint32_t>(blendAttachments.size());
+        colorBlending.pAttachments = blendAttachments.data();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        pipelineInfo.pStages = shaderStages.data();
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = oitPipelineLayout;
+        pipelineInfo.renderPass = oitRenderPass;
+        pipelineInfo.subpass = subpass;
+
+        VkPipeline pipeline;
+        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create transparency pipeline!");
+        }
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        return pipeline;
+    }
+
+    /// <summary>
+    /// Creates the weighted targets at the first window's size and a
+    /// framebuffer for each of its swap chain images 
+    /// </summary>
+    void CreateTransparencyTargets()
+    {
+        const WindowTarget& target = windows[0];
+        VkExtent2D extent = target.swapChainExtent;
+
+        // Note: Transient attachments never have to be backed by memory
+        //       on GPUs that keep them in tile memory. Lazily allocated
+        //       memory only gets committed if they do spill, CreateImage
+        //       falls back to plain device local memory where there is
+        //       no such type 
+        VkImageUsageFlags usage =
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+        CreateImage(extent.width, extent.height, 1, OIT_ACCUMULATION_FORMAT, usage,
+            properties, oitAccumulationImage, oitAccumulationMemory);
+        oitAccumulationView = CreateImageView(oitAccumulationImage, VK_IMAGE_VIEW_TYPE_2D, OIT_ACCUMULATION_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        CreateImage(extent.width, extent.height, 1, OIT_REVEALAGE_FORMAT, usage,
+            properties, oitRevealageImage, oitRevealageMemory);
+        oitRevealageView = CreateImageView(oitRevealageImage, VK_IMAGE_VIEW_TYPE_2D, OIT_REVEALAGE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        oitFramebuffers.resize(target.swapChainImageViews.size());
+        for (size_t i = 0; i < target.swapChainImageViews.size(); i++)
+        {
+            std::array<VkImageView, 3> attachments = { target.swapChainImageViews[i], oitAccumulationView, oitRevealageView };
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = oitRenderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            framebufferInfo.pAttachments = attachments.data();
+            framebufferInfo.width = extent.width;
+            framebufferInfo.height = extent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &oitFramebuffers[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("Failed to create transparency framebuffer!");
+            }
+        }
+
+        std::array<VkDescriptorImageInfo, 2> imageInfos{};
+        imageInfos[0] = { VK_NULL_HANDLE, oitAccumulationView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        imageInfos[1] = { VK_NULL_HANDLE, oitRevealageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+        for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+        {
+            descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[b].dstSet = oitDescriptorSet;
+            descriptorWrites[b].dstBinding = b;
+            descriptorWrites[b].descriptorCount = 1;
+            descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            descriptorWrites[b].pImageInfo = &imageInfos[b];
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    void DestroyTransparencyTargets()
+    {
+        for (VkFramebuffer framebuffer : oitFramebuffers)
+        {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        oitFramebuffers.clear();
+
+        vkDestroyImageView(device, oitAccumulationView, nullptr);
+        vkDestroyImage(device, oitAccumulationImage, nullptr);
+        vkFreeMemory(device, oitAccumulationMemory, nullptr);
+        vkDestroyImageView(device, oitRevealageView, nullptr);
+        vkDestroyImage(device, oitRevealageImage, nullptr);
+        vkFreeMemory(device, oitRevealageMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Follows the first window to its new size and swap chain. The
+    /// device is idle while it is recreated 
+    /// </summary>
+    void ResizeTransparencyTargets()
+    {
+        if (!transparencyEnabled)
+        {
+            return;
+        }
+
+        DestroyTransparencyTargets();
+        CreateTransparencyTargets();
+    }
+
+    /// <summary>
+    /// Draws every bubble over the scene already in the acquired image,
+    /// unsorted, then resolves them into it 
+    /// </summary>
+    void RecordTransparentPass(VkCommandBuffer commandBuffer, const WindowTarget& target)
+    {
+        std::array<VkClearValue, 3> clearValues{};
+        clearValues[1].color = { {0.0f, 0.0f, 0.0f, 0.0f} };
+        clearValues[2].color = { {1.0f, 0.0f, 0.0f, 0.0f} };
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = oitRenderPass;
+        renderPassInfo.framebuffer = oitFramebuffers[target.imageIndex];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = target.swapChainExtent;
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+
+        VkExtent2D extent = target.swapChainExtent;
+        VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+        VkRect2D scissor = { { 0, 0 }, extent };
+
+        TransparencyPushConstants pushConstants{};
+        pushConstants.time = animationTime;
+        pushConstants.aspect = static_cast<float>(extent.width) / static_cast<float>(extent.height);
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // ------------ Accumulation ------------
+
+        VkDeviceSize offset = 0;
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, oitAccumulatePipeline);
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        vkCmdPushConstants(commandBuffer, oitPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+            0, sizeof(TransparencyPushConstants), &pushConstants);
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &transparentInstanceBuffer, &offset);
+        vkCmdDraw(commandBuffer, 6, transparentCount, 0, 0);
+
+        // ------------ Resolve ------------
+
+        vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, oitResolvePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, oitPipelineLayout,
+            0, 1, &oitDescriptorSet, 0, nullptr);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    void CleanupTransparency()
+    {
+        if (!transparencyEnabled)
+        {
+            return;
+        }
+
+        DestroyTransparencyTargets();
+        vkDestroyPipeline(device, oitAccumulatePipeline, nullptr);
+        vkDestroyPipeline(device, oitResolvePipeline, nullptr);
+        vkDestroyPipelineLayout(device, oitPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, oitDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, oitDescriptorSetLayout, nullptr);
+        vkDestroyRenderPass(device, oitRenderPass, nullptr);
+        vkDestroyBuffer(device, transparentInstanceBuffer, nullptr);
+        vkFreeMemory(device, transparentInstanceMemory, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Image Based Lighting
+
+    // Note: Ambient light from an environment instead of a flat color.
+    //       Everything the lit shaders need is precomputed on the GPU:
+    //
+    //           environment     RGBA16F cube with mips, the .hdr file
+    //                           or procedural sky drawn into it 
+    //           prefiltered     RGBA16F cube, one GGX roughness per
+    //                           level for specular 
+    //           irradiance      9 spherical harmonics coefficients
+    //                           for diffuse 
+    //           BRDF LUT        scale and bias for F0 per view angle
+    //                           and roughness (split sum) 
+    //
+    //       The convolutions are by far the slowest part of startup, so
+    //       their results are cached on disk keyed by a hash of the
+    //       environment and every setting that affects them. Later runs
+    //       only upload what the cache holds.
+    //
+    //       L turns the environment, which has to be filtered again.
+    //       Instead of a hitch, the environment is redrawn on one frame
+    //       and one face of it is filtered on each of the following
+    //       six. Diffuse switches over in one go once every face has
+    //       been projected, specular follows face by face 
+
+    /// <summary>
+    /// Loads the environment and fills the lighting images, from the
+    /// cache if possible. Without image based lighting they are still
+    /// created so the shading descriptor sets stay valid 
+    /// </summary>
+    void CreateImageBasedLighting()
+    {
+        CreateImage(ENVIRONMENT_SIZE, ENVIRONMENT_SIZE, CUBE_FACES, IBL_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, environmentImage, environmentMemory,
+            nullptr, nullptr, ENVIRONMENT_LEVELS, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+        environmentCubeView = CreateImageView(environmentImage, VK_IMAGE_VIEW_TYPE_CUBE, IBL_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, CUBE_FACES, 0, ENVIRONMENT_LEVELS);
+        environmentFaceView = CreateImageView(environmentImage, VK_IMAGE_VIEW_TYPE_2D_ARRAY, IBL_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, CUBE_FACES);
+
+        // The prefiltered levels and the LUT may be loaded from the cache 
+        prefilteredUsage = HostUploadUsage(IBL_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+        CreateImage(PREFILTER_SIZE, PREFILTER_SIZE, CUBE_FACES, IBL_FORMAT, prefilteredUsage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, prefilteredImage, prefilteredMemory,
+            nullptr, nullptr, PREFILTER_LEVELS, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+        prefilteredCubeView = CreateImageView(prefilteredImage, VK_IMAGE_VIEW_TYPE_CUBE, IBL_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, CUBE_FACES, 0, PREFILTER_LEVELS);
+        for (uint32_t level = 0; level < PREFILTER_LEVELS; level++)
+        {
+            prefilteredLevelViews[level] = CreateImageView(prefilteredImage, VK_IMAGE_VIEW_TYPE_2D_ARRAY, IBL_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, CUBE_FACES, level, 1);
+        }
+
+        brdfLutUsage = HostUploadUsage(IBL_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        CreateImage(BRDF_LUT_SIZE, BRDF_LUT_SIZE, 1, IBL_FORMAT, brdfLutUsage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, brdfLutImage, brdfLutMemory);
+        brdfLutView = CreateImageView(brdfLutImage, VK_IMAGE_VIEW_TYPE_2D, IBL_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        CreateBuffer(sizeof(glm::vec4) * IRRADIANCE_SLOTS * SH_COEFFICIENTS,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, irradianceBuffer, irradianceMemory);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &iblSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create image based lighting sampler!");
+        }
+
+        // Everything stays in GENERAL, it is written by compute, blits
+        // and copies and read by both shading paths 
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        std::array<VkImageMemoryBarrier, 3> barriers{};
+        const VkImage images[] = { environmentImage, prefilteredImage, brdfLutImage };
+        for (size_t i = 0; i < barriers.size(); i++)
+        {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = images[i];
+            barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        // Unlit ambient reads no coefficients, but they should not be garbage 
+        vkCmdFillBuffer(commandBuffer, irradianceBuffer, 0, VK_WHOLE_SIZE, 0);
+
+        EndSingleTimeCommands(commandBuffer);
+
+        if (!iblEnabled)
+        {
+            return;
+        }
+
+        // ------------ Environment ------------
+
+        Environment::EquirectImage equirect;
+        if (!environmentPath.empty() && !Environment::LoadHdr(environmentPath, equirect))
+        {
+            throw std::runtime_error("Failed to load environment " + environmentPath + "!");
+        }
+        equirectSize = { equirect.width, equirect.height };
+
+        // Something has to be bound even for the procedural sky 
+        if (equirect.pixels.empty())
+        {
+            equirect.pixels.assign(4, 0.0f);
+        }
+
+        CreateDeviceLocalBuffer(equirect.pixels.data(), sizeof(float) * equirect.pixels.size(),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, equirectBuffer, equirectMemory);
+
+        CreateImageBasedLightingPipelines();
+
+        // ------------ Precompute Or Cache ------------
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Note: The key covers the environment itself and everything
+        //       that changes what is derived from it. IBL_CACHE_VERSION
+        //       has to go up whenever one of the shaders does 
+        uint64_t key = Environment::HashValue(IBL_CACHE_VERSION, Environment::HASH_SEED);
+        key = Environment::Hash(equirect.pixels.data(), sizeof(float) * equirect.pixels.size(), key);
+        const uint32_t settings[] = { equirectSize.width, equirectSize.height, ENVIRONMENT_SIZE, ENVIRONMENT_LEVELS,
+            PREFILTER_SIZE, PREFILTER_LEVELS, PREFILTER_SAMPLES, IRRADIANCE_SAMPLE_SIZE, BRDF_LUT_SIZE, BRDF_LUT_SAMPLES };
+        key = Environment::Hash(settings, sizeof(settings), key);
+        key = Environment::HashValue(environmentYaw, key);
+        key = Environment::HashValue(ENVIRONMENT_INTENSITY, key);
+
+        // The cache is mapped rather than read, so its pages can go
+        // to the GPU without another copy on the way 
+        MappedFile cacheFile;
+        cacheFile.Open(Environment::CachePath(iblCacheDirectory, key));
+        const uint8_t* cached = Environment::CachedPayload(cacheFile.Data(), cacheFile.Size(), key, IBL_CACHE_VERSION,
+            ImageBasedLightingPayloadSize());
+        if (cached != nullptr)
+        {
+            const char* method = UploadImageBasedLighting(cacheFile, cached);
+
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Image based lighting loaded from " << Environment::CachePath(iblCacheDirectory, key)
+                << " in " << milliseconds << " ms through the " << method << std::endl;
+        }
+        else
+        {
+            cacheFile.Close();
+
+            // The environment cube itself is not cached, relighting
+            // draws it again anyway 
+            commandBuffer = BeginSingleTimeCommands();
+            RecordEnvironment(commandBuffer);
+            for (uint32_t face = 0; face < CUBE_FACES; face++)
+            {
+                RecordFilterFace(commandBuffer, face);
+            }
+            RecordBrdfLut(commandBuffer);
+            EndSingleTimeCommands(commandBuffer);
+
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Image based lighting computed in " << milliseconds << " ms" << std::endl;
+
+            std::vector<uint8_t> payload(ImageBasedLightingPayloadSize());
+            DownloadImageBasedLighting(payload);
+            if (!Environment::WriteCache(iblCacheDirectory, key, IBL_CACHE_VERSION, payload.size(), payload.data()))
+            {
+                std::cerr << "Failed to write image based lighting cache to " << iblCacheDirectory << std::endl;
+            }
+        }
+
+        // Up to date, nothing to spread over the next frames 
+        environmentDirty = false;
+        iblNextFace = CUBE_FACES;
+    }
+
+    void CreateImageBasedLightingPipelines()
+    {
+        //  0   Environment cube        prefilter.comp, shproject.comp
+        //  1   Image being written     envmap.comp, prefilter.comp, brdflut.comp
+        //  2   Buffer                  envmap.comp (equirect), shproject.comp (irradiance)
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &iblDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create image based lighting descriptor set layout!");
+        }
+
+        // Environment, BRDF LUT, irradiance and one per prefiltered level 
+        const uint32_t setCount = 3 + PREFILTER_LEVELS;
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount };
+        poolSizes[2] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &iblDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create image based lighting descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(setCount, iblDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = iblDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        std::vector<VkDescriptorSet> sets(setCount);
+        if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate image based lighting descriptor sets!");
+        }
+
+        environmentSet = sets[0];
+        brdfLutSet = sets[1];
+        irradianceSet = sets[2];
+        std::copy(sets.begin() + 3, sets.end(), prefilterSets.begin());
+
+        // Bindings a shader does not use still get something valid 
+        std::vector<VkDescriptorImageInfo> imageInfos;
+        std::vector<VkDescriptorBufferInfo> bufferInfos;
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        imageInfos.reserve(setCount * 2);
+        bufferInfos.reserve(setCount);
+
+        auto write = [&](VkDescriptorSet set, VkImageView storageView, VkBuffer buffer)
+        {
+            imageInfos.push_back({ iblSampler, environmentCubeView, VK_IMAGE_LAYOUT_GENERAL });
+            imageInfos.push_back({ VK_NULL_HANDLE, storageView, VK_IMAGE_LAYOUT_GENERAL });
+            bufferInfos.push_back({ buffer, 0, VK_WHOLE_SIZE });
+
+            for (uint32_t b = 0; b < bindings.size(); b++)
+            {
+                VkWriteDescriptorSet descriptorWrite{};
+                descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrite.dstSet = set;
+                descriptorWrite.dstBinding = b;
+                descriptorWrite.descriptorCount = 1;
+                descriptorWrite.descriptorType = bindings[b].descriptorType;
+                descriptorWrite.pImageInfo = b < 2 ? &imageInfos[imageInfos.size() - 2 + b] : nullptr;
+                descriptorWrite.pBufferInfo = b == 2 ? &bufferInfos.back() : nullptr;
+                descriptorWrites.push_back(descriptorWrite);
+            }
+        };
+
+        write(environmentSet, environmentFaceView, equirectBuffer);
+        write(brdfLutSet, brdfLutView, irradianceBuffer);
+        write(irradianceSet, prefilteredLevelViews[0], irradianceBuffer);
+        for (uint32_t level = 0; level < PREFILTER_LEVELS; level++)
+        {
+            write(prefilterSets[level], prefilteredLevelViews[level], irradianceBuffer);
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(IblPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &iblDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &iblPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create image based lighting pipeline layout!");
+        }
+
+        environmentPipeline = CreateShadingComputePipeline("Shaders/envmap.spv", iblPipelineLayout);
+        prefilterPipeline = CreateShadingComputePipeline("Shaders/prefilter.spv", iblPipelineLayout);
+        irradiancePipeline = CreateShadingComputePipeline("Shaders/shproject.spv", iblPipelineLayout);
+        brdfLutPipeline = CreateShadingComputePipeline("Shaders/brdflut.spv", iblPipelineLayout);
+    }
+
+    IblPushConstants ImageBasedLightingPushConstants()
+    {
+        IblPushConstants pushConstants{};
+        pushConstants.yaw = environmentYaw;
+        pushConstants.intensity = ENVIRONMENT_INTENSITY;
+        pushConstants.useEquirect = equirectSize.width > 0 ? 1 : 0;
+        pushConstants.equirectSize[0] = equirectSize.width;
+        pushConstants.equirectSize[1] = equirectSize.height;
+        pushConstants.environmentSize = ENVIRONMENT_SIZE;
+        return pushConstants;
+    }
+
+    void DispatchImageBasedLighting(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkDescriptorSet set,
+        const IblPushConstants& pushConstants, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, iblPipelineLayout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, iblPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(IblPushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer, groupsX, groupsY, groupsZ);
+    }
+
+    /// <summary>
+    /// Draws every face of the environment and blits its levels down.
+    /// Whatever read the environment before (an earlier frame's
+    /// filtering) is waited for first 
+    /// </summary>
+    void RecordEnvironment(VkCommandBuffer commandBuffer)
+    {
+        RecordImageBasedLightingBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+        uint32_t groups = (ENVIRONMENT_SIZE + IBL_GROUP_SIZE - 1) / IBL_GROUP_SIZE;
+        IblPushConstants pushConstants = ImageBasedLightingPushConstants();
+        pushConstants.size = ENVIRONMENT_SIZE;
+        DispatchImageBasedLighting(commandBuffer, environmentPipeline, environmentSet, pushConstants, groups, groups, CUBE_FACES);
+
+        // Note: Blits accept GENERAL on both ends, each level is read
+        //       once the one above it has been written 
+        RecordImageBasedLightingBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+        for (uint32_t level = 1; level < ENVIRONMENT_LEVELS; level++)
+        {
+            int32_t source = static_cast<int32_t>(ENVIRONMENT_SIZE >> (level - 1));
+            VkImageBlit region{};
+            region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, CUBE_FACES };
+            region.srcOffsets[1] = { source, source, 1 };
+            region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, CUBE_FACES };
+            region.dstOffsets[1] = { (std::max)(source / 2, 1), (std::max)(source / 2, 1), 1 };
+
+            vkCmdBlitImage(commandBuffer,
+                environmentImage, VK_IMAGE_LAYOUT_GENERAL,
+                environmentImage, VK_IMAGE_LAYOUT_GENERAL,
+                1, &region, VK_FILTER_LINEAR);
+
+            RecordImageBasedLightingBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        }
+    }
+
+    /// <summary>
+    /// Filters every prefiltered level of one face and projects it into
+    /// the irradiance coefficients. After the last face the
+    /// coefficients are combined 
+    /// </summary>
+    void RecordFilterFace(VkCommandBuffer commandBuffer, uint32_t face)
+    {
+        // The environment is ready and nothing still reads the face 
+        RecordImageBasedLightingBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        IblPushConstants pushConstants = ImageBasedLightingPushConstants();
+        pushConstants.face = face;
+        pushConstants.sampleCount = PREFILTER_SAMPLES;
+        for (uint32_t level = 0; level < PREFILTER_LEVELS; level++)
+        {
+            pushConstants.size = PREFILTER_SIZE >> level;
+            pushConstants.roughness = static_cast<float>(level) / (PREFILTER_LEVELS - 1);
+
+            uint32_t groups = (pushConstants.size + IBL_GROUP_SIZE - 1) / IBL_GROUP_SIZE;
+            DispatchImageBasedLighting(commandBuffer, prefilterPipeline, prefilterSets[level], pushConstants, groups, groups, 1);
+        }
+
+        pushConstants.size = IRRADIANCE_SAMPLE_SIZE;
+        pushConstants.lod = std::log2(static_cast<float>(ENVIRONMENT_SIZE) / IRRADIANCE_SAMPLE_SIZE);
+        DispatchImageBasedLighting(commandBuffer, irradiancePipeline, irradianceSet, pushConstants, 1, 1, 1);
+
+        if (face == CUBE_FACES - 1)
+        {
+            RecordComputeBarrier(commandBuffer);
+            pushConstants.face = CUBE_FACES;
+            DispatchImageBasedLighting(commandBuffer, irradiancePipeline, irradianceSet, pushConstants, 1, 1, 1);
+        }
+
+        // Both shading paths read the results 
+        RecordImageBasedLightingBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+    }
+
+    void RecordBrdfLut(VkCommandBuffer commandBuffer)
+    {
+        IblPushConstants pushConstants = ImageBasedLightingPushConstants();
+        pushConstants.size = BRDF_LUT_SIZE;
+        pushConstants.sampleCount = BRDF_LUT_SAMPLES;
+
+        uint32_t groups = (BRDF_LUT_SIZE + IBL_GROUP_SIZE - 1) / IBL_GROUP_SIZE;
+        DispatchImageBasedLighting(commandBuffer, brdfLutPipeline, brdfLutSet, pushConstants, groups, groups, 1);
+
+        RecordImageBasedLightingBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+    }
+
+    /// <summary>
+    /// A global barrier, every image based lighting resource is in
+    /// GENERAL so no layouts change 
+    /// </summary>
+    void RecordImageBasedLightingBarrier(VkCommandBuffer commandBuffer,
+        VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    /// <summary>
+    /// Bytes of the cached results: every prefiltered level, the BRDF
+    /// LUT and the combined irradiance coefficients 
+    /// </summary>
+    size_t ImageBasedLightingPayloadSize()
+    {
+        size_t texels = BRDF_LUT_SIZE * BRDF_LUT_SIZE;
+        for (uint32_t level = 0; level < PREFILTER_LEVELS; level++)
+        {
+            texels += CUBE_FACES * (PREFILTER_SIZE >> level) * (PREFILTER_SIZE >> level);
+        }
+        return texels * IBL_TEXEL_SIZE + sizeof(glm::vec4) * SH_COEFFICIENTS;
+    }
+
+    /// <summary>
+    /// Where each part of the cached results lies in the payload.
+    /// Returns the offset of the combined irradiance coefficients 
+    /// </summary>
+    VkDeviceSize ImageBasedLightingRegions(std::vector<VkBufferImageCopy>& prefilteredRegions, VkBufferImageCopy& lutRegion)
+    {
+        prefilteredRegions.assign(PREFILTER_LEVELS, VkBufferImageCopy{});
+        VkDeviceSize offset = 0;
+        for (uint32_t level = 0; level < PREFILTER_LEVELS; level++)
+        {
+            uint32_t size = PREFILTER_SIZE >> level;
+            prefilteredRegions[level].bufferOffset = offset;
+            prefilteredRegions[level].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, CUBE_FACES };
+            prefilteredRegions[level].imageExtent = { size, size, 1 };
+            offset += static_cast<VkDeviceSize>(CUBE_FACES) * size * size * IBL_TEXEL_SIZE;
+        }
+
+        lutRegion = {};
+        lutRegion.bufferOffset = offset;
+        lutRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        lutRegion.imageExtent = { BRDF_LUT_SIZE, BRDF_LUT_SIZE, 1 };
+        offset += static_cast<VkDeviceSize>(BRDF_LUT_SIZE) * BRDF_LUT_SIZE * IBL_TEXEL_SIZE;
+
+        return offset;
+    }
+
+    /// <summary>
+    /// Uploads the cached results from a mapped cache file, payload
+    /// pointing into it. Returns how, for the log 
+    /// </summary>
+    const char* UploadImageBasedLighting(const MappedFile& cacheFile, const uint8_t* payload)
+    {
+        std::vector<VkBufferImageCopy> prefilteredRegions;
+        VkBufferImageCopy lutRegion;
+        VkDeviceSize coefficients = ImageBasedLightingRegions(prefilteredRegions, lutRegion);
+        VkDeviceSize payloadSize = ImageBasedLightingPayloadSize();
+
+        // Only the combined coefficients, the per face ones are scratch 
+        VkBufferCopy irradianceRegion{};
+        irradianceRegion.size = sizeof(glm::vec4) * SH_COEFFICIENTS;
+        irradianceRegion.srcOffset = coefficients;
+        irradianceRegion.dstOffset = sizeof(glm::vec4) * SH_COEFFICIENTS * CUBE_FACES;
+
+        // Note: Best is the GPU reading the file's pages in place, next
+        //       the CPU writing the images from them. Otherwise the
+        //       payload goes through a staging buffer. Either way the
+        //       images are idle at startup 
+        VkBuffer source = VK_NULL_HANDLE;
+        VkDeviceMemory sourceMemory = VK_NULL_HANDLE;
+        VkDeviceSize sourceOffset = 0;
+        VkDeviceSize stagingFrom = 0;
+        const char* method = "staging buffer";
+
+        if (ImportHostBuffer(cacheFile.Data(), cacheFile.MappedSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, source, sourceMemory))
+        {
+            sourceOffset = static_cast<VkDeviceSize>(payload - cacheFile.Data());
+            method = "imported file";
+        }
+        else
+        {
+            if (prefilteredUsage & brdfLutUsage & VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT)
+            {
+                const VkPipelineStageFlags readers = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                UploadImage(prefilteredImage, prefilteredUsage, payload, lutRegion.bufferOffset, prefilteredRegions,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, readers, VK_ACCESS_SHADER_READ_BIT);
+                UploadImage(brdfLutImage, brdfLutUsage, payload, coefficients, { lutRegion },
+                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, readers, VK_ACCESS_SHADER_READ_BIT);
+
+                // Only the coefficients are left for the staging buffer 
+                stagingFrom = coefficients;
+                method = "host image copy";
+            }
+
+            CreateBuffer(payloadSize - stagingFrom, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, source, sourceMemory);
+
+            void* mapped;
+            vkMapMemory(device, sourceMemory, 0, payloadSize - stagingFrom, 0, &mapped);
+            std::memcpy(mapped, payload + stagingFrom, static_cast<size_t>(payloadSize - stagingFrom));
+            vkUnmapMemory(device, sourceMemory);
+        }
+
+        // Offsets in the source buffer 
+        for (VkBufferImageCopy& region : prefilteredRegions)
+        {
+            region.bufferOffset += sourceOffset;
+        }
+        lutRegion.bufferOffset += sourceOffset;
+        irradianceRegion.srcOffset = irradianceRegion.srcOffset + sourceOffset - stagingFrom;
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+        if (stagingFrom == 0)
+        {
+            vkCmdCopyBufferToImage(commandBuffer, source, prefilteredImage, VK_IMAGE_LAYOUT_GENERAL,
+                static_cast<uint32_t>(prefilteredRegions.size()), prefilteredRegions.data());
+            vkCmdCopyBufferToImage(commandBuffer, source, brdfLutImage, VK_IMAGE_LAYOUT_GENERAL, 1, &lutRegion);
+        }
+        vkCmdCopyBuffer(commandBuffer, source, irradianceBuffer, 1, &irradianceRegion);
+        EndSingleTimeCommands(commandBuffer);
+
+        vkDestroyBuffer(device, source, nullptr);
+        vkFreeMemory(device, sourceMemory, nullptr);
+        return method;
+    }
+
+    /// <summary>
+    /// Reads the results back into the payload for the cache 
+    /// </summary>
+    void DownloadImageBasedLighting(std::vector<uint8_t>& payload)
+    {
+        std::vector<VkBufferImageCopy> prefilteredRegions;
+        VkBufferImageCopy lutRegion;
+        VkDeviceSize coefficients = ImageBasedLightingRegions(prefilteredRegions, lutRegion);
+
+        VkBufferCopy irradianceRegion{};
+        irradianceRegion.size = sizeof(glm::vec4) * SH_COEFFICIENTS;
+        irradianceRegion.srcOffset = sizeof(glm::vec4) * SH_COEFFICIENTS * CUBE_FACES;
+        irradianceRegion.dstOffset = coefficients;
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        CreateBuffer(payload.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            stagingBuffer, stagingBufferMemory);
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+        vkCmdCopyImageToBuffer(commandBuffer, prefilteredImage, VK_IMAGE_LAYOUT_GENERAL, stagingBuffer,
+            static_cast<uint32_t>(prefilteredRegions.size()), prefilteredRegions.data());
+        vkCmdCopyImageToBuffer(commandBuffer, brdfLutImage, VK_IMAGE_LAYOUT_GENERAL, stagingBuffer, 1, &lutRegion);
+        vkCmdCopyBuffer(commandBuffer, irradianceBuffer, stagingBuffer, 1, &irradianceRegion);
+        EndSingleTimeCommands(commandBuffer);
+
+        void* mapped;
+        vkMapMemory(device, stagingBufferMemory, 0, payload.size(), 0, &mapped);
+        std::memcpy(payload.data(), mapped, payload.size());
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Spreads relighting over frames: the environment is redrawn on
+    /// the first, then one face is filtered per frame 
+    /// </summary>
+    void RecordImageBasedLighting(VkCommandBuffer commandBuffer)
+    {
+        if (!iblEnabled)
+        {
+            return;
+        }
+
+        if (environmentDirty)
+        {
+            RecordEnvironment(commandBuffer);
+            environmentDirty = false;
+            iblNextFace = 0;
+        }
+
+        if (iblNextFace < CUBE_FACES)
+        {
+            RecordFilterFace(commandBuffer, iblNextFace++);
+        }
+    }
+
+    /// <summary>
+    /// Turns the environment for L. The work starts with the next frame 
+    /// </summary>
+    void RotateEnvironment()
+    {
+        environmentYaw = std::fmod(environmentYaw + ENVIRONMENT_ROTATION_STEP, 6.2831853f);
+        environmentDirty = true;
+        std::cout << "Environment turned to " << static_cast<int>(glm::degrees(environmentYaw) + 0.5f) << " degrees" << std::endl;
+    }
+
+    void CleanupImageBasedLighting()
+    {
+        if (iblEnabled)
+        {
+            vkDestroyPipeline(device, environmentPipeline, nullptr);
+            vkDestroyPipeline(device, prefilterPipeline, nullptr);
+            vkDestroyPipeline(device, irradiancePipeline, nullptr);
+            vkDestroyPipeline(device, brdfLutPipeline, nullptr);
+            vkDestroyPipelineLayout(device, iblPipelineLayout, nullptr);
+            vkDestroyDescriptorPool(device, iblDescriptorPool, nullptr);
+            vkDestroyDescriptorSetLayout(device, iblDescriptorSetLayout, nullptr);
+            vkDestroyBuffer(device, equirectBuffer, nullptr);
+            vkFreeMemory(device, equirectMemory, nullptr);
+        }
+
+        for (VkImageView view : prefilteredLevelViews)
+        {
+            vkDestroyImageView(device, view, nullptr);
+        }
+
+        const VkImageView views[] = { environmentCubeView, environmentFaceView, prefilteredCubeView, brdfLutView };
+        for (VkImageView view : views)
+        {
+            vkDestroyImageView(device, view, nullptr);
+        }
+
+        const VkImage images[] = { environmentImage, prefilteredImage, brdfLutImage };
+        const VkDeviceMemory memories[] = { environmentMemory, prefilteredMemory, brdfLutMemory };
+        for (size_t i = 0; i < 3; i++)
+        {
+            vkDestroyImage(device, images[i], nullptr);
+            vkFreeMemory(device, memories[i], nullptr);
+        }
+
+        vkDestroyBuffer(device, irradianceBuffer, nullptr);
+        vkFreeMemory(device, irradianceMemory, nullptr);
+        vkDestroySampler(device, iblSampler, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Atmosphere
+
+    // Note: A physically based sky behind the scene (Hillaire's LUTs).
+    //       Three small images hold everything the sky pass needs:
+    //
+    //           transmittance       sunlight surviving to each point,
+    //                               computed once 
+    //           multiple scattering light that bounced more than
+    //                               once, computed once 
+    //           sky-view            the sky around the camera for
+    //                               the current sun height 
+    //
+    //       The sky pass samples the sky-view LUT per pixel instead of
+    //       marching through the atmosphere. When the sun moves only
+    //       that one is rebuilt, SKY_VIEW_SLICES rows at a time into a
+    //       second image over as many frames, which is then copied
+    //       over the shown one. The sky lags the sun by a few frames
+    //       but never shows a half built LUT 
+
+    /// <summary>
+    /// Creates the LUTs and fills them for the starting sun. Without a
+    /// sky they are still created so the shading descriptor sets stay
+    /// valid 
+    /// </summary>
+    void CreateAtmosphere()
+    {
+        const VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+        CreateImage(TRANSMITTANCE_LUT_EXTENT.width, TRANSMITTANCE_LUT_EXTENT.height, 1, ATMOSPHERE_FORMAT, usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, transmittanceImage, transmittanceMemory);
+        transmittanceView = CreateImageView(transmittanceImage, VK_IMAGE_VIEW_TYPE_2D, ATMOSPHERE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        CreateImage(MULTI_SCATTERING_LUT_SIZE, MULTI_SCATTERING_LUT_SIZE, 1, ATMOSPHERE_FORMAT, usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, multiScatteringImage, multiScatteringMemory);
+        multiScatteringView = CreateImageView(multiScatteringImage, VK_IMAGE_VIEW_TYPE_2D, ATMOSPHERE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        CreateImage(SKY_VIEW_LUT_EXTENT.width, SKY_VIEW_LUT_EXTENT.height, 1, ATMOSPHERE_FORMAT, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, skyViewImage, skyViewMemory);
+        skyViewView = CreateImageView(skyViewImage, VK_IMAGE_VIEW_TYPE_2D, ATMOSPHERE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        CreateImage(SKY_VIEW_LUT_EXTENT.width, SKY_VIEW_LUT_EXTENT.height, 1, ATMOSPHERE_FORMAT, usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, skyViewBuildImage, skyViewBuildMemory);
+        skyViewBuildView = CreateImageView(skyViewBuildImage, VK_IMAGE_VIEW_TYPE_2D, ATMOSPHERE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &atmosphereSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create atmosphere sampler!");
+        }
+
+        // All four stay in GENERAL, written by compute and copies and
+        // read by both shading paths 
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        std::array<VkImageMemoryBarrier, 4> barriers{};
+        const VkImage images[] = { transmittanceImage, multiScatteringImage, skyViewImage, skyViewBuildImage };
+        for (size_t i = 0; i < barriers.size(); i++)
+        {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = images[i];
+            barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        if (!skyEnabled)
+        {
+            EndSingleTimeCommands(commandBuffer);
+            return;
+        }
+
+        CreateAtmospherePipelines();
+
+        auto start = std::chrono::steady_clock::now();
+
+        // The two LUTs that only depend on the atmosphere 
+        uint32_t groupsX = (TRANSMITTANCE_LUT_EXTENT.width + ATMOSPHERE_GROUP_SIZE - 1) / ATMOSPHERE_GROUP_SIZE;
+        uint32_t groupsY = (TRANSMITTANCE_LUT_EXTENT.height + ATMOSPHERE_GROUP_SIZE - 1) / ATMOSPHERE_GROUP_SIZE;
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, transmittancePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, atmospherePipelineLayout, 0, 1, &transmittanceSet, 0, nullptr);
+        vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+        RecordComputeBarrier(commandBuffer);
+
+        uint32_t groups = (MULTI_SCATTERING_LUT_SIZE + ATMOSPHERE_GROUP_SIZE - 1) / ATMOSPHERE_GROUP_SIZE;
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, multiScatteringPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, atmospherePipelineLayout, 0, 1, &multiScatteringSet, 0, nullptr);
+        vkCmdDispatch(commandBuffer, groups, groups, 1);
+        RecordComputeBarrier(commandBuffer);
+
+        // The first sky-view LUT is built in one go 
+        skyBuildSun = SunDirection(CurrentSunAngle());
+        for (uint32_t slice = 0; slice < SKY_VIEW_SLICES; slice++)
+        {
+            RecordSkyViewSlice(commandBuffer, slice);
+        }
+        RecordSkyViewPublish(commandBuffer);
+
+        EndSingleTimeCommands(commandBuffer);
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Atmosphere LUTs computed in " << milliseconds << " ms" << std::endl;
+    }
+
+    void CreateAtmospherePipelines()
+    {
+        //  0   Transmittance LUT       multiscatter.comp, skyview.comp
+        //  1   Multiple scattering LUT skyview.comp
+        //  2   LUT being written       transmittance.comp, multiscatter.comp, skyview.comp
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &atmosphereDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create atmosphere descriptor set layout!");
+        }
+
+        const uint32_t setCount = 3;
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount * 2 };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &atmosphereDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create atmosphere descriptor pool!");
+        }
+
+        std::array<VkDescriptorSetLayout, setCount> layouts;
+        layouts.fill(atmosphereDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = atmosphereDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        std::array<VkDescriptorSet, setCount> sets;
+        if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate atmosphere descriptor sets!");
+        }
+
+        transmittanceSet = sets[0];
+        multiScatteringSet = sets[1];
+        skyViewSet = sets[2];
+
+        // Bindings a shader does not use still get something valid 
+        std::vector<VkDescriptorImageInfo> imageInfos;
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        imageInfos.reserve(setCount * bindings.size());
+
+        auto write = [&](VkDescriptorSet set, VkImageView storageView)
+        {
+            imageInfos.push_back({ atmosphereSampler, transmittanceView, VK_IMAGE_LAYOUT_GENERAL });
+            imageInfos.push_back({ atmosphereSampler, multiScatteringView, VK_IMAGE_LAYOUT_GENERAL });
+            imageInfos.push_back({ VK_NULL_HANDLE, storageView, VK_IMAGE_LAYOUT_GENERAL });
+
+            for (uint32_t b = 0; b < bindings.size(); b++)
+            {
+                VkWriteDescriptorSet descriptorWrite{};
+                descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrite.dstSet = set;
+                descriptorWrite.dstBinding = b;
+                descriptorWrite.descriptorCount = 1;
+                descriptorWrite.descriptorType = bindings[b].descriptorType;
+                descriptorWrite.pImageInfo = &imageInfos[imageInfos.size() - bindings.size() + b];
+                descriptorWrites.push_back(descriptorWrite);
+            }
+        };
+
+        write(transmittanceSet, transmittanceView);
+        write(multiScatteringSet, multiScatteringView);
+        write(skyViewSet, skyViewBuildView);
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(AtmospherePushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &atmosphereDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &atmospherePipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create atmosphere pipeline layout!");
+        }
+
+        transmittancePipeline = CreateShadingComputePipeline("Shaders/transmittance.spv", atmospherePipelineLayout);
+        multiScatteringPipeline = CreateShadingComputePipeline("Shaders/multiscatter.spv", atmospherePipelineLayout);
+        skyViewPipeline = CreateShadingComputePipeline("Shaders/skyview.spv", atmospherePipelineLayout);
+    }
+
+    /// <summary>
+    /// The sun at an angle along its path, zero rises in front of the
+    /// camera and a quarter turn is noon. Up is +y like in atmosphere.glsl 
+    /// </summary>
+    glm::vec3 SunDirection(float angle)
+    {
+        float elevation = std::sin(angle) * SUN_MAX_ELEVATION;
+        float azimuth = SUN_AZIMUTH + std::cos(angle) * 0.5f;
+        return glm::vec3(std::cos(elevation) * std::sin(azimuth), std::sin(elevation), -std::cos(elevation) * std::cos(azimuth));
+    }
+
+    /// <summary>
+    /// K steps the sun, --sun-cycle moves it with the animation 
+    /// </summary>
+    float CurrentSunAngle()
+    {
+        float angle = sunAngle;
+        if (sunCycle > 0.0f)
+        {
+            angle += 6.2831853f * static_cast<float>(animationTime) / sunCycle;
+        }
+        return angle;
+    }
+
+    /// <summary>
+    /// Rows of one slice of the sky-view LUT into the build image 
+    /// </summary>
+    void RecordSkyViewSlice(VkCommandBuffer commandBuffer, uint32_t slice)
+    {
+        uint32_t rowCount = (SKY_VIEW_LUT_EXTENT.height + SKY_VIEW_SLICES - 1) / SKY_VIEW_SLICES;
+
+        AtmospherePushConstants pushConstants{};
+        pushConstants.sunCosZenith = skyBuildSun.y;
+        pushConstants.firstRow = slice * rowCount;
+        pushConstants.rowCount = rowCount;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, skyViewPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, atmospherePipelineLayout, 0, 1, &skyViewSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, atmospherePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(AtmospherePushConstants), &pushConstants);
+        vkCmdDispatch(commandBuffer,
+            (SKY_VIEW_LUT_EXTENT.width + ATMOSPHERE_GROUP_SIZE - 1) / ATMOSPHERE_GROUP_SIZE,
+            (rowCount + ATMOSPHERE_GROUP_SIZE - 1) / ATMOSPHERE_GROUP_SIZE, 1);
+    }
+
+    /// <summary>
+    /// Copies the finished build image over the shown sky-view LUT,
+    /// once earlier frames are done sampling it 
+    /// </summary>
+    void RecordSkyViewPublish(VkCommandBuffer commandBuffer)
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkImageCopy region{};
+        region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.extent = { SKY_VIEW_LUT_EXTENT.width, SKY_VIEW_LUT_EXTENT.height, 1 };
+        vkCmdCopyImage(commandBuffer, skyViewBuildImage, VK_IMAGE_LAYOUT_GENERAL, skyViewImage, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        skyShownSun = skyBuildSun;
+    }
+
+    /// <summary>
+    /// Starts rebuilding the sky-view LUT when the sun moved and
+    /// records the next slice of a build in progress. A build always
+    /// finishes before the next starts, so a sun that keeps moving
+    /// still gets a fresh sky every SKY_VIEW_SLICES frames 
+    /// </summary>
+    void RecordAtmosphere(VkCommandBuffer commandBuffer)
+    {
+        if (!skyEnabled)
+        {
+            return;
+        }
+
+        glm::vec3 sun = SunDirection(CurrentSunAngle());
+        if (skyBuildSlice == SKY_VIEW_SLICES && sun != skyShownSun)
+        {
+            skyBuildSun = sun;
+            skyBuildSlice = 0;
+        }
+
+        if (skyBuildSlice < SKY_VIEW_SLICES)
+        {
+            // The publish copy of the last build may still read it 
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            RecordSkyViewSlice(commandBuffer, skyBuildSlice++);
+            if (skyBuildSlice == SKY_VIEW_SLICES)
+            {
+                RecordSkyViewPublish(commandBuffer);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Moves the sun along its path for K 
+    /// </summary>
+    void StepSun()
+    {
+        sunAngle = std::fmod(sunAngle + SUN_STEP, 6.2831853f);
+        float elevation = glm::degrees(std::asin(SunDirection(CurrentSunAngle()).y));
+        std::cout << "Sun at " << static_cast<int>(std::round(elevation)) << " degrees elevation" << std::endl;
+    }
+
+    void CleanupAtmosphere()
+    {
+        if (skyEnabled)
+        {
+            vkDestroyPipeline(device, transmittancePipeline, nullptr);
+            vkDestroyPipeline(device, multiScatteringPipeline, nullptr);
+            vkDestroyPipeline(device, skyViewPipeline, nullptr);
+            vkDestroyPipelineLayout(device, atmospherePipelineLayout, nullptr);
+            vkDestroyDescriptorPool(device, atmosphereDescriptorPool, nullptr);
+            vkDestroyDescriptorSetLayout(device, atmosphereDescriptorSetLayout, nullptr);
+        }
+
+        const VkImageView views[] = { transmittanceView, multiScatteringView, skyViewView, skyViewBuildView };
+        const VkImage images[] = { transmittanceImage, multiScatteringImage, skyViewImage, skyViewBuildImage };
+        const VkDeviceMemory memories[] = { transmittanceMemory, multiScatteringMemory, skyViewMemory, skyViewBuildMemory };
+        for (size_t i = 0; i < 4; i++)
+        {
+            vkDestroyImageView(device, views[i], nullptr);
+            vkDestroyImage(device, images[i], nullptr);
+            vkFreeMemory(device, memories[i], nullptr);
+        }
+
+        vkDestroySampler(device, atmosphereSampler, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Volumetric Fog
+
+    // Note: Fog lit by the scene's lights, computed in a froxel grid of
+    //       FOG_GRID cells (frustum voxels) whatever the window size:
+    //
+    //           foginject.comp      density and in-scattered light per
+    //                               froxel, blended with the last
+    //                               frame's grid 
+    //           fogintegrate.comp   scattering and transmittance from
+    //                               the viewer up to every slice 
+    //
+    //       Both shading paths then apply it with one lookup per pixel.
+    //       Each frame samples every froxel at another jittered point,
+    //       so the temporal blend averages many samples over a few
+    //       frames at the cost of one 
+
+    /// <summary>
+    /// Creates the froxel grids and the two fog passes. They exist
+    /// whenever shading does so V can turn fog on at any time 
+    /// </summary>
+    void CreateFog()
+    {
+        const VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        for (uint32_t i = 0; i < FOG_HISTORY; i++)
+        {
+            CreateImage3D(FOG_GRID, FOG_FORMAT, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, fogScatteringImages[i], fogScatteringMemory[i]);
+            fogScatteringViews[i] = CreateImageView(fogScatteringImages[i], VK_IMAGE_VIEW_TYPE_3D, FOG_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        }
+
+        CreateImage3D(FOG_GRID, FOG_FORMAT, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, fogIntegratedImage, fogIntegratedMemory);
+        fogIntegratedView = CreateImageView(fogIntegratedImage, VK_IMAGE_VIEW_TYPE_3D, FOG_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        // Written by compute and sampled by both paths, always GENERAL 
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        std::array<VkImageMemoryBarrier, FOG_HISTORY + 1> barriers{};
+        for (size_t i = 0; i < barriers.size(); i++)
+        {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = i < FOG_HISTORY ? fogScatteringImages[i] : fogIntegratedImage;
+            barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        EndSingleTimeCommands(commandBuffer);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &fogSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create fog sampler!");
+        }
+
+        //  0   Lights                  foginject.comp
+        //  1   Last frame's grid       foginject.comp
+        //  2   This frame's grid       foginject.comp, fogintegrate.comp
+        //  3   Integrated grid         fogintegrate.comp
+        std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &fogDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create fog descriptor set layout!");
+        }
+
+        // One set per frame in flight for its lights. With two frames
+        // in flight they also alternate between the two grids 
+        uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount };
+        poolSizes[2] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount * 2 };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &fogDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create fog descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, fogDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = fogDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        fogDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocInfo, fogDescriptorSets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate fog descriptor sets!");
+        }
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            VkDescriptorBufferInfo lightInfo = { lightBuffers[i], 0, VK_WHOLE_SIZE };
+            std::array<VkDescriptorImageInfo, 4> imageInfos{};
+            imageInfos[1] = { fogSampler, fogScatteringViews[(i + 1) % FOG_HISTORY], VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[2] = { VK_NULL_HANDLE, fogScatteringViews[i % FOG_HISTORY], VK_IMAGE_LAYOUT_GENERAL };
+            imageInfos[3] = { VK_NULL_HANDLE, fogIntegratedView, VK_IMAGE_LAYOUT_GENERAL };
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+            for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+            {
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = fogDescriptorSets[i];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].descriptorType = bindings[b].descriptorType;
+                descriptorWrites[b].pImageInfo = &imageInfos[b];
+            }
+            descriptorWrites[0].pBufferInfo = &lightInfo;
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(FogPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &fogDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &fogPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create fog pipeline layout!");
+        }
+
+        fogInjectPipeline = CreateShadingComputePipeline("Shaders/foginject.spv", fogPipelineLayout);
+        fogIntegratePipeline = CreateShadingComputePipeline("Shaders/fogintegrate.spv", fogPipelineLayout);
+    }
+
+    /// <summary>
+    /// Injects and integrates this frame's fog, before either shading
+    /// path reads it 
+    /// </summary>
+    void RecordFog(VkCommandBuffer commandBuffer)
+    {
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_FOG_BEGIN);
+        }
+
+        // The last frame may still sample the integrated grid and read
+        // the one about to be written as its history 
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        // Note: The scene has no camera, so nothing moves between
+        //       frames and the reprojection is the identity. With one
+        //       it would be last frame's view projection times the
+        //       inverse of this frame's 
+        auto halton = [](uint32_t index, uint32_t base)
+        {
+            float result = 0.0f;
+            float fraction = 1.0f / base;
+            for (uint32_t i = index; i > 0; i /= base)
+            {
+                result += fraction * (i % base);
+                fraction /= base;
+            }
+            return result;
+        };
+
+        uint32_t sample = fogFrameIndex++ % FOG_JITTER_SAMPLES + 1;
+        FogPushConstants pushConstants{};
+        pushConstants.reprojection = glm::mat4(1.0f);
+        pushConstants.jitter = glm::vec4(halton(sample, 2) - 0.5f, halton(sample, 3) - 0.5f, halton(sample, 5) - 0.5f, 0.0f);
+        pushConstants.lightCount = lightCount;
+        pushConstants.historyValid = fogHistoryValid ? 1 : 0;
+        pushConstants.density = FOG_DENSITY;
+        pushConstants.ambient = FOG_AMBIENT;
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fogPipelineLayout,
+            0, 1, &fogDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, fogPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FogPushConstants), &pushConstants);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fogInjectPipeline);
+        vkCmdDispatch(commandBuffer,
+            (FOG_GRID.width + FOG_GROUP_SIZE - 1) / FOG_GROUP_SIZE,
+            (FOG_GRID.height + FOG_GROUP_SIZE - 1) / FOG_GROUP_SIZE,
+            (FOG_GRID.depth + FOG_GROUP_SIZE - 1) / FOG_GROUP_SIZE);
+        RecordComputeBarrier(commandBuffer);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fogIntegratePipeline);
+        vkCmdDispatch(commandBuffer,
+            (FOG_GRID.width + FOG_INTEGRATE_GROUP_SIZE - 1) / FOG_INTEGRATE_GROUP_SIZE,
+            (FOG_GRID.height + FOG_INTEGRATE_GROUP_SIZE - 1) / FOG_INTEGRATE_GROUP_SIZE, 1);
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        fogHistoryValid = true;
+        if (fogSettleFrames > 0)
+        {
+            fogSettleFrames--;
+        }
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_FOG_END);
+            fogTimed[currentFrame] = true;
+        }
+    }
+
+    /// <summary>
+    /// V turns fog on or off. A fresh start has no history to blend
+    /// with, so a few frames are drawn for it to settle 
+    /// </summary>
+    void ToggleFog()
+    {
+        fogEnabled = !fogEnabled;
+        fogHistoryValid = false;
+        fogSettleFrames = fogEnabled ? FOG_SETTLE_FRAMES : 0;
+        fogGpuMilliseconds = 0.0;
+        fogFrames = 0;
+        std::cout << "Volumetric fog " << (fogEnabled ? "on" : "off") << std::endl;
+    }
+
+    void PrintFogStats()
+    {
+        if (fogFrames == 0)
+        {
+            return;
+        }
+
+        std::cout << "Volumetric fog, " << FOG_GRID.width << "x" << FOG_GRID.height << "x" << FOG_GRID.depth
+            << " froxels at any resolution: " << fogGpuMilliseconds / fogFrames << " ms GPU ("
+            << fogFrames << " frames)" << std::endl;
+    }
+
+    void CleanupFog()
+    {
+        vkDestroyPipeline(device, fogInjectPipeline, nullptr);
+        vkDestroyPipeline(device, fogIntegratePipeline, nullptr);
+        vkDestroyPipelineLayout(device, fogPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, fogDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, fogDescriptorSetLayout, nullptr);
+        vkDestroySampler(device, fogSampler, nullptr);
+
+        for (uint32_t i = 0; i < FOG_HISTORY; i++)
+        {
+            vkDestroyImageView(device, fogScatteringViews[i], nullptr);
+            vkDestroyImage(device, fogScatteringImages[i], nullptr);
+            vkFreeMemory(device, fogScatteringMemory[i], nullptr);
+        }
+
+        vkDestroyImageView(device, fogIntegratedView, nullptr);
+        vkDestroyImage(device, fogIntegratedImage, nullptr);
+        vkFreeMemory(device, fogIntegratedMemory, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Terrain
+
+    // Note: Terrain under the sky, seen through the same fixed camera
+    //       flying forward with the animation. The ground is drawn as
+    //       geometry clipmaps, TERRAIN_LEVELS nested rings of grid
+    //       patches around the camera, each level twice as coarse as
+    //       the one inside it (see terrain.glsl). Per frame:
+    //
+    //           UpdateTerrain       places the levels, fills the page
+    //                               table, picks finished pages to
+    //                               upload and asks for missing ones 
+    //           terraincull.comp    drops patches in a level's hole or
+    //                               outside the view, appends the rest
+    //                               to one indirect draw 
+    //           terrain.vert/frag   every visible patch as an instance
+    //                               of the same grid 
+    //
+    //       The vertex count is at most TERRAIN_LEVELS rings of patches
+    //       whatever the terrain's size, and heights live in a fixed
+    //       number of page slots, so memory is bounded too 
+
+    /// <summary>
+    /// Creates everything the terrain draws with. Only the (tiny)
+    /// color target exists without --terrain, for the descriptor 
+    /// </summary>
+    void CreateTerrain()
+    {
+        if (!terrainEnabled)
+        {
+            return;
+        }
+
+        terrainStreamer = std::make_unique<Terrain::PageStreamer>(terrainPath, TERRAIN_HEIGHT_SCALE);
+        terrainCache = std::make_unique<Terrain::PageCache>(TERRAIN_PAGE_SLOTS);
+
+        // Every slot is one layer of the atlas, always GENERAL since
+        // pages are copied in between draws 
+        CreateImage(Terrain::PAGE_TEXELS, Terrain::PAGE_TEXELS, TERRAIN_PAGE_SLOTS, TERRAIN_HEIGHT_FORMAT,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, terrainAtlasImage, terrainAtlasMemory);
+        terrainAtlasView = CreateImageView(terrainAtlasImage, VK_IMAGE_VIEW_TYPE_2D_ARRAY, TERRAIN_HEIGHT_FORMAT,
+            VK_IMAGE_ASPECT_COLOR_BIT, TERRAIN_PAGE_SLOTS);
+
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = terrainAtlasImage;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, TERRAIN_PAGE_SLOTS };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        EndSingleTimeCommands(commandBuffer);
+
+        // One grid shared by every patch, vertices made from the index 
+        std::vector<uint16_t> indices;
+        indices.reserve(TERRAIN_PATCH_QUADS * TERRAIN_PATCH_QUADS * 6);
+        const uint32_t row = TERRAIN_PATCH_QUADS + 1;
+        for (uint32_t z = 0; z < TERRAIN_PATCH_QUADS; z++)
+        {
+            for (uint32_t x = 0; x < TERRAIN_PATCH_QUADS; x++)
+            {
+                uint16_t corner = static_cast<uint16_t>(z * row + x);
+                const uint16_t quad[] = {
+                    corner, static_cast<uint16_t>(corner + row), static_cast<uint16_t>(corner + 1),
+                    static_cast<uint16_t>(corner + 1), static_cast<uint16_t>(corner + row), static_cast<uint16_t>(corner + row + 1) };
+                indices.insert(indices.end(), std::begin(quad), std::end(quad));
+            }
+        }
+        terrainIndexCount = static_cast<uint32_t>(indices.size());
+        CreateDeviceLocalBuffer(indices.data(), indices.size() * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+            terrainIndexBuffer, terrainIndexMemory);
+
+        const uint32_t patchCount = TERRAIN_LEVELS * TERRAIN_PATCHES * TERRAIN_PATCHES;
+        CreateBuffer(patchCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, terrainVisibleBuffer, terrainVisibleMemory);
+        CreateBuffer(sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, terrainDrawBuffer, terrainDrawMemory);
+
+        // The table and camera are rewritten every frame, pages are
+        // staged here before being copied into the atlas 
+        terrainFrameBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        terrainFrameMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        terrainFrameMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        terrainStagingBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        terrainStagingMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        terrainStagingMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateDynamicBuffer(static_cast<uint32_t>(i), sizeof(TerrainFrameData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                terrainFrameBuffers[i], terrainFrameMemory[i], terrainFrameMapped[i]);
+
+            VkDeviceSize stagingSize = TERRAIN_UPLOADS_PER_FRAME * TERRAIN_PAGE_BYTES;
+            CreateBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                terrainStagingBuffers[i], terrainStagingMemory[i]);
+            vkMapMemory(device, terrainStagingMemory[i], 0, stagingSize, 0, &terrainStagingMapped[i]);
+        }
+
+        //  0   Camera, levels, page table      terraincull.comp, terrain.vert, terrain.frag, foliage
+        //  1   Height atlas                    terrain.vert, foliagescatter.comp
+        //  2   Visible patches                 terraincull.comp, terrain.vert, foliagescatter.comp
+        //  3   Indirect draw                   terraincull.comp, foliagescatter.comp
+        std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &terrainDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create terrain descriptor set layout!");
+        }
+
+        uint32_t setCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount * 3 };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = setCount;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &terrainDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create terrain descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, terrainDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = terrainDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        terrainDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocInfo, terrainDescriptorSets.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate terrain descriptor sets!");
+        }
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            std::array<VkDescriptorBufferInfo, 4> bufferInfos{};
+            bufferInfos[0] = { terrainFrameBuffers[i], 0, VK_WHOLE_SIZE };
+            bufferInfos[2] = { terrainVisibleBuffer, 0, VK_WHOLE_SIZE };
+            bufferInfos[3] = { terrainDrawBuffer, 0, VK_WHOLE_SIZE };
+            VkDescriptorImageInfo atlasInfo = { shadingSampler, terrainAtlasView, VK_IMAGE_LAYOUT_GENERAL };
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+            for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+            {
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = terrainDescriptorSets[i];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].descriptorType = bindings[b].descriptorType;
+                descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+            }
+            descriptorWrites[1].pBufferInfo = nullptr;
+            descriptorWrites[1].pImageInfo = &atlasInfo;
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &terrainDescriptorSetLayout;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &terrainPipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create terrain pipeline layout!");
+        }
+
+        terrainRenderPass = CreateTerrainRenderPass();
+        terrainPipeline = CreateTerrainPipeline("Shaders/terrainvert.spv", "Shaders/terrainfrag.spv", terrainPipelineLayout);
+        terrainCullPipeline = CreateShadingComputePipeline("Shaders/terraincull.spv", terrainPipelineLayout);
+    }
+
+    /// <summary>
+    /// Color with coverage in alpha and a depth buffer of its own,
+    /// the color left ready for the background pass or deferred.comp 
+    /// </summary>
+    VkRenderPass CreateTerrainRenderPass()
+    {
+        std::array<VkAttachmentDescription, 2> attachments{};
+        attachments[0].format = TERRAIN_COLOR_FORMAT;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        attachments[1].format = TERRAIN_DEPTH_FORMAT;
+        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        VkAttachmentReference depthAttachmentRef = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        // An earlier frame may still read the color, and this frame's
+        // background has to wait for it 
+        std::array<VkSubpassDependency, 2> dependencies{};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+
+        VkRenderPass pass;
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create terrain render pass!");
+        }
+        return pass;
+    }
+
+    /// <summary>
+    /// Geometry made in the vertex shader, without vertex buffers,
+    /// depth tested in the terrain pass. Patches and foliage 
+    /// </summary>
+    VkPipeline CreateTerrainPipeline(const std::string& vertPath, const std::string& fragPath, VkPipelineLayout layout)
+    {
+        VkShaderModule vertShaderModule = CreateShaderModule(ReadFile(vertPath));
+        VkShaderModule fragShaderModule = CreateShaderModule(ReadFile(fragPath));
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStages[0].module = vertShaderModule;
+        shaderStages[0].pName = "main";
+        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[1].module = fragShaderModule;
+        shaderStages[1].pName = "main";
+
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        // Steep slopes can show their back from a low camera, blades
+        // of grass are seen from both sides 
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.minSampleShading = 1.0f;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+        colorBlendAttachment.colorWriteMask =
+            VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        pipelineInfo.pStages = shaderStages.data();
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = layout;
+        pipelineInfo.renderPass = terrainRenderPass;
+        pipelineInfo.subpass = 0;
+
+        VkPipeline pipeline;
+        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create terrain pipeline!");
+        }
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        return pipeline;
+    }
+
+    /// <summary>
+    /// The terrain's color and depth at the window's size. Without
+    /// --terrain the color is a single texel the background never
+    /// reads, only there to fill binding 12 
+    /// </summary>
+    void CreateTerrainTargets(ShadingTargets& targets, VkExtent2D extent)
+    {
+        VkExtent2D size = terrainEnabled ? extent : VkExtent2D{ 1, 1 };
+        CreateImage(size.width, size.height, 1, TERRAIN_COLOR_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.terrainColorImage, targets.terrainColorMemory);
+        targets.terrainColorView = CreateImageView(targets.terrainColorImage, VK_IMAGE_VIEW_TYPE_2D, TERRAIN_COLOR_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        // Readable from the start, a frame always draws the terrain
+        // before anything samples it 
+        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = targets.terrainColorImage;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        EndSingleTimeCommands(commandBuffer);
+
+        if (!terrainEnabled)
+        {
+            return;
+        }
+
+        CreateImage(extent.width, extent.height, 1, TERRAIN_DEPTH_FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targets.terrainDepthImage, targets.terrainDepthMemory);
+        targets.terrainDepthView = CreateImageView(targets.terrainDepthImage, VK_IMAGE_VIEW_TYPE_2D, TERRAIN_DEPTH_FORMAT, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+        std::array<VkImageView, 2> attachments = { targets.terrainColorView, targets.terrainDepthView };
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = terrainRenderPass;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        framebufferInfo.pAttachments = attachments.data();
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &targets.terrainFramebuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create terrain framebuffer!");
+        }
+    }
+
+    void DestroyTerrainTargets(ShadingTargets& targets)
+    {
+        vkDestroyImageView(device, targets.terrainColorView, nullptr);
+        vkDestroyImage(device, targets.terrainColorImage, nullptr);
+        vkFreeMemory(device, targets.terrainColorMemory, nullptr);
+
+        if (!terrainEnabled)
+        {
+            return;
+        }
+
+        vkDestroyFramebuffer(device, targets.terrainFramebuffer, nullptr);
+        vkDestroyImageView(device, targets.terrainDepthView, nullptr);
+        vkDestroyImage(device, targets.terrainDepthImage, nullptr);
+        vkFreeMemory(device, targets.terrainDepthMemory, nullptr);
+    }
+
+    /// <summary>
+    /// Where the camera is, moving forward with the animation at a
+    /// height clear of every peak 
+    /// </summary>
+    glm::vec3 TerrainCameraPosition()
+    {
+        return glm::vec3(0.0f, TERRAIN_HEIGHT_SCALE + TERRAIN_CAMERA_CLEARANCE, -TERRAIN_FLY_SPEED * animationTime);
+    }
+
+    /// <summary>
+    /// Fills this frame's camera, levels and page table. Pages the
+    /// table needs but the cache lacks are asked for, and up to
+    /// TERRAIN_UPLOADS_PER_FRAME finished ones are staged for
+    /// RecordTerrain to copy into the atlas 
+    /// </summary>
+    void UpdateTerrain()
+    {
+        if (!terrainEnabled)
+        {
+            return;
+        }
+
+        terrainFrameNumber++;
+        TerrainFrameData& frame = *static_cast<TerrainFrameData*>(terrainFrameMapped[currentFrame]);
+
+        // The same camera the sky is seen through, see sky.glsl 
+        glm::vec3 eye = TerrainCameraPosition();
+        glm::vec3 forward(0.0f, std::sin(TERRAIN_CAMERA_PITCH), -std::cos(TERRAIN_CAMERA_PITCH));
+        float aspect = static_cast<float>(shadingExtent.width) / static_cast<float>(shadingExtent.height);
+        glm::mat4 projection = glm::perspectiveRH_ZO(TERRAIN_FIELD_OF_VIEW, aspect, TERRAIN_NEAR, TERRAIN_FAR);
+        projection[1][1] *= -1.0f;
+        glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        frame.viewProjection = viewProjection;
+        frame.cameraPosition = glm::vec4(eye, animationTime);
+        frame.sunDirection = glm::vec4(SunDirection(CurrentSunAngle()), 0.0f);
+
+        // Planes facing inwards, straight from the rows of the matrix
+        // with depth from zero to one 
+        glm::mat4 rows = glm::transpose(viewProjection);
+        frame.frustumPlanes[0] = rows[3] + rows[0];
+        frame.frustumPlanes[1] = rows[3] - rows[0];
+        frame.frustumPlanes[2] = rows[3] + rows[1];
+        frame.frustumPlanes[3] = rows[3] - rows[1];
+        frame.frustumPlanes[4] = rows[2];
+        frame.frustumPlanes[5] = rows[3] - rows[2];
+
+        // Each level is centered on the camera, snapped to twice its
+        // patch size so the finer level's hole lands on whole patches 
+        const int32_t snap = 2 * TERRAIN_PATCH_QUADS;
+        const int32_t halfWidth = TERRAIN_PATCHES / 2 * TERRAIN_PATCH_QUADS;
+        for (uint32_t level = 0; level < TERRAIN_LEVELS; level++)
+        {
+            float spacing = TERRAIN_SPACING * static_cast<float>(1u << level);
+            int32_t centerX = static_cast<int32_t>(std::round(eye.x / spacing / snap)) * snap;
+            int32_t centerZ = static_cast<int32_t>(std::round(eye.z / spacing / snap)) * snap;
+            glm::ivec4& levelData = frame.levels[level];
+            levelData.x = centerX - halfWidth;
+            levelData.y = centerZ - halfWidth;
+            levelData.z = level > 0 ? frame.levels[level - 1].x / 2 : levelData.x;
+            levelData.w = level > 0 ? frame.levels[level - 1].y / 2 : levelData.y;
+        }
+
+        // Coarse levels first, they are what finer ones fall back to
+        // while loading. The range reaches a texel past the level for
+        // normals and morphing 
+        std::vector<Terrain::PageKey> missing;
+        for (uint32_t i = 0; i < TERRAIN_PAGE_SLOTS; i++)
+        {
+            frame.pages[i] = { glm::ivec4(INT32_MIN, INT32_MIN, static_cast<int32_t>(Terrain::PageCache::NO_SLOT), 0), glm::vec4(0.0f) };
+        }
+
+        for (int32_t level = TERRAIN_LEVELS - 1; level >= 0; level--)
+        {
+            const glm::ivec4& levelData = frame.levels[level];
+            int32_t firstX = FloorDivide(levelData.x - 1, Terrain::PAGE_TEXELS);
+            int32_t firstZ = FloorDivide(levelData.y - 1, Terrain::PAGE_TEXELS);
+            int32_t lastX = FloorDivide(levelData.x + 2 * halfWidth + 2, Terrain::PAGE_TEXELS);
+            int32_t lastZ = FloorDivide(levelData.y + 2 * halfWidth + 2, Terrain::PAGE_TEXELS);
+
+            for (int32_t z = firstZ; z <= lastZ; z++)
+            {
+                for (int32_t x = firstX; x <= lastX; x++)
+                {
+                    Terrain::PageKey key = { level, x, z };
+                    uint32_t slot = terrainCache->Find(key, terrainFrameNumber);
+                    SetTerrainPage(frame, key, slot);
+                    if (slot == Terrain::PageCache::NO_SLOT)
+                    {
+                        missing.push_back(key);
+                    }
+                }
+            }
+        }
+
+        // Only slots no page of this frame uses can be given away 
+        terrainUploads.clear();
+        Terrain::Page page;
+        while (terrainUploads.size() < TERRAIN_UPLOADS_PER_FRAME && terrainStreamer->Pop(page))
+        {
+            if (terrainCache->Contains(page.key))
+            {
+                continue;
+            }
+
+            uint32_t slot = terrainCache->Insert(page, terrainFrameNumber);
+            if (slot == Terrain::PageCache::NO_SLOT)
+            {
+                break;
+            }
+
+            uint8_t* staging = static_cast<uint8_t*>(terrainStagingMapped[currentFrame]) + terrainUploads.size() * TERRAIN_PAGE_BYTES;
+            memcpy(staging, page.heights.data(), TERRAIN_PAGE_BYTES);
+            terrainUploads.push_back(slot);
+            terrainPagesUploaded++;
+
+            SetTerrainPage(frame, page.key, slot);
+        }
+
+        missing.erase(std::remove_if(missing.begin(), missing.end(),
+            [this](const Terrain::PageKey& key) { return terrainCache->Contains(key); }), missing.end());
+        terrainStreamer->Request(missing);
+        terrainPagesMissing = static_cast<uint32_t>(missing.size());
+    }
+
+    /// <summary>
+    /// Points the page's table entry at a slot, if the table currently
+    /// holds that page there 
+    /// </summary>
+    void SetTerrainPage(TerrainFrameData& frame, const Terrain::PageKey& key, uint32_t slot)
+    {
+        const int32_t mask = TERRAIN_PAGE_TABLE - 1;
+        TerrainPageEntry& entry = frame.pages[(key.level * TERRAIN_PAGE_TABLE + (key.z & mask)) * TERRAIN_PAGE_TABLE + (key.x & mask)];
+
+        // A page that arrived too late for this frame's table 
+        if (slot != Terrain::PageCache::NO_SLOT && (entry.keySlot.x != key.x || entry.keySlot.y != key.z))
+        {
+            return;
+        }
+
+        entry.keySlot = glm::ivec4(key.x, key.z, static_cast<int32_t>(slot), 0);
+        entry.range = glm::vec4(0.0f);
+        if (slot != Terrain::PageCache::NO_SLOT)
+        {
+            terrainCache->Range(slot, entry.range.x, entry.range.y);
+        }
+    }
+
+    static int32_t FloorDivide(int32_t value, int32_t divisor)
+    {
+        return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+    }
+
+    /// <summary>
+    /// Copies this frame's pages in, culls the patches and draws the
+    /// visible ones into the terrain target 
+    /// </summary>
+    void RecordTerrain(VkCommandBuffer commandBuffer, const ShadingTargets& targets)
+    {
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_TERRAIN_BEGIN);
+        }
+
+        // The last frame's draws may still read the atlas slots, the
+        // visible patches, the foliage and the indirect commands about
+        // to be written, and copy the commands back 
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        std::vector<VkBufferImageCopy> regions(terrainUploads.size());
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            regions[i].bufferOffset = i * TERRAIN_PAGE_BYTES;
+            regions[i].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, terrainUploads[i], 1 };
+            regions[i].imageExtent = { Terrain::PAGE_TEXELS, Terrain::PAGE_TEXELS, 1 };
+        }
+
+        if (!regions.empty())
+        {
+            vkCmdCopyBufferToImage(commandBuffer, terrainStagingBuffers[currentFrame], terrainAtlasImage,
+                VK_IMAGE_LAYOUT_GENERAL, static_cast<uint32_t>(regions.size()), regions.data());
+        }
+
+        // Instances are counted up from zero by the cull, and the
+        // foliage by the scatter 
+        VkDrawIndexedIndirectCommand command = { terrainIndexCount, 0, 0, 0, 0 };
+        vkCmdUpdateBuffer(commandBuffer, terrainDrawBuffer, 0, sizeof(command), &command);
+        if (foliageEnabled)
+        {
+            ResetFoliageDraws(commandBuffer);
+        }
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        const uint32_t patchCount = TERRAIN_LEVELS * TERRAIN_PATCHES * TERRAIN_PATCHES;
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, terrainPipelineLayout,
+            0, 1, &terrainDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, terrainCullPipeline);
+        vkCmdDispatch(commandBuffer, (patchCount + TERRAIN_CULL_GROUP_SIZE - 1) / TERRAIN_CULL_GROUP_SIZE, 1, 1);
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        if (foliageEnabled)
+        {
+            RecordFoliageScatter(commandBuffer);
+        }
+
+        std::array<VkClearValue, 2> clearValues{};
+        clearValues[0].color = { {0.0f, 0.0f, 0.0f, 0.0f} };
+        clearValues[1].depthStencil = { 1.0f, 0 };
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = terrainRenderPass;
+        renderPassInfo.framebuffer = targets.terrainFramebuffer;
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = shadingExtent;
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, terrainPipelineLayout,
+            0, 1, &terrainDescriptorSets[currentFrame], 0, nullptr);
+
+        VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(shadingExtent.width), static_cast<float>(shadingExtent.height), 0.0f, 1.0f };
+        VkRect2D scissor = { { 0, 0 }, shadingExtent };
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        vkCmdBindIndexBuffer(commandBuffer, terrainIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        vkCmdDrawIndexedIndirect(commandBuffer, terrainDrawBuffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+
+        if (foliageEnabled)
+        {
+            RecordFoliageDraws(commandBuffer);
+        }
+
+        vkCmdEndRenderPass(commandBuffer);
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_TERRAIN_END);
+            terrainTimed[currentFrame] = true;
+        }
+    }
+
+    void PrintTerrainStats()
+    {
+        if (!terrainEnabled)
+        {
+            return;
+        }
+
+        std::cout << "Terrain, " << TERRAIN_LEVELS << " levels of up to " << TERRAIN_PATCHES * TERRAIN_PATCHES << " patches: "
+            << terrainCache->Resident() << " of " << TERRAIN_PAGE_SLOTS << " page slots used, "
+            << terrainPagesUploaded << " pages uploaded, " << terrainPagesMissing << " missing";
+        if (terrainFrames > 0)
+        {
+            std::cout << ", " << terrainGpuMilliseconds / terrainFrames << " ms GPU (" << terrainFrames << " frames)";
+        }
+        std::cout << std::endl;
+    }
+
+    void CleanupTerrain()
+    {
+        if (!terrainEnabled)
+        {
+            return;
+        }
+
+        // Stops the loader before anything it could hand over goes 
+        terrainStreamer.reset();
+        terrainCache.reset();
+
+        vkDestroyPipeline(device, terrainPipeline, nullptr);
+        vkDestroyPipeline(device, terrainCullPipeline, nullptr);
+        vkDestroyPipelineLayout(device, terrainPipelineLayout, nullptr);
+        vkDestroyRenderPass(device, terrainRenderPass, nullptr);
+        vkDestroyDescriptorPool(device, terrainDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, terrainDescriptorSetLayout, nullptr);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            DestroyDynamicBuffer(static_cast<uint32_t>(i), terrainFrameBuffers[i], terrainFrameMemory[i]);
+            vkDestroyBuffer(device, terrainStagingBuffers[i], nullptr);
+            vkFreeMemory(device, terrainStagingMemory[i], nullptr);
+        }
+
+        vkDestroyBuffer(device, terrainIndexBuffer, nullptr);
+        vkFreeMemory(device, terrainIndexMemory, nullptr);
+        vkDestroyBuffer(device, terrainVisibleBuffer, nullptr);
+        vkFreeMemory(device, terrainVisibleMemory, nullptr);
+        vkDestroyBuffer(device, terrainDrawBuffer, nullptr);
+        vkFreeMemory(device, terrainDrawMemory, nullptr);
+
+        vkDestroyImageView(device, terrainAtlasView, nullptr);
+        vkDestroyImage(device, terrainAtlasImage, nullptr);
+        vkFreeMemory(device, terrainAtlasMemory, nullptr);
+    }
+
+    #pragma endregion
+
+    #pragma region Foliage
+
+    // Note: Grass and trees on the terrain, placed on the GPU from
+    //       scratch every frame (see foliage.glsl). After the terrain
+    //       cull:
+    //
+    //           foliagescatter.comp     one workgroup per visible
+    //                                   patch grows its cells from the
+    //                                   density map, culls them and
+    //                                   appends the survivors to their
+    //                                   bin 
+    //           foliage.vert/frag       one indirect draw per bin, in
+    //                                   the terrain pass 
+    //
+    //       The CPU uploads the density map once and resets the four
+    //       indirect commands per frame, so the number of instances is
+    //       only bounded by the bins and the GPU 
+
+    /// <summary>
+    /// Creates the density map, the instance bins and what fills and
+    /// draws them 
+    /// </summary>
+    void CreateFoliage()
+    {
+        if (!foliageEnabled)
+        {
+            return;
+        }
+
+        Foliage::DensityMap density;
+        if (foliagePath.empty())
+        {
+            density = Foliage::ProceduralDensity(FOLIAGE_DENSITY_SIZE);
+        }
+        else if (!Foliage::LoadDensity(foliagePath, density))
+        {
+            throw std::runtime_error("Failed to load the foliage density map " + foliagePath + "!");
+        }
+
+        VkImageUsageFlags densityUsage = HostUploadUsage(FOLIAGE_DENSITY_FORMAT, VK_IMAGE_USAGE_SAMPLED_BIT);
+        CreateImage(density.size, density.size, 1, FOLIAGE_DENSITY_FORMAT, densityUsage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, foliageDensityImage, foliageDensityMemory);
+        foliageDensityView = CreateImageView(foliageDensityImage, VK_IMAGE_VIEW_TYPE_2D, FOLIAGE_DENSITY_FORMAT,
+            VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        VkBufferImageCopy region{};
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageExtent = { density.size, density.size, 1 };
+        UploadImage(foliageDensityImage, densityUsage, density.texels.data(), density.texels.size(), { region },
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+        // The map tiles the ground 
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &foliageSampler) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create foliage sampler!");
+        }
+
+        // Every bin has room for its capacity, back to back. Only the
+        // indirect commands are ever touched by the CPU 
+        VkDeviceSize instanceCount = 0;
+        for (uint32_t bin = 0; bin < FOLIAGE_BINS; bin++)
+        {
+            instanceCount += FOLIAGE_BIN_CAPACITY[bin];
+        }
+        CreateBuffer(instanceCount * FOLIAGE_INSTANCE_BYTES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, foliageInstanceBuffer, foliageInstanceMemory);
+        CreateBuffer(FOLIAGE_BINS * sizeof(VkDrawIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, foliageDrawBuffer, foliageDrawMemory);
+
+        foliageCountBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        foliageCountMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        foliageCountMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        foliageCounted.assign(MAX_FRAMES_IN_FLIGHT, false);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            CreateBuffer(FOLIAGE_BINS * sizeof(VkDrawIndirectCommand), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                foliageCountBuffers[i], foliageCountMemory[i]);
+            vkMapMemory(device, foliageCountMemory[i], 0, FOLIAGE_BINS * sizeof(VkDrawIndirectCommand), 0, &foliageCountMapped[i]);
+        }
+
+        // Set 1, next to the terrain's set 0:
+        //
+        //  0   Density map             foliagescatter.comp
+        //  1   Instances               foliagescatter.comp, foliage.vert
+        //  2   Indirect draws          foliagescatter.comp
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+        for (uint32_t b = 0; b < bindings.size(); b++)
+        {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &foliageDescriptorSetLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create foliage descriptor set layout!");
+        }
+
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 };
+        poolSizes[1] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 };
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = 1;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &foliageDescriptorPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create foliage descriptor pool!");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = foliageDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &foliageDescriptorSetLayout;
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, &foliageDescriptorSet) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to allocate foliage descriptor set!");
+        }
+
+        VkDescriptorImageInfo densityInfo = { foliageSampler, foliageDensityView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        std::array<VkDescriptorBufferInfo, 3> bufferInfos{};
+        bufferInfos[1] = { foliageInstanceBuffer, 0, VK_WHOLE_SIZE };
+        bufferInfos[2] = { foliageDrawBuffer, 0, VK_WHOLE_SIZE };
+
+        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+        for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+        {
+            descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[b].dstSet = foliageDescriptorSet;
+            descriptorWrites[b].dstBinding = b;
+            descriptorWrites[b].descriptorCount = 1;
+            descriptorWrites[b].descriptorType = bindings[b].descriptorType;
+            descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+        }
+        descriptorWrites[0].pBufferInfo = nullptr;
+        descriptorWrites[0].pImageInfo = &densityInfo;
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+        // The bin being drawn, for foliage.vert 
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(uint32_t);
+
+        std::array<VkDescriptorSetLayout, 2> setLayouts = { terrainDescriptorSetLayout, foliageDescriptorSetLayout };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &foliagePipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create foliage pipeline layout!");
+        }
+
+        foliagePipeline = CreateTerrainPipeline("Shaders/foliagevert.spv", "Shaders/foliagefrag.spv", foliagePipelineLayout);
+        foliageScatterPipeline = CreateShadingComputePipeline("Shaders/foliagescatter.spv", foliagePipelineLayout);
+    }
+
+    /// <summary>
+    /// Empties every bin, keeping the vertex count of its mesh 
+    /// </summary>
+    void ResetFoliageDraws(VkCommandBuffer commandBuffer)
+    {
+        std::array<VkDrawIndirectCommand, FOLIAGE_BINS> commands{};
+        for (uint32_t bin = 0; bin < FOLIAGE_BINS; bin++)
+        {
+            commands[bin] = { FOLIAGE_BIN_VERTICES[bin], 0, 0, 0 };
+        }
+        vkCmdUpdateBuffer(commandBuffer, foliageDrawBuffer, 0, sizeof(commands), commands.data());
+    }
+
+    /// <summary>
+    /// Scatters this frame's foliage over the patches the cull just
+    /// found, then copies the indirect commands back for the stats 
+    /// </summary>
+    void RecordFoliageScatter(VkCommandBuffer commandBuffer)
+    {
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame) * SHADING_QUERY_COUNT;
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_FOLIAGE_BEGIN);
+        }
+
+        // One workgroup for every patch there could be, those past the
+        // number of visible ones return at once. This keeps the CPU
+        // from ever waiting on the cull 
+        std::array<VkDescriptorSet, 2> sets = { terrainDescriptorSets[currentFrame], foliageDescriptorSet };
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, foliagePipelineLayout,
+            0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, foliageScatterPipeline);
+        vkCmdDispatch(commandBuffer, TERRAIN_LEVELS * TERRAIN_PATCHES * TERRAIN_PATCHES, 1, 1);
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        if (shadingQueryPool != VK_NULL_HANDLE)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadingQueryPool, firstQuery + QUERY_FOLIAGE_END);
+            foliageTimed[currentFrame] = true;
+        }
+
+        VkBufferCopy region{};
+        region.size = FOLIAGE_BINS * sizeof(VkDrawIndirectCommand);
+        vkCmdCopyBuffer(commandBuffer, foliageDrawBuffer, foliageCountBuffers[currentFrame], 1, &region);
+
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = foliageCountBuffers[currentFrame];
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+        foliageCounted[currentFrame] = true;
+    }
+
+    /// <summary>
+    /// One indirect draw per bin, inside the terrain pass with its
+    /// viewport already set 
+    /// </summary>
+    void RecordFoliageDraws(VkCommandBuffer commandBuffer)
+    {
+        std::array<VkDescriptorSet, 2> sets = { terrainDescriptorSets[currentFrame], foliageDescriptorSet };
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, foliagePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, foliagePipelineLayout,
+            0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+
+        for (uint32_t bin = 0; bin < FOLIAGE_BINS; bin++)
+        {
+            vkCmdPushConstants(commandBuffer, foliagePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(bin), &bin);
+            vkCmdDrawIndirect(commandBuffer, foliageDrawBuffer, bin * sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+        }
+    }
+
+    /// <summary>
+    /// Adds up how many instances the frame whose fence was just
+    /// waited on drew, and whether a bin ran full 
+    /// </summary>
+    void CollectFoliageCounts()
+    {
+        if (!foliageEnabled || !foliageCounted[currentFrame])
+        {
+            return;
+        }
+
+        const VkDrawIndirectCommand* commands = static_cast<const VkDrawIndirectCommand*>(foliageCountMapped[currentFrame]);
+        for (uint32_t bin = 0; bin < FOLIAGE_BINS; bin++)
+        {
+            uint32_t count = commands[bin].instanceCount;
+            if (count > FOLIAGE_BIN_CAPACITY[bin])
+            {
+                foliageOverflows++;
+                count = FOLIAGE_BIN_CAPACITY[bin];
+            }
+            foliageInstances[bin] += count;
+        }
+
+        foliageCountedFrames++;
+        foliageCounted[currentFrame] = false;
+    }
+
+    void PrintFoliageStats()
+    {
+        if (!foliageEnabled || foliageCountedFrames == 0)
+        {
+            return;
+        }
+
+        const char* names[FOLIAGE_BINS] = { "near grass", "far grass", "near trees", "far trees" };
+        uint64_t total = 0;
+        std::cout << "Foliage, per frame:";
+        for (uint32_t bin = 0; bin < FOLIAGE_BINS; bin++)
+        {
+            std::cout << (bin > 0 ? ", " : " ") << foliageInstances[bin] / foliageCountedFrames << " " << names[bin];
+            total += foliageInstances[bin];
+        }
+        std::cout << " (" << total / foliageCountedFrames << " instances";
+        if (foliageTimedFrames > 0)
+        {
+            std::cout << ", scattered in " << foliageGpuMilliseconds / foliageTimedFrames << " ms GPU";
+        }
+        std::cout << ", " << foliageCountedFrames << " frames)";
+        if (foliageOverflows > 0)
+        {
+            std::cout << ", a bin ran full " << foliageOverflows << " times";
+        }
+        std::cout << std::endl;
+    }
+
+    void CleanupFoliage()
+    {
+        if (!foliageEnabled)
+        {
+            return;
+        }
+
+        vkDestroyPipeline(device, foliagePipeline, nullptr);
+        vkDestroyPipeline(device, foliageScatterPipeline, nullptr);
+        vkDestroyPipelineLayout(device, foliagePipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, foliageDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, foliageDescriptorSetLayout, nullptr);
+        vkDestroySampler(device, foliageSampler, nullptr);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            vkDestroyBuffer(device, foliageCountBuffers[i], nullptr);
+            vkFreeMemory(device, foliageCountMemory[i], nullptr);
+        }
+
+        vkDestroyBuffer(device, foliageInstanceBuffer, nullptr);
+        vkFreeMemory(device, foliageInstanceMemory, nullptr);
+        vkDestroyBuffer(device, foliageDrawBuffer, nullptr);
+        vkFreeMemory(device, foliageDrawMemory, nullptr);
+
+        vkDestroyImageView(device, foliageDensityView, nullptr);
+        vkDestroyImage(device, foliageDensityImage, nullptr);
+        vkFreeMemory(device, foliageDensityMemory, nullptr);
+    }
+
+    #pragma endregion
+
+private: // Main functions 
+    void InitWindow()
+    {
+        glfwInit();
+
+        // Tell application to not create an OpenGL context 
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+        // Serving and benchmarking still need a device made for a
+        // surface, but nobody should ever see the window 
+        if (serveEnabled || primitivesBenchmark || memoryBenchmark)
+        {
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        }
+
+
+        // Generate window 
+        //      Fourth parameter lets us choose a montitor to open to
+        //      Fifth parameter is only relevant to OpenGL
+        windows.resize(windowCount);
+        for (uint32_t i = 0; i < windowCount; i++)
+        {
+            std::string title = i == 0 ? "Vulkan" : "Vulkan (" + std::to_string(i + 1) + ")";
+
+            GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, title.c_str(), nullptr, nullptr);
+            glfwSetWindowUserPointer(window, this); // Setsup user pointer 
+            glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
+            glfwSetKeyCallback(window, KeyCallback);
+            glfwSetWindowRefreshCallback(window, WindowRefreshCallback);
+            glfwSetCursorPosCallback(window, CursorPosCallback);
+            glfwSetMouseButtonCallback(window, MouseButtonCallback);
+            glfwSetScrollCallback(window, ScrollCallback);
+
+            windows[i].window = window;
+        }
+    }
+
+    void InitVulkan() 
+    {
+        CreateInstance();
+        SetupDebugMessenger();
+        CreateSurfaces();
+        PickPhysicalDevice();
+        CreateLogicalDevice();
+        for (auto& target : windows)
+        {
+            CreateSwapChain(target);
+            CreateImageViews(target);
+        }
         CreateRenderPass();
+        CreateViewDescriptorSetLayout();
         CreateGraphicsPipeline();
-        CreateFrameBuffers();
+        for (auto& target : windows)
+        {
+            CreateFrameBuffers(target);
+        }
         CreateCommandPool();
+        CreateComputePrimitives();
+        CreateAnimations();
+        CreateSkinningBuffers();
+        CreateSkinningDescriptorSetLayout();
+        CreateSkinningPipeline();
+        CreateSkinningDescriptorPool();
+        CreateSkinningDescriptorSets();
+        CreateViewTargets();
+        CreateExportTargets();
+        CreateReadback();
+        CreateRenderService();
+        CreateDamageTracking();
+        CreateShading();
+        CreateTransparency();
         CreateCommandBuffers();
         CreateSyncObjects();
     }
 
     void MainLoop() 
     {
-        while (!glfwWindowShouldClose(window))
+        // Closing any of the windows closes the app 
+        auto anyWindowClosed = [this]()
         {
-            glfwPollEvents();
-            DrawFrame();
+            for (const auto& target : windows)
+            {
+                if (glfwWindowShouldClose(target.window))
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        if (primitivesBenchmark)
+        {
+            RunPrimitivesBenchmark();
+        }
+        else if (memoryBenchmark)
+        {
+            RunMemoryBenchmark();
+        }
+        else if (serveEnabled)
+        {
+            ServeLoop();
+        }
+        else if (renderOnDemand)
+        {
+            lastFrameTime = std::chrono::steady_clock::now();
+            while (WaitForDirtyFrame(anyWindowClosed) && !anyWindowClosed())
+            {
+                // Cleared before drawing so a frame that could not
+                // acquire any image can ask to be drawn again 
+                frameDirty = 0;
+                DrawFrame();
+                drawnFrames++;
+
+                lastFrameTime = std::chrono::steady_clock::now();
+            }
+
+            std::cout << "Drew " << drawnFrames << " frames on demand" << std::endl;
+        }
+        else
+        {
+            while (!anyWindowClosed())
+            {
+                glfwPollEvents();
+                DrawFrame();
+            }
+        }
+
+        if (shadingEnabled)
+        {
+            PrintShadingStats();
+        }
+
+        if (damageTrackingEnabled && windowPixels > 0)
+        {
+            std::cout << "Damage tracking repainted " << 100.0 * repaintedPixels / windowPixels
+                << "% of the window pixels" << std::endl;
         }
 
         // Wait for our device since they are async
@@ -1827,7 +13301,10 @@ private: // Main functions
 
     void Cleanup() 
     {
-        CleanupSwapChain();
+        for (auto& target : windows)
+        {
+            CleanupSwapChain(target);
+        }
 
         vkDestroyPipeline(device, graphicsPipeline, nullptr);
         // Once we have multiple pipelines we can destroy them all here 
@@ -1835,13 +13312,30 @@ private: // Main functions
 
         vkDestroyRenderPass(device, renderPass, nullptr);
 
+        CleanupComputePrimitives();
+        CleanupSkinning();
+        CleanupViews();
+        CleanupExport();
+        CleanupReadback();
+        CleanupRenderService();
+        CleanupDamageTracking();
+        CleanupShading();
+        CleanupTransparency();
+
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
-            vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
             vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
             vkDestroyFence(device, inFlightFences[i], nullptr);
         }
 
+        for (auto& target : windows)
+        {
+            for (auto semaphore : target.imageAvailableSemaphores)
+            {
+                vkDestroySemaphore(device, semaphore, nullptr);
+            }
+        }
+
         vkDestroyCommandPool(device, commandPool, nullptr);
 
         vkDestroyDevice(device, nullptr);
@@ -1851,21 +13345,298 @@ private: // Main functions
             DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
         }
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        for (auto& target : windows)
+        {
+            vkDestroySurfaceKHR(instance, target.surface, nullptr);
+        }
         vkDestroyInstance(instance, nullptr);
 
 
-        glfwDestroyWindow(window);
+        for (auto& target : windows)
+        {
+            glfwDestroyWindow(target.window);
+        }
 
         glfwTerminate();
     }
 };
 
-int main() {
-    HelloTriangleApplication app;
+/// <summary>
+/// The value of a command line option that takes a whole number, or an
+/// error naming the option when it is not one or is over max 
+/// </summary>
+static uint64_t ParseUnsigned(const std::string& option, const std::string& value, uint64_t max = UINT32_MAX)
+{
+    // Note: stoull skips whitespace, wraps negative numbers around and
+    //       stops at the first character that is not a digit, none of
+    //       which a count should get away with 
+    size_t used = 0;
+    unsigned long long result = 0;
+    try
+    {
+        result = std::stoull(value, &used);
+    }
+    catch (const std::logic_error&)
+    {
+        used = 0;
+    }
+
+    if (used == 0 || used != value.size() || !isdigit(static_cast<unsigned char>(value[0])) || result > max)
+    {
+        throw std::runtime_error(option + " expects a whole number up to " + std::to_string(max) + ", not \"" + value + "\"");
+    }
+    return result;
+}
+
+/// <summary>
+/// The value of a command line option that takes seconds 
+/// </summary>
+static float ParseSeconds(const std::string& option, const std::string& value)
+{
+    size_t used = 0;
+    float result = 0.0f;
+    try
+    {
+        result = std::stof(value, &used);
+    }
+    catch (const std::logic_error&)
+    {
+        used = 0;
+    }
 
+    if (used == 0 || used != value.size() || !(result >= 0.0f) || std::isinf(result))
+    {
+        throw std::runtime_error(option + " expects a number of seconds, not \"" + value + "\"");
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    HelloTriangleApplication app;
+    HelloTriangleApplication::Options options;
+    std::string consumePath;
+    uint64_t consumeFrames = 0;
+    std::string renderClientPath;
+    RenderClient::Options renderClientOptions;
+
+    // --windows N opens N windows that are all presented together 
+    // --views N renders N views in one multiview pass 
+    // --export PATH shares every frame with a consumer on PATH
+    // --consume PATH [--frames N] runs the test consumer instead 
+    // --record FILE writes every frame to a .y4m file
+    // --record-pipe COMMAND streams .y4m into an encoder's stdin 
+    // --screenshots DIR [--screenshot-format png|qoi] lets F12 save frames 
+    // --serve PATH serves batched render jobs on PATH without a window
+    // --render-client PATH [--jobs N] [--job-size N] [--in-flight N] [--job-format png|qoi]
+    //                      [--output DIR] [--stop-server] runs the throughput test client instead 
+    // --on-demand [--min-refresh SECONDS] only draws when something changed 
+    // --damage-tracking only repaints what changed since an image was last drawn 
+    // --lights N [--shading forward|deferred] lights the scene, G switches paths 
+    // --ssao full|half|quarter adds ambient occlusion to deferred shading, O toggles it 
+    // --post all|bloom,tonemap,vignette,grade,dither post-processes deferred shading, F1 to F5 toggle 
+    // --ssr low|medium|high adds Hi-Z screen space reflections to deferred shading, R steps through them 
+    // --transparency N draws N transparent bubbles over the scene in any order 
+    // --ibl sky|FILE.hdr [--ibl-cache DIR] lights with an environment, L turns it 
+    // --sky [--sun-cycle SECONDS] draws a sky behind the scene, K moves the sun 
+    // --fog adds volumetric fog lit by the lights, V toggles it 
+    // --terrain procedural|FILE.raw flies over clipmap terrain, streamed a page at a time 
+    // --foliage procedural|FILE.raw grows grass and trees on the terrain, placed on the GPU 
+    // --primitives-benchmark [--primitives-max N] times scan, compaction and radix sort up to N items 
+    // --dynamic-memory auto|direct|staged places per-frame data in mappable VRAM or stages it 
+    // --memory-benchmark times per-frame data written to host memory, staged and mappable VRAM 
     try {
-        app.Run();
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--windows" && i + 1 < argc)
+            {
+                options.windowCount = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--views" && i + 1 < argc)
+            {
+                options.viewCount = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--export" && i + 1 < argc)
+            {
+                options.exportPath = argv[++i];
+            }
+            else if (arg == "--record" && i + 1 < argc)
+            {
+                options.recordPath = argv[++i];
+            }
+            else if (arg == "--record-pipe" && i + 1 < argc)
+            {
+                options.recordCommand = argv[++i];
+            }
+            else if (arg == "--screenshots" && i + 1 < argc)
+            {
+                options.screenshotDirectory = argv[++i];
+            }
+            else if (arg == "--screenshot-format" && i + 1 < argc)
+            {
+                std::string format = argv[++i];
+                if (format != "png" && format != "qoi")
+                {
+                    throw std::runtime_error("Unknown screenshot format \"" + format + "\", use png or qoi!");
+                }
+
+                options.screenshotFormat = format == "qoi" ? ImageEncode::Format::Qoi : ImageEncode::Format::Png;
+            }
+            else if (arg == "--on-demand")
+            {
+                options.renderOnDemand = true;
+            }
+            else if (arg == "--min-refresh" && i + 1 < argc)
+            {
+                options.minimumRefresh = ParseSeconds(arg, argv[++i]);
+            }
+            else if (arg == "--damage-tracking")
+            {
+                options.damageTracking = true;
+            }
+            else if (arg == "--lights" && i + 1 < argc)
+            {
+                options.lightCount = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--shading" && i + 1 < argc)
+            {
+                std::string path = argv[++i];
+                if (path != "forward" && path != "deferred")
+                {
+                    throw std::runtime_error("Unknown shading path \"" + path + "\", use forward or deferred!");
+                }
+
+                options.deferredShading = path == "deferred";
+            }
+            else if (arg == "--ssao" && i + 1 < argc)
+            {
+                std::string resolution = argv[++i];
+                if (resolution != "full" && resolution != "half" && resolution != "quarter")
+                {
+                    throw std::runtime_error("Unknown ambient occlusion resolution \"" + resolution + "\", use full, half or quarter!");
+                }
+
+                options.ambientOcclusion = true;
+                options.ambientOcclusionScale = resolution == "full" ? 1 : resolution == "quarter" ? 4 : 2;
+            }
+            else if (arg == "--post" && i + 1 < argc)
+            {
+                options.postEffects = argv[++i];
+            }
+            else if (arg == "--ssr" && i + 1 < argc)
+            {
+                options.reflections = argv[++i];
+            }
+            else if (arg == "--transparency" && i + 1 < argc)
+            {
+                options.transparentCount = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--ibl" && i + 1 < argc)
+            {
+                options.environment = argv[++i];
+            }
+            else if (arg == "--ibl-cache" && i + 1 < argc)
+            {
+                options.iblCacheDirectory = argv[++i];
+            }
+            else if (arg == "--sky")
+            {
+                options.sky = true;
+            }
+            else if (arg == "--sun-cycle" && i + 1 < argc)
+            {
+                options.sunCycle = ParseSeconds(arg, argv[++i]);
+            }
+            else if (arg == "--fog")
+            {
+                options.fog = true;
+            }
+            else if (arg == "--terrain" && i + 1 < argc)
+            {
+                options.terrain = argv[++i];
+            }
+            else if (arg == "--foliage" && i + 1 < argc)
+            {
+                options.foliage = argv[++i];
+            }
+            else if (arg == "--primitives-benchmark")
+            {
+                options.primitivesBenchmark = true;
+            }
+            else if (arg == "--primitives-max" && i + 1 < argc)
+            {
+                options.primitivesMax = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--dynamic-memory" && i + 1 < argc)
+            {
+                options.dynamicMemory = argv[++i];
+            }
+            else if (arg == "--memory-benchmark")
+            {
+                options.memoryBenchmark = true;
+            }
+            else if (arg == "--serve" && i + 1 < argc)
+            {
+                options.servePath = argv[++i];
+            }
+            else if (arg == "--render-client" && i + 1 < argc)
+            {
+                renderClientPath = argv[++i];
+            }
+            else if (arg == "--jobs" && i + 1 < argc)
+            {
+                renderClientOptions.jobCount = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--job-size" && i + 1 < argc)
+            {
+                renderClientOptions.width = renderClientOptions.height = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--in-flight" && i + 1 < argc)
+            {
+                renderClientOptions.inFlight = static_cast<uint32_t>(ParseUnsigned(arg, argv[++i]));
+            }
+            else if (arg == "--job-format" && i + 1 < argc)
+            {
+                std::string format = argv[++i];
+                if (format != "png" && format != "qoi")
+                {
+                    throw std::runtime_error("Unknown job format \"" + format + "\", use png or qoi!");
+                }
+
+                renderClientOptions.format = format == "png" ? RenderService::IMAGE_FORMAT_PNG : RenderService::IMAGE_FORMAT_QOI;
+            }
+            else if (arg == "--output" && i + 1 < argc)
+            {
+                renderClientOptions.outputDirectory = argv[++i];
+            }
+            else if (arg == "--stop-server")
+            {
+                renderClientOptions.stopServer = true;
+            }
+            else if (arg == "--consume" && i + 1 < argc)
+            {
+                consumePath = argv[++i];
+            }
+            else if (arg == "--frames" && i + 1 < argc)
+            {
+                consumeFrames = ParseUnsigned(arg, argv[++i], UINT64_MAX);
+            }
+        }
+
+        if (!consumePath.empty())
+        {
+            FrameConsumer consumer;
+            consumer.Run(consumePath, consumeFrames);
+        }
+        else if (!renderClientPath.empty())
+        {
+            RenderClient client;
+            client.Run(renderClientPath, renderClientOptions);
+        }
+        else
+        {
+            app.Run(options);
+        }
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,175 @@
+#pragma once
+
+// Note: A whole file mapped read only into memory. The view starts on a
+//       page boundary and the rest of its last page reads as zeros, so
+//       up to MappedSize() it can be handed to Vulkan as host memory
+//       whenever the driver asks for no more than page alignment
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// <summary>
+/// Owns the mapping of a file and unmaps it when destroyed
+/// </summary>
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept : data(other.data), size(other.size)
+    {
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            data = other.data;
+            size = other.size;
+            other.data = nullptr;
+            other.size = 0;
+        }
+        return *this;
+    }
+
+    /// <summary>
+    /// Maps every byte of the file at path. Fails for missing and
+    /// empty files
+    /// </summary>
+    bool Open(const std::string& path)
+    {
+        Close();
+
+        // Note: The view keeps the file open by itself, the handles
+        //       are not needed once it exists
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (mapping == nullptr)
+        {
+            return false;
+        }
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr)
+        {
+            return false;
+        }
+
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            return false;
+        }
+
+        struct stat status;
+        void* view = MAP_FAILED;
+        if (fstat(file, &status) == 0 && status.st_size > 0)
+        {
+            view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        }
+        close(file);
+        if (view == MAP_FAILED)
+        {
+            return false;
+        }
+
+        size = static_cast<size_t>(status.st_size);
+#endif
+        data = static_cast<const uint8_t*>(view);
+        return true;
+    }
+
+    void Close()
+    {
+        if (data == nullptr)
+        {
+            return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(const_cast<uint8_t*>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    bool IsOpen() const
+    {
+        return data != nullptr;
+    }
+
+    const uint8_t* Data() const
+    {
+        return data;
+    }
+
+    /// <summary>
+    /// Bytes of the file
+    /// </summary>
+    size_t Size() const
+    {
+        return size;
+    }
+
+    /// <summary>
+    /// Bytes of the view, the file rounded up to whole pages
+    /// </summary>
+    size_t MappedSize() const
+    {
+        size_t page = PageSize();
+        return (size + page - 1) / page * page;
+    }
+
+    static size_t PageSize()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<size_t>(info.dwPageSize);
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
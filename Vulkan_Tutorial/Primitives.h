@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Note: Host side of the compute primitives, the building blocks for
+//       culling, particles, transparency and light binning:
+//
+//           scan.comp           exclusive prefix sum
+//           compact.comp        keeps the values whose flag is set
+//           radixhistogram.comp digit counts of every sort pass at once
+//           onesweep.comp       one pass of an 8 bit LSD radix sort
+//
+//       All of them work on partitions of PARTITION_SIZE items and
+//       pass sums between partitions with decoupled look-back, so a
+//       scan is a single dispatch and a sort five. What they share
+//       lives in a state buffer laid out below. The functions here are
+//       the CPU reference the GPU results are checked against
+
+namespace Primitives
+{
+    // Note: Keep in sync with primitives.glsl
+    const uint32_t GROUP_SIZE = 256;
+    const uint32_t ITEMS_PER_THREAD = 8;
+    const uint32_t PARTITION_SIZE = GROUP_SIZE * ITEMS_PER_THREAD;
+
+    const uint32_t RADIX_BITS = 8;
+    const uint32_t RADIX = 1 << RADIX_BITS;
+    const uint32_t RADIX_PASSES = 32 / RADIX_BITS;
+
+    // A look-back state keeps its flag in the top two bits, so every
+    // sum has to stay below this. Counts and offsets always do
+    const uint32_t SUM_LIMIT = 1u << 30;
+
+    // Words of the state buffer, which is cleared before every use:
+    //
+    //      STATE_TICKETS       one partition ticket per radix pass
+    //      STATE_HISTOGRAM     RADIX digit counts per radix pass
+    //      STATE_LOOKBACK      one state per partition for a scan,
+    //                          RADIX per partition and pass for a sort
+    const uint32_t STATE_TICKETS = 0;
+    const uint32_t STATE_HISTOGRAM = STATE_TICKETS + RADIX_PASSES;
+    const uint32_t STATE_LOOKBACK = STATE_HISTOGRAM + RADIX_PASSES * RADIX;
+
+    inline uint32_t PartitionCount(uint32_t count)
+    {
+        return (count + PARTITION_SIZE - 1) / PARTITION_SIZE;
+    }
+
+    /// <summary>
+    /// Words of state a scan or compaction (or a sort) of count items
+    /// clears and uses
+    /// </summary>
+    inline uint64_t StateWords(uint32_t count, bool sorting)
+    {
+        uint64_t partitions = PartitionCount(count);
+        return STATE_LOOKBACK + partitions * (sorting ? RADIX * RADIX_PASSES : 1);
+    }
+
+    /// <summary>
+    /// Sum of everything before each item
+    /// </summary>
+    inline void ExclusiveScan(const std::vector<uint32_t>& input, std::vector<uint32_t>& output)
+    {
+        output.resize(input.size());
+        uint32_t sum = 0;
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            output[i] = sum;
+            sum += input[i];
+        }
+    }
+
+    /// <summary>
+    /// The values whose flag is not zero, in order. Returns how many
+    /// </summary>
+    inline uint32_t Compact(const std::vector<uint32_t>& values, const std::vector<uint32_t>& flags, std::vector<uint32_t>& output)
+    {
+        output.clear();
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (flags[i] != 0)
+            {
+                output.push_back(values[i]);
+            }
+        }
+        return static_cast<uint32_t>(output.size());
+    }
+
+    /// <summary>
+    /// Sorts the keys, and the values along with them when there are
+    /// any. Equal keys keep their order like they do on the GPU
+    /// </summary>
+    inline void Sort(std::vector<uint32_t>& keys, std::vector<uint32_t>* values)
+    {
+        if (values == nullptr)
+        {
+            std::sort(keys.begin(), keys.end());
+            return;
+        }
+
+        std::vector<uint32_t> order(keys.size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b)
+        {
+            return keys[a] < keys[b];
+        });
+
+        std::vector<uint32_t> sortedKeys(keys.size());
+        std::vector<uint32_t> sortedValues(keys.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            sortedKeys[i] = keys[order[i]];
+            sortedValues[i] = (*values)[order[i]];
+        }
+        keys.swap(sortedKeys);
+        values->swap(sortedValues);
+    }
+}
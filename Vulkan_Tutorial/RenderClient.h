@@ -0,0 +1,141 @@
+#pragma once
+
+#include "RenderService.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Throughput test for the batch render service. Keeps a fixed number
+/// of jobs queued on the server, so the server always has a full batch
+/// to work on, and reports how quickly the images come back
+/// </summary>
+class RenderClient
+{
+public:
+    struct Options
+    {
+        uint32_t jobCount = 256;
+        uint32_t inFlight = 64;     // Jobs sent before waiting on any result
+        uint32_t width = 256;
+        uint32_t height = 256;
+        RenderService::ImageFormat format = RenderService::IMAGE_FORMAT_QOI;
+        uint32_t sceneCount = 4;    // Distinct scene times, each one is its own batch
+        std::string outputDirectory; // When set, every image is written here
+        bool stopServer = false;
+    };
+
+    void Run(const std::string& socketPath, const Options& options)
+    {
+        LocalSocket socket = LocalSocket::Connect(socketPath);
+
+        uint32_t inFlight = (std::max)(options.inFlight, 1u);
+        std::vector<std::chrono::steady_clock::time_point> sentAt(options.jobCount);
+
+        uint32_t sent = 0;
+        uint32_t received = 0;
+        uint32_t failed = 0;
+        uint64_t bytes = 0;
+        double totalLatency = 0.0;
+        std::vector<uint8_t> image;
+
+        auto start = std::chrono::steady_clock::now();
+
+        while (received < options.jobCount)
+        {
+            while (sent < options.jobCount && sent - received < inFlight)
+            {
+                RenderService::Request request{};
+                request.type = RenderService::REQUEST_RENDER;
+                request.job = MakeJob(sent, options);
+
+                sentAt[sent] = std::chrono::steady_clock::now();
+                if (!socket.Send(request))
+                {
+                    throw std::runtime_error("Render server went away!");
+                }
+                sent++;
+            }
+
+            RenderService::Result result;
+            if (!socket.Receive(result) || result.id >= options.jobCount)
+            {
+                throw std::runtime_error("Render server went away!");
+            }
+
+            image.resize(static_cast<size_t>(result.size));
+            if (!socket.Receive(image.data(), image.size()))
+            {
+                throw std::runtime_error("Render server went away!");
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            totalLatency += std::chrono::duration<double, std::milli>(now - sentAt[result.id]).count();
+            received++;
+            bytes += result.size;
+
+            if (result.status != RenderService::RESULT_OK)
+            {
+                failed++;
+            }
+            else if (!options.outputDirectory.empty())
+            {
+                WriteImage(options, result.id, image);
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << received << " jobs (" << failed << " failed) of " << options.width << "x" << options.height
+            << " in " << seconds << " s" << std::endl;
+        std::cout << "  " << received / seconds << " jobs/s, " << bytes / seconds / (1024.0 * 1024.0) << " MB/s, "
+            << "average latency " << totalLatency / received << " ms" << std::endl;
+
+        if (options.stopServer)
+        {
+            RenderService::Request request{};
+            request.type = RenderService::REQUEST_SHUTDOWN;
+            socket.Send(request);
+        }
+    }
+
+private:
+    /// <summary>
+    /// Spreads the jobs over a few scene times and pans the camera
+    /// across the crowd so no two images are the same
+    /// </summary>
+    static RenderService::Job MakeJob(uint32_t index, const Options& options)
+    {
+        uint32_t sceneCount = (std::max)(options.sceneCount, 1u);
+        float t = static_cast<float>(index) / static_cast<float>((std::max)(options.jobCount, 1u));
+
+        RenderService::Job job{};
+        job.id = index;
+        job.width = options.width;
+        job.height = options.height;
+        job.format = options.format;
+        job.sceneTime = 0.5f * static_cast<float>(index % sceneCount);
+        job.cameraX = 2.0f * t - 1.0f;
+        job.cameraY = 0.0f;
+        job.cameraZoom = 1.0f + t;
+        return job;
+    }
+
+    static void WriteImage(const Options& options, uint32_t id, const std::vector<uint8_t>& image)
+    {
+        std::string path = options.outputDirectory + "/render_" + std::to_string(id) +
+            (options.format == RenderService::IMAGE_FORMAT_PNG ? ".png" : ".qoi");
+
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (file != nullptr)
+        {
+            std::fwrite(image.data(), 1, image.size(), file);
+            std::fclose(file);
+        }
+    }
+};
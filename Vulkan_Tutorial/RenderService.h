@@ -0,0 +1,97 @@
+#pragma once
+
+#include "LocalSocket.h"
+
+#include <cmath>
+#include <cstdint>
+
+// Note: Protocol of the batch render service. Clients connect to the
+//       server's socket and send any number of requests without
+//       waiting, every render request is eventually answered with one
+//       result followed by the encoded image. Results come back in the
+//       order their batch finished, not necessarily in request order
+//
+//       client -> server   Request (Render)   render a job
+//       server -> client   Result + bytes     encoded image, or an error
+//       client -> server   Request (Shutdown) stop the server
+//
+//       The only scene is the crowd of animated characters. A job picks
+//       the moment in time the crowd is posed at and a 2D camera on it.
+//       Jobs that share a scene time are rendered in the same batch
+
+namespace RenderService
+{
+    // Jobs are packed into a square atlas of this size, so no job can
+    // be bigger than half of it in either direction
+    const uint32_t ATLAS_SIZE = 2048;
+    const uint32_t MAX_JOB_SIZE = ATLAS_SIZE / 2;
+
+    const float MIN_ZOOM = 0.1f;
+    const float MAX_ZOOM = 4.0f;
+
+    enum RequestType : uint32_t
+    {
+        REQUEST_RENDER = 1,
+        REQUEST_SHUTDOWN,
+    };
+
+    enum ImageFormat : uint32_t
+    {
+        IMAGE_FORMAT_PNG,
+        IMAGE_FORMAT_QOI,
+    };
+
+    enum ResultStatus : uint32_t
+    {
+        RESULT_OK,
+        RESULT_INVALID_JOB,
+    };
+
+    /// <summary>
+    /// One image to render. The camera centre is in clip space and
+    /// a zoom of one shows exactly what the window would
+    /// </summary>
+    struct Job
+    {
+        uint32_t id;            // Chosen by the client, echoed in the result
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;        // ImageFormat
+        float sceneTime;        // Seconds into the animation
+        float cameraX;
+        float cameraY;
+        float cameraZoom;
+    };
+
+    struct Request
+    {
+        uint32_t type;
+        uint32_t padding;
+        Job job;
+    };
+
+    /// <summary>
+    /// Followed by size bytes of encoded image
+    /// </summary>
+    struct Result
+    {
+        uint32_t id;
+        uint32_t status;
+        uint64_t size;
+    };
+
+    /// <summary>
+    /// Whether a job from a client can be rendered. The scene time has
+    /// to be finite, a NaN never equals itself so it would never batch
+    /// </summary>
+    inline bool IsValid(const Job& job)
+    {
+        return std::isfinite(job.sceneTime) &&
+            job.width > 0 && job.width <= MAX_JOB_SIZE &&
+            job.height > 0 && job.height <= MAX_JOB_SIZE &&
+            job.format <= IMAGE_FORMAT_QOI &&
+            job.cameraZoom >= MIN_ZOOM && job.cameraZoom <= MAX_ZOOM &&
+            job.cameraX >= -1.0f && job.cameraX <= 1.0f &&
+            job.cameraY >= -1.0f && job.cameraY <= 1.0f;
+    }
+}
@@ -0,0 +1,160 @@
+// Note: Earth-like atmosphere shared by the sky LUT shaders
+//       (transmittance.comp, multiscatter.comp, skyview.comp) and
+//       sky.glsl. Distances are in kilometres, the planet's centre is
+//       the origin and +y is up. Not compiled on its own, glslc pulls
+//       it in through #include
+
+const float PI = 3.14159265;
+const uint ATMOSPHERE_GROUP_SIZE = 8;   // Keep in sync with ATMOSPHERE_GROUP_SIZE in Main.cpp
+
+const float BOTTOM_RADIUS = 6360.0;
+const float TOP_RADIUS = 6460.0;
+const float CAMERA_HEIGHT = 0.2;        // Above the ground
+
+const vec3 RAYLEIGH_SCATTERING = vec3(5.802, 13.558, 33.1) * 1e-3;
+const float RAYLEIGH_SCALE_HEIGHT = 8.0;
+const float MIE_SCATTERING = 3.996e-3;
+const float MIE_EXTINCTION = 4.44e-3;
+const float MIE_SCALE_HEIGHT = 1.2;
+const float MIE_G = 0.8;
+const vec3 OZONE_ABSORPTION = vec3(0.650, 1.881, 0.085) * 1e-3;
+const float OZONE_CENTER = 25.0;        // Ozone is a tent around this height
+const float OZONE_HALF_WIDTH = 15.0;
+const vec3 GROUND_ALBEDO = vec3(0.3);
+
+struct Medium
+{
+    vec3 rayleigh;          // Scattering of each kind
+    float mie;
+    vec3 scattering;
+    vec3 extinction;        // Scattering plus absorption
+};
+
+Medium SampleMedium(vec3 position)
+{
+    float height = max(length(position) - BOTTOM_RADIUS, 0.0);
+    float mieDensity = exp(-height / MIE_SCALE_HEIGHT);
+    float ozoneDensity = max(1.0 - abs(height - OZONE_CENTER) / OZONE_HALF_WIDTH, 0.0);
+
+    Medium medium;
+    medium.rayleigh = RAYLEIGH_SCATTERING * exp(-height / RAYLEIGH_SCALE_HEIGHT);
+    medium.mie = MIE_SCATTERING * mieDensity;
+    medium.scattering = medium.rayleigh + medium.mie;
+    medium.extinction = medium.rayleigh + MIE_EXTINCTION * mieDensity + OZONE_ABSORPTION * ozoneDensity;
+    return medium;
+}
+
+/// Distance along a ray to a sphere around the planet's centre, the
+/// nearest hit in front of origin or negative if there is none
+float RaySphere(vec3 origin, vec3 direction, float radius)
+{
+    float b = dot(origin, direction);
+    float c = dot(origin, origin) - radius * radius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0)
+    {
+        return -1.0;
+    }
+
+    float root = sqrt(discriminant);
+    return -b - root >= 0.0 ? -b - root : -b + root;
+}
+
+float RayleighPhase(float cosTheta)
+{
+    return 3.0 / (16.0 * PI) * (1.0 + cosTheta * cosTheta);
+}
+
+/// Cornette-Shanks, Henyey-Greenstein with a better back lobe
+float MiePhase(float cosTheta)
+{
+    float g2 = MIE_G * MIE_G;
+    float denominator = (2.0 + g2) * pow(1.0 + g2 - 2.0 * MIE_G * cosTheta, 1.5);
+    return 3.0 / (8.0 * PI) * (1.0 - g2) * (1.0 + cosTheta * cosTheta) / denominator;
+}
+
+// Note: Transmittance LUT parameterization (Bruneton). x is the
+//       distance to the top of the atmosphere between its shortest
+//       and longest possible value for the height, y the height
+//       remapped so that low altitudes get more texels
+
+vec2 TransmittanceUv(float radius, float cosZenith)
+{
+    float h = sqrt(TOP_RADIUS * TOP_RADIUS - BOTTOM_RADIUS * BOTTOM_RADIUS);
+    float rho = sqrt(max(radius * radius - BOTTOM_RADIUS * BOTTOM_RADIUS, 0.0));
+    float discriminant = radius * radius * (cosZenith * cosZenith - 1.0) + TOP_RADIUS * TOP_RADIUS;
+    float distance = max(-radius * cosZenith + sqrt(max(discriminant, 0.0)), 0.0);
+    float minDistance = TOP_RADIUS - radius;
+    float maxDistance = rho + h;
+    return vec2((distance - minDistance) / (maxDistance - minDistance), rho / h);
+}
+
+void TransmittanceFromUv(vec2 uv, out float radius, out float cosZenith)
+{
+    float h = sqrt(TOP_RADIUS * TOP_RADIUS - BOTTOM_RADIUS * BOTTOM_RADIUS);
+    float rho = h * uv.y;
+    radius = sqrt(rho * rho + BOTTOM_RADIUS * BOTTOM_RADIUS);
+    float minDistance = TOP_RADIUS - radius;
+    float maxDistance = rho + h;
+    float distance = minDistance + uv.x * (maxDistance - minDistance);
+    cosZenith = distance == 0.0 ? 1.0 : (h * h - rho * rho - distance * distance) / (2.0 * radius * distance);
+    cosZenith = clamp(cosZenith, -1.0, 1.0);
+}
+
+/// Transmittance from a point to the top of the atmosphere
+vec3 Transmittance(sampler2D lut, vec3 position, vec3 direction)
+{
+    float radius = length(position);
+    return textureLod(lut, TransmittanceUv(radius, dot(position, direction) / radius), 0.0).rgb;
+}
+
+// Note: Sky-view LUT parameterization (Hillaire). The sky is
+//       symmetric around the plane through the sun, so x only covers
+//       the azimuth from towards the sun (0) to away from it (1). y
+//       goes from straight up (0) over the horizon (0.5) to straight
+//       down (1), squeezed so most texels sit close to the horizon
+//       where the sky changes fastest
+
+vec2 SkyViewUv(float radius, float viewCosZenith, float sunViewCosAzimuth)
+{
+    float beta = acos(sqrt(radius * radius - BOTTOM_RADIUS * BOTTOM_RADIUS) / radius);
+    float horizonZenith = PI - beta;
+    float viewZenith = acos(clamp(viewCosZenith, -1.0, 1.0));
+
+    vec2 uv;
+    uv.x = sqrt(clamp(0.5 - 0.5 * sunViewCosAzimuth, 0.0, 1.0));
+    uv.y = viewZenith < horizonZenith ?
+        0.5 - 0.5 * sqrt(1.0 - viewZenith / horizonZenith) :
+        0.5 + 0.5 * sqrt((viewZenith - horizonZenith) / beta);
+    return uv;
+}
+
+void SkyViewFromUv(vec2 uv, float radius, out float viewCosZenith, out float sunViewCosAzimuth)
+{
+    float beta = acos(sqrt(radius * radius - BOTTOM_RADIUS * BOTTOM_RADIUS) / radius);
+    float horizonZenith = PI - beta;
+
+    float viewZenith;
+    if (uv.y < 0.5)
+    {
+        float coord = 1.0 - 2.0 * uv.y;
+        viewZenith = horizonZenith * (1.0 - coord * coord);
+    }
+    else
+    {
+        float coord = 2.0 * uv.y - 1.0;
+        viewZenith = horizonZenith + beta * coord * coord;
+    }
+
+    viewCosZenith = cos(viewZenith);
+    sunViewCosAzimuth = 1.0 - 2.0 * uv.x * uv.x;
+}
+
+/// Where light scattered more than once is looked up, x the sun's
+/// zenith cosine and y the height
+vec2 MultiScatteringUv(vec3 position, vec3 sunDirection)
+{
+    float radius = length(position);
+    return vec2(0.5 + 0.5 * dot(position, sunDirection) / radius,
+        (radius - BOTTOM_RADIUS) / (TOP_RADIUS - BOTTOM_RADIUS));
+}
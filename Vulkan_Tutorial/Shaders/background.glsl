@@ -0,0 +1,19 @@
+// Note: What lies behind the characters, drawn by sky.frag on the
+//       forward path and by deferred.comp wherever the G-buffer is
+//       empty. The terrain covers the sky where terrain.frag drew.
+//       Needs shading.glsl first
+
+#include "sky.glsl"
+
+layout(set = 0, binding = 12) uniform sampler2D terrainImage;
+
+vec3 BackgroundColor(vec2 pixel)
+{
+    vec3 color = pc.skyEnabled != 0u ? SkyColor(pixel) : vec3(0.0);
+    if (pc.terrainEnabled != 0u)
+    {
+        vec4 terrain = texelFetch(terrainImage, ivec2(pixel), 0);
+        color = mix(color, terrain.rgb, terrain.a);
+    }
+    return color;
+}
@@ -1,3 +1,47 @@
 C:\VulkanSDK\1.3.296.0\Bin\glslc.exe shader.vert -o vert.spv
 C:\VulkanSDK\1.3.296.0\Bin\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe skinning.comp -o skinning.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe multiview.vert -o multiview.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe lit.vert -o lit.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe forward.frag -o forward.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe gbuffer.frag -o gbuffer.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe deferred.comp -o deferred.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe hiz.comp -o hiz.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe ssao.comp -o ssao.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe aoblur.comp -o aoblur.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe bloomdown.comp -o bloomdown.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe bloomup.comp -o bloomup.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe post.comp -o post.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe transparent.vert -o transparent.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe oit.frag -o oit.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe fullscreen.vert -o fullscreen.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe oitresolve.frag -o oitresolve.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe envmap.comp -o envmap.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe prefilter.comp -o prefilter.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe shproject.comp -o shproject.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe brdflut.comp -o brdflut.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe transmittance.comp -o transmittance.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe multiscatter.comp -o multiscatter.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe skyview.comp -o skyview.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe sky.frag -o sky.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe foginject.comp -o foginject.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe fogintegrate.comp -o fogintegrate.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe terraincull.comp -o terraincull.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe terrain.vert -o terrainvert.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe terrain.frag -o terrainfrag.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe foliagescatter.comp -o foliagescatter.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe foliage.vert -o foliagevert.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe foliage.frag -o foliagefrag.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe ssr.comp -o ssr.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe ssrtemporal.comp -o ssrtemporal.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe ssrcomposite.comp -o ssrcomposite.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe scan.comp -o scan.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe -DPRIMITIVES_SUBGROUPS --target-env=vulkan1.1 scan.comp -o scansubgroup.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe compact.comp -o compact.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe -DPRIMITIVES_SUBGROUPS --target-env=vulkan1.1 compact.comp -o compactsubgroup.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe radixhistogram.comp -o radixhistogram.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe onesweep.comp -o onesweep.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe -DPRIMITIVES_SUBGROUPS --target-env=vulkan1.1 onesweep.comp -o onesweepsubgroup.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe -DSORT_PAIRS onesweep.comp -o onesweeppairs.spv
+C:\VulkanSDK\1.3.296.0\Bin\glslc.exe -DSORT_PAIRS -DPRIMITIVES_SUBGROUPS --target-env=vulkan1.1 onesweep.comp -o onesweeppairssubgroup.spv
 pause
\ No newline at end of file
@@ -0,0 +1,69 @@
+// Note: Shared by the image based lighting precompute shaders
+//       (envmap.comp, prefilter.comp, shproject.comp, brdflut.comp).
+//       Not compiled on its own, glslc pulls it in through #include
+
+const float PI = 3.14159265;
+const uint CUBE_FACES = 6;
+const uint IBL_GROUP_SIZE = 8;          // Keep in sync with IBL_GROUP_SIZE in Main.cpp
+
+// Note: Keep in sync with IblPushConstants in Main.cpp
+layout(push_constant) uniform IblPushConstants
+{
+    uint face;              // 6 tells shproject.comp to combine the faces
+    uint size;              // Of the face or image being written
+    float roughness;
+    uint sampleCount;
+    float lod;              // Environment level shproject.comp reads
+    float yaw;              // Turns the environment around the up axis
+    float intensity;
+    uint useEquirect;       // Zero draws the procedural sky
+    uvec2 equirectSize;
+    uint environmentSize;
+} pc;
+
+/// Direction through a point of a cube face, uv from 0 to 1. Faces
+/// go +X -X +Y -Y +Z -Z like the layers of a cube image
+vec3 CubeDirection(uint face, vec2 uv)
+{
+    vec2 p = uv * 2.0 - 1.0;
+    vec3 direction;
+    switch (face)
+    {
+        case 0: direction = vec3(1.0, -p.y, -p.x); break;
+        case 1: direction = vec3(-1.0, -p.y, p.x); break;
+        case 2: direction = vec3(p.x, 1.0, p.y); break;
+        case 3: direction = vec3(p.x, -1.0, -p.y); break;
+        case 4: direction = vec3(p.x, -p.y, 1.0); break;
+        default: direction = vec3(-p.x, -p.y, -1.0); break;
+    }
+    return normalize(direction);
+}
+
+/// Low discrepancy point i of count, spreads samples far more evenly
+/// than random numbers would
+vec2 Hammersley(uint i, uint count)
+{
+    return vec2(float(i) / float(count), float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+/// Half vector around normal, distributed like the GGX lobe of this
+/// alpha (roughness squared)
+vec3 ImportanceSampleGGX(vec2 xi, vec3 normal, float alpha)
+{
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    vec3 h = vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+
+    vec3 up = abs(normal.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangentX = normalize(cross(up, normal));
+    vec3 tangentY = cross(normal, tangentX);
+    return normalize(tangentX * h.x + tangentY * h.y + normal * h.z);
+}
+
+float DistributionGGX(float nDotH, float alpha)
+{
+    float a2 = alpha * alpha;
+    float d = nDotH * nDotH * (a2 - 1.0) + 1.0;
+    return a2 / (PI * d * d);
+}
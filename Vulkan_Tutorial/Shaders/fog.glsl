@@ -0,0 +1,24 @@
+// Note: Applies the volumetric fog to whatever is seen at a pixel and
+//       depth, shared by forward.frag, sky.frag and deferred.comp. One
+//       lookup into the integrated froxel grid gives the light
+//       scattered towards the viewer and the transmittance up to that
+//       depth. Needs shading.glsl first
+
+#include "froxel.glsl"
+
+layout(set = 0, binding = 11) uniform sampler3D fogVolume;
+
+vec3 ApplyFog(vec3 color, vec2 pixel, float depth)
+{
+    if (pc.fogEnabled == 0u)
+    {
+        return color;
+    }
+
+    // Slice s holds everything up to its far side, half a slice past
+    // its centre
+    float slices = float(textureSize(fogVolume, 0).z);
+    vec3 uvw = vec3(pixel / vec2(pc.extent), FroxelSlice(depth) - 0.5 / slices);
+    vec4 fog = textureLod(fogVolume, uvw, 0.0);
+    return color * fog.a + fog.rgb;
+}
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: Lights foliage like the ground it stands on. Blades are seen
+//       from both sides, so their normal is turned to the viewer
+//       around the vertical and keeps leaning up to the sky
+
+#include "terrain.glsl"
+
+layout(location = 0) in vec3 fragPosition;
+layout(location = 1) in vec3 fragNormal;
+layout(location = 2) in vec3 fragAlbedo;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 normal = normalize(fragNormal);
+    if (dot(normal.xz, frame.cameraPosition.xz - fragPosition.xz) < 0.0)
+    {
+        normal.xz = -normal.xz;
+    }
+
+    outColor = vec4(LightGround(fragAlbedo, normal, fragPosition), 1.0);
+}
@@ -0,0 +1,38 @@
+// Note: What the foliage passes share. Foliage is scattered over a
+//       grid of cells fixed to the ground, one candidate per cell, so
+//       the same cell always grows the same plant whichever clipmap
+//       level its patch currently belongs to. Accepted instances are
+//       sorted into bins by kind and detail, each bin a range of the
+//       instance buffer drawn by one indirect command
+//
+//           bin     kind    mesh
+//           0       grass   three bent blades of three triangles
+//           1       grass   a single triangle
+//           2       tree    trunk and an eight sided crown
+//           3       tree    a four sided crown
+
+// Keep in sync with the FOLIAGE_ constants in Main.cpp
+const uint FOLIAGE_BINS = 4;
+const uint BIN_GRASS_NEAR = 0;
+const uint BIN_GRASS_FAR = 1;
+const uint BIN_TREE_NEAR = 2;
+const uint BIN_TREE_FAR = 3;
+const uint BIN_CAPACITY[FOLIAGE_BINS] = uint[](1u << 19, 1u << 21, 1u << 16, 1u << 18);
+const uint BIN_OFFSET[FOLIAGE_BINS] = uint[](0u, 1u << 19, (1u << 19) + (1u << 21), (1u << 19) + (1u << 21) + (1u << 16));
+
+const uint KIND_GRASS = 0;
+const uint KIND_TREE = 1;
+const vec2 PLANT_HEIGHTS[2] = vec2[](vec2(0.4, 0.9), vec2(8.0, 18.0));   // Meters, smallest and largest
+
+/// Matches VkDrawIndirectCommand
+struct FoliageDraw
+{
+    uint vertexCount;
+    uint instanceCount;
+    uint firstVertex;
+    uint firstInstance;
+};
+
+// An instance is its root on the ground and, packed into the bits of
+// w, its turn, size and tint from zero to one
+layout(std430, set = 1, binding = 1) buffer FoliageInstances { vec4 instances[]; };
@@ -0,0 +1,133 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: Draws one bin of foliagescatter.comp's instances, the mesh
+//       made from the vertex index alone. Sizes are in units of the
+//       plant's height, turned around its root and scaled to it.
+//       Grass bends over towards its tips and sways with the wind
+
+#include "terrain.glsl"
+#include "foliage.glsl"
+
+const float GRASS_BLADE_WIDTH = 0.06;
+const float GRASS_BEND = 0.25;
+const float GRASS_SWAY = 0.12;
+const float TRUNK_HEIGHT = 0.3;
+const float TRUNK_RADIUS = 0.03;
+const float CROWN_BASE = 0.2;
+const float CROWN_RADIUS = 0.22;
+const float TWO_PI = 6.28318531;
+
+// A blade is a tapering quad with a tip, the far one a single wide
+// triangle standing in for the whole tuft
+const vec2 BLADE_NEAR[9] = vec2[](
+    vec2(-1.0, 0.0), vec2(1.0, 0.0), vec2(-0.6, 0.5),
+    vec2(1.0, 0.0), vec2(0.6, 0.5), vec2(-0.6, 0.5),
+    vec2(-0.6, 0.5), vec2(0.6, 0.5), vec2(0.0, 1.0));
+const vec2 BLADE_FAR[3] = vec2[](vec2(-3.0, 0.0), vec2(3.0, 0.0), vec2(0.0, 1.0));
+
+// Corners of a side of a prism or cone, x the step around it and y
+// whether at the top
+const vec2 SIDE_QUAD[6] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+const vec2 SIDE_TRIANGLE[3] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.5, 1.0));
+
+layout(push_constant) uniform FoliagePushConstants
+{
+    uint bin;
+} pc;
+
+layout(location = 0) out vec3 fragPosition;
+layout(location = 1) out vec3 fragNormal;
+layout(location = 2) out vec3 fragAlbedo;
+
+void Grass(uint vertex, bool near, float tint, out vec3 position, out vec3 normal, out vec3 albedo)
+{
+    uint blade = near ? vertex / 9u : 0u;
+    vec2 corner = near ? BLADE_NEAR[vertex % 9u] : BLADE_FAR[vertex];
+
+    float angle = float(blade) * TWO_PI / 3.0;
+    vec2 across = vec2(cos(angle), sin(angle));
+    vec2 facing = vec2(-across.y, across.x);
+    vec2 offset = across * corner.x * GRASS_BLADE_WIDTH + facing * corner.y * corner.y * GRASS_BEND;
+
+    position = vec3(offset.x, corner.y, offset.y);
+    normal = normalize(vec3(facing.x, 1.0, facing.y));
+    albedo = mix(vec3(0.1, 0.2, 0.04), vec3(0.24, 0.3, 0.08), tint) * mix(0.4, 1.0, corner.y);
+}
+
+/// A cone of sides triangles, and near a trunk of four quads below
+void Tree(uint vertex, bool near, float tint, out vec3 position, out vec3 normal, out vec3 albedo)
+{
+    const uint TRUNK_VERTICES = 24;
+    if (near && vertex < TRUNK_VERTICES)
+    {
+        vec2 corner = SIDE_QUAD[vertex % 6u];
+        float angle = (float(vertex / 6u) + corner.x) * TWO_PI / 4.0;
+        vec2 direction = vec2(cos(angle), sin(angle));
+        position = vec3(direction.x * TRUNK_RADIUS, corner.y * TRUNK_HEIGHT, direction.y * TRUNK_RADIUS);
+        normal = vec3(direction.x, 0.0, direction.y);
+        albedo = vec3(0.2, 0.13, 0.07);
+        return;
+    }
+
+    uint crownVertex = near ? vertex - TRUNK_VERTICES : vertex;
+    float sides = near ? 8.0 : 4.0;
+    vec2 corner = SIDE_TRIANGLE[crownVertex % 3u];
+    float angle = (float(crownVertex / 3u) + corner.x) * TWO_PI / sides;
+    vec2 direction = vec2(cos(angle), sin(angle));
+    float radius = CROWN_RADIUS * (1.0 - corner.y);
+    position = vec3(direction.x * radius, mix(CROWN_BASE, 1.0, corner.y), direction.y * radius);
+
+    // The slope of the cone, up is along the side towards the apex
+    normal = normalize(vec3(direction.x * (1.0 - CROWN_BASE), CROWN_RADIUS, direction.y * (1.0 - CROWN_BASE)));
+    albedo = mix(vec3(0.04, 0.1, 0.04), vec3(0.08, 0.16, 0.05), tint) * mix(0.6, 1.0, corner.y);
+}
+
+void main() {
+    uint index = uint(gl_InstanceIndex);
+    if (index >= BIN_CAPACITY[pc.bin])
+    {
+        // Counted but never written, outside the clip volume
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        return;
+    }
+
+    vec4 instance = instances[BIN_OFFSET[pc.bin] + index];
+    vec4 look = unpackUnorm4x8(floatBitsToUint(instance.w));
+    float turn = look.x * TWO_PI;
+    float size = look.y;
+    float tint = look.z;
+
+    vec3 local;
+    vec3 normal;
+    vec3 albedo;
+    uint kind = pc.bin == BIN_GRASS_NEAR || pc.bin == BIN_GRASS_FAR ? KIND_GRASS : KIND_TREE;
+    if (kind == KIND_GRASS)
+    {
+        Grass(uint(gl_VertexIndex), pc.bin == BIN_GRASS_NEAR, tint, local, normal, albedo);
+    }
+    else
+    {
+        Tree(uint(gl_VertexIndex), pc.bin == BIN_TREE_NEAR, tint, local, normal, albedo);
+    }
+
+    float plantHeight = mix(PLANT_HEIGHTS[kind].x, PLANT_HEIGHTS[kind].y, size);
+    float c = cos(turn);
+    float s = sin(turn);
+    mat2 rotation = mat2(c, s, -s, c);
+    local.xz = rotation * local.xz;
+    normal.xz = rotation * normal.xz;
+
+    vec3 position = instance.xyz + local * plantHeight;
+    if (kind == KIND_GRASS)
+    {
+        float time = frame.cameraPosition.w;
+        float wind = sin(time * 2.0 + dot(instance.xz, vec2(0.13, 0.07)));
+        position.xz += vec2(0.8, 0.6) * wind * GRASS_SWAY * local.y * local.y * plantHeight;
+    }
+
+    gl_Position = frame.viewProjection * vec4(position, 1.0);
+    fragPosition = position;
+    fragNormal = normal;
+    fragAlbedo = albedo;
+}
@@ -0,0 +1,31 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: Forward shading. Every fragment walks every light, so the
+//       cost grows with covered pixels (and overdraw) times lights
+
+#include "shading.glsl"
+#include "lighting.glsl"
+#include "ibl.glsl"
+#include "fog.glsl"
+
+layout(std430, set = 0, binding = 0) readonly buffer Lights { Light lights[]; };
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragPosition;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 position = fragPosition;
+    vec3 normal = SurfaceNormal(fragPosition.xy);
+    float roughness = SurfaceRoughness(fragPosition.xy);
+
+    vec3 color = AmbientLight(normal, fragColor, roughness, 1.0);
+    for (uint i = 0; i < pc.lightCount; i++)
+    {
+        color += ShadePoint(position, normal, fragColor, roughness, lights[i]);
+    }
+
+    outColor = vec4(ApplyFog(color, gl_FragCoord.xy, position.z), 1.0);
+}
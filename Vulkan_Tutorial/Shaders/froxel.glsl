@@ -0,0 +1,29 @@
+// Note: Layout of the volumetric fog's froxel grid, shared by
+//       foginject.comp, fogintegrate.comp and fog.glsl. The grid
+//       covers the screen in x and y and runs along z from in front
+//       of the lights to the far plane. Slices are spread by the
+//       square of w so most sit near the crowd, where the lights are.
+//       Not compiled on its own, glslc pulls it in through #include
+
+const float FOG_NEAR = -0.25;       // Past LIGHT_HEIGHT in Main.cpp, towards the viewer
+const float FOG_FAR = 1.0;
+const uint FOG_GROUP_SIZE = 4;      // Keep in sync with FOG_GROUP_SIZE in Main.cpp
+
+/// Depth of a point w of the way through the grid
+float FroxelDepth(float w)
+{
+    return FOG_NEAR + (FOG_FAR - FOG_NEAR) * w * w;
+}
+
+/// How far through the grid a depth is, from 0 to 1
+float FroxelSlice(float depth)
+{
+    return sqrt(clamp((depth - FOG_NEAR) / (FOG_FAR - FOG_NEAR), 0.0, 1.0));
+}
+
+/// Position of a point of the grid, in froxels
+vec3 FroxelPosition(vec3 froxel, vec3 size)
+{
+    vec3 uvw = froxel / size;
+    return vec3(uvw.xy * 2.0 - 1.0, FroxelDepth(uvw.z));
+}
@@ -0,0 +1,20 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: Fills the G-buffer for deferred.comp. Only what cannot be
+//       rebuilt later is stored: 4 bytes of octahedral normal and
+//       4 bytes of albedo + roughness. Position comes back from the
+//       depth buffer
+
+#include "lighting.glsl"
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragPosition;
+
+layout(location = 0) out vec2 outNormal;    // R16G16_SNORM
+layout(location = 1) out vec4 outAlbedo;    // R8G8B8A8_SRGB, roughness in alpha
+
+void main() {
+    outNormal = OctEncode(SurfaceNormal(fragPosition.xy));
+    outAlbedo = vec4(fragColor, SurfaceRoughness(fragPosition.xy));
+}
@@ -0,0 +1,46 @@
+// Note: Image based ambient light, shared by forward.frag and
+//       deferred.comp in place of the flat AMBIENT term. Diffuse comes
+//       from the irradiance spherical harmonics, specular from the
+//       prefiltered cube and the BRDF lookup table (split sum). All
+//       three are precomputed, see the Image Based Lighting region of
+//       Main.cpp. Needs shading.glsl and lighting.glsl first
+
+layout(set = 0, binding = 6) uniform samplerCube prefilteredEnvironment;
+layout(set = 0, binding = 7) uniform sampler2D brdfLut;
+layout(std430, set = 0, binding = 8) readonly buffer Irradiance { vec4 irradiance[]; };
+
+// Slot written by the combining pass of shproject.comp
+const uint IRRADIANCE_OFFSET = 6 * 9;
+
+/// Irradiance over pi arriving at a surface facing normal
+vec3 EvaluateIrradiance(vec3 n)
+{
+    vec3 sum = irradiance[IRRADIANCE_OFFSET + 0].rgb * 0.282095;
+    sum += irradiance[IRRADIANCE_OFFSET + 1].rgb * 0.488603 * n.y;
+    sum += irradiance[IRRADIANCE_OFFSET + 2].rgb * 0.488603 * n.z;
+    sum += irradiance[IRRADIANCE_OFFSET + 3].rgb * 0.488603 * n.x;
+    sum += irradiance[IRRADIANCE_OFFSET + 4].rgb * 1.092548 * n.x * n.y;
+    sum += irradiance[IRRADIANCE_OFFSET + 5].rgb * 1.092548 * n.y * n.z;
+    sum += irradiance[IRRADIANCE_OFFSET + 6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0);
+    sum += irradiance[IRRADIANCE_OFFSET + 7].rgb * 1.092548 * n.x * n.z;
+    sum += irradiance[IRRADIANCE_OFFSET + 8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(sum, vec3(0.0));
+}
+
+/// Light from everything around the surface, darkened by occlusion
+vec3 AmbientLight(vec3 normal, vec3 albedo, float roughness, float occlusion)
+{
+    if (pc.iblEnabled == 0u)
+    {
+        return AMBIENT * occlusion * albedo;
+    }
+
+    vec3 reflected = reflect(-VIEW_DIRECTION, normal);
+    float nDotV = max(dot(normal, VIEW_DIRECTION), 0.0);
+    float lod = roughness * float(textureQueryLevels(prefilteredEnvironment) - 1);
+    vec2 scaleBias = textureLod(brdfLut, vec2(nDotV, roughness), 0.0).rg;
+
+    // Same dielectric F0 as ShadePoint
+    vec3 specular = textureLod(prefilteredEnvironment, reflected, lod).rgb * (0.04 * scaleBias.x + scaleBias.y);
+    return (EvaluateIrradiance(normal) * albedo + specular) * occlusion;
+}
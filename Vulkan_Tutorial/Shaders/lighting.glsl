@@ -0,0 +1,80 @@
+// Note: Shared by forward.frag, gbuffer.frag and deferred.comp so
+//       both shading paths light the exact same surface, and by
+//       foginject.comp for the lights. Not
+//       compiled on its own, glslc pulls it in through #include.
+//       The push constants live in shading.glsl
+
+// Note: Keep in sync with ShadingLight in Main.cpp
+struct Light
+{
+    vec4 positionRadius;    // xyz position, w distance the light reaches
+    vec4 color;             // rgb already scaled by intensity
+};
+
+const vec3 AMBIENT = vec3(0.1);
+
+// The camera looks down +z at the characters which lie close to
+// z = 0, spread over a few layers by lit.vert
+const vec3 VIEW_DIRECTION = vec3(0.0, 0.0, -1.0);
+
+/// The characters are flat, so they get a bumpy normal from
+/// their position to give the lights something to play with
+vec3 SurfaceNormal(vec2 position)
+{
+    vec2 slope = 0.35 * sin(position * 60.0);
+    return normalize(vec3(slope, -1.0));
+}
+
+float SurfaceRoughness(vec2 position)
+{
+    return 0.3 + 0.2 * sin(position.x * 23.0 + position.y * 17.0);
+}
+
+// Note: Octahedral normal encoding. The unit sphere is projected
+//       onto an octahedron which is unfolded into a square, so two
+//       16 bit channels hold a normal with far less error than
+//       three 8 bit ones
+
+vec2 SignNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * SignNotZero(n.xy);
+}
+
+vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy -= t * SignNotZero(n.xy);
+    return normalize(n);
+}
+
+/// Diffuse plus a normalized Blinn-Phong highlight from one light.
+/// Light falls off smoothly to exactly zero at its radius so tiles
+/// can safely skip every light that does not reach them
+vec3 ShadePoint(vec3 position, vec3 normal, vec3 albedo, float roughness, Light light)
+{
+    vec3 toLight = light.positionRadius.xyz - position;
+    float distanceSquared = dot(toLight, toLight);
+    float radiusSquared = light.positionRadius.w * light.positionRadius.w;
+    if (distanceSquared >= radiusSquared)
+    {
+        return vec3(0.0);
+    }
+
+    vec3 lightDirection = toLight * inversesqrt(distanceSquared);
+    float falloff = 1.0 - distanceSquared / radiusSquared;
+    falloff *= falloff;
+
+    float nDotL = max(dot(normal, lightDirection), 0.0);
+    vec3 halfVector = normalize(lightDirection + VIEW_DIRECTION);
+    float shininess = exp2(10.0 * (1.0 - roughness) + 1.0);
+    float specular = pow(max(dot(normal, halfVector), 0.0), shininess) * (shininess + 8.0) / 25.1327;
+
+    return light.color.rgb * falloff * nDotL * (albedo + 0.04 * specular);
+}
@@ -0,0 +1,28 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: shader.vert plus the position the lit fragment shaders
+//       need to place the surface relative to the lights. Each
+//       character is pushed onto one of a few depth layers so that
+//       neighbours overlap in a fixed order and screen space effects
+//       like SSAO have some relief to work with
+
+#include "shading.glsl"
+
+const uint DEPTH_LAYERS = 4;
+const float DEPTH_LAYER_STEP = 0.01;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragPosition;
+
+void main() {
+    uint character = uint(gl_VertexIndex) / pc.verticesPerCharacter;
+    float depth = DEPTH_LAYER_STEP * float((character * 7u) % DEPTH_LAYERS);
+
+    gl_Position = vec4(inPosition, depth, 1.0);
+    fragColor = inColor;
+    fragPosition = vec3(inPosition, depth);
+}
@@ -0,0 +1,24 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+// Note: Used instead of shader.vert when rendering several views
+//       in one pass. The draw is submitted once and runs once per
+//       view, gl_ViewIndex says which layer is being written 
+
+// Note: Keep in sync with MAX_VIEWS in Main.cpp 
+const int MAX_VIEWS = 8;
+
+layout(set = 0, binding = 0) uniform Views
+{
+    mat4 viewProjection[MAX_VIEWS];
+} views;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor; 
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = views.viewProjection[gl_ViewIndex] * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+}
@@ -0,0 +1,34 @@
+#version 450
+
+// Note: Weighted blended order-independent transparency (McGuire and
+//       Bavoil 2013). Instead of blending over what is behind it, every
+//       fragment adds its premultiplied color times a weight into the
+//       accumulation target and multiplies the revealage target by how
+//       much it lets through. Addition and multiplication do not care
+//       about order, so nothing has to be sorted. The weight favours
+//       fragments closer to the camera so they still win where the
+//       blend is ambiguous
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragOffset;
+
+layout(location = 0) out vec4 outAccumulation;  // Blended ONE, ONE
+layout(location = 1) out float outRevealage;    // Blended ZERO, ONE_MINUS_SRC_COLOR
+
+void main() {
+    float distanceSquared = dot(fragOffset, fragOffset);
+    if (distanceSquared > 1.0)
+    {
+        discard;
+    }
+
+    // Bubbles are clearer in the middle than at the rim
+    float alpha = fragColor.a * mix(0.3, 1.0, distanceSquared * distanceSquared);
+
+    // Equation 10 of the paper for depth in 0 to 1
+    float depth = 1.0 - gl_FragCoord.z;
+    float weight = clamp(alpha * max(0.01, 3000.0 * depth * depth * depth), 0.01, 3000.0);
+
+    outAccumulation = vec4(fragColor.rgb * alpha, alpha) * weight;
+    outRevealage = alpha;
+}
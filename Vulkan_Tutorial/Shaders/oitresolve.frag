@@ -0,0 +1,32 @@
+#version 450
+
+// Note: Resolves weighted blended transparency over the opaque scene.
+//       The accumulated color divided by its accumulated weight gives
+//       the average transparent color, revealage says how much of the
+//       scene still shows through. Both are read from the previous
+//       subpass at this very pixel, so on tiled GPUs they never leave
+//       tile memory
+
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput accumulation;
+layout(input_attachment_index = 1, set = 0, binding = 1) uniform subpassInput revealage;
+
+layout(location = 0) out vec4 outColor;     // Blended SRC_ALPHA, ONE_MINUS_SRC_ALPHA
+
+void main() {
+    float revealed = subpassLoad(revealage).r;
+    if (revealed >= 1.0)
+    {
+        // Nothing transparent here, leave the scene as it is
+        discard;
+    }
+
+    vec4 accumulated = subpassLoad(accumulation);
+
+    // Many bright layers can overflow half floats
+    if (isinf(max(abs(accumulated.r), max(abs(accumulated.g), abs(accumulated.b)))))
+    {
+        accumulated.rgb = vec3(accumulated.a);
+    }
+
+    outColor = vec4(accumulated.rgb / max(accumulated.a, 0.00001), 1.0 - revealed);
+}
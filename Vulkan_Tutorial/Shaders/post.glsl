@@ -0,0 +1,37 @@
+// Note: Push constants of the post-processing passes (bloomdown.comp,
+//       bloomup.comp, post.comp), which share one layout
+
+// Note: Keep in sync with PostPushConstants in Main.cpp
+layout(push_constant) uniform PostPushConstants
+{
+    uvec2 sourceSize;
+    uvec2 destinationSize;
+    uint prefilter;         // First downsample, reads the lit image
+    uint bloomLevels;
+    uint outputSrgb;        // The swap chain encodes to sRGB on write
+    uint frameIndex;
+    float threshold;        // Bloom starts at this brightness
+    float knee;             // and fades in over this range below it
+    float bloomStrength;
+    float exposure;
+    float vignette;
+} pc;
+
+const vec3 LUMA = vec3(0.2126, 0.7152, 0.0722);
+
+const uint POST_GROUP_SIZE = 8;
+
+/// 3x3 tent filter, bilinear taps make it a smooth upscale
+vec3 Tent(sampler2D image, vec2 uv, vec2 texelSize)
+{
+    vec3 color = textureLod(image, uv, 0.0).rgb * 4.0;
+    color += (textureLod(image, uv + vec2(-texelSize.x, 0.0), 0.0).rgb
+            + textureLod(image, uv + vec2( texelSize.x, 0.0), 0.0).rgb
+            + textureLod(image, uv + vec2(0.0, -texelSize.y), 0.0).rgb
+            + textureLod(image, uv + vec2(0.0,  texelSize.y), 0.0).rgb) * 2.0;
+    color += textureLod(image, uv - texelSize, 0.0).rgb
+           + textureLod(image, uv + texelSize, 0.0).rgb
+           + textureLod(image, uv + vec2(-texelSize.x, texelSize.y), 0.0).rgb
+           + textureLod(image, uv + vec2(texelSize.x, -texelSize.y), 0.0).rgb;
+    return color / 16.0;
+}
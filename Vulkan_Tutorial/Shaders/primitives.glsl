@@ -0,0 +1,178 @@
+// Note: What the compute primitives share. Every workgroup takes a
+//       partition of PARTITION_SIZE items, reduces it and passes the
+//       sum on to the partitions after it with decoupled look-back
+//       (Merrill and Garland): it publishes its own sum right away,
+//       then walks back over the partitions before it, adding up sums
+//       until it meets one that already knows everything before it.
+//       A partition is taken by ticket rather than by workgroup id,
+//       so whatever a workgroup waits on has already started and will
+//       finish without any promise about how groups are scheduled.
+//
+//       Built with PRIMITIVES_SUBGROUPS the workgroup scans run on
+//       subgroup arithmetic, without it on shared memory alone for
+//       devices that do not have it. The including shader enables the
+//       extension. Not compiled on its own
+//
+//       A subgroup build may also be specialized on the subgroup size
+//       the pipeline asked for, which turns the subgroup counts below
+//       into constants. Zero leaves the size to the device
+
+// Note: Keep in sync with Primitives.h
+const uint PRIMITIVES_GROUP_SIZE = 256;
+const uint ITEMS_PER_THREAD = 8;
+const uint PARTITION_SIZE = PRIMITIVES_GROUP_SIZE * ITEMS_PER_THREAD;
+
+const uint RADIX_BITS = 8;
+const uint RADIX = 256;
+const uint RADIX_PASSES = 4;
+
+const uint STATE_TICKETS = 0;
+const uint STATE_HISTOGRAM = STATE_TICKETS + RADIX_PASSES;
+const uint STATE_LOOKBACK = STATE_HISTOGRAM + RADIX_PASSES * RADIX;
+
+// A look-back state, the flag in the top two bits and a sum below
+const uint FLAG_NOT_READY = 0x00000000u;
+const uint FLAG_AGGREGATE = 0x40000000u;    // Sum of the partition alone
+const uint FLAG_INCLUSIVE = 0x80000000u;    // Sum of it and all before it
+const uint FLAG_MASK = 0xC0000000u;
+const uint SUM_MASK = 0x3FFFFFFFu;
+
+layout(push_constant) uniform PrimitivePushConstants
+{
+    uint count;
+    uint partitionCount;
+    uint pass;              // Radix pass, the digit is bits 8 * pass and up
+} primitive;
+
+layout(set = 0, binding = 0) coherent buffer PrimitiveStates
+{
+    uint states[];
+};
+
+#ifdef PRIMITIVES_SUBGROUPS
+layout(constant_id = 0) const uint SUBGROUP_SIZE = 0;
+#endif
+
+shared uint scanShared[PRIMITIVES_GROUP_SIZE];
+shared uint scanTotal;
+shared uint partitionTicket;
+
+/// Sum of the values of all invocations before this one in the
+/// workgroup, and of all of them in total. Every invocation calls it
+uint WorkgroupExclusiveScan(uint value, out uint total)
+{
+    uint invocation = gl_LocalInvocationIndex;
+
+    // Whatever used the scratch before may still be reading it
+    barrier();
+
+#ifdef PRIMITIVES_SUBGROUPS
+    uint subgroupSum = subgroupAdd(value);
+    if (subgroupElect())
+    {
+        scanShared[gl_SubgroupID] = subgroupSum;
+    }
+    barrier();
+
+    // The first subgroup scans the subgroup sums, as many at a time
+    // as it is wide
+    uint width = SUBGROUP_SIZE != 0u ? SUBGROUP_SIZE : gl_SubgroupSize;
+    uint subgroupCount = SUBGROUP_SIZE != 0u ? PRIMITIVES_GROUP_SIZE / SUBGROUP_SIZE : gl_NumSubgroups;
+    if (gl_SubgroupID == 0)
+    {
+        uint carry = 0;
+        for (uint first = 0; first < subgroupCount; first += width)
+        {
+            uint index = first + gl_SubgroupInvocationID;
+            uint sum = index < subgroupCount ? scanShared[index] : 0u;
+            uint scanned = carry + subgroupExclusiveAdd(sum);
+            if (index < subgroupCount)
+            {
+                scanShared[index] = scanned;
+            }
+            carry += subgroupAdd(sum);
+        }
+
+        if (subgroupElect())
+        {
+            scanTotal = carry;
+        }
+    }
+    barrier();
+
+    total = scanTotal;
+    return scanShared[gl_SubgroupID] + subgroupExclusiveAdd(value);
+#else
+    // Hillis and Steele, one doubling of the reach per step
+    scanShared[invocation] = value;
+    barrier();
+
+    for (uint offset = 1; offset < PRIMITIVES_GROUP_SIZE; offset <<= 1)
+    {
+        uint before = invocation >= offset ? scanShared[invocation - offset] : 0u;
+        barrier();
+        scanShared[invocation] += before;
+        barrier();
+    }
+
+    total = scanShared[PRIMITIVES_GROUP_SIZE - 1];
+    return scanShared[invocation] - value;
+#endif
+}
+
+/// The partition this workgroup works on, in the order workgroups
+/// started
+uint AcquirePartition(uint ticket)
+{
+    if (gl_LocalInvocationIndex == 0)
+    {
+        partitionTicket = atomicAdd(states[STATE_TICKETS + ticket], 1u);
+    }
+    barrier();
+    return partitionTicket;
+}
+
+/// Publishes a partition's sum and returns the sum of all partitions
+/// before it. The state of partition p is states[first + p * stride].
+/// Called by a single invocation per state
+uint LookBack(uint first, uint partitionIndex, uint aggregate, uint stride)
+{
+    if (partitionIndex == 0)
+    {
+        atomicExchange(states[first], FLAG_INCLUSIVE | aggregate);
+        return 0;
+    }
+
+    atomicExchange(states[first + partitionIndex * stride], FLAG_AGGREGATE | aggregate);
+
+    uint exclusive = 0;
+    uint previous = partitionIndex - 1;
+    while (true)
+    {
+        uint state = atomicOr(states[first + previous * stride], 0u);
+        uint flag = state & FLAG_MASK;
+        if (flag == FLAG_NOT_READY)
+        {
+            continue;
+        }
+
+        exclusive += state & SUM_MASK;
+        if (flag == FLAG_INCLUSIVE)
+        {
+            break;
+        }
+        previous--;
+    }
+
+    atomicExchange(states[first + partitionIndex * stride], FLAG_INCLUSIVE | (exclusive + aggregate));
+    return exclusive;
+}
+
+/// Index into a partition sized tile with a word of padding every
+/// 32, so reading it a thread's run at a time avoids bank conflicts
+uint Padded(uint index)
+{
+    return index + (index >> 5);
+}
+
+const uint PADDED_PARTITION_SIZE = PARTITION_SIZE + (PARTITION_SIZE >> 5);
@@ -0,0 +1,18 @@
+// Note: Push constants of every pipeline in the shading layout
+//       (lit.vert, forward.frag, gbuffer.frag, deferred.comp, sky.frag)
+
+// Note: Keep in sync with ShadingPushConstants in Main.cpp
+layout(push_constant) uniform ShadingPushConstants
+{
+    mat4 inverseViewProjection;
+    uvec2 extent;
+    uint lightCount;
+    uint verticesPerCharacter;
+    uint aoEnabled;
+    uint aoScale;           // Full resolution pixels per AO texel
+    uint iblEnabled;        // Otherwise ambient light is flat
+    uint skyEnabled;        // Otherwise the background stays black
+    vec4 sunDirection;      // The sun the shown sky-view LUT was built for
+    uint fogEnabled;
+    uint terrainEnabled;    // Otherwise the background is only the sky
+} pc;
@@ -0,0 +1,17 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: Background pass of the forward path, a full screen triangle
+//       drawn before the characters. It shows the sky and terrain,
+//       fogged like everything else at the far plane
+
+#include "shading.glsl"
+#include "background.glsl"
+#include "fog.glsl"
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 color = BackgroundColor(gl_FragCoord.xy);
+    outColor = vec4(ApplyFog(color, gl_FragCoord.xy, 1.0), 1.0);
+}
@@ -0,0 +1,53 @@
+// Note: The sky behind the scene, drawn by sky.frag on the forward
+//       path and by deferred.comp wherever the G-buffer is empty.
+//       The scene has no camera, so the sky is seen through a fixed
+//       one looking at the horizon. It only samples the sky-view LUT,
+//       plus the transmittance LUT for the sun's disk. Needs
+//       shading.glsl first
+
+#include "atmosphere.glsl"
+
+layout(set = 0, binding = 9) uniform sampler2D skyViewLut;
+layout(set = 0, binding = 10) uniform sampler2D transmittanceLut;
+
+const float SKY_EXPOSURE = 8.0;
+const float SKY_CAMERA_PITCH = 0.15;           // Radians above the horizon, keep in sync with TERRAIN_CAMERA_PITCH in Main.cpp
+const float SKY_TAN_HALF_FOV = 0.577;          // 60 degrees vertically
+const float SUN_COS_RADIUS = 0.99996;          // About twice the real sun
+const float SUN_LUMINANCE = 4.0;
+
+/// Direction through a pixel, +y up while the screen's up is -y
+vec3 SkyViewDirection(vec2 pixel)
+{
+    vec2 ndc = pixel / vec2(pc.extent) * 2.0 - 1.0;
+    float aspect = float(pc.extent.x) / float(pc.extent.y);
+    vec3 direction = normalize(vec3(ndc.x * aspect * SKY_TAN_HALF_FOV, -ndc.y * SKY_TAN_HALF_FOV, -1.0));
+
+    float c = cos(SKY_CAMERA_PITCH);
+    float s = sin(SKY_CAMERA_PITCH);
+    return vec3(direction.x, c * direction.y - s * direction.z, s * direction.y + c * direction.z);
+}
+
+vec3 SkyColor(vec2 pixel)
+{
+    vec3 direction = SkyViewDirection(pixel);
+    vec3 sunDirection = pc.sunDirection.xyz;
+    vec3 origin = vec3(0.0, BOTTOM_RADIUS + CAMERA_HEIGHT, 0.0);
+
+    // Azimuth between the view and the sun, straight up or down
+    // looks the same from every side
+    vec2 viewAzimuth = direction.xz;
+    vec2 sunAzimuth = sunDirection.xz;
+    float sunViewCosAzimuth = dot(viewAzimuth, viewAzimuth) > 1e-8 && dot(sunAzimuth, sunAzimuth) > 1e-8 ?
+        dot(normalize(viewAzimuth), normalize(sunAzimuth)) : 1.0;
+
+    vec3 luminance = textureLod(skyViewLut, SkyViewUv(origin.y, direction.y, sunViewCosAzimuth), 0.0).rgb;
+
+    // The sun's disk, dimmed by the air in front of it
+    if (dot(direction, sunDirection) > SUN_COS_RADIUS && RaySphere(origin, direction, BOTTOM_RADIUS) < 0.0)
+    {
+        luminance += SUN_LUMINANCE * Transmittance(transmittanceLut, origin, direction);
+    }
+
+    return luminance * SKY_EXPOSURE;
+}
@@ -0,0 +1,55 @@
+// Note: What the screen space reflection passes share. They run in
+//       order after deferred.comp, the first two at the resolution of
+//       Hi-Z level 0 (half the screen) and the last at full:
+//
+//           ssr.comp            traces one reflected ray per texel
+//                               through the Hi-Z chain
+//           ssrtemporal.comp    blends the hits with last frame's
+//           ssrcomposite.comp   swaps the probe's specular for them
+//
+//       A result is how much the ray's hit can be trusted in alpha,
+//       zero for a miss, and the radiance it found times that in rgb.
+//       Whatever is not trusted keeps the light of the IBL probes (or
+//       nothing, with flat ambient light). Not compiled on its own
+
+// Note: Keep in sync with SSR_GROUP_SIZE in Main.cpp
+const uint SSR_GROUP_SIZE = 8;
+
+// Note: Keep in sync with ReflectionFrameData in Main.cpp
+layout(std140, set = 0, binding = 0) uniform ReflectionFrame
+{
+    mat4 viewProjection;
+    mat4 inverseViewProjection;
+    mat4 reprojection;      // This frame's clip space to last frame's
+    uvec2 extent;
+    uvec2 traceExtent;      // Hi-Z level 0
+    uint hiZLevels;
+    uint maxSteps;          // Hi-Z cells a ray may visit
+    float maxRoughness;     // Rougher surfaces keep the probe
+    float thickness;        // Depth behind a surface still counted as a hit
+    uint frameIndex;
+    uint historyValid;
+    float historyWeight;
+    uint iblEnabled;
+} frame;
+
+layout(set = 0, binding = 1) uniform sampler2D gDepth;
+layout(set = 0, binding = 2) uniform sampler2D gNormal;
+layout(set = 0, binding = 3) uniform sampler2D gAlbedo;
+layout(set = 0, binding = 4) uniform sampler2D hiZ;
+
+/// World position of a point on the screen, in pixels, at a depth
+vec3 Reconstruct(vec2 pixel, float depth)
+{
+    vec2 ndc = pixel / vec2(frame.extent) * 2.0 - 1.0;
+    vec4 position = frame.inverseViewProjection * vec4(ndc, depth, 1.0);
+    return position.xyz / position.w;
+}
+
+/// The full resolution pixel a trace texel stands for this frame. It
+/// walks the texel's 2x2 block so the history sees all four
+ivec2 TracedPixel(ivec2 texel, uint frameIndex)
+{
+    ivec2 offset = ivec2(frameIndex & 1u, (frameIndex >> 1) & 1u);
+    return min(texel * 2 + offset, ivec2(frame.extent) - 1);
+}
@@ -0,0 +1,27 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: Colors the ground by height and slope and lights it with the
+//       sun, then fades it into haze with distance. Alpha marks the
+//       pixel as covered for the background pass and deferred.comp
+
+#include "terrain.glsl"
+
+const vec3 GRASS = vec3(0.16, 0.24, 0.08);
+const vec3 ROCK = vec3(0.28, 0.25, 0.22);
+const vec3 SNOW = vec3(0.85, 0.87, 0.9);
+
+layout(location = 0) in vec3 fragPosition;
+layout(location = 1) in vec3 fragNormal;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 normal = normalize(fragNormal);
+    float height = fragPosition.y / TERRAIN_HEIGHT_SCALE;
+
+    vec3 albedo = mix(GRASS, ROCK, 1.0 - smoothstep(0.55, 0.75, normal.y));
+    albedo = mix(albedo, SNOW, smoothstep(0.6, 0.7, height) * smoothstep(0.5, 0.7, normal.y));
+
+    outColor = vec4(LightGround(albedo, normal, fragPosition), 1.0);
+}
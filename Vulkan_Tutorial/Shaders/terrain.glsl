@@ -0,0 +1,96 @@
+// Note: What the terrain passes share. The ground is covered by
+//       TERRAIN_LEVELS nested clipmap levels, each a square of
+//       PATCHES x PATCHES grid patches with twice the spacing of the
+//       level inside it. A level leaves a hole where the finer one
+//       lies, always exactly PATCHES / 2 of its patches wide. Every
+//       position is in texels of its level, integer and snapped so
+//       that patches of neighbouring levels meet without gaps
+
+// Keep in sync with the TERRAIN_ constants in Main.cpp
+const uint TERRAIN_LEVELS = 9;
+const uint PATCH_QUADS = 16;
+const uint PATCHES = 8;
+const uint PAGE_TEXELS = 64;
+const uint PAGE_TABLE = 4;                  // Pages per side kept for a level
+const uint NO_SLOT = 0xFFFFFFFFu;
+const float TERRAIN_SPACING = 2.0;          // Meters between level 0 texels
+const float TERRAIN_HEIGHT_SCALE = 600.0;
+
+struct TerrainPage
+{
+    ivec4 keySlot;          // Page x and z in pages of its level, atlas slot
+    vec4 range;             // Lowest and highest height on the page
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer TerrainFrame
+{
+    mat4 viewProjection;
+    vec4 cameraPosition;                    // Animation time in seconds in w
+    vec4 sunDirection;
+    vec4 frustumPlanes[6];
+    ivec4 levels[TERRAIN_LEVELS];           // Origin of the level, origin of its hole
+    TerrainPage pages[TERRAIN_LEVELS * PAGE_TABLE * PAGE_TABLE];
+} frame;
+
+layout(set = 0, binding = 1) uniform sampler2DArray heightAtlas;
+
+float LevelSpacing(uint level)
+{
+    return TERRAIN_SPACING * float(1u << level);
+}
+
+/// Level of a patch and its first texel. Patches are numbered level
+/// by level, row by row
+ivec2 PatchOrigin(uint patchIndex, out uint level)
+{
+    level = patchIndex / (PATCHES * PATCHES);
+    uint local = patchIndex % (PATCHES * PATCHES);
+    return frame.levels[level].xy + ivec2(local % PATCHES, local / PATCHES) * int(PATCH_QUADS);
+}
+
+/// The page table entry for a texel of a level, whether it holds that
+/// page or not
+TerrainPage PageEntry(uint level, ivec2 texel)
+{
+    // Arithmetic shifts and masks round towards minus infinity, so
+    // negative positions wrap around the table like positive ones
+    ivec2 page = texel >> findLSB(PAGE_TEXELS);
+    ivec2 wrapped = page & int(PAGE_TABLE - 1);
+    return frame.pages[(level * PAGE_TABLE + uint(wrapped.y)) * PAGE_TABLE + uint(wrapped.x)];
+}
+
+bool PageResident(TerrainPage entry, ivec2 texel)
+{
+    return entry.keySlot.xy == (texel >> findLSB(PAGE_TEXELS)) && uint(entry.keySlot.z) != NO_SLOT;
+}
+
+/// Height at a texel of a level, from the finest level that has it
+float TerrainHeight(uint level, ivec2 texel)
+{
+    for (uint l = level; l < TERRAIN_LEVELS; l++)
+    {
+        TerrainPage entry = PageEntry(l, texel);
+        if (PageResident(entry, texel))
+        {
+            return texelFetch(heightAtlas, ivec3(texel & int(PAGE_TEXELS - 1), entry.keySlot.z), 0).r;
+        }
+        texel >>= 1;
+    }
+    return 0.0;
+}
+
+const vec3 SUN_ILLUMINANCE = vec3(3.0, 2.9, 2.7);
+const vec3 AMBIENT = vec3(0.25, 0.3, 0.4);
+const vec3 HAZE = vec3(0.55, 0.65, 0.8);
+const float HAZE_DENSITY = 3e-5;            // Per meter
+
+/// Sun and sky light on anything standing on the terrain, faded into
+/// haze with distance
+vec3 LightGround(vec3 albedo, vec3 normal, vec3 position)
+{
+    vec3 sun = frame.sunDirection.xyz;
+    vec3 color = albedo * (SUN_ILLUMINANCE * max(dot(normal, sun), 0.0) * smoothstep(-0.05, 0.05, sun.y) + AMBIENT * (0.5 + 0.5 * normal.y));
+
+    float distance = length(position - frame.cameraPosition.xyz);
+    return mix(HAZE, color, exp(-distance * HAZE_DENSITY));
+}
@@ -0,0 +1,58 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Note: One instance per visible patch, its vertices made from the
+//       index alone. Heights are fetched through the page table, from
+//       the next coarser level while a page is still loading. Towards
+//       the outer edge of its level a vertex morphs to the height the
+//       coarser level has there, so the edge matches the next ring
+//       exactly and moving the camera never pops
+
+#include "terrain.glsl"
+
+const float MORPH_START = 0.75;             // Fraction of the level's half width
+
+layout(std430, set = 0, binding = 2) readonly buffer VisiblePatches { uint visiblePatches[]; };
+
+layout(location = 0) out vec3 fragPosition;
+layout(location = 1) out vec3 fragNormal;
+
+/// Height of the coarser level at a texel, the bilinear blend of the
+/// even texels around it
+float CoarseHeight(uint level, ivec2 texel)
+{
+    ivec2 base = texel & ~1;
+    ivec2 odd = texel & 1;
+    float h00 = TerrainHeight(level, base);
+    float h10 = odd.x != 0 ? TerrainHeight(level, base + ivec2(2, 0)) : h00;
+    float h01 = odd.y != 0 ? TerrainHeight(level, base + ivec2(0, 2)) : h00;
+    float h11 = odd.x != 0 && odd.y != 0 ? TerrainHeight(level, base + ivec2(2, 2)) : (odd.x != 0 ? h10 : h01);
+    return mix(mix(h00, h10, 0.5 * float(odd.x)), mix(h01, h11, 0.5 * float(odd.x)), 0.5 * float(odd.y));
+}
+
+float MorphedHeight(uint level, ivec2 texel, float morph)
+{
+    float height = TerrainHeight(level, texel);
+    return morph > 0.0 ? mix(height, CoarseHeight(level, texel), morph) : height;
+}
+
+void main() {
+    uint level;
+    ivec2 origin = PatchOrigin(visiblePatches[gl_InstanceIndex], level);
+    ivec2 texel = origin + ivec2(gl_VertexIndex % (PATCH_QUADS + 1), gl_VertexIndex / (PATCH_QUADS + 1));
+
+    // Zero in the middle of the level, one on its outer edge
+    float halfWidth = float(PATCHES * PATCH_QUADS / 2);
+    vec2 offset = abs(vec2(texel - frame.levels[level].xy) - halfWidth) / halfWidth;
+    float morph = clamp((max(offset.x, offset.y) - MORPH_START) / (1.0 - MORPH_START), 0.0, 1.0);
+
+    float spacing = LevelSpacing(level);
+    float height = MorphedHeight(level, texel, morph);
+    float dx = MorphedHeight(level, texel + ivec2(1, 0), morph) - MorphedHeight(level, texel - ivec2(1, 0), morph);
+    float dz = MorphedHeight(level, texel + ivec2(0, 1), morph) - MorphedHeight(level, texel - ivec2(0, 1), morph);
+
+    vec3 position = vec3(float(texel.x) * spacing, height, float(texel.y) * spacing);
+    gl_Position = frame.viewProjection * vec4(position, 1.0);
+    fragPosition = position;
+    fragNormal = normalize(vec3(-dx, 2.0 * spacing, -dz));
+}
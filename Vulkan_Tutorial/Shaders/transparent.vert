@@ -0,0 +1,40 @@
+#version 450
+
+// Note: Transparent bubbles drifting up over the scene. Every bubble
+//       is one instance of a quad built from gl_VertexIndex, so they
+//       are all drawn with a single instanced draw in whatever order
+//       the instance buffer happens to hold them
+
+// Note: Keep in sync with TransparencyPushConstants in Main.cpp
+layout(push_constant) uniform TransparencyPushConstants
+{
+    float time;
+    float aspect;           // Width over height, keeps bubbles round
+} pc;
+
+layout(location = 0) in vec4 inPlacement;   // x, starting height, depth, radius
+layout(location = 1) in vec4 inColor;       // rgb, alpha
+layout(location = 2) in float inSpeed;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragOffset;   // -1 to 1 across the quad
+
+const vec2 CORNERS[6] = vec2[6](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+    vec2 corner = CORNERS[gl_VertexIndex];
+    float radius = inPlacement.w;
+
+    // Clip space y points down. Bubbles rise from below the screen to
+    // above it and start over, swaying a little on the way
+    float travel = 2.0 + 4.0 * radius;
+    float height = 1.0 + 2.0 * radius - mod(inPlacement.y + pc.time * inSpeed, travel);
+    float sway = 0.03 * sin(pc.time * 1.3 + inPlacement.y * 7.0);
+
+    vec2 center = vec2(inPlacement.x + sway, height);
+    gl_Position = vec4(center + corner * radius * vec2(1.0 / pc.aspect, 1.0), inPlacement.z, 1.0);
+    fragColor = inColor;
+    fragOffset = corner;
+}
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Note: Host side of the terrain. Heights are cut into square pages of
+//       PAGE_TEXELS on a side, each belonging to one clipmap level:
+//       a page of level l holds every 2^l-th height of level 0, so it
+//       covers 2^l times the ground. Heights come either from a
+//       procedural heightfield that goes on forever or from a square
+//       16 bit RAW file, read a page at a time. A loader thread makes
+//       pages on request and the renderer uploads finished ones into a
+//       fixed number of slots, so neither the size of the file nor the
+//       distance travelled costs anything but loading time
+
+namespace Terrain
+{
+    const uint32_t PAGE_TEXELS = 64;
+
+    /// <summary>
+    /// A page is found by its level and its position in pages of
+    /// that level
+    /// </summary>
+    struct PageKey
+    {
+        int32_t level;
+        int32_t x;
+        int32_t z;
+
+        bool operator==(const PageKey& other) const
+        {
+            return level == other.level && x == other.x && z == other.z;
+        }
+
+        uint64_t Packed() const
+        {
+            return (static_cast<uint64_t>(level) << 56) ^
+                (static_cast<uint64_t>(static_cast<uint32_t>(x) & 0x0FFFFFFFu) << 28) ^
+                (static_cast<uint32_t>(z) & 0x0FFFFFFFu);
+        }
+    };
+
+    /// <summary>
+    /// Heights in meters, row by row. The range also covers the row
+    /// and column just past the page so that a patch ending on the
+    /// next page is still bounded by it
+    /// </summary>
+    struct Page
+    {
+        PageKey key;
+        std::vector<float> heights;
+        float minHeight;
+        float maxHeight;
+    };
+
+    #pragma region Height Sources
+
+    inline float Hash(int32_t x, int32_t z)
+    {
+        uint32_t h = static_cast<uint32_t>(x) * 0x8DA6B343u ^ static_cast<uint32_t>(z) * 0xD8163841u;
+        h ^= h >> 13;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 16;
+        return static_cast<float>(h & 0xFFFFFFu) / static_cast<float>(0x1000000);
+    }
+
+    /// <summary>
+    /// Smoothly interpolated value noise in [0, 1)
+    /// </summary>
+    inline float ValueNoise(double x, double z)
+    {
+        double fx = std::floor(x);
+        double fz = std::floor(z);
+        int32_t ix = static_cast<int32_t>(fx);
+        int32_t iz = static_cast<int32_t>(fz);
+        float tx = static_cast<float>(x - fx);
+        float tz = static_cast<float>(z - fz);
+        tx = tx * tx * (3.0f - 2.0f * tx);
+        tz = tz * tz * (3.0f - 2.0f * tz);
+
+        float a = Hash(ix, iz) + (Hash(ix + 1, iz) - Hash(ix, iz)) * tx;
+        float b = Hash(ix, iz + 1) + (Hash(ix + 1, iz + 1) - Hash(ix, iz + 1)) * tx;
+        return a + (b - a) * tz;
+    }
+
+    /// <summary>
+    /// Ridged fractal noise in [0, 1) over level 0 texels. Every level
+    /// samples all octaves, a coarse level has to agree with the finer
+    /// ones where their texels meet or the rings would crack
+    /// </summary>
+    inline float ProceduralHeight(int64_t x, int64_t z)
+    {
+        const double BASE_WAVELENGTH = 2048.0;
+        const uint32_t OCTAVES = 9;
+
+        double frequency = 1.0 / BASE_WAVELENGTH;
+        float amplitude = 0.5f;
+        float height = 0.0f;
+        float weight = 1.0f;
+        for (uint32_t octave = 0; octave < OCTAVES; octave++)
+        {
+            float ridge = 1.0f - std::abs(ValueNoise(x * frequency, z * frequency) * 2.0f - 1.0f);
+            ridge *= ridge * weight;
+            weight = (std::min)(ridge * 2.0f, 1.0f);
+            height += ridge * amplitude;
+            frequency *= 2.0;
+            amplitude *= 0.5f;
+        }
+        return height;
+    }
+
+    /// <summary>
+    /// Where heights come from. An empty path means the procedural
+    /// heightfield, otherwise a square RAW file of little endian
+    /// 16 bit heights. Outside the file the ground is flat at zero.
+    /// Only the loader thread reads pages, one at a time
+    /// </summary>
+    class HeightSource
+    {
+    public:
+        HeightSource(const std::string& path, float heightScale)
+            : heightScale(heightScale)
+        {
+            if (path.empty())
+            {
+                return;
+            }
+
+            file.open(path, std::ios::binary | std::ios::ate);
+            if (!file)
+            {
+                throw std::runtime_error("Failed to open terrain heightmap " + path + "!");
+            }
+
+            uint64_t samples = static_cast<uint64_t>(file.tellg()) / 2;
+            size = static_cast<uint32_t>(std::sqrt(static_cast<double>(samples)));
+            if (size == 0 || static_cast<uint64_t>(size) * size != samples)
+            {
+                throw std::runtime_error("Terrain heightmap " + path + " is not a square of 16 bit heights!");
+            }
+        }
+
+        /// <summary>
+        /// Fills a page, including the extra row and column its
+        /// range covers
+        /// </summary>
+        void ReadPage(const PageKey& key, Page& page)
+        {
+            const uint32_t samples = PAGE_TEXELS + 1;
+            const uint32_t spacing = 1u << key.level;
+            const int64_t firstX = static_cast<int64_t>(key.x) * PAGE_TEXELS * spacing;
+            const int64_t firstZ = static_cast<int64_t>(key.z) * PAGE_TEXELS * spacing;
+
+            std::vector<float> heights(static_cast<size_t>(samples) * samples);
+            for (uint32_t j = 0; j < samples; j++)
+            {
+                ReadRow(firstX, firstZ + static_cast<int64_t>(j) * spacing, spacing, &heights[static_cast<size_t>(j) * samples]);
+            }
+
+            page.key = key;
+            page.heights.resize(static_cast<size_t>(PAGE_TEXELS) * PAGE_TEXELS);
+            page.minHeight = std::numeric_limits<float>::max();
+            page.maxHeight = std::numeric_limits<float>::lowest();
+            for (uint32_t j = 0; j < samples; j++)
+            {
+                for (uint32_t i = 0; i < samples; i++)
+                {
+                    float height = heights[static_cast<size_t>(j) * samples + i];
+                    page.minHeight = (std::min)(page.minHeight, height);
+                    page.maxHeight = (std::max)(page.maxHeight, height);
+                    if (i < PAGE_TEXELS && j < PAGE_TEXELS)
+                    {
+                        page.heights[static_cast<size_t>(j) * PAGE_TEXELS + i] = height;
+                    }
+                }
+            }
+        }
+
+    private:
+        /// <summary>
+        /// PAGE_TEXELS + 1 heights along a row, every spacing-th from x
+        /// </summary>
+        void ReadRow(int64_t x, int64_t z, uint32_t spacing, float* out)
+        {
+            const uint32_t samples = PAGE_TEXELS + 1;
+            if (!file.is_open())
+            {
+                for (uint32_t i = 0; i < samples; i++)
+                {
+                    out[i] = ProceduralHeight(x + static_cast<int64_t>(i) * spacing, z) * heightScale;
+                }
+                return;
+            }
+
+            std::fill(out, out + samples, 0.0f);
+            if (z < 0 || z >= size)
+            {
+                return;
+            }
+
+            // One read covers the whole span, coarse levels then pick
+            // every spacing-th height out of it
+            int64_t first = (std::max)(x, int64_t(0));
+            int64_t last = (std::min)(x + static_cast<int64_t>(samples - 1) * spacing, static_cast<int64_t>(size) - 1);
+            if (first > last)
+            {
+                return;
+            }
+
+            row.resize(static_cast<size_t>(last - first + 1));
+            file.clear();
+            file.seekg(static_cast<std::streamoff>((z * size + first) * 2));
+            file.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row.size() * 2));
+
+            for (uint32_t i = 0; i < samples; i++)
+            {
+                int64_t sample = x + static_cast<int64_t>(i) * spacing;
+                if (sample >= first && sample <= last)
+                {
+                    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&row[static_cast<size_t>(sample - first)]);
+                    out[i] = static_cast<float>(bytes[0] | (bytes[1] << 8)) / 65535.0f * heightScale;
+                }
+            }
+        }
+
+        float heightScale;
+        std::ifstream file;
+        uint32_t size = 0;
+        std::vector<uint16_t> row;
+    };
+
+    #pragma endregion
+
+    #pragma region Streaming
+
+    /// <summary>
+    /// Owns a thread that makes the pages asked for, most wanted first.
+    /// Each Request replaces whatever was still waiting, so pages the
+    /// camera has already left behind are never made
+    /// </summary>
+    class PageStreamer
+    {
+    public:
+        PageStreamer(const std::string& path, float heightScale)
+            : source(path, heightScale)
+        {
+            thread = std::thread([this] { ThreadLoop(); });
+        }
+
+        /// <summary>
+        /// Drops every page still waiting, the one being made is
+        /// finished first
+        /// </summary>
+        ~PageStreamer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                requests.clear();
+            }
+            wake.notify_one();
+            thread.join();
+        }
+
+        PageStreamer(const PageStreamer&) = delete;
+        PageStreamer& operator=(const PageStreamer&) = delete;
+
+        void Request(const std::vector<PageKey>& keys)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                requests.assign(keys.begin(), keys.end());
+            }
+            wake.notify_one();
+        }
+
+        /// <summary>
+        /// Takes a finished page, if there is one
+        /// </summary>
+        bool Pop(Page& page)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (finished.empty())
+            {
+                return false;
+            }
+
+            page = std::move(finished.front());
+            finished.pop_front();
+            return true;
+        }
+
+        /// <summary>
+        /// Pages asked for and not taken yet
+        /// </summary>
+        size_t Pending()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return requests.size() + finished.size() + (busy ? 1 : 0);
+        }
+
+    private:
+        void ThreadLoop()
+        {
+            while (true)
+            {
+                PageKey key;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    busy = false;
+                    wake.wait(lock, [this] { return stopping || !requests.empty(); });
+
+                    if (stopping)
+                    {
+                        return;
+                    }
+
+                    key = requests.front();
+                    requests.pop_front();
+                    busy = true;
+                }
+
+                Page page;
+                source.ReadPage(key, page);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back(std::move(page));
+            }
+        }
+
+        HeightSource source;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<PageKey> requests;
+        std::deque<Page> finished;
+        bool busy = false;
+        bool stopping = false;
+    };
+
+    /// <summary>
+    /// Which page sits in which of a fixed number of GPU slots. A full
+    /// cache gives up the slot used longest ago, never one used in
+    /// the current frame
+    /// </summary>
+    class PageCache
+    {
+    public:
+        static const uint32_t NO_SLOT = 0xFFFFFFFFu;
+
+        explicit PageCache(uint32_t slotCount)
+            : slots(slotCount)
+        {
+        }
+
+        /// <summary>
+        /// The page's slot, marked as used in frame, or NO_SLOT
+        /// </summary>
+        uint32_t Find(const PageKey& key, uint64_t frame)
+        {
+            auto it = lookup.find(key.Packed());
+            if (it == lookup.end())
+            {
+                return NO_SLOT;
+            }
+
+            slots[it->second].lastUsed = frame;
+            return it->second;
+        }
+
+        bool Contains(const PageKey& key) const
+        {
+            return lookup.count(key.Packed()) != 0;
+        }
+
+        /// <summary>
+        /// Picks a slot for a new page, or NO_SLOT when every one is
+        /// in use this frame
+        /// </summary>
+        uint32_t Insert(const Page& page, uint64_t frame)
+        {
+            uint32_t best = NO_SLOT;
+            for (uint32_t i = 0; i < slots.size(); i++)
+            {
+                if (!slots[i].occupied)
+                {
+                    best = i;
+                    break;
+                }
+
+                if (slots[i].lastUsed < frame && (best == NO_SLOT || slots[i].lastUsed < slots[best].lastUsed))
+                {
+                    best = i;
+                }
+            }
+
+            if (best == NO_SLOT)
+            {
+                return NO_SLOT;
+            }
+
+            Slot& slot = slots[best];
+            if (slot.occupied)
+            {
+                lookup.erase(slot.key.Packed());
+            }
+
+            slot = { page.key, page.minHeight, page.maxHeight, frame, true };
+            lookup[page.key.Packed()] = best;
+            return best;
+        }
+
+        void Range(uint32_t slot, float& minHeight, float& maxHeight) const
+        {
+            minHeight = slots[slot].minHeight;
+            maxHeight = slots[slot].maxHeight;
+        }
+
+        uint32_t Resident() const
+        {
+            return static_cast<uint32_t>(lookup.size());
+        }
+
+    private:
+        struct Slot
+        {
+            PageKey key;
+            float minHeight;
+            float maxHeight;
+            uint64_t lastUsed;
+            bool occupied;
+        };
+
+        std::vector<Slot> slots;
+        std::unordered_map<uint64_t, uint32_t> lookup;
+    };
+
+    #pragma endregion
+}